@@ -2,6 +2,8 @@
 #include "../http/gskhttpcontent.h"
 #include "../gskmemory.h"
 #include "../gsklog.h"
+#include "../gskmempool.h"
+#include "../gsklogringbuffer.h"
 #include <string.h>
 
 
@@ -397,13 +399,102 @@ command_handler__cat(char **argv,
   return TRUE;
 }
 
+/* main-loop-stats [on|off|reset]:  report (and control)
+   the instrumentation of the server's main-loop */
+static gboolean
+command_handler__main_loop_stats (char **argv,
+                                  GskStream *input,
+                                  GskStream **output,
+                                  gpointer data,
+                                  GError **error)
+{
+  GskMainLoop *main_loop = gsk_main_loop_default ();
+  char *mem;
+  if (argv[1] != NULL && argv[2] != NULL)
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN,
+                   GSK_ERROR_INVALID_ARGUMENT,
+                   "'main-loop-stats' command takes at most one argument");
+      return FALSE;
+    }
+  if (argv[1] == NULL)
+    ;
+  else if (strcmp (argv[1], "on") == 0)
+    gsk_main_loop_set_instrumented (main_loop, TRUE);
+  else if (strcmp (argv[1], "off") == 0)
+    gsk_main_loop_set_instrumented (main_loop, FALSE);
+  else if (strcmp (argv[1], "reset") == 0)
+    gsk_main_loop_reset_stats (main_loop);
+  else
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN,
+                   GSK_ERROR_INVALID_ARGUMENT,
+                   "main-loop-stats: expected 'on', 'off' or 'reset', got '%s'",
+                   argv[1]);
+      return FALSE;
+    }
+  mem = gsk_main_loop_stats_to_string (main_loop);
+  *output = gsk_memory_slab_source_new (mem, strlen (mem), g_free, mem);
+  return TRUE;
+}
+
+/* pool-stats [trim]:  report (and trim) the per-type memory pools */
+static gboolean
+command_handler__pool_stats (char **argv,
+                             GskStream *input,
+                             GskStream **output,
+                             gpointer data,
+                             GError **error)
+{
+  char *mem;
+  if (argv[1] != NULL && (argv[2] != NULL || strcmp (argv[1], "trim") != 0))
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN,
+                   GSK_ERROR_INVALID_ARGUMENT,
+                   "'pool-stats' command takes only the argument 'trim'");
+      return FALSE;
+    }
+  if (argv[1] != NULL)
+    gsk_type_pool_trim_all ();
+  mem = gsk_type_pool_stats_to_string ();
+  *output = gsk_memory_slab_source_new (mem, strlen (mem), g_free, mem);
+  return TRUE;
+}
+
+/* flight-recorder:  report what every thread did recently */
+static gboolean
+command_handler__flight_recorder (char **argv,
+                                  GskStream *input,
+                                  GskStream **output,
+                                  gpointer data,
+                                  GError **error)
+{
+  char *mem;
+  if (argv[1] != NULL)
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN,
+                   GSK_ERROR_INVALID_ARGUMENT,
+                   "'flight-recorder' command takes no arguments");
+      return FALSE;
+    }
+  mem = gsk_flight_recorder_snapshot ();
+  *output = gsk_memory_slab_source_new (mem, strlen (mem), g_free, mem);
+  return TRUE;
+}
+
 /**
  * gsk_control_server_new:
  * returns: a new GskControlServer.
  *
  * Allocate a new GskControlServer.
  *
- * It has a few builtin commands: 'ls', 'cat'.
+ * It has a few builtin commands: 'ls', 'cat',
+ * and 'main-loop-stats', which turns the main-loop's
+ * instrumentation on or off (see gsk_main_loop_set_instrumented())
+ * and reports its timing histograms, and 'pool-stats',
+ * which reports the memory pools of GSK_DECLARE_POOL_ALLOCATORS(),
+ * and 'flight-recorder', which gives a snapshot
+ * of gsk_flight_recorder_event()s.
  */
 GskControlServer *
 gsk_control_server_new (void)
@@ -422,6 +513,12 @@ gsk_control_server_new (void)
 
   add_command_internal (server, "ls", command_handler__ls, server);
   add_command_internal (server, "cat", command_handler__cat, server);
+  add_command_internal (server, "main-loop-stats",
+                        command_handler__main_loop_stats, server);
+  add_command_internal (server, "pool-stats",
+                        command_handler__pool_stats, server);
+  add_command_internal (server, "flight-recorder",
+                        command_handler__flight_recorder, server);
   return server;
 }
 
@@ -12,6 +12,7 @@
 #include "gskinit.h"
 #include "gskio.h"
 #include "gsklog.h"
+#include "gsklogbinary.h"
 #include "gskmacros.h"
 #include "gskmain.h"
 #include "gskmainloop.h"
@@ -26,6 +27,7 @@
 #include "gskstreamconnection.h"
 #include "gskstreamexternal.h"
 #include "gskstreamfd.h"
+#include "gskstreamfile.h"
 #include "gskstreamlistener.h"
 #include "gskstreamlistenersocket.h"
 #include "gsktree.h"
@@ -19,15 +19,16 @@
         daveb@ffem.org <Dave Benson>
 */
 
-/* Free blocks to hold around to avoid repeated mallocs... */
-#define MAX_RECYCLED		16
-
-/* Size of allocations to make. */
-#define BUF_CHUNK_SIZE		32768
-
 /* Max fragments in the iovector to writev. */
 #define MAX_FRAGMENTS_TO_WRITE	16
 
+/* Max new fragments in the iovector to readv. */
+#define MAX_FRAGMENTS_TO_READ	4
+
+/* Bounds on the amount gsk_buffer_read_in_fd() tries to read. */
+#define MIN_READ_SIZE		2048
+#define MAX_READ_SIZE		(256*1024)
+
 /* This causes fragments not to be transferred from buffer to buffer,
  * and not to be allocated in pools.  The result is that stack-trace
  * based debug-allocators work much better with this on.
@@ -40,14 +41,14 @@
 #include "config.h"
 #include "gskmacros.h"
 #include <sys/types.h>
-#if HAVE_WRITEV
 #include <sys/uio.h>
-#endif
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include "gskbuffer.h"
+#include "gskbufferscan.h"
 #include "gskerrno.h"
+#include "gsklistmacros.h"
 
 /* --- GskBufferFragment implementation --- */
 static inline int 
@@ -66,35 +67,249 @@ gsk_buffer_fragment_end (GskBufferFragment *frag)
   return frag->buf + frag->buf_start + frag->buf_length;
 }
 
+/* --- GskBufferFragment sizing --- */
+/* Fragments come in a few sizes:  small ones keep mostly-idle
+ * buffers cheap, large ones make bulk transfers efficient.
+ * The sizes here include the GskBufferFragment header.
+ *
+ * Each size has its own recycling limits:
+ *   - free blocks each thread holds onto to avoid repeated mallocs,
+ *   - free blocks held in the shared pool, which is used
+ *     to rebalance the per-thread caches,
+ *   - number of blocks moved between a thread's cache and
+ *     the shared pool at a time.
+ */
+#define N_FRAGMENT_SIZES	GSK_BUFFER_N_FRAGMENT_SIZES
+static const struct
+{
+  guint size;
+  guint max_thread_recycled;
+  guint max_recycled;
+  guint batch_size;
+} fragment_sizes[N_FRAGMENT_SIZES] =
+{
+  {    512, 64, 256, 16 },
+  {   4096, 32, 128,  8 },
+  {  32768, 16,  64,  8 },
+  { 262144,  2,   8,  1 },
+};
+
+/* The largest fragment size that a buffer will grow into
+ * through a sequence of appends.  Larger fragments are only
+ * used for single appends that will fill at least half of one. */
+#define MAX_GROWTH_SIZE_INDEX	2
+
+static inline guint
+fragment_size_index (const GskBufferFragment *frag)
+{
+  guint alloc_size = frag->buf_max_size + sizeof (GskBufferFragment);
+  guint index = 0;
+  while (fragment_sizes[index].size != alloc_size)
+    index++;
+  return index;
+}
+
+/* Pick the fragment size for a new fragment to follow last_frag,
+   which is about to receive 'length' more bytes:
+   the smallest fragment which will hold the data,
+   but at least one size up from the last fragment,
+   so that buffers which are appended to piece-by-piece
+   quickly move to the larger fragments. */
+static inline guint
+choose_fragment_size_index (const GskBufferFragment *last_frag,
+                            guint                    length)
+{
+  guint index = 0;
+  while (index < N_FRAGMENT_SIZES - 1
+      && fragment_sizes[index].size - sizeof (GskBufferFragment) < length)
+    index++;
+  if (index > MAX_GROWTH_SIZE_INDEX && length < fragment_sizes[index].size / 2)
+    index--;
+  if (last_frag != NULL && !last_frag->is_foreign)
+    {
+      guint grown = fragment_size_index (last_frag) + 1;
+      if (grown > MAX_GROWTH_SIZE_INDEX)
+        grown = MAX_GROWTH_SIZE_INDEX;
+      if (grown > index)
+        index = grown;
+    }
+  return index;
+}
+
 /* --- GskBufferFragment recycling --- */
+/* Each thread has its own cache of free fragments,
+ * so that the common case of allocating and recycling
+ * fragments takes no locks.  When a thread's cache overflows,
+ * a batch of fragments is spilled into the shared pool;
+ * when it runs dry, a batch is taken from the shared pool.
+ * Each fragment size is recycled separately.
+ */
 #if !GSK_DEBUG_BUFFER_ALLOCATIONS
-static int num_recycled = 0;
-static GskBufferFragment* recycling_stack = 0;
+typedef struct _FragmentCache FragmentCache;
+struct _FragmentCache
+{
+  GskBufferFragment *stacks[N_FRAGMENT_SIZES];
+  guint n_cached[N_FRAGMENT_SIZES];
+
+  /* statistics */
+  guint64 n_allocs;
+  guint64 n_hits;
+  guint64 n_refills;
+  guint64 n_spills;
+  gint64 live_bytes;
+  gpointer thread;
+
+  /* list of all caches, protected by the recycling_stack lock */
+  FragmentCache *prev, *next;
+};
+#define GET_FRAGMENT_CACHE_LIST()  \
+  FragmentCache *, first_cache, last_cache, prev, next
+
+static guint num_recycled[N_FRAGMENT_SIZES];
+static GskBufferFragment* recycling_stacks[N_FRAGMENT_SIZES];
+static FragmentCache *first_cache = NULL, *last_cache = NULL;
+static GskBufferRecyclingStats retired_cache_stats;
+static GStaticPrivate fragment_cache_key = G_STATIC_PRIVATE_INIT;
 G_LOCK_DEFINE_STATIC (recycling_stack);
 
+/* move up to 'count' fragments of the given size from
+   the thread's cache into the shared pool, freeing them
+   if the pool is full.
+   Must be called with the recycling_stack lock held. */
+static void
+spill_fragments_locked (FragmentCache *cache,
+                        guint          index,
+                        guint          count)
+{
+  while (count-- > 0 && cache->stacks[index] != NULL)
+    {
+      GskBufferFragment *frag = cache->stacks[index];
+      cache->stacks[index] = frag->next;
+      cache->n_cached[index]--;
+      if (num_recycled[index] >= fragment_sizes[index].max_recycled)
+        g_free (frag);
+      else
+        {
+          frag->next = recycling_stacks[index];
+          recycling_stacks[index] = frag;
+          num_recycled[index]++;
+          cache->n_spills++;
+        }
+    }
+}
+
+static void
+fragment_cache_destroy (gpointer data)
+{
+  FragmentCache *cache = data;
+  guint i;
+  G_LOCK (recycling_stack);
+  for (i = 0; i < N_FRAGMENT_SIZES; i++)
+    spill_fragments_locked (cache, i, cache->n_cached[i]);
+  retired_cache_stats.n_allocs += cache->n_allocs;
+  retired_cache_stats.n_hits += cache->n_hits;
+  retired_cache_stats.n_refills += cache->n_refills;
+  retired_cache_stats.n_spills += cache->n_spills;
+  retired_cache_stats.live_bytes += cache->live_bytes;
+  GSK_LIST_REMOVE (GET_FRAGMENT_CACHE_LIST (), cache);
+  G_UNLOCK (recycling_stack);
+  g_free (cache);
+}
+
+static FragmentCache *
+fragment_cache_new (void)
+{
+  FragmentCache *cache = g_new0 (FragmentCache, 1);
+  if (g_thread_supported ())
+    cache->thread = g_thread_self ();
+  G_LOCK (recycling_stack);
+  GSK_LIST_APPEND (GET_FRAGMENT_CACHE_LIST (), cache);
+  G_UNLOCK (recycling_stack);
+  g_static_private_set (&fragment_cache_key, cache, fragment_cache_destroy);
+  return cache;
+}
+
+static inline FragmentCache *
+get_fragment_cache (void)
+{
+  FragmentCache *cache = g_static_private_get (&fragment_cache_key);
+  if (G_UNLIKELY (cache == NULL))
+    cache = fragment_cache_new ();
+  return cache;
+}
+
+/* Take a batch of fragments of the given size from the shared pool. */
+static void
+refill_fragment_cache (FragmentCache *cache,
+                       guint          index)
+{
+  guint count = 0;
+
+  /* an unlocked peek: if the pool looks empty,
+     don't bother with the lock, just malloc. */
+  if (num_recycled[index] == 0)
+    return;
+
+  G_LOCK (recycling_stack);
+  while (count < fragment_sizes[index].batch_size
+      && recycling_stacks[index] != NULL)
+    {
+      GskBufferFragment *frag = recycling_stacks[index];
+      recycling_stacks[index] = frag->next;
+      num_recycled[index]--;
+      frag->next = cache->stacks[index];
+      cache->stacks[index] = frag;
+      count++;
+    }
+  G_UNLOCK (recycling_stack);
+  if (count > 0)
+    {
+      cache->n_cached[index] += count;
+      cache->n_refills++;
+    }
+}
+
+static void
+fill_recycling_stats (GskBufferRecyclingStats *stats,
+                      const guint             *n_cached)
+{
+  guint i;
+  stats->n_cached = 0;
+  stats->cached_bytes = 0;
+  for (i = 0; i < N_FRAGMENT_SIZES; i++)
+    {
+      stats->n_cached_by_size[i] = n_cached[i];
+      stats->n_cached += n_cached[i];
+      stats->cached_bytes += (gsize) n_cached[i] * fragment_sizes[i].size;
+    }
+}
 #endif
 
 static GskBufferFragment *
-new_native_fragment()
+new_native_fragment (guint index)
 {
   GskBufferFragment *frag;
+  guint size = fragment_sizes[index].size;
 #if GSK_DEBUG_BUFFER_ALLOCATIONS
-  frag = (GskBufferFragment *) g_malloc (BUF_CHUNK_SIZE);
-  frag->buf_max_size = BUF_CHUNK_SIZE - sizeof (GskBufferFragment);
+  frag = (GskBufferFragment *) g_malloc (size);
+  frag->buf_max_size = size - sizeof (GskBufferFragment);
 #else  /* optimized (?) */
-  G_LOCK (recycling_stack);
-  if (recycling_stack)
+  FragmentCache *cache = get_fragment_cache ();
+  cache->n_allocs++;
+  cache->live_bytes += size;
+  if (cache->stacks[index] == NULL)
+    refill_fragment_cache (cache, index);
+  if (cache->stacks[index] != NULL)
     {
-      frag = recycling_stack;
-      recycling_stack = recycling_stack->next;
-      num_recycled--;
-      G_UNLOCK (recycling_stack);
+      frag = cache->stacks[index];
+      cache->stacks[index] = frag->next;
+      cache->n_cached[index]--;
+      cache->n_hits++;
     }
   else
     {
-      G_UNLOCK (recycling_stack);
-      frag = (GskBufferFragment *) g_malloc (BUF_CHUNK_SIZE);
-      frag->buf_max_size = BUF_CHUNK_SIZE - sizeof (GskBufferFragment);
+      frag = (GskBufferFragment *) g_malloc (size);
+      frag->buf_max_size = size - sizeof (GskBufferFragment);
     }
 #endif	/* !GSK_DEBUG_BUFFER_ALLOCATIONS */
   frag->buf_start = frag->buf_length = 0;
@@ -104,6 +319,22 @@ new_native_fragment()
   return frag;
 }
 
+/* Add a new empty fragment to the end of the buffer,
+   sized for an append of 'length' bytes. */
+static inline GskBufferFragment *
+append_native_fragment (GskBuffer *buffer,
+                        guint      length)
+{
+  GskBufferFragment *frag;
+  frag = new_native_fragment (choose_fragment_size_index (buffer->last_frag, length));
+  if (buffer->last_frag == NULL)
+    buffer->first_frag = frag;
+  else
+    buffer->last_frag->next = frag;
+  buffer->last_frag = frag;
+  return frag;
+}
+
 static GskBufferFragment *
 new_foreign_fragment (gconstpointer        ptr,
 		      int                  length,
@@ -123,6 +354,34 @@ new_foreign_fragment (gconstpointer        ptr,
   return fragment;
 }
 
+/* Shared fragments are foreign fragments whose destroy
+ * function drops a reference to the GskBufferShared,
+ * so they are never appended into or recycled. */
+#define FRAGMENT_IS_SHARED(frag) \
+  ((frag)->is_foreign && (frag)->destroy == (GDestroyNotify) gsk_buffer_shared_unref)
+
+static void
+append_shared_fragment (GskBuffer       *buffer,
+                        GskBufferShared *shared,
+                        guint            offset,
+                        guint            length)
+{
+  GskBufferFragment *fragment;
+  /* like all foreign fragments, leave no room to append into */
+  fragment = new_foreign_fragment (shared->data, offset + length,
+                                   (GDestroyNotify) gsk_buffer_shared_unref,
+                                   gsk_buffer_shared_ref (shared));
+  fragment->buf_start = offset;
+  fragment->buf_length = length;
+
+  if (buffer->last_frag == NULL)
+    buffer->first_frag = fragment;
+  else
+    buffer->last_frag->next = fragment;
+  buffer->last_frag = fragment;
+  buffer->size += length;
+}
+
 #if GSK_DEBUG_BUFFER_ALLOCATIONS
 #define recycle(frag) G_STMT_START{ \
     if (frag->is_foreign) { \
@@ -134,6 +393,8 @@ new_foreign_fragment (gconstpointer        ptr,
 static void
 recycle(GskBufferFragment* frag)
 {
+  FragmentCache *cache;
+  guint index;
   if (frag->is_foreign)
     {
       if (frag->destroy)
@@ -141,19 +402,18 @@ recycle(GskBufferFragment* frag)
       g_slice_free (GskBufferFragment, frag);
       return;
     }
-  G_LOCK (recycling_stack);
-#if defined(MAX_RECYCLED)
-  if (num_recycled >= MAX_RECYCLED)
+  cache = get_fragment_cache ();
+  index = fragment_size_index (frag);
+  cache->live_bytes -= fragment_sizes[index].size;
+  if (cache->n_cached[index] >= fragment_sizes[index].max_thread_recycled)
     {
-      g_free (frag);
+      G_LOCK (recycling_stack);
+      spill_fragments_locked (cache, index, fragment_sizes[index].batch_size);
       G_UNLOCK (recycling_stack);
-      return;
     }
-#endif
-  frag->next = recycling_stack;
-  recycling_stack = frag;
-  num_recycled++;
-  G_UNLOCK (recycling_stack);
+  frag->next = cache->stacks[index];
+  cache->stacks[index] = frag;
+  cache->n_cached[index]++;
 }
 #endif	/* !GSK_DEBUG_BUFFER_ALLOCATIONS */
 
@@ -163,23 +423,155 @@ recycle(GskBufferFragment* frag)
  * 
  * Free unused buffer fragments.  (Normally some are
  * kept around to reduce strain on the global allocator.)
+ *
+ * This frees the shared pool and the calling thread's cache;
+ * other threads' caches are released when those threads exit.
  */
 void
 gsk_buffer_cleanup_recycling_bin ()
 {
 #if !GSK_DEBUG_BUFFER_ALLOCATIONS
+  FragmentCache *cache = g_static_private_get (&fragment_cache_key);
+  guint i;
+  for (i = 0; i < N_FRAGMENT_SIZES; i++)
+    {
+      if (cache != NULL)
+        {
+          while (cache->stacks[i] != NULL)
+            {
+              GskBufferFragment *next = cache->stacks[i]->next;
+              g_free (cache->stacks[i]);
+              cache->stacks[i] = next;
+            }
+          cache->n_cached[i] = 0;
+        }
+      G_LOCK (recycling_stack);
+      while (recycling_stacks[i] != NULL)
+        {
+          GskBufferFragment *next;
+          next = recycling_stacks[i]->next;
+          g_free (recycling_stacks[i]);
+          recycling_stacks[i] = next;
+        }
+      num_recycled[i] = 0;
+      G_UNLOCK (recycling_stack);
+    }
+#endif
+}
+
+/**
+ * gsk_buffer_get_fragment_size:
+ * @size_index: index of the fragment size, less than
+ * GSK_BUFFER_N_FRAGMENT_SIZES.
+ *
+ * Get the allocation size of one of the sizes of fragments,
+ * as used to index #GskBufferRecyclingStats.n_cached_by_size.
+ *
+ * returns: the number of bytes in a fragment of the given size.
+ */
+guint
+gsk_buffer_get_fragment_size (guint size_index)
+{
+  g_return_val_if_fail (size_index < N_FRAGMENT_SIZES, 0);
+  return fragment_sizes[size_index].size;
+}
+
+/**
+ * gsk_buffer_recycling_stats_foreach:
+ * @func: function to call with each thread's statistics.
+ * @data: second argument to @func.
+ *
+ * Report the fragment-recycling statistics of
+ * each thread that has allocated a buffer fragment.
+ *
+ * The counters are owned by their threads, so
+ * the values are only approximate while those threads
+ * are running.  @func is called with an internal lock held,
+ * so it must not use any #GskBuffer.
+ */
+void
+gsk_buffer_recycling_stats_foreach (GskBufferRecyclingStatsFunc func,
+                                    gpointer                    data)
+{
+#if !GSK_DEBUG_BUFFER_ALLOCATIONS
+  FragmentCache *cache;
+  G_LOCK (recycling_stack);
+  for (cache = first_cache; cache != NULL; cache = cache->next)
+    {
+      GskBufferRecyclingStats stats;
+      stats.thread = cache->thread;
+      stats.n_allocs = cache->n_allocs;
+      stats.n_hits = cache->n_hits;
+      stats.n_refills = cache->n_refills;
+      stats.n_spills = cache->n_spills;
+      stats.live_bytes = cache->live_bytes;
+      fill_recycling_stats (&stats, cache->n_cached);
+      func (&stats, data);
+    }
+  G_UNLOCK (recycling_stack);
+#endif
+}
+
+/**
+ * gsk_buffer_get_recycling_stats:
+ * @stats_out: the statistics to fill in.
+ *
+ * Obtain fragment-recycling statistics summed over
+ * all threads, including threads that have exited.
+ * The @n_cached and @cached_bytes members include
+ * the fragments in the shared pool.
+ */
+void
+gsk_buffer_get_recycling_stats (GskBufferRecyclingStats *stats_out)
+{
+#if GSK_DEBUG_BUFFER_ALLOCATIONS
+  memset (stats_out, 0, sizeof (GskBufferRecyclingStats));
+#else
+  FragmentCache *cache;
+  guint n_cached[N_FRAGMENT_SIZES];
+  guint i;
   G_LOCK (recycling_stack);
-  while (recycling_stack != NULL)
+  *stats_out = retired_cache_stats;
+  stats_out->thread = NULL;
+  for (i = 0; i < N_FRAGMENT_SIZES; i++)
+    n_cached[i] = num_recycled[i];
+  for (cache = first_cache; cache != NULL; cache = cache->next)
     {
-      GskBufferFragment *next;
-      next = recycling_stack->next;
-      g_free (recycling_stack);
-      recycling_stack = next;
+      stats_out->n_allocs += cache->n_allocs;
+      stats_out->n_hits += cache->n_hits;
+      stats_out->n_refills += cache->n_refills;
+      stats_out->n_spills += cache->n_spills;
+      stats_out->live_bytes += cache->live_bytes;
+      for (i = 0; i < N_FRAGMENT_SIZES; i++)
+        n_cached[i] += cache->n_cached[i];
     }
-  num_recycled = 0;
   G_UNLOCK (recycling_stack);
+  fill_recycling_stats (stats_out, n_cached);
 #endif
 }
+
+/**
+ * gsk_buffer_get_wasted_bytes:
+ * @buffer: the buffer to examine.
+ *
+ * Compute the amount of memory allocated for
+ * the buffer's fragments which is not holding data,
+ * including the fragments' bookkeeping.
+ *
+ * returns: the number of unused bytes.
+ */
+gsize
+gsk_buffer_get_wasted_bytes (const GskBuffer *buffer)
+{
+  const GskBufferFragment *frag;
+  gsize rv = 0;
+  for (frag = buffer->first_frag; frag != NULL; frag = frag->next)
+    if (frag->is_foreign)
+      rv += sizeof (GskBufferFragment);
+    else
+      rv += frag->buf_max_size + sizeof (GskBufferFragment) - frag->buf_length;
+  return rv;
+}
       
 /* --- Public methods --- */
 /**
@@ -194,6 +586,7 @@ gsk_buffer_construct(GskBuffer *buffer)
 {
   buffer->first_frag = buffer->last_frag = NULL;
   buffer->size = 0;
+  buffer->read_size_hint = 0;
 }
 
 #if defined(GSK_DEBUG) || GSK_DEBUG_BUFFER_ALLOCATIONS
@@ -229,21 +622,9 @@ gsk_buffer_append(GskBuffer    *buffer,
   while (length > 0)
     {
       guint avail;
-      if (!buffer->last_frag)
-	{
-	  buffer->last_frag = buffer->first_frag = new_native_fragment ();
-	  avail = gsk_buffer_fragment_avail (buffer->last_frag);
-	}
-      else
-	{
-	  avail = gsk_buffer_fragment_avail (buffer->last_frag);
-	  if (avail <= 0)
-	    {
-	      buffer->last_frag->next = new_native_fragment ();
-	      avail = gsk_buffer_fragment_avail (buffer->last_frag);
-	      buffer->last_frag = buffer->last_frag->next;
-	    }
-	}
+      if (buffer->last_frag == NULL
+       || (avail = gsk_buffer_fragment_avail (buffer->last_frag)) == 0)
+        avail = gsk_buffer_fragment_avail (append_native_fragment (buffer, length));
       if (avail > length)
 	avail = length;
       memcpy (gsk_buffer_fragment_end (buffer->last_frag), data, avail);
@@ -264,21 +645,9 @@ gsk_buffer_append_repeated_char (GskBuffer    *buffer,
   while (count > 0)
     {
       guint avail;
-      if (!buffer->last_frag)
-	{
-	  buffer->last_frag = buffer->first_frag = new_native_fragment ();
-	  avail = gsk_buffer_fragment_avail (buffer->last_frag);
-	}
-      else
-	{
-	  avail = gsk_buffer_fragment_avail (buffer->last_frag);
-	  if (avail <= 0)
-	    {
-	      buffer->last_frag->next = new_native_fragment ();
-	      avail = gsk_buffer_fragment_avail (buffer->last_frag);
-	      buffer->last_frag = buffer->last_frag->next;
-	    }
-	}
+      if (buffer->last_frag == NULL
+       || (avail = gsk_buffer_fragment_avail (buffer->last_frag)) == 0)
+        avail = gsk_buffer_fragment_avail (append_native_fragment (buffer, MIN (count, G_MAXUINT)));
       if (avail > count)
 	avail = count;
       memset (gsk_buffer_fragment_end (buffer->last_frag), character, avail);
@@ -439,6 +808,56 @@ gsk_buffer_peek     (const GskBuffer *buffer,
   return rv;
 }
 
+/**
+ * gsk_buffer_peek_contiguous:
+ * @buffer: the buffer to look at.
+ *    This buffer is unchanged by the operation.
+ * @offset: the index of the first byte to look at.
+ * @length: the number of bytes to look at.
+ * @scratch: memory to use if the bytes straddle fragments.
+ *    It must have room for @length bytes.
+ *
+ * Get a pointer to a range of the buffer's data,
+ * without copying it, if possible.  If the range is
+ * contained in one fragment, a pointer into that fragment is returned;
+ * otherwise the range is copied into @scratch, and @scratch is returned.
+ *
+ * The returned pointer is only valid until the buffer is next modified.
+ *
+ * returns: the data, or NULL if the buffer has fewer
+ * than @offset + @length bytes.
+ */
+const guint8 *
+gsk_buffer_peek_contiguous (const GskBuffer *buffer,
+                            guint            offset,
+                            guint            length,
+                            gpointer         scratch)
+{
+  GskBufferFragment *frag;
+  guint8 *out;
+  if (offset > buffer->size || length > buffer->size - offset)
+    return NULL;
+  if (length == 0)
+    return scratch;
+  for (frag = buffer->first_frag; offset >= frag->buf_length; frag = frag->next)
+    offset -= frag->buf_length;
+  if (offset + length <= frag->buf_length)
+    return (const guint8 *) gsk_buffer_fragment_start (frag) + offset;
+
+  /* straddles fragments:  copy to scratch */
+  out = scratch;
+  while (length > 0)
+    {
+      guint n = MIN (frag->buf_length - offset, length);
+      memcpy (out, gsk_buffer_fragment_start (frag) + offset, n);
+      out += n;
+      length -= n;
+      offset = 0;
+      frag = frag->next;
+    }
+  return scratch;
+}
+
 /**
  * gsk_buffer_read_line:
  * @buffer: buffer to read a line from.
@@ -699,19 +1118,101 @@ gsk_buffer_writev_len (GskBuffer *read_from,
  * Append data into the buffer directly from the
  * given file-descriptor.
  *
+ * The data is read with a single readv(2) call directly
+ * into the free space at the end of the buffer and into new fragments,
+ * without an intermediate copy.  The amount requested adapts to
+ * the sizes of recent reads into the same buffer.
+ *
  * returns: the number of bytes transferred,
  * or -1 on a read error (consult errno).
  */
-/* TODO: zero-copy! */
 int
 gsk_buffer_read_in_fd(GskBuffer *write_to,
                       int        read_from)
 {
-  char buf[8192];
-  int rv = read (read_from, buf, sizeof (buf));
-  if (rv < 0)
-    return rv;
-  gsk_buffer_append (write_to, buf, rv);
+  struct iovec iov[MAX_FRAGMENTS_TO_READ + 1];
+  GskBufferFragment *new_frags[MAX_FRAGMENTS_TO_READ];
+  GskBufferFragment *tail = write_to->last_frag;
+  guint want = MAX (write_to->read_size_hint, MIN_READ_SIZE);
+  guint space = 0;
+  guint n_iov = 0;
+  guint n_new = 0;
+  guint i;
+  int rv;
+
+  CHECK_INTEGRITY (write_to);
+
+  /* read into the free end of the last fragment first */
+  if (tail != NULL && !tail->is_foreign && gsk_buffer_fragment_avail (tail) > 0)
+    {
+      space = gsk_buffer_fragment_avail (tail);
+      iov[0].iov_base = gsk_buffer_fragment_end (tail);
+      iov[0].iov_len = space;
+      n_iov = 1;
+    }
+  else
+    tail = NULL;
+
+  /* then into enough new fragments to hold the expected amount */
+  while (space < want && n_new < MAX_FRAGMENTS_TO_READ)
+    {
+      GskBufferFragment *prev = n_new > 0 ? new_frags[n_new - 1] : write_to->last_frag;
+      GskBufferFragment *frag;
+      frag = new_native_fragment (choose_fragment_size_index (prev, want - space));
+      new_frags[n_new++] = frag;
+      iov[n_iov].iov_base = frag->buf;
+      iov[n_iov].iov_len = frag->buf_max_size;
+      n_iov++;
+      space += frag->buf_max_size;
+    }
+
+  rv = readv (read_from, iov, n_iov);
+
+  if (rv > 0)
+    {
+      guint remaining = rv;
+      if (tail != NULL)
+        {
+          guint amount = MIN (remaining, (guint) iov[0].iov_len);
+          tail->buf_length += amount;
+          remaining -= amount;
+        }
+      for (i = 0; i < n_new && remaining > 0; i++)
+        {
+          GskBufferFragment *frag = new_frags[i];
+          frag->buf_length = MIN (remaining, frag->buf_max_size);
+          remaining -= frag->buf_length;
+          if (write_to->last_frag == NULL)
+            write_to->first_frag = frag;
+          else
+            write_to->last_frag->next = frag;
+          write_to->last_frag = frag;
+        }
+      write_to->size += rv;
+
+      /* Grow the next read quickly while reads fill the space
+         offered, and shrink it slowly toward the amounts read. */
+      if ((guint) rv == space)
+        write_to->read_size_hint = MIN (space * 2, MAX_READ_SIZE);
+      else
+        write_to->read_size_hint = (write_to->read_size_hint * 3 + rv) / 4;
+    }
+  else
+    i = 0;
+
+  /* recycle the fragments that didn't get any data */
+  if (i < n_new)
+    {
+      int e = errno;
+      for ( ; i < n_new; i++)
+        {
+          GskBufferFragment *frag = new_frags[i];
+          recycle (frag);
+        }
+      errno = e;
+    }
+
+  CHECK_INTEGRITY (write_to);
   return rv;
 }
 
@@ -755,8 +1256,8 @@ gsk_buffer_index_of(GskBuffer *buffer,
   int rv = 0;
   while (at)
     {
-      char *start = gsk_buffer_fragment_start (at);
-      char *saught = memchr (start, char_to_find, at->buf_length);
+      const guint8 *start = (const guint8 *) gsk_buffer_fragment_start (at);
+      const guint8 *saught = _gsk_buffer_scan_char (start, at->buf_length, char_to_find);
       if (saught)
 	return (saught - start) + rv;
       else
@@ -766,6 +1267,43 @@ gsk_buffer_index_of(GskBuffer *buffer,
   return -1;
 }
 
+/* --- scanning --- */
+/* Test to see if a sequence of buffer fragments
+ * starts with a particular NUL-terminated string.
+ */
+static gboolean
+fragment_n_str(GskBufferFragment   *frag,
+               guint                frag_index,
+               const char          *string)
+{
+  guint len = strlen (string);
+  for (;;)
+    {
+      guint test_len = frag->buf_length - frag_index;
+      if (test_len > len)
+        test_len = len;
+
+      if (memcmp (string,
+                  gsk_buffer_fragment_start (frag) + frag_index,
+                  test_len) != 0)
+        return FALSE;
+
+      len -= test_len;
+      string += test_len;
+
+      if (len <= 0)
+        return TRUE;
+      frag_index += test_len;
+      while (frag_index >= frag->buf_length)
+        {
+          frag = frag->next;
+          if (frag == NULL)
+            return FALSE;
+          frag_index = 0;
+        }
+    }
+}
+
 /**
  * gsk_buffer_str_index_of:
  * @buffer: buffer to scan.
@@ -779,55 +1317,40 @@ int
 gsk_buffer_str_index_of (GskBuffer *buffer,
                          const char *str_to_find)
 {
-  GskBufferFragment *frag = buffer->first_frag;
+  guint len = strlen (str_to_find);
+  GskBufferFragment *frag;
   guint rv = 0;
+  if (len == 0)
+    return 0;
+  if (len == 1)
+    return gsk_buffer_index_of (buffer, str_to_find[0]);
   for (frag = buffer->first_frag; frag; frag = frag->next)
     {
-      const char *frag_at = frag->buf + frag->buf_start;
-      guint frag_rem = frag->buf_length;
-      while (frag_rem > 0)
+      const guint8 *start = (const guint8 *) gsk_buffer_fragment_start (frag);
+      const guint8 *at;
+      guint tail_start;
+
+      /* matches entirely within this fragment */
+      at = _gsk_buffer_scan_substr (start, frag->buf_length,
+                                    (const guint8 *) str_to_find, len);
+      if (at != NULL)
+        return rv + (at - start);
+
+      /* matches which begin near the end of this fragment
+         and continue into the following ones */
+      tail_start = frag->buf_length >= len ? frag->buf_length - len + 1 : 0;
+      while (tail_start < frag->buf_length)
         {
-          GskBufferFragment *subfrag;
-          const char *subfrag_at;
-          guint subfrag_rem;
-          const char *str_at;
-          if (G_LIKELY (*frag_at != str_to_find[0]))
-            {
-              frag_at++;
-              frag_rem--;
-              rv++;
-              continue;
-            }
-          subfrag = frag;
-          subfrag_at = frag_at + 1;
-          subfrag_rem = frag_rem - 1;
-          str_at = str_to_find + 1;
-          if (*str_at == '\0')
-            return rv;
-          while (subfrag != NULL)
-            {
-              while (subfrag_rem == 0)
-                {
-                  subfrag = subfrag->next;
-                  if (subfrag == NULL)
-                    goto bad_guess;
-                  subfrag_at = subfrag->buf + subfrag->buf_start;
-                  subfrag_rem = subfrag->buf_length;
-                }
-              while (*str_at != '\0' && subfrag_rem != 0)
-                {
-                  if (*str_at++ != *subfrag_at++)
-                    goto bad_guess;
-                  subfrag_rem--;
-                }
-              if (*str_at == '\0')
-                return rv;
-            }
-bad_guess:
-          frag_at++;
-          frag_rem--;
-          rv++;
+          at = _gsk_buffer_scan_char (start + tail_start,
+                                      frag->buf_length - tail_start,
+                                      str_to_find[0]);
+          if (at == NULL)
+            break;
+          if (fragment_n_str (frag, at - start, str_to_find))
+            return rv + (at - start);
+          tail_start = at - start + 1;
         }
+      rv += frag->buf_length;
     }
   return -1;
 }
@@ -964,7 +1487,11 @@ gsk_buffer_transfer(GskBuffer *dst,
   if (src->first_frag && max_transfer)
     {
       GskBufferFragment *frag = src->first_frag;
-      gsk_buffer_append (dst, gsk_buffer_fragment_start (frag), max_transfer);
+      if (FRAGMENT_IS_SHARED (frag))
+        append_shared_fragment (dst, frag->destroy_data,
+                                frag->buf_start, max_transfer);
+      else
+        gsk_buffer_append (dst, gsk_buffer_fragment_start (frag), max_transfer);
       frag->buf_start += max_transfer;
       frag->buf_length -= max_transfer;
       rv += max_transfer;
@@ -1015,6 +1542,188 @@ void gsk_buffer_append_foreign (GskBuffer        *buffer,
   CHECK_INTEGRITY (buffer);
 }
 
+/* --- shared data --- */
+/**
+ * gsk_buffer_shared_new:
+ * @data: the data to copy.
+ * @length: length of @data.
+ *
+ * Make an immutable copy of @data which may be
+ * appended to any number of buffers without further copying.
+ *
+ * returns: the new shared data, with a single reference.
+ */
+GskBufferShared *
+gsk_buffer_shared_new (gconstpointer data,
+                       guint         length)
+{
+  GskBufferShared *shared = g_malloc (sizeof (GskBufferShared) + length);
+  memcpy (shared + 1, data, length);
+  shared->data = (const char *) (shared + 1);
+  shared->length = length;
+  shared->ref_count = 1;
+  shared->destroy = NULL;
+  shared->destroy_data = NULL;
+  return shared;
+}
+
+/**
+ * gsk_buffer_shared_new_foreign:
+ * @data: the data to share.
+ * @length: length of @data.
+ * @destroy: optional method to call when the last reference is dropped.
+ * @destroy_data: the argument to the destroy method.
+ *
+ * Share memory which is owned by the caller, without copying it.
+ * As with gsk_buffer_append_foreign(), @data must remain valid
+ * and unchanged until @destroy is called.
+ *
+ * returns: the new shared data, with a single reference.
+ */
+GskBufferShared *
+gsk_buffer_shared_new_foreign (gconstpointer  data,
+                               guint          length,
+                               GDestroyNotify destroy,
+                               gpointer       destroy_data)
+{
+  GskBufferShared *shared = g_new (GskBufferShared, 1);
+  shared->data = data;
+  shared->length = length;
+  shared->ref_count = 1;
+  shared->destroy = destroy;
+  shared->destroy_data = destroy_data;
+  return shared;
+}
+
+/**
+ * gsk_buffer_shared_new_from_buffer:
+ * @buffer: the buffer whose contents should be shared.
+ *
+ * Move the entire contents of @buffer into
+ * a new shared block, leaving @buffer empty.
+ *
+ * returns: the new shared data, with a single reference.
+ */
+GskBufferShared *
+gsk_buffer_shared_new_from_buffer (GskBuffer *buffer)
+{
+  GskBufferShared *shared = g_malloc (sizeof (GskBufferShared) + buffer->size);
+  shared->data = (const char *) (shared + 1);
+  shared->length = gsk_buffer_read (buffer, shared + 1, buffer->size);
+  shared->ref_count = 1;
+  shared->destroy = NULL;
+  shared->destroy_data = NULL;
+  return shared;
+}
+
+/**
+ * gsk_buffer_shared_ref:
+ * @shared: the shared data to reference.
+ *
+ * Increase the reference count of @shared.
+ * This is safe to call from any thread.
+ *
+ * returns: @shared, for convenience.
+ */
+GskBufferShared *
+gsk_buffer_shared_ref (GskBufferShared *shared)
+{
+  g_return_val_if_fail (shared->ref_count > 0, shared);
+  g_atomic_int_inc (&shared->ref_count);
+  return shared;
+}
+
+/**
+ * gsk_buffer_shared_unref:
+ * @shared: the shared data to unreference.
+ *
+ * Decrease the reference count of @shared,
+ * freeing it when no buffers or callers refer to it.
+ * This is safe to call from any thread.
+ */
+void
+gsk_buffer_shared_unref (GskBufferShared *shared)
+{
+  g_return_if_fail (shared->ref_count > 0);
+  if (g_atomic_int_dec_and_test (&shared->ref_count))
+    {
+      if (shared->destroy != NULL)
+        shared->destroy (shared->destroy_data);
+      g_free (shared);
+    }
+}
+
+/**
+ * gsk_buffer_append_shared:
+ * @buffer: the buffer to append into.
+ * @shared: the shared data.
+ * @offset: the offset of the data to append within @shared.
+ * @length: number of bytes to append.
+ *
+ * Append part of @shared to @buffer without copying it.
+ * The buffer takes its own reference to @shared,
+ * which is dropped once the data is read or discarded.
+ */
+void
+gsk_buffer_append_shared (GskBuffer       *buffer,
+                          GskBufferShared *shared,
+                          guint            offset,
+                          guint            length)
+{
+  g_return_if_fail (offset <= shared->length);
+  g_return_if_fail (length <= shared->length - offset);
+  CHECK_INTEGRITY (buffer);
+  if (length > 0)
+    append_shared_fragment (buffer, shared, offset, length);
+  CHECK_INTEGRITY (buffer);
+}
+
+/**
+ * gsk_buffer_clone_range:
+ * @dst: the buffer to append into.
+ * @src: the buffer to copy from.
+ * @offset: the index in @src of the first byte to copy.
+ * @length: maximum number of bytes to copy.
+ *
+ * Append a copy of a range of @src to @dst, leaving @src unchanged.
+ * Data in shared fragments is referenced rather than copied,
+ * so cloning a buffer built with gsk_buffer_append_shared()
+ * is cheap however large the data is.
+ *
+ * returns: the number of bytes appended to @dst.
+ */
+guint
+gsk_buffer_clone_range (GskBuffer       *dst,
+                        const GskBuffer *src,
+                        guint            offset,
+                        guint            length)
+{
+  GskBufferFragment *frag;
+  guint rv = 0;
+  g_return_val_if_fail (dst != src, 0);
+  CHECK_INTEGRITY (dst);
+  for (frag = src->first_frag; frag != NULL && length > 0; frag = frag->next)
+    {
+      guint n;
+      if (offset >= frag->buf_length)
+        {
+          offset -= frag->buf_length;
+          continue;
+        }
+      n = MIN (frag->buf_length - offset, length);
+      if (FRAGMENT_IS_SHARED (frag))
+        append_shared_fragment (dst, frag->destroy_data,
+                                frag->buf_start + offset, n);
+      else
+        gsk_buffer_append (dst, gsk_buffer_fragment_start (frag) + offset, n);
+      offset = 0;
+      length -= n;
+      rv += n;
+    }
+  CHECK_INTEGRITY (dst);
+  return rv;
+}
+
 /**
  * gsk_buffer_printf:
  * @buffer: the buffer to append to.
@@ -1065,42 +1774,6 @@ void     gsk_buffer_vprintf             (GskBuffer    *buffer,
     }
 }
 
-/* --- gsk_buffer_polystr_index_of implementation --- */
-/* Test to see if a sequence of buffer fragments
- * starts with a particular NUL-terminated string.
- */
-static gboolean
-fragment_n_str(GskBufferFragment   *frag,
-               guint                frag_index,
-               const char          *string)
-{
-  guint len = strlen (string);
-  for (;;)
-    {
-      guint test_len = frag->buf_length - frag_index;
-      if (test_len > len)
-        test_len = len;
-
-      if (memcmp (string,
-                  gsk_buffer_fragment_start (frag) + frag_index,
-                  test_len) != 0)
-        return FALSE;
-
-      len -= test_len;
-      string += test_len;
-
-      if (len <= 0)
-        return TRUE;
-      frag_index += test_len;
-      if (frag_index >= frag->buf_length)
-        {
-          frag = frag->next;
-          if (frag == NULL)
-            return FALSE;
-        }
-    }
-}
-
 /**
  * gsk_buffer_polystr_index_of:
  * @buffer: buffer to scan.
@@ -1115,9 +1788,10 @@ int
 gsk_buffer_polystr_index_of    (GskBuffer    *buffer,
                                 char        **strings)
 {
-  guint8 init_char_map[16];
+  guint8 init_char_map[32];
+  guint8 init_chars[256];
   int num_strings;
-  int num_bits = 0;
+  guint num_chars = 0;
   int total_index = 0;
   GskBufferFragment *frag;
   memset (init_char_map, 0, sizeof (init_char_map));
@@ -1129,56 +1803,30 @@ gsk_buffer_polystr_index_of    (GskBuffer    *buffer,
       if ((*rack & mask) == 0)
         {
           *rack |= mask;
-          num_bits++;
+          init_chars[num_chars++] = c;
         }
     }
-  if (num_bits == 0)
+  if (num_chars == 0)
     return 0;
   for (frag = buffer->first_frag; frag != NULL; frag = frag->next)
     {
-      const char *frag_start;
-      const char *at;
-      int remaining = frag->buf_length;
-      frag_start = gsk_buffer_fragment_start (frag);
-      at = frag_start;
-      while (at != NULL)
+      const guint8 *frag_start = (const guint8 *) gsk_buffer_fragment_start (frag);
+      const guint8 *frag_end = frag_start + frag->buf_length;
+      const guint8 *at = frag_start;
+      while (at < frag_end)
         {
-          const char *start = at;
-          if (num_bits == 1)
-            {
-              at = memchr (start, strings[0][0], remaining);
-              if (at == NULL)
-                remaining = 0;
-              else
-                remaining -= (at - start);
-            }
-          else
-            {
-              while (remaining > 0)
-                {
-                  guint8 i = (guint8) (*at);
-                  if (init_char_map[i / 8] & (1 << (i % 8)))
-                    break;
-                  remaining--;
-                  at++;
-                }
-              if (remaining == 0)
-                at = NULL;
-            }
-
+          char **test;
+          at = _gsk_buffer_scan_charset (at, frag_end - at, init_chars, num_chars);
           if (at == NULL)
             break;
 
           /* Now test each of the strings manually. */
-          {
-            char **test;
-            for (test = strings; *test != NULL; test++)
-              {
-                if (fragment_n_str(frag, at - frag_start, *test))
-                  return total_index + (at - frag_start);
-              }
-            at++;
-          }
+          for (test = strings; *test != NULL; test++)
+            {
+              if (fragment_n_str(frag, at - frag_start, *test))
+                return total_index + (at - frag_start);
+            }
+          at++;
         }
       total_index += frag->buf_length;
     }
@@ -1264,6 +1912,39 @@ gsk_buffer_iterator_peek      (GskBufferIterator *iterator,
   return max_length - out_remaining;
 }
 
+/**
+ * gsk_buffer_iterator_peek_contiguous:
+ * @iterator: to peek data from.
+ * @max_length: maximum number of bytes to look at.
+ * @length_out: where to store the number of bytes available,
+ * which is less than @max_length only at the end of the buffer.
+ * @scratch: memory to use if the bytes straddle fragments.
+ *    It must have room for @max_length bytes.
+ *
+ * Like gsk_buffer_iterator_peek(), but returns a pointer
+ * into the current fragment, instead of copying,
+ * if the data is all in that fragment.
+ * Otherwise the data is copied into @scratch, and @scratch is returned.
+ * The iterator's position is not changed.
+ *
+ * returns: the data.
+ */
+const guint8 *
+gsk_buffer_iterator_peek_contiguous (GskBufferIterator *iterator,
+                                     guint              max_length,
+                                     guint             *length_out,
+                                     gpointer           scratch)
+{
+  if (iterator->fragment != NULL
+   && iterator->cur_length - iterator->in_cur >= max_length)
+    {
+      *length_out = max_length;
+      return iterator->cur_data + iterator->in_cur;
+    }
+  *length_out = gsk_buffer_iterator_peek (iterator, scratch, max_length);
+  return scratch;
+}
+
 /**
  * gsk_buffer_iterator_read:
  * @iterator: to read data from.
@@ -1350,7 +2031,7 @@ gsk_buffer_iterator_find_char (GskBufferIterator *iterator,
   for (;;)
     {
       guint frag_remaining = frag_length - in_frag;
-      const guint8 * ptr = memchr (frag_data + in_frag, c, frag_remaining);
+      const guint8 * ptr = _gsk_buffer_scan_char (frag_data + in_frag, frag_remaining, c);
       if (ptr != NULL)
 	{
 	  iterator->offset = (ptr - frag_data) - in_frag + new_offset;
@@ -49,9 +49,12 @@ struct _GskBuffer
 
   GskBufferFragment    *first_frag;
   GskBufferFragment    *last_frag;
+
+  /* how much gsk_buffer_read_in_fd() should try to read */
+  guint                 read_size_hint;
 };
 
-#define GSK_BUFFER_STATIC_INIT		{ 0, NULL, NULL }
+#define GSK_BUFFER_STATIC_INIT		{ 0, NULL, NULL, 0 }
 
 
 void     gsk_buffer_construct           (GskBuffer       *buffer);
@@ -64,6 +67,17 @@ guint    gsk_buffer_peek                (const GskBuffer* buffer,
                                          guint         max_length);
 int      gsk_buffer_discard             (GskBuffer    *buffer,
                                          guint         max_discard);
+
+/* Get 'length' bytes at 'offset' without copying them if possible:
+ * the returned pointer is into the buffer's own memory if the range
+ * is in a single fragment; otherwise the range is copied into
+ * 'scratch', which must have room for 'length' bytes.
+ * Returns NULL if the buffer is too short. */
+const guint8 *gsk_buffer_peek_contiguous(const GskBuffer *buffer,
+                                         guint         offset,
+                                         guint         length,
+                                         gpointer      scratch);
+
 char    *gsk_buffer_read_line           (GskBuffer    *buffer);
 
 char    *gsk_buffer_parse_string0       (GskBuffer    *buffer);
@@ -103,6 +117,44 @@ void     gsk_buffer_append_foreign      (GskBuffer    *buffer,
 					 GDestroyNotify destroy,
 					 gpointer      destroy_data);
 
+/* Immutable, reference-counted data which may be
+ * appended to any number of buffers without copying. */
+typedef struct _GskBufferShared GskBufferShared;
+struct _GskBufferShared
+{
+  /*< read-only >*/
+  const char           *data;
+  guint                 length;
+
+  /*< private >*/
+  gint                  ref_count;
+  GDestroyNotify        destroy;
+  gpointer              destroy_data;
+};
+GskBufferShared *gsk_buffer_shared_new  (gconstpointer data,
+                                         guint         length);
+GskBufferShared *gsk_buffer_shared_new_foreign
+                                        (gconstpointer data,
+                                         guint         length,
+					 GDestroyNotify destroy,
+					 gpointer      destroy_data);
+GskBufferShared *gsk_buffer_shared_new_from_buffer
+                                        (GskBuffer    *buffer);
+GskBufferShared *gsk_buffer_shared_ref  (GskBufferShared *shared);
+void             gsk_buffer_shared_unref(GskBufferShared *shared);
+
+void     gsk_buffer_append_shared       (GskBuffer    *buffer,
+                                         GskBufferShared *shared,
+                                         guint         offset,
+                                         guint         length);
+
+/* Append a copy of part of src to dst, leaving src unchanged.
+ * Shared fragments are referenced rather than copied. */
+guint    gsk_buffer_clone_range         (GskBuffer    *dst,
+                                         const GskBuffer *src,
+                                         guint         offset,
+                                         guint         length);
+
 void     gsk_buffer_printf              (GskBuffer    *buffer,
 					 const char   *format,
 					 ...) G_GNUC_PRINTF(2,3);
@@ -147,6 +199,39 @@ void     gsk_buffer_destruct            (GskBuffer    *to_destroy);
 /* Free all unused buffer fragments. */
 void     gsk_buffer_cleanup_recycling_bin ();
 
+/* Statistics about fragment recycling. */
+#define GSK_BUFFER_N_FRAGMENT_SIZES	4
+guint    gsk_buffer_get_fragment_size   (guint         size_index);
+
+typedef struct _GskBufferRecyclingStats GskBufferRecyclingStats;
+struct _GskBufferRecyclingStats
+{
+  gpointer      thread;         /* the GThread, or NULL */
+  guint64       n_allocs;       /* fragments requested */
+  guint64       n_hits;         /* ... which were recycled, not malloced */
+  guint64       n_refills;      /* batches taken from the shared pool */
+  guint64       n_spills;       /* fragments given to the shared pool */
+  guint         n_cached;       /* free fragments being held */
+  gsize         cached_bytes;
+  guint         n_cached_by_size[GSK_BUFFER_N_FRAGMENT_SIZES];
+
+  /* bytes in fragments allocated minus those recycled;
+     for a single thread, this may be negative if it
+     frees fragments that other threads allocated. */
+  gint64        live_bytes;
+};
+#define GSK_BUFFER_RECYCLING_STATS_HIT_RATE(stats) \
+  ((stats)->n_allocs ? (double)(stats)->n_hits / (stats)->n_allocs : 0.0)
+
+typedef void (*GskBufferRecyclingStatsFunc) (const GskBufferRecyclingStats *stats,
+                                             gpointer                       data);
+void     gsk_buffer_recycling_stats_foreach (GskBufferRecyclingStatsFunc func,
+                                             gpointer                    data);
+void     gsk_buffer_get_recycling_stats     (GskBufferRecyclingStats    *stats_out);
+
+/* Memory allocated for the buffer which is not holding data. */
+gsize    gsk_buffer_get_wasted_bytes    (const GskBuffer *buffer);
+
 
 /* intended for use on the stack */
 typedef struct _GskBufferIterator GskBufferIterator;
@@ -165,6 +250,11 @@ void     gsk_buffer_iterator_construct (GskBufferIterator *iterator,
 guint    gsk_buffer_iterator_peek      (GskBufferIterator *iterator,
            			        gpointer           out,
            			        guint              max_length);
+const guint8 *gsk_buffer_iterator_peek_contiguous
+                                       (GskBufferIterator *iterator,
+                                        guint              max_length,
+                                        guint             *length_out,
+                                        gpointer           scratch);
 guint    gsk_buffer_iterator_read      (GskBufferIterator *iterator,
            			        gpointer           out,
            			        guint              max_length);
@@ -0,0 +1,315 @@
+/* Scanning kernels for GskBuffer.
+ *
+ * SSE2 is always available on x86-64, so it is the baseline there;
+ * the AVX2 kernels are compiled with a target attribute
+ * and only used if the CPU supports them.
+ * Other platforms use the scalar kernels.
+ *
+ * tests/time-buffer-scan compares the implementations.
+ */
+
+#include "config.h"
+#include <string.h>
+#include "gskbufferscan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+# define GSK_SCAN_SSE2 1
+# include <emmintrin.h>
+# if (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#  define GSK_SCAN_AVX2 1
+#  include <immintrin.h>
+# endif
+#endif
+
+/* Largest character-set handled with vector compares;
+ * larger sets use a bitmap, one byte at a time. */
+#define MAX_VECTOR_CHARSET	16
+
+/* --- scalar --- */
+/* The C library's memchr() is already vectorized on
+ * every platform we care about, and unrolled more aggressively
+ * than we would want to, so all implementations use it. */
+static const guint8 *
+scan_char_scalar (const guint8 *at,
+                  gsize         len,
+                  guint8        c)
+{
+  return memchr (at, c, len);
+}
+
+static const guint8 *
+scan_charset_scalar (const guint8 *at,
+                     gsize         len,
+                     const guint8 *set,
+                     guint         n_set)
+{
+  guint8 map[32];
+  guint i;
+  memset (map, 0, sizeof (map));
+  for (i = 0; i < n_set; i++)
+    map[set[i] / 8] |= 1 << (set[i] % 8);
+  while (len-- > 0)
+    {
+      if (map[*at / 8] & (1 << (*at % 8)))
+        return at;
+      at++;
+    }
+  return NULL;
+}
+
+static const guint8 *
+scan_substr_scalar (const guint8 *haystack,
+                    gsize         haystack_len,
+                    const guint8 *needle,
+                    gsize         needle_len)
+{
+  const guint8 *at = haystack;
+  const guint8 *last_start;
+  if (haystack_len < needle_len)
+    return NULL;
+  last_start = haystack + haystack_len - needle_len;
+  while (at <= last_start)
+    {
+      at = memchr (at, needle[0], last_start - at + 1);
+      if (at == NULL)
+        return NULL;
+      if (memcmp (at + 1, needle + 1, needle_len - 1) == 0)
+        return at;
+      at++;
+    }
+  return NULL;
+}
+
+/* --- SSE2 --- */
+#if GSK_SCAN_SSE2
+static const guint8 *
+scan_charset_sse2 (const guint8 *at,
+                   gsize         len,
+                   const guint8 *set,
+                   guint         n_set)
+{
+  __m128i needles[MAX_VECTOR_CHARSET];
+  guint i;
+  if (n_set == 0 || n_set > MAX_VECTOR_CHARSET)
+    return scan_charset_scalar (at, len, set, n_set);
+  for (i = 0; i < n_set; i++)
+    needles[i] = _mm_set1_epi8 ((char) set[i]);
+  while (len >= 16)
+    {
+      __m128i block = _mm_loadu_si128 ((const __m128i *) at);
+      __m128i hits = _mm_cmpeq_epi8 (block, needles[0]);
+      int mask;
+      for (i = 1; i < n_set; i++)
+        hits = _mm_or_si128 (hits, _mm_cmpeq_epi8 (block, needles[i]));
+      mask = _mm_movemask_epi8 (hits);
+      if (mask != 0)
+        return at + __builtin_ctz (mask);
+      at += 16;
+      len -= 16;
+    }
+  return scan_charset_scalar (at, len, set, n_set);
+}
+
+/* Compare the first and last bytes of the needle
+ * against 16 candidate positions at once;
+ * only positions where both match get a memcmp(). */
+static const guint8 *
+scan_substr_sse2 (const guint8 *haystack,
+                  gsize         haystack_len,
+                  const guint8 *needle,
+                  gsize         needle_len)
+{
+  const __m128i first = _mm_set1_epi8 ((char) needle[0]);
+  const __m128i last = _mm_set1_epi8 ((char) needle[needle_len - 1]);
+  gsize i = 0;
+  if (needle_len == 1)
+    return memchr (haystack, needle[0], haystack_len);
+  if (haystack_len < needle_len)
+    return NULL;
+  for (i = 0; i + needle_len - 1 + 16 <= haystack_len; i += 16)
+    {
+      __m128i block_first = _mm_loadu_si128 ((const __m128i *) (haystack + i));
+      __m128i block_last = _mm_loadu_si128 ((const __m128i *) (haystack + i + needle_len - 1));
+      unsigned mask = _mm_movemask_epi8 (_mm_and_si128 (_mm_cmpeq_epi8 (block_first, first),
+                                                        _mm_cmpeq_epi8 (block_last, last)));
+      while (mask != 0)
+        {
+          guint bit = __builtin_ctz (mask);
+          if (memcmp (haystack + i + bit + 1, needle + 1, needle_len - 2) == 0)
+            return haystack + i + bit;
+          mask &= mask - 1;
+        }
+    }
+  return scan_substr_scalar (haystack + i, haystack_len - i, needle, needle_len);
+}
+#endif
+
+/* --- AVX2 --- */
+#if GSK_SCAN_AVX2
+#define AVX2_FUNC __attribute__ ((target ("avx2")))
+
+static AVX2_FUNC const guint8 *
+scan_charset_avx2 (const guint8 *at,
+                   gsize         len,
+                   const guint8 *set,
+                   guint         n_set)
+{
+  __m256i needles[MAX_VECTOR_CHARSET];
+  guint i;
+  if (n_set == 0 || n_set > MAX_VECTOR_CHARSET)
+    return scan_charset_scalar (at, len, set, n_set);
+  for (i = 0; i < n_set; i++)
+    needles[i] = _mm256_set1_epi8 ((char) set[i]);
+  while (len >= 32)
+    {
+      __m256i block = _mm256_loadu_si256 ((const __m256i *) at);
+      __m256i hits = _mm256_cmpeq_epi8 (block, needles[0]);
+      guint32 mask;
+      for (i = 1; i < n_set; i++)
+        hits = _mm256_or_si256 (hits, _mm256_cmpeq_epi8 (block, needles[i]));
+      mask = _mm256_movemask_epi8 (hits);
+      if (mask != 0)
+        return at + __builtin_ctz (mask);
+      at += 32;
+      len -= 32;
+    }
+  return scan_charset_sse2 (at, len, set, n_set);
+}
+
+static AVX2_FUNC const guint8 *
+scan_substr_avx2 (const guint8 *haystack,
+                  gsize         haystack_len,
+                  const guint8 *needle,
+                  gsize         needle_len)
+{
+  const __m256i first = _mm256_set1_epi8 ((char) needle[0]);
+  const __m256i last = _mm256_set1_epi8 ((char) needle[needle_len - 1]);
+  gsize i = 0;
+  if (needle_len == 1)
+    return memchr (haystack, needle[0], haystack_len);
+  if (haystack_len < needle_len)
+    return NULL;
+  for (i = 0; i + needle_len - 1 + 32 <= haystack_len; i += 32)
+    {
+      __m256i block_first = _mm256_loadu_si256 ((const __m256i *) (haystack + i));
+      __m256i block_last = _mm256_loadu_si256 ((const __m256i *) (haystack + i + needle_len - 1));
+      guint32 mask = _mm256_movemask_epi8 (_mm256_and_si256 (_mm256_cmpeq_epi8 (block_first, first),
+                                                             _mm256_cmpeq_epi8 (block_last, last)));
+      while (mask != 0)
+        {
+          guint bit = __builtin_ctz (mask);
+          if (memcmp (haystack + i + bit + 1, needle + 1, needle_len - 2) == 0)
+            return haystack + i + bit;
+          mask &= mask - 1;
+        }
+    }
+  return scan_substr_sse2 (haystack + i, haystack_len - i, needle, needle_len);
+}
+#endif
+
+/* --- dispatch --- */
+typedef struct _ScanImpl ScanImpl;
+struct _ScanImpl
+{
+  const char *name;
+  const guint8 *(*scan_char)    (const guint8 *, gsize, guint8);
+  const guint8 *(*scan_charset) (const guint8 *, gsize, const guint8 *, guint);
+  const guint8 *(*scan_substr)  (const guint8 *, gsize, const guint8 *, gsize);
+};
+
+static const ScanImpl scan_impls[] =
+{
+  { "scalar", scan_char_scalar, scan_charset_scalar, scan_substr_scalar },
+#if GSK_SCAN_SSE2
+  { "sse2", scan_char_scalar, scan_charset_sse2, scan_substr_sse2 },
+#else
+  { "sse2", NULL, NULL, NULL },
+#endif
+#if GSK_SCAN_AVX2
+  { "avx2", scan_char_scalar, scan_charset_avx2, scan_substr_avx2 },
+#else
+  { "avx2", NULL, NULL, NULL },
+#endif
+};
+
+static const ScanImpl *scan_impl = NULL;
+
+static gboolean
+impl_is_supported (GskBufferScanImpl impl)
+{
+  if ((guint) impl >= G_N_ELEMENTS (scan_impls)
+   || scan_impls[impl].scan_char == NULL)
+    return FALSE;
+#if GSK_SCAN_AVX2
+  if (impl == GSK_BUFFER_SCAN_AVX2)
+    {
+      __builtin_cpu_init ();
+      return __builtin_cpu_supports ("avx2");
+    }
+#endif
+  return TRUE;
+}
+
+static inline const ScanImpl *
+get_scan_impl (void)
+{
+  if (G_UNLIKELY (scan_impl == NULL))
+    {
+      /* benign race:  all threads pick the same implementation */
+      if (impl_is_supported (GSK_BUFFER_SCAN_AVX2))
+        scan_impl = scan_impls + GSK_BUFFER_SCAN_AVX2;
+      else if (impl_is_supported (GSK_BUFFER_SCAN_SSE2))
+        scan_impl = scan_impls + GSK_BUFFER_SCAN_SSE2;
+      else
+        scan_impl = scan_impls + GSK_BUFFER_SCAN_SCALAR;
+    }
+  return scan_impl;
+}
+
+GskBufferScanImpl
+_gsk_buffer_scan_get_impl (void)
+{
+  return (GskBufferScanImpl) (get_scan_impl () - scan_impls);
+}
+
+const char *
+_gsk_buffer_scan_impl_name (GskBufferScanImpl impl)
+{
+  g_return_val_if_fail ((guint) impl < G_N_ELEMENTS (scan_impls), NULL);
+  return scan_impls[impl].name;
+}
+
+gboolean
+_gsk_buffer_scan_set_impl (GskBufferScanImpl impl)
+{
+  if (!impl_is_supported (impl))
+    return FALSE;
+  scan_impl = scan_impls + impl;
+  return TRUE;
+}
+
+const guint8 *
+_gsk_buffer_scan_char (const guint8 *at,
+                       gsize         len,
+                       guint8        c)
+{
+  return get_scan_impl ()->scan_char (at, len, c);
+}
+
+const guint8 *
+_gsk_buffer_scan_charset (const guint8 *at,
+                          gsize         len,
+                          const guint8 *set,
+                          guint         n_set)
+{
+  return get_scan_impl ()->scan_charset (at, len, set, n_set);
+}
+
+const guint8 *
+_gsk_buffer_scan_substr (const guint8 *haystack,
+                         gsize         haystack_len,
+                         const guint8 *needle,
+                         gsize         needle_len)
+{
+  return get_scan_impl ()->scan_substr (haystack, haystack_len, needle, needle_len);
+}
@@ -0,0 +1,50 @@
+/* Vectorized scanning kernels used by GskBuffer.
+ *
+ * This is a private header: these functions
+ * operate on a single contiguous region of memory;
+ * gskbuffer.c handles matches which straddle fragments.
+ */
+#ifndef __GSK_BUFFER_SCAN_H_
+#define __GSK_BUFFER_SCAN_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  GSK_BUFFER_SCAN_SCALAR,
+  GSK_BUFFER_SCAN_SSE2,
+  GSK_BUFFER_SCAN_AVX2
+} GskBufferScanImpl;
+
+/* The implementation in use, which is picked
+ * the first time a scan is done, based on the CPU. */
+GskBufferScanImpl _gsk_buffer_scan_get_impl (void);
+const char *      _gsk_buffer_scan_impl_name(GskBufferScanImpl impl);
+
+/* Force a particular implementation (for testing and benchmarking).
+ * Returns FALSE if it is not supported by this CPU or build. */
+gboolean          _gsk_buffer_scan_set_impl (GskBufferScanImpl impl);
+
+/* Find the first instance of 'c'; like memchr(). */
+const guint8 *    _gsk_buffer_scan_char     (const guint8 *at,
+                                             gsize         len,
+                                             guint8        c);
+
+/* Find the first instance of any of the 'n_set' bytes in 'set'. */
+const guint8 *    _gsk_buffer_scan_charset  (const guint8 *at,
+                                             gsize         len,
+                                             const guint8 *set,
+                                             guint         n_set);
+
+/* Find the first instance of 'needle' which is
+ * entirely contained in 'haystack'.  'needle_len' must be nonzero. */
+const guint8 *    _gsk_buffer_scan_substr   (const guint8 *haystack,
+                                             gsize         haystack_len,
+                                             const guint8 *needle,
+                                             gsize         needle_len);
+
+G_END_DECLS
+
+#endif
@@ -15,7 +15,9 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/uio.h>
 #include "gskmainloop.h"
+#include "gskinit.h"
 
 
 #define DEFAULT_TIME_FORMAT     "%Y-%m-%d %H:%M:%S"
@@ -102,35 +104,73 @@ piece_nmessage (guint n)
   return p;
 }
 
+typedef struct _DatetimePiece DatetimePiece;
+struct _DatetimePiece
+{
+  Piece base;
+  gboolean use_localtime;
+
+  /* the last second rendered:  see datetime_print() */
+  time_t cached_time;
+  char cached[512];
+
+  char fmt[1];		/* rest of string follows */
+};
+G_LOCK_DEFINE_STATIC (datetime_cache);
+
+static void
+datetime_render (DatetimePiece *dt,
+                 time_t         t,
+                 char          *buf,
+                 guint          buf_size)
+{
+  struct tm tm;
+  if (dt->use_localtime)
+    localtime_r (&t, &tm);
+  else
+    gmtime_r (&t, &tm);
+  if (strftime (buf, buf_size, dt->fmt, &tm) == 0)
+    buf[0] = '\0';
+}
+
 static void
 datetime_print (Piece *piece,
                  PrintInfo *info,
                  GString *out)
 {
+  DatetimePiece *dt = (DatetimePiece *) piece;
   char buf[512];
   time_t t;
-  struct tm tm;
-  gboolean *b = (gboolean *) (piece + 1);
-  const char *fmt = (char *) (b + 1);
   time (&t);
-  if (*b)
-    localtime_r (&t, &tm);
-  else
-    gmtime_r (&t, &tm);
-  strftime (buf, sizeof (buf), fmt, &tm);
+
+  /* localtime_r() and strftime() are much slower
+     than the rest of formatting a line, so reuse the rendering
+     while it is still the same second.  If another thread
+     has the cache, don't wait for it. */
+  if (G_TRYLOCK (datetime_cache))
+    {
+      if (dt->cached_time != t)
+        {
+          datetime_render (dt, t, dt->cached, sizeof (dt->cached));
+          dt->cached_time = t;
+        }
+      g_string_append (out, dt->cached);
+      G_UNLOCK (datetime_cache);
+      return;
+    }
+  datetime_render (dt, t, buf, sizeof (buf));
   g_string_append (out, buf);
 }
 
 static Piece *
 piece_datetime(gboolean use_localtime, const char *fmt)
 {
-  Piece *piece = g_malloc (sizeof (Piece) + sizeof (gboolean) + strlen (fmt) + 1);
-  gboolean *b = (gboolean *) (piece + 1);
-  char *piece_fmt = (char *) (b + 1);
-  *b = use_localtime;
-  strcpy (piece_fmt, fmt);
-  piece->print = datetime_print;
-  return piece;
+  DatetimePiece *dt = g_malloc (sizeof (DatetimePiece) + strlen (fmt));
+  dt->base.print = datetime_print;
+  dt->use_localtime = use_localtime;
+  dt->cached_time = (time_t) -1;
+  strcpy (dt->fmt, fmt);
+  return &dt->base;
 }
 
 static void
@@ -390,6 +430,363 @@ log_file_maybe_open (const char *filename, const char *mode)
   return fp;
 }
 
+/* --- asynchronous output to files --- */
+/* In async mode, a message trapped to a file is formatted
+   by the thread that logged it, then queued in a bounded ring
+   which a writer thread empties, writing as many messages
+   as it can with each writev().
+
+   The ring is a lock-free multi-producer queue:  each record's
+   sequence number says whether it is free for the producer
+   at position 'tail' (seq == tail), or filled and ready for
+   the writer at position 'head' (seq == head + 1).
+   The lock is only taken to go to sleep and to wake up. */
+#define ASYNC_MAX_BATCH		64
+
+typedef struct _AsyncRecord AsyncRecord;
+typedef struct _AsyncLog AsyncLog;
+
+struct _AsyncRecord
+{
+  volatile gint seq;
+  int fd;
+  guint len;
+  char *data;			/* ends with a newline */
+};
+
+struct _AsyncLog
+{
+  guint capacity;		/* a power of two */
+  AsyncRecord *records;
+  volatile gint tail;		/* next position to fill */
+  guint head;			/* next position to write (writer only) */
+  volatile gint n_written;	/* number of positions written */
+  GskLogOverflow overflow;
+
+  volatile gint n_dropped;
+  volatile gint n_unreported;	/* dropped, but not noted in a log yet */
+
+  GMutex *lock;
+  GCond *wake_writer;
+  GCond *written;
+  volatile gint writer_sleeping;
+  volatile gint n_waiting;	/* threads waiting for 'written' */
+  gboolean stopping;
+  GThread *writer;
+};
+
+static AsyncLog *async_log = NULL;
+
+static gboolean
+async_log_try_enqueue (AsyncLog   *log,
+                       int         fd,
+                       char       *data,
+                       guint       len)
+{
+  guint pos = g_atomic_int_get (&log->tail);
+  AsyncRecord *record;
+  for (;;)
+    {
+      gint dif;
+      record = log->records + (pos & (log->capacity - 1));
+      dif = (gint) ((guint) g_atomic_int_get (&record->seq) - pos);
+      if (dif == 0)
+        {
+          if (g_atomic_int_compare_and_exchange (&log->tail, pos, pos + 1))
+            break;
+        }
+      else if (dif < 0)
+        return FALSE;		/* full */
+      pos = g_atomic_int_get (&log->tail);
+    }
+  record->fd = fd;
+  record->len = len;
+  record->data = data;
+  g_atomic_int_inc (&record->seq);	/* ready for the writer */
+  return TRUE;
+}
+
+static inline gboolean
+async_log_has_record (AsyncLog *log)
+{
+  AsyncRecord *record = log->records + (log->head & (log->capacity - 1));
+  return (guint) g_atomic_int_get (&record->seq) == log->head + 1;
+}
+
+static void
+async_log_write (AsyncLog   *log,
+                 int         fd,
+                 const char *message)
+{
+  guint len = strlen (message);
+  char *data = g_malloc (len + 1);
+  memcpy (data, message, len);
+  data[len] = '\n';
+  if (!async_log_try_enqueue (log, fd, data, len + 1))
+    {
+      if (log->overflow != GSK_LOG_OVERFLOW_BLOCK)
+        {
+          g_atomic_int_inc (&log->n_dropped);
+          if (log->overflow == GSK_LOG_OVERFLOW_COUNT)
+            g_atomic_int_inc (&log->n_unreported);
+          g_free (data);
+          return;
+        }
+      g_mutex_lock (log->lock);
+      g_atomic_int_inc (&log->n_waiting);
+      while (!async_log_try_enqueue (log, fd, data, len + 1))
+        {
+          g_cond_signal (log->wake_writer);
+          g_cond_wait (log->written, log->lock);
+        }
+      g_atomic_int_add (&log->n_waiting, -1);
+      g_mutex_unlock (log->lock);
+    }
+
+  /* the writer sets writer_sleeping before looking for records,
+     so either it sees this record or we see that it sleeps */
+  if (g_atomic_int_get (&log->writer_sleeping))
+    {
+      g_mutex_lock (log->lock);
+      g_cond_signal (log->wake_writer);
+      g_mutex_unlock (log->lock);
+    }
+}
+
+static void
+writev_all (int           fd,
+            struct iovec *iov,
+            guint         n_iov)
+{
+  while (n_iov > 0)
+    {
+      gssize rv = writev (fd, iov, n_iov);
+      if (rv < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return;		/* there's nowhere to report it */
+        }
+      while (n_iov > 0 && (gsize) rv >= iov->iov_len)
+        {
+          rv -= iov->iov_len;
+          iov++;
+          n_iov--;
+        }
+      if (n_iov > 0)
+        {
+          iov->iov_base = (char *) iov->iov_base + rv;
+          iov->iov_len -= rv;
+        }
+    }
+}
+
+/* write each run of records for the same file with one writev() */
+static void
+async_log_write_batch (AsyncLog    *log,
+                       AsyncRecord *batch,
+                       guint        n)
+{
+  struct iovec iov[ASYNC_MAX_BATCH + 1];
+  char note[64];
+  guint i = 0;
+  while (i < n)
+    {
+      int fd = batch[i].fd;
+      guint n_iov = 0;
+      gint n_unreported = g_atomic_int_get (&log->n_unreported);
+      while (n_unreported > 0
+         && !g_atomic_int_compare_and_exchange (&log->n_unreported, n_unreported, 0))
+        n_unreported = g_atomic_int_get (&log->n_unreported);
+      if (n_unreported > 0)
+        {
+          g_snprintf (note, sizeof (note),
+                      "[%d log messages dropped]\n", n_unreported);
+          iov[n_iov].iov_base = note;
+          iov[n_iov].iov_len = strlen (note);
+          n_iov++;
+        }
+      for ( ; i < n && batch[i].fd == fd; i++)
+        {
+          iov[n_iov].iov_base = batch[i].data;
+          iov[n_iov].iov_len = batch[i].len;
+          n_iov++;
+        }
+      writev_all (fd, iov, n_iov);
+    }
+  for (i = 0; i < n; i++)
+    g_free (batch[i].data);
+}
+
+static gpointer
+async_log_writer_func (gpointer data)
+{
+  AsyncLog *log = data;
+  AsyncRecord batch[ASYNC_MAX_BATCH];
+  for (;;)
+    {
+      guint n = 0;
+      while (n < ASYNC_MAX_BATCH && async_log_has_record (log))
+        {
+          AsyncRecord *record = log->records + (log->head & (log->capacity - 1));
+          batch[n++] = *record;
+
+          /* free the record for the producer one lap ahead */
+          g_atomic_int_add (&record->seq, log->capacity - 1);
+          log->head++;
+        }
+      if (n == 0)
+        {
+          gboolean stop = FALSE;
+          g_mutex_lock (log->lock);
+          g_atomic_int_inc (&log->writer_sleeping);
+          if (!async_log_has_record (log))
+            {
+              if (log->stopping)
+                stop = TRUE;
+              else
+                g_cond_wait (log->wake_writer, log->lock);
+            }
+          g_atomic_int_add (&log->writer_sleeping, -1);
+          g_mutex_unlock (log->lock);
+          if (stop)
+            break;
+          continue;
+        }
+
+      async_log_write_batch (log, batch, n);
+      g_atomic_int_add (&log->n_written, n);
+      if (g_atomic_int_get (&log->n_waiting) > 0)
+        {
+          g_mutex_lock (log->lock);
+          g_cond_broadcast (log->written);
+          g_mutex_unlock (log->lock);
+        }
+    }
+  return NULL;
+}
+
+static void
+async_log_flush (AsyncLog *log)
+{
+  guint target = g_atomic_int_get (&log->tail);
+  g_mutex_lock (log->lock);
+  g_atomic_int_inc (&log->n_waiting);
+  while ((gint) (target - (guint) g_atomic_int_get (&log->n_written)) > 0)
+    {
+      g_cond_signal (log->wake_writer);
+      g_cond_wait (log->written, log->lock);
+    }
+  g_atomic_int_add (&log->n_waiting, -1);
+  g_mutex_unlock (log->lock);
+}
+
+static void
+flush_FILE (gpointer key, gpointer value, gpointer data)
+{
+  if (value != NULL)
+    fflush (value);
+}
+
+/**
+ * gsk_log_set_async:
+ * @max_records: the number of messages that may be waiting
+ * to be written, or 0 to go back to writing synchronously.
+ * @overflow: what to do with a message when @max_records
+ * messages are already waiting.
+ *
+ * Make the traps created by gsk_log_trap_domain_to_file()
+ * queue their messages for a background thread to write,
+ * so that a slow disk does not stall the thread that logs.
+ *
+ * The messages are still formatted by the thread that logs them.
+ * The writer thread writes them in batches, in the order
+ * they were logged.
+ *
+ * This should not be called while other threads may be logging.
+ * Turning async mode off (or changing @max_records) waits
+ * until all the queued messages are written.
+ *
+ * GSK must have been initialized with thread support.
+ */
+void
+gsk_log_set_async (guint          max_records,
+                   GskLogOverflow overflow)
+{
+  AsyncLog *log = async_log;
+  guint i;
+  if (log != NULL)
+    {
+      async_log = NULL;
+      async_log_flush (log);
+      g_mutex_lock (log->lock);
+      log->stopping = TRUE;
+      g_cond_signal (log->wake_writer);
+      g_mutex_unlock (log->lock);
+      g_thread_join (log->writer);
+      g_mutex_free (log->lock);
+      g_cond_free (log->wake_writer);
+      g_cond_free (log->written);
+      g_free (log->records);
+      g_free (log);
+    }
+  if (max_records == 0)
+    return;
+  g_return_if_fail (gsk_init_get_support_threads ());
+
+  /* the async writes bypass stdio */
+  if (filename_to_FILE != NULL)
+    g_hash_table_foreach (filename_to_FILE, flush_FILE, NULL);
+
+  log = g_new0 (AsyncLog, 1);
+  log->capacity = 1;
+  while (log->capacity < max_records)
+    log->capacity *= 2;
+  log->records = g_new (AsyncRecord, log->capacity);
+  for (i = 0; i < log->capacity; i++)
+    log->records[i].seq = i;
+  log->overflow = overflow;
+  log->lock = g_mutex_new ();
+  log->wake_writer = g_cond_new ();
+  log->written = g_cond_new ();
+  log->writer = g_thread_create (async_log_writer_func, log, TRUE, NULL);
+
+  /* publish the initialized log to the threads that log */
+  g_atomic_pointer_compare_and_exchange ((gpointer *) &async_log, NULL, log);
+}
+
+/**
+ * gsk_log_flush:
+ *
+ * Wait until every message logged so far
+ * has been written to its log file.
+ * This only has to wait in async mode: see gsk_log_set_async().
+ */
+void
+gsk_log_flush (void)
+{
+  AsyncLog *log = g_atomic_pointer_get ((gpointer *) &async_log);
+  if (log != NULL)
+    async_log_flush (log);
+}
+
+/**
+ * gsk_log_get_n_dropped:
+ *
+ * Get the number of messages that were not written
+ * because too many were waiting to be written,
+ * since async mode was last turned on.
+ * See gsk_log_set_async().
+ *
+ * returns: the number of messages dropped.
+ */
+guint
+gsk_log_get_n_dropped (void)
+{
+  AsyncLog *log = g_atomic_pointer_get ((gpointer *) &async_log);
+  return log ? (guint) g_atomic_int_get (&log->n_dropped) : 0;
+}
+
 /**
  * gsk_log_append:
  * @filename: log filename that should be opened in append-mode,
@@ -425,6 +822,12 @@ handle_fp (const char *domain,
            gpointer    data)
 {
   FILE *fp = data;
+  AsyncLog *log = g_atomic_pointer_get ((gpointer *) &async_log);
+  if (log != NULL)
+    {
+      async_log_write (log, fileno (fp), formatted_message);
+      return;
+    }
   fputs (formatted_message, fp);
   fputc ('\n', fp);
 }
@@ -666,15 +1069,20 @@ static gboolean output_use_localtime = FALSE;
 static guint output_rotation_period = 3600;
 
 
-static char *
-make_output_filename (guint time)
+/* Also used for rotating binary logs.
+   A rotation_period of 0 means that the file is never rotated. */
+char *
+_gsk_log_make_rotated_filename (const char *templ,
+                                gboolean    use_localtime,
+                                guint       rotation_period,
+                                guint       time)
 {
   char buf[4096];
   time_t t = time;
   struct tm tm;
-  const char *templ = the_output_file_template;
   GString *str = g_string_new ("");
-  t -= t % output_rotation_period;
+  if (rotation_period > 0)
+    t -= t % rotation_period;
 
   while (*templ)
     {
@@ -697,7 +1105,7 @@ make_output_filename (guint time)
       templ++;
     }
 
-  if (output_use_localtime)
+  if (use_localtime)
     localtime_r (&t, &tm);
   else
     gmtime_r (&t, &tm);
@@ -709,6 +1117,15 @@ make_output_filename (guint time)
   return g_strdup (buf);
 }
 
+static char *
+make_output_filename (guint time)
+{
+  return _gsk_log_make_rotated_filename (the_output_file_template,
+                                         output_use_localtime,
+                                         output_rotation_period,
+                                         time);
+}
+
 static void
 do_stdio_dups (guint time)
 {
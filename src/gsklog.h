@@ -74,6 +74,25 @@ GskLogTrap *gsk_log_trap_ignore       (const char    *domain,
    must be given before any other references to the logfile */
 void gsk_log_append (const char *filename);
 
+/* writing log files from a background thread */
+typedef enum
+{
+  GSK_LOG_OVERFLOW_BLOCK,	/* wait for the writer to catch up */
+  GSK_LOG_OVERFLOW_DROP,	/* drop the message */
+  GSK_LOG_OVERFLOW_COUNT	/* drop it, but note how many were dropped */
+} GskLogOverflow;
+
+void  gsk_log_set_async     (guint          max_records,
+                             GskLogOverflow overflow);
+void  gsk_log_flush         (void);
+guint gsk_log_get_n_dropped (void);
+
+/*< private >*/
+char *_gsk_log_make_rotated_filename (const char *output_file_template,
+                                      gboolean    use_localtime,
+                                      guint       rotation_period,
+                                      guint       time);
+
 #define GSK_LOG_DEFAULT_OUTPUT_FORMAT   \
         "%{localtime} %{Level}: [%{domain}]: %{200message}."
 
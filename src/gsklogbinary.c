@@ -0,0 +1,1040 @@
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "gsklogbinary.h"
+#include "gsklog.h"
+#include "gskerror.h"
+#include "gskerrno.h"
+
+/* The file format, in the byte order of the machine that wrote it:
+     a header:
+       "GSKBLOG\0"
+       guint32 byte-order mark (0x01020304)
+       guint32 version (1)
+       guint64 wall-clock time when opened, in microseconds since the epoch
+       guint64 monotonic time when opened, in microseconds
+     then records, each of which starts with a one-byte type:
+       RECORD_FORMAT:  guint32 id, guint32 length, the format string
+       RECORD_DOMAIN:  guint32 id, guint32 length, the domain
+       RECORD_MESSAGE: guint32 format-id, guint32 domain-id (0 for none),
+                       guint32 level, guint64 monotonic time,
+                       guint32 length, the arguments
+
+   A format or domain is defined in each file before the first message
+   that uses it.  A file which was appended to after a restart
+   has another header, and everything is defined again after it.
+
+   The arguments follow one another:  integers that are promoted to int
+   take 4 bytes; other integers and pointers take 8 bytes; floating-point
+   numbers are 8-byte doubles; strings are a guint32 length
+   (0xffffffff for NULL) followed by the string. */
+
+#define MAGIC			"GSKBLOG"	/* and its NUL */
+#define MAGIC_SIZE		8
+#define BYTE_ORDER_MARK		0x01020304
+#define FORMAT_VERSION		1
+#define NULL_STRING_LENGTH	0xffffffff
+
+typedef enum
+{
+  RECORD_FORMAT = 1,
+  RECORD_DOMAIN = 2,
+  RECORD_MESSAGE = 3
+} RecordType;
+
+typedef enum
+{
+  ARG_INT,
+  ARG_LONG,
+  ARG_UNSIGNED_LONG,		/* zero-extended, unlike ARG_LONG */
+  ARG_LONG_LONG,
+  ARG_SIZE,
+  ARG_SIGNED_SIZE,
+  ARG_DOUBLE,
+  ARG_LONG_DOUBLE,
+  ARG_STRING,
+  ARG_POINTER
+} ArgType;
+
+/* --- parsing printf formats --- */
+typedef struct _Conversion Conversion;
+struct _Conversion
+{
+  guint n_stars;		/* '*' width and precision, as ints */
+  gboolean has_arg;		/* FALSE for "%%" */
+  ArgType type;
+
+  /* offsets of the length modifier from the '%' */
+  guint length_start, length_end;
+};
+
+/* Parse the conversion that starts at 'at' (which is a '%').
+   Returns the end of the conversion, or NULL if it is one
+   we don't handle:  positional arguments, %n, %m, wide strings. */
+static const char *
+parse_conversion (const char *at,
+                  Conversion *conv)
+{
+  const char *start = at++;
+  char length = 0;
+
+  conv->n_stars = 0;
+  conv->has_arg = TRUE;
+  if (*at == '%')
+    {
+      conv->has_arg = FALSE;
+      conv->length_start = conv->length_end = 1;
+      return at + 1;
+    }
+  while (*at != '\0' && strchr ("#0- +'", *at) != NULL)
+    at++;
+  if (*at == '*')
+    {
+      conv->n_stars++;
+      at++;
+    }
+  else
+    while (g_ascii_isdigit (*at))
+      at++;
+  if (*at == '.')
+    {
+      at++;
+      if (*at == '*')
+        {
+          conv->n_stars++;
+          at++;
+        }
+      else
+        while (g_ascii_isdigit (*at))
+          at++;
+    }
+
+  conv->length_start = at - start;
+  switch (*at)
+    {
+    case 'h':
+      length = 'h';
+      at++;
+      if (*at == 'h')
+        at++;
+      break;
+    case 'l':
+      length = 'l';
+      at++;
+      if (*at == 'l')
+        {
+          length = 'q';
+          at++;
+        }
+      break;
+    case 'q': case 'j': case 'L':
+      length = *at == 'L' ? 'L' : 'q';
+      at++;
+      break;
+    case 'z': case 'Z': case 't':
+      length = 'z';
+      at++;
+      break;
+    }
+  conv->length_end = at - start;
+
+  switch (*at)
+    {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+      {
+        gboolean is_signed = (*at == 'd' || *at == 'i');
+        if (length == 'l')
+          conv->type = is_signed ? ARG_LONG : ARG_UNSIGNED_LONG;
+        else if (length == 'q' || length == 'L')
+          conv->type = ARG_LONG_LONG;
+        else if (length == 'z')
+          conv->type = is_signed ? ARG_SIGNED_SIZE : ARG_SIZE;
+        else
+          conv->type = ARG_INT;
+      }
+      break;
+    case 'c':
+      if (length != 0)
+        return NULL;
+      conv->type = ARG_INT;
+      break;
+    case 'e': case 'E': case 'f': case 'F':
+    case 'g': case 'G': case 'a': case 'A':
+      conv->type = length == 'L' ? ARG_LONG_DOUBLE : ARG_DOUBLE;
+      break;
+    case 's':
+      if (length != 0)
+        return NULL;
+      conv->type = ARG_STRING;
+      break;
+    case 'p':
+      conv->type = ARG_POINTER;
+      break;
+    default:
+      return NULL;
+    }
+  return at + 1;
+}
+
+/* --- writing --- */
+typedef struct _FormatInfo FormatInfo;
+typedef struct _DomainInfo DomainInfo;
+
+struct _FormatInfo
+{
+  guint id;
+  guint file_serial;		/* the file it was last defined in */
+  gboolean preformat;		/* too hard to defer: see parse_conversion() */
+  guint n_args;
+  guint8 *arg_types;		/* '*'s are ARG_INTs */
+};
+
+struct _DomainInfo
+{
+  guint id;
+  guint file_serial;
+};
+
+/* used for messages whose format we can't handle */
+static const char preformatted_format[] = "%s";
+
+G_LOCK_DEFINE_STATIC (binary_log);
+static char *log_template = NULL;
+static gboolean log_use_localtime;
+static guint log_rotation_period;
+static guint log_period_start;
+static FILE *log_fp = NULL;
+static guint log_file_serial = 0;
+static GHashTable *format_infos = NULL;		/* by address */
+static GHashTable *domain_infos = NULL;		/* by address */
+static guint next_format_id = 1;
+static guint next_domain_id = 1;
+static GByteArray *scratch = NULL;
+
+static guint64
+wall_usecs (void)
+{
+  GTimeVal tv;
+  g_get_current_time (&tv);
+  return (guint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static guint64
+monotonic_usecs (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return (guint64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+  return wall_usecs ();
+}
+
+static FormatInfo *
+format_info_new (const char *format)
+{
+  FormatInfo *info = g_new0 (FormatInfo, 1);
+  GByteArray *types = g_byte_array_new ();
+  const char *at = format;
+  info->id = next_format_id++;
+  while ((at = strchr (at, '%')) != NULL)
+    {
+      Conversion conv;
+      guint i;
+      at = parse_conversion (at, &conv);
+      if (at == NULL)
+        {
+          info->preformat = TRUE;
+          break;
+        }
+      if (!conv.has_arg)
+        continue;
+      for (i = 0; i < conv.n_stars; i++)
+        {
+          guint8 type = ARG_INT;
+          g_byte_array_append (types, &type, 1);
+        }
+      {
+        guint8 type = conv.type;
+        g_byte_array_append (types, &type, 1);
+      }
+    }
+  info->n_args = types->len;
+  info->arg_types = g_byte_array_free (types, FALSE);
+  return info;
+}
+
+static inline void
+append_u32 (GByteArray *out, guint32 v)
+{
+  g_byte_array_append (out, (guint8 *) &v, 4);
+}
+
+static inline void
+append_u64 (GByteArray *out, guint64 v)
+{
+  g_byte_array_append (out, (guint8 *) &v, 8);
+}
+
+static void
+append_string (GByteArray *out, const char *str)
+{
+  if (str == NULL)
+    append_u32 (out, NULL_STRING_LENGTH);
+  else
+    {
+      guint len = strlen (str);
+      append_u32 (out, len);
+      g_byte_array_append (out, (const guint8 *) str, len);
+    }
+}
+
+static void
+append_definition (GByteArray *out,
+                   RecordType  type,
+                   guint       id,
+                   const char *str)
+{
+  guint8 type_byte = type;
+  g_byte_array_append (out, &type_byte, 1);
+  append_u32 (out, id);
+  append_string (out, str);
+}
+
+static gboolean
+open_log_file (guint    now,
+               GError **error)
+{
+  char *filename = _gsk_log_make_rotated_filename (log_template,
+                                                   log_use_localtime,
+                                                   log_rotation_period,
+                                                   now);
+  GByteArray *header;
+  FILE *fp = fopen (filename, "ab");
+  if (fp == NULL)
+    {
+      int e = errno;
+      g_set_error (error, GSK_G_ERROR_DOMAIN,
+                   gsk_error_code_from_errno (e),
+                   "error opening binary log %s: %s",
+                   filename, g_strerror (e));
+      g_free (filename);
+      return FALSE;
+    }
+  g_free (filename);
+
+  header = g_byte_array_new ();
+  g_byte_array_append (header, (const guint8 *) MAGIC, MAGIC_SIZE);
+  append_u32 (header, BYTE_ORDER_MARK);
+  append_u32 (header, FORMAT_VERSION);
+  append_u64 (header, wall_usecs ());
+  append_u64 (header, monotonic_usecs ());
+  fwrite (header->data, header->len, 1, fp);
+  g_byte_array_free (header, TRUE);
+
+  log_fp = fp;
+  log_file_serial++;
+  if (log_rotation_period > 0)
+    log_period_start = now - now % log_rotation_period;
+  return TRUE;
+}
+
+/**
+ * gsk_log_binary_open:
+ * @output_file_template: the filename to log to,
+ * which may contain any format specifier as known by strftime,
+ * as well as "%s" for the start of the rotation period in seconds
+ * since the epoch.
+ * @use_localtime: whether to use the local timezone
+ * (rather than GMT) to make the filename.
+ * @rotation_period: the number of seconds after which
+ * to start a new file, or 0 to keep using the same file.
+ * @error: where to put an error if the file cannot be opened.
+ *
+ * Start recording the messages passed to gsk_log_binary().
+ * The file is appended to if it already exists.
+ *
+ * Use gsk-log-render to read the log.
+ *
+ * returns: whether the log was opened.
+ */
+gboolean
+gsk_log_binary_open (const char    *output_file_template,
+                     gboolean       use_localtime,
+                     guint          rotation_period,
+                     GError       **error)
+{
+  gboolean rv;
+  G_LOCK (binary_log);
+  if (log_template != NULL)
+    {
+      G_UNLOCK (binary_log);
+      g_return_val_if_reached (FALSE);
+    }
+  if (format_infos == NULL)
+    {
+      format_infos = g_hash_table_new (NULL, NULL);
+      domain_infos = g_hash_table_new (NULL, NULL);
+      scratch = g_byte_array_new ();
+    }
+  log_template = g_strdup (output_file_template);
+  log_use_localtime = use_localtime;
+  log_rotation_period = rotation_period;
+  rv = open_log_file (time (NULL), error);
+  if (!rv)
+    {
+      g_free (log_template);
+      log_template = NULL;
+    }
+  G_UNLOCK (binary_log);
+  return rv;
+}
+
+/**
+ * gsk_log_binary_flush:
+ *
+ * Write any buffered messages to the binary log.
+ */
+void
+gsk_log_binary_flush (void)
+{
+  G_LOCK (binary_log);
+  if (log_fp != NULL)
+    fflush (log_fp);
+  G_UNLOCK (binary_log);
+}
+
+/**
+ * gsk_log_binary_close:
+ *
+ * Flush and close the binary log.
+ * Messages passed to gsk_log_binary() are ignored
+ * until the log is opened again.
+ */
+void
+gsk_log_binary_close (void)
+{
+  G_LOCK (binary_log);
+  if (log_fp != NULL)
+    {
+      fclose (log_fp);
+      log_fp = NULL;
+    }
+  g_free (log_template);
+  log_template = NULL;
+  G_UNLOCK (binary_log);
+}
+
+/**
+ * gsk_log_binary:
+ * @domain: the log domain, a string constant.
+ * @level: the severity of the message.
+ * @format: a printf-style format, which must be a string constant.
+ * @...: the arguments for @format.
+ *
+ * Record a message in the binary log,
+ * without formatting it.  Strings passed as arguments are copied;
+ * the format and domain are written to the log the first time
+ * they are used, and identified by their address after that.
+ *
+ * Formats which use positional arguments, %n, %m
+ * or wide strings are formatted now instead.
+ *
+ * This is separate from g_log() and the gsk_log traps:
+ * only messages passed to this function are recorded.
+ *
+ * If the binary log isn't open, this does nothing.
+ */
+void
+gsk_log_binary (const char    *domain,
+                GLogLevelFlags level,
+                const char    *format,
+                ...)
+{
+  va_list args;
+  va_start (args, format);
+  gsk_log_binary_valist (domain, level, format, args);
+  va_end (args);
+}
+
+/**
+ * gsk_log_binary_valist:
+ * @domain: the log domain, a string constant.
+ * @level: the severity of the message.
+ * @format: a printf-style format, which must be a string constant.
+ * @args: the arguments for @format.
+ *
+ * Record a message in the binary log:
+ * see gsk_log_binary().
+ */
+void
+gsk_log_binary_valist (const char    *domain,
+                       GLogLevelFlags level,
+                       const char    *format,
+                       va_list        args)
+{
+  FormatInfo *format_info;
+  DomainInfo *domain_info = NULL;
+  char *preformatted = NULL;
+  guint args_len_offset;
+  guint32 args_len;
+  guint8 type_byte = RECORD_MESSAGE;
+  guint i;
+
+  G_LOCK (binary_log);
+  if (log_template == NULL)
+    goto done;
+  if (log_rotation_period > 0 || log_fp == NULL)
+    {
+      guint now = time (NULL);
+      if (log_fp != NULL
+       && now - now % log_rotation_period != log_period_start)
+        {
+          fclose (log_fp);
+          log_fp = NULL;
+        }
+      if (log_fp == NULL && !open_log_file (now, NULL))
+        goto done;
+    }
+
+  format_info = g_hash_table_lookup (format_infos, format);
+  if (format_info == NULL)
+    {
+      format_info = format_info_new (format);
+      g_hash_table_insert (format_infos, (gpointer) format, format_info);
+    }
+  if (format_info->preformat)
+    {
+      preformatted = g_strdup_vprintf (format, args);
+      format = preformatted_format;
+      format_info = g_hash_table_lookup (format_infos, format);
+      if (format_info == NULL)
+        {
+          format_info = format_info_new (format);
+          g_hash_table_insert (format_infos, (gpointer) format, format_info);
+        }
+    }
+
+  g_byte_array_set_size (scratch, 0);
+  if (format_info->file_serial != log_file_serial)
+    {
+      append_definition (scratch, RECORD_FORMAT, format_info->id, format);
+      format_info->file_serial = log_file_serial;
+    }
+  if (domain != NULL)
+    {
+      domain_info = g_hash_table_lookup (domain_infos, domain);
+      if (domain_info == NULL)
+        {
+          domain_info = g_new0 (DomainInfo, 1);
+          domain_info->id = next_domain_id++;
+          g_hash_table_insert (domain_infos, (gpointer) domain, domain_info);
+        }
+      if (domain_info->file_serial != log_file_serial)
+        {
+          append_definition (scratch, RECORD_DOMAIN, domain_info->id, domain);
+          domain_info->file_serial = log_file_serial;
+        }
+    }
+
+  g_byte_array_append (scratch, &type_byte, 1);
+  append_u32 (scratch, format_info->id);
+  append_u32 (scratch, domain_info ? domain_info->id : 0);
+  append_u32 (scratch, level);
+  append_u64 (scratch, monotonic_usecs ());
+  args_len_offset = scratch->len;
+  append_u32 (scratch, 0);
+
+  if (preformatted != NULL)
+    append_string (scratch, preformatted);
+  else
+    for (i = 0; i < format_info->n_args; i++)
+      switch (format_info->arg_types[i])
+        {
+        case ARG_INT:
+          append_u32 (scratch, va_arg (args, int));
+          break;
+        case ARG_LONG:
+          append_u64 (scratch, va_arg (args, long));
+          break;
+        case ARG_UNSIGNED_LONG:
+          append_u64 (scratch, va_arg (args, unsigned long));
+          break;
+        case ARG_LONG_LONG:
+          append_u64 (scratch, va_arg (args, gint64));
+          break;
+        case ARG_SIZE:
+          append_u64 (scratch, va_arg (args, gsize));
+          break;
+        case ARG_SIGNED_SIZE:
+          append_u64 (scratch, va_arg (args, gssize));
+          break;
+        case ARG_DOUBLE:
+          {
+            double d = va_arg (args, double);
+            g_byte_array_append (scratch, (guint8 *) &d, 8);
+          }
+          break;
+        case ARG_LONG_DOUBLE:
+          {
+            double d = va_arg (args, long double);
+            g_byte_array_append (scratch, (guint8 *) &d, 8);
+          }
+          break;
+        case ARG_STRING:
+          append_string (scratch, va_arg (args, const char *));
+          break;
+        case ARG_POINTER:
+          append_u64 (scratch, (gsize) va_arg (args, gpointer));
+          break;
+        }
+  args_len = scratch->len - args_len_offset - 4;
+  memcpy (scratch->data + args_len_offset, &args_len, 4);
+
+  fwrite (scratch->data, scratch->len, 1, log_fp);
+
+done:
+  G_UNLOCK (binary_log);
+  g_free (preformatted);
+}
+
+/* --- reading --- */
+struct _GskLogBinaryReader
+{
+  FILE *fp;
+  char *filename;
+  guint64 wall_base;
+  guint64 monotonic_base;
+  GHashTable *formats;		/* id to string */
+  GHashTable *domains;		/* id to string */
+  guint64 file_size;		/* as of the last check_length() */
+  GByteArray *args;
+  GString *message;
+};
+
+static gboolean
+read_or_fail (GskLogBinaryReader *reader,
+              gpointer            data,
+              guint               len,
+              GError            **error)
+{
+  if (fread (data, len, 1, reader->fp) != 1)
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_PARSE,
+                   "%s: truncated binary log", reader->filename);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* A length read from the log must fit in the rest of the file;
+   the file size is checked again in case the log has grown. */
+static gboolean
+check_length (GskLogBinaryReader *reader,
+              guint32             len,
+              GError            **error)
+{
+  long offset = ftell (reader->fp);
+  struct stat stat_buf;
+  if (offset < 0)
+    offset = 0;
+  if ((guint64) offset + len <= reader->file_size)
+    return TRUE;
+  if (fstat (fileno (reader->fp), &stat_buf) == 0)
+    {
+      reader->file_size = stat_buf.st_size;
+      if ((guint64) offset + len <= reader->file_size)
+        return TRUE;
+    }
+  g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_PARSE,
+               "%s: length %u at offset %ld is past the end of the binary log",
+               reader->filename, len, offset);
+  return FALSE;
+}
+
+static gboolean
+remove_all (gpointer key, gpointer value, gpointer data)
+{
+  return TRUE;
+}
+
+/* the header, after the magic */
+static gboolean
+read_header (GskLogBinaryReader *reader,
+             GError            **error)
+{
+  guint32 mark, version;
+  if (!read_or_fail (reader, &mark, 4, error)
+   || !read_or_fail (reader, &version, 4, error))
+    return FALSE;
+  if (mark != BYTE_ORDER_MARK || version != FORMAT_VERSION)
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_VERSION,
+                   "%s: binary log from an incompatible machine or version",
+                   reader->filename);
+      return FALSE;
+    }
+  if (!read_or_fail (reader, &reader->wall_base, 8, error)
+   || !read_or_fail (reader, &reader->monotonic_base, 8, error))
+    return FALSE;
+  g_hash_table_foreach_remove (reader->formats, remove_all, NULL);
+  g_hash_table_foreach_remove (reader->domains, remove_all, NULL);
+  return TRUE;
+}
+
+static char *
+read_string (GskLogBinaryReader *reader,
+             GError            **error)
+{
+  guint32 len;
+  char *rv;
+  if (!read_or_fail (reader, &len, 4, error))
+    return NULL;
+  if (len == NULL_STRING_LENGTH)
+    return g_strdup ("(null)");
+  if (!check_length (reader, len, error))
+    return NULL;
+  rv = g_malloc (len + 1);
+  if (!read_or_fail (reader, rv, len, error))
+    {
+      g_free (rv);
+      return NULL;
+    }
+  rv[len] = '\0';
+  return rv;
+}
+
+/**
+ * gsk_log_binary_reader_open:
+ * @filename: the binary log to read.
+ * @error: where to put an error if the file cannot be opened,
+ * or isn't a binary log.
+ *
+ * Open a log written with gsk_log_binary(),
+ * to read its messages with gsk_log_binary_reader_next().
+ *
+ * returns: the new reader, or NULL on error.
+ */
+GskLogBinaryReader *
+gsk_log_binary_reader_open  (const char          *filename,
+                             GError             **error)
+{
+  GskLogBinaryReader *reader;
+  char magic[MAGIC_SIZE];
+  FILE *fp = fopen (filename, "rb");
+  if (fp == NULL)
+    {
+      int e = errno;
+      g_set_error (error, GSK_G_ERROR_DOMAIN,
+                   gsk_error_code_from_errno (e),
+                   "error opening %s: %s", filename, g_strerror (e));
+      return NULL;
+    }
+  reader = g_new (GskLogBinaryReader, 1);
+  reader->fp = fp;
+  reader->filename = g_strdup (filename);
+  reader->formats = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  reader->domains = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  reader->file_size = 0;
+  reader->args = g_byte_array_new ();
+  reader->message = g_string_new ("");
+  if (fread (magic, MAGIC_SIZE, 1, fp) != 1
+   || memcmp (magic, MAGIC, MAGIC_SIZE) != 0)
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_PARSE,
+                   "%s is not a binary log", filename);
+      gsk_log_binary_reader_close (reader);
+      return NULL;
+    }
+  if (!read_header (reader, error))
+    {
+      gsk_log_binary_reader_close (reader);
+      return NULL;
+    }
+  return reader;
+}
+
+typedef struct _ArgReader ArgReader;
+struct _ArgReader
+{
+  const guint8 *at;
+  const guint8 *end;
+};
+
+static gboolean
+arg_read (ArgReader *ar, gpointer out, guint len)
+{
+  if (ar->at + len > ar->end)
+    return FALSE;
+  memcpy (out, ar->at, len);
+  ar->at += len;
+  return TRUE;
+}
+
+/* the conversion at 'conv_start', with its length modifier
+   changed to suit the way the argument was stored */
+static gboolean
+make_spec (const char       *conv_start,
+           const char       *conv_end,
+           const Conversion *conv,
+           char             *spec,
+           guint             spec_size)
+{
+  const char *length = "";
+  guint len;
+  if ((guint) (conv_end - conv_start) + 8 > spec_size)
+    return FALSE;
+  switch (conv->type)
+    {
+    case ARG_INT:
+      length = NULL;		/* keep 'h' or 'hh' */
+      break;
+    case ARG_LONG:
+    case ARG_UNSIGNED_LONG:
+    case ARG_LONG_LONG:
+    case ARG_SIZE:
+    case ARG_SIGNED_SIZE:
+      length = G_GINT64_MODIFIER;
+      break;
+    default:
+      break;			/* drop 'L':  doubles are stored */
+    }
+  if (length == NULL)
+    {
+      len = conv_end - conv_start;
+      memcpy (spec, conv_start, len);
+      spec[len] = '\0';
+      return TRUE;
+    }
+  memcpy (spec, conv_start, conv->length_start);
+  len = conv->length_start;
+  strcpy (spec + len, length);
+  len += strlen (length);
+  spec[len++] = conv_end[-1];
+  spec[len] = '\0';
+  return TRUE;
+}
+
+#define APPEND_ARG(out, spec, stars, conv, value)                           \
+  G_STMT_START{                                                             \
+    if ((conv).n_stars == 0)                                                \
+      g_string_append_printf (out, spec, value);                            \
+    else if ((conv).n_stars == 1)                                           \
+      g_string_append_printf (out, spec, stars[0], value);                  \
+    else                                                                    \
+      g_string_append_printf (out, spec, stars[0], stars[1], value);        \
+  }G_STMT_END
+
+static gboolean
+render_message (const char   *format,
+                const guint8 *args,
+                guint         args_len,
+                GString      *out)
+{
+  ArgReader ar = { args, args + args_len };
+  const char *at = format;
+  g_string_set_size (out, 0);
+  for (;;)
+    {
+      const char *pct = strchr (at, '%');
+      const char *end;
+      Conversion conv;
+      char spec[64];
+      gint32 stars[2];
+      guint i;
+      if (pct == NULL)
+        {
+          g_string_append (out, at);
+          return TRUE;
+        }
+      g_string_append_len (out, at, pct - at);
+      end = parse_conversion (pct, &conv);
+      if (end == NULL)
+        return FALSE;
+      at = end;
+      if (!conv.has_arg)
+        {
+          g_string_append_c (out, '%');
+          continue;
+        }
+      for (i = 0; i < conv.n_stars; i++)
+        if (!arg_read (&ar, stars + i, 4))
+          return FALSE;
+      if (!make_spec (pct, end, &conv, spec, sizeof (spec)))
+        return FALSE;
+      switch (conv.type)
+        {
+        case ARG_INT:
+          {
+            gint32 v;
+            if (!arg_read (&ar, &v, 4))
+              return FALSE;
+            APPEND_ARG (out, spec, stars, conv, (int) v);
+          }
+          break;
+        case ARG_LONG:
+        case ARG_UNSIGNED_LONG:
+        case ARG_LONG_LONG:
+        case ARG_SIZE:
+        case ARG_SIGNED_SIZE:
+          {
+            gint64 v;
+            if (!arg_read (&ar, &v, 8))
+              return FALSE;
+            APPEND_ARG (out, spec, stars, conv, v);
+          }
+          break;
+        case ARG_DOUBLE:
+        case ARG_LONG_DOUBLE:
+          {
+            double v;
+            if (!arg_read (&ar, &v, 8))
+              return FALSE;
+            APPEND_ARG (out, spec, stars, conv, v);
+          }
+          break;
+        case ARG_STRING:
+          {
+            guint32 len;
+            char *str;
+            if (!arg_read (&ar, &len, 4))
+              return FALSE;
+            if (len == NULL_STRING_LENGTH)
+              str = g_strdup ("(null)");
+            else if (ar.at + len > ar.end)
+              return FALSE;
+            else
+              {
+                str = g_strndup ((const char *) ar.at, len);
+                ar.at += len;
+              }
+            APPEND_ARG (out, spec, stars, conv, str);
+            g_free (str);
+          }
+          break;
+        case ARG_POINTER:
+          {
+            guint64 v;
+            if (!arg_read (&ar, &v, 8))
+              return FALSE;
+            APPEND_ARG (out, spec, stars, conv, (gpointer) (gsize) v);
+          }
+          break;
+        }
+    }
+}
+
+/**
+ * gsk_log_binary_reader_next:
+ * @reader: the binary log to read.
+ * @message: the next message is put here.
+ * Its strings are valid until @reader is used again.
+ * @error: where to put an error if the log is damaged.
+ *
+ * Read and format the next message from the log.
+ *
+ * returns: TRUE if a message was read, FALSE at the end of the log
+ * (in which case @error is not set) or on error.
+ */
+gboolean
+gsk_log_binary_reader_next  (GskLogBinaryReader  *reader,
+                             GskLogBinaryMessage *message,
+                             GError             **error)
+{
+  for (;;)
+    {
+      int c = fgetc (reader->fp);
+      guint32 id, level, args_len;
+      guint64 timestamp;
+      const char *format;
+      char *str;
+      if (c == EOF)
+        return FALSE;
+      switch (c)
+        {
+        case 'G':		/* another header */
+          {
+            char magic[MAGIC_SIZE];
+            magic[0] = c;
+            if (!read_or_fail (reader, magic + 1, MAGIC_SIZE - 1, error))
+              return FALSE;
+            if (memcmp (magic, MAGIC, MAGIC_SIZE) != 0)
+              goto bad_record;
+            if (!read_header (reader, error))
+              return FALSE;
+          }
+          break;
+
+        case RECORD_FORMAT:
+        case RECORD_DOMAIN:
+          if (!read_or_fail (reader, &id, 4, error)
+           || (str = read_string (reader, error)) == NULL)
+            return FALSE;
+          g_hash_table_insert (c == RECORD_FORMAT ? reader->formats : reader->domains,
+                               GUINT_TO_POINTER (id), str);
+          break;
+
+        case RECORD_MESSAGE:
+          if (!read_or_fail (reader, &id, 4, error))
+            return FALSE;
+          format = g_hash_table_lookup (reader->formats, GUINT_TO_POINTER (id));
+          if (format == NULL)
+            goto bad_record;
+          if (!read_or_fail (reader, &id, 4, error))
+            return FALSE;
+          message->domain = NULL;
+          if (id != 0)
+            {
+              message->domain = g_hash_table_lookup (reader->domains, GUINT_TO_POINTER (id));
+              if (message->domain == NULL)
+                goto bad_record;
+            }
+          if (!read_or_fail (reader, &level, 4, error)
+           || !read_or_fail (reader, &timestamp, 8, error)
+           || !read_or_fail (reader, &args_len, 4, error)
+           || !check_length (reader, args_len, error))
+            return FALSE;
+          g_byte_array_set_size (reader->args, args_len);
+          if (args_len > 0
+           && !read_or_fail (reader, reader->args->data, args_len, error))
+            return FALSE;
+          if (!render_message (format, reader->args->data, args_len, reader->message))
+            goto bad_record;
+          message->level = level;
+          message->time = reader->wall_base + (timestamp - reader->monotonic_base);
+          message->message = reader->message->str;
+          return TRUE;
+
+        default:
+          goto bad_record;
+        }
+    }
+
+bad_record:
+  g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_PARSE,
+               "%s: bad record in binary log at offset %ld",
+               reader->filename, ftell (reader->fp));
+  return FALSE;
+}
+
+/**
+ * gsk_log_binary_reader_close:
+ * @reader: the reader to close.
+ *
+ * Close the binary log and free the reader.
+ */
+void
+gsk_log_binary_reader_close (GskLogBinaryReader  *reader)
+{
+  fclose (reader->fp);
+  g_free (reader->filename);
+  g_hash_table_destroy (reader->formats);
+  g_hash_table_destroy (reader->domains);
+  g_byte_array_free (reader->args, TRUE);
+  g_string_free (reader->message, TRUE);
+  g_free (reader);
+}
@@ -0,0 +1,55 @@
+#ifndef __GSK_LOG_BINARY_H_
+#define __GSK_LOG_BINARY_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GskLogBinaryReader GskLogBinaryReader;
+typedef struct _GskLogBinaryMessage GskLogBinaryMessage;
+
+/* Binary logs:  instead of formatting each message,
+   record which format it used, its arguments, level, domain
+   and a timestamp.  The messages are only formatted
+   when the log is read, usually by gsk-log-render.
+
+   The format and domain must be string constants,
+   since they are only recorded the first time they are used. */
+
+/* output_file_template is as for gsk_log_rotate_stdio_logs();
+   a rotation_period of 0 means the file is never rotated. */
+gboolean gsk_log_binary_open   (const char    *output_file_template,
+                                gboolean       use_localtime,
+                                guint          rotation_period,
+                                GError       **error);
+void     gsk_log_binary_flush  (void);
+void     gsk_log_binary_close  (void);
+
+void     gsk_log_binary        (const char    *domain,
+                                GLogLevelFlags level,
+                                const char    *format,
+                                ...) G_GNUC_PRINTF(3,4);
+void     gsk_log_binary_valist (const char    *domain,
+                                GLogLevelFlags level,
+                                const char    *format,
+                                va_list        args);
+
+/* --- reading binary logs --- */
+struct _GskLogBinaryMessage
+{
+  const char *domain;		/* or NULL */
+  GLogLevelFlags level;
+  guint64 time;			/* microseconds since the epoch */
+  const char *message;
+};
+
+GskLogBinaryReader *gsk_log_binary_reader_open  (const char          *filename,
+                                                 GError             **error);
+gboolean            gsk_log_binary_reader_next  (GskLogBinaryReader  *reader,
+                                                 GskLogBinaryMessage *message,
+                                                 GError             **error);
+void                gsk_log_binary_reader_close (GskLogBinaryReader  *reader);
+
+G_END_DECLS
+
+#endif
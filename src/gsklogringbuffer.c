@@ -1,7 +1,13 @@
+#include "config.h"
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
 #include "gsklogringbuffer.h"
+#include "gskmemorybarrier.h"
+#include "cycle.h"
 
 struct _GskLogRingBuffer
 {
@@ -158,3 +164,368 @@ void gsk_log_ring_buffer_free(GskLogRingBuffer *buffer)
   g_free (buffer->buffer);
   g_free (buffer);
 }
+
+/* --- the flight recorder --- */
+typedef struct _FlightEvent FlightEvent;
+typedef struct _FlightRing FlightRing;
+typedef struct _FlightCursor FlightCursor;
+typedef void (*FlightLineFunc) (const char *line,
+                                guint       len,
+                                gpointer    data);
+
+struct _FlightEvent
+{
+  guint64 time;
+  const char *name;
+  guint64 a, b;
+};
+
+/* Only the owning thread writes to a ring.
+   Readers copy an event, then check that n_written
+   hasn't moved far enough for it to have been overwritten meanwhile. */
+struct _FlightRing
+{
+  volatile guint n_written;
+  volatile guint first_valid;	/* earlier events are from an exited thread */
+  volatile gint is_free;	/* its thread has exited */
+  guint thread_serial;
+  FlightRing *next;
+  FlightEvent events[1];	/* flight_n_events of them */
+};
+
+struct _FlightCursor
+{
+  FlightRing *ring;
+  guint at, end;
+  gboolean has_event;
+  FlightEvent event;
+};
+
+/* the most threads a dump shows:  it can't allocate memory */
+#define FLIGHT_MAX_DUMP_THREADS		256
+
+static guint flight_n_events = 0;	/* a power of two, or 0 if off */
+static FlightRing *flight_rings = NULL;
+static GStaticPrivate flight_ring_key = G_STATIC_PRIVATE_INIT;
+static volatile gint flight_next_serial = 1;
+static guint64 flight_start_stamp;
+static GTimeVal flight_start_time;
+static int flight_dump_fd = -1;
+
+static inline guint64
+flight_now (void)
+{
+#ifdef HAVE_TICK_COUNTER
+  return getticks ();
+#else
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return (guint64) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static void
+flight_ring_release (gpointer data)
+{
+  FlightRing *ring = data;
+  g_atomic_int_inc (&ring->is_free);
+}
+
+static FlightRing *
+flight_ring_for_this_thread (void)
+{
+  FlightRing *ring;
+
+  /* rings are never freed:  a new thread takes over
+     the ring of a thread which has exited */
+  for (ring = g_atomic_pointer_get ((gpointer *) &flight_rings);
+       ring != NULL;
+       ring = ring->next)
+    if (g_atomic_int_get (&ring->is_free)
+     && g_atomic_int_compare_and_exchange (&ring->is_free, 1, 0))
+      break;
+  if (ring != NULL)
+    ring->first_valid = ring->n_written;
+  else
+    {
+      ring = g_malloc0 (sizeof (FlightRing)
+                        + sizeof (FlightEvent) * (flight_n_events - 1));
+      do
+        ring->next = g_atomic_pointer_get ((gpointer *) &flight_rings);
+      while (!g_atomic_pointer_compare_and_exchange ((gpointer *) &flight_rings,
+                                                     ring->next, ring));
+    }
+  ring->thread_serial = g_atomic_int_exchange_and_add (&flight_next_serial, 1);
+  g_static_private_set (&flight_ring_key, ring, flight_ring_release);
+  return ring;
+}
+
+/**
+ * gsk_flight_recorder_init:
+ * @n_events_per_thread: the number of events to keep for each thread.
+ * It is rounded up to a power of two.
+ *
+ * Turn on the flight recorder.  Until this is called,
+ * gsk_flight_recorder_event() does nothing.
+ * This may only be called once, before any events are recorded.
+ */
+void
+gsk_flight_recorder_init (guint n_events_per_thread)
+{
+  guint n = 1;
+  g_return_if_fail (flight_n_events == 0);
+  g_return_if_fail (n_events_per_thread > 0);
+  while (n < n_events_per_thread)
+    n *= 2;
+  flight_start_stamp = flight_now ();
+  g_get_current_time (&flight_start_time);
+  GSK_MEMORY_BARRIER ();
+  flight_n_events = n;
+}
+
+/**
+ * gsk_flight_recorder_event:
+ * @name: what happened.  This must be a string constant.
+ * @a: a number to record with the event.
+ * @b: another number to record with the event.
+ *
+ * Record an event in the calling thread's ring.
+ * This takes no locks and makes no system calls
+ * (except the first time a thread records an event),
+ * so it is cheap enough to use on busy code paths.
+ */
+void
+gsk_flight_recorder_event (const char *name,
+                           guint64     a,
+                           guint64     b)
+{
+  FlightRing *ring;
+  FlightEvent *event;
+  guint n;
+  if (flight_n_events == 0)
+    return;
+  ring = g_static_private_get (&flight_ring_key);
+  if (G_UNLIKELY (ring == NULL))
+    ring = flight_ring_for_this_thread ();
+  n = ring->n_written;
+  event = ring->events + (n & (flight_n_events - 1));
+  event->time = flight_now ();
+  event->name = name;
+  event->a = a;
+  event->b = b;
+  GSK_MEMORY_BARRIER ();
+  ring->n_written = n + 1;
+}
+
+/* load the cursor's oldest event that hasn't been overwritten */
+static void
+flight_cursor_load (FlightCursor *cursor)
+{
+  FlightRing *ring = cursor->ring;
+  while (cursor->at != cursor->end)
+    {
+      cursor->event = ring->events[cursor->at & (flight_n_events - 1)];
+      GSK_MEMORY_BARRIER ();
+      if (ring->n_written - cursor->at < flight_n_events)
+        {
+          cursor->has_event = TRUE;
+          return;
+        }
+      cursor->at++;
+    }
+  cursor->has_event = FALSE;
+}
+
+static guint
+flight_format_uint (char *buf, guint64 v, guint min_digits)
+{
+  char tmp[24];
+  guint n = 0, i;
+  do
+    {
+      tmp[n++] = '0' + v % 10;
+      v /= 10;
+    }
+  while (v != 0 || n < min_digits);
+  for (i = 0; i < n; i++)
+    buf[i] = tmp[n - 1 - i];
+  return n;
+}
+
+/* Merge all the threads' events in time order,
+   making a line for each one, like:
+       -1.234567 [thread 3] name 12 34
+   where the time is in seconds before now.
+   This must be safe to call from a signal handler:
+   no locks and no memory allocation. */
+static void
+flight_recorder_foreach_line (FlightLineFunc func,
+                              gpointer       data)
+{
+  FlightCursor cursors[FLIGHT_MAX_DUMP_THREADS];
+  guint n_cursors = 0;
+  FlightRing *ring;
+  guint64 now;
+  gdouble usecs_per_unit = 1.0;
+  char line[512];
+
+  if (flight_n_events == 0)
+    return;
+  now = flight_now ();
+#ifdef HAVE_TICK_COUNTER
+  {
+    struct timeval tv;
+    gdouble dusecs;
+    gettimeofday (&tv, NULL);
+    dusecs = ((gdouble) tv.tv_sec - flight_start_time.tv_sec) * 1e6
+           + ((gdouble) tv.tv_usec - flight_start_time.tv_usec);
+    if (now > flight_start_stamp && dusecs > 0)
+      usecs_per_unit = dusecs / (gdouble) (now - flight_start_stamp);
+  }
+#endif
+
+  for (ring = g_atomic_pointer_get ((gpointer *) &flight_rings);
+       ring != NULL && n_cursors < FLIGHT_MAX_DUMP_THREADS;
+       ring = ring->next)
+    {
+      FlightCursor *cursor = cursors + n_cursors++;
+      cursor->ring = ring;
+      cursor->end = ring->n_written;
+      cursor->at = ring->first_valid;
+      if (cursor->end - cursor->at > flight_n_events)
+        cursor->at = cursor->end - flight_n_events;
+      flight_cursor_load (cursor);
+    }
+
+  for (;;)
+    {
+      FlightCursor *best = NULL;
+      FlightEvent *event;
+      guint64 usecs_ago;
+      guint i, len, name_len;
+      for (i = 0; i < n_cursors; i++)
+        if (cursors[i].has_event
+         && (best == NULL || cursors[i].event.time < best->event.time))
+          best = cursors + i;
+      if (best == NULL)
+        break;
+      event = &best->event;
+
+      usecs_ago = event->time < now ? (now - event->time) * usecs_per_unit : 0;
+      len = 0;
+      line[len++] = '-';
+      len += flight_format_uint (line + len, usecs_ago / 1000000, 1);
+      line[len++] = '.';
+      len += flight_format_uint (line + len, usecs_ago % 1000000, 6);
+      memcpy (line + len, " [thread ", 9);
+      len += 9;
+      len += flight_format_uint (line + len, best->ring->thread_serial, 1);
+      line[len++] = ']';
+      line[len++] = ' ';
+      name_len = event->name ? strlen (event->name) : 0;
+      name_len = MIN (name_len, sizeof (line) - len - 128);
+      if (name_len > 0)
+        memcpy (line + len, event->name, name_len);
+      len += name_len;
+      line[len++] = ' ';
+      len += flight_format_uint (line + len, event->a, 1);
+      line[len++] = ' ';
+      len += flight_format_uint (line + len, event->b, 1);
+      line[len++] = '\n';
+      (*func) (line, len, data);
+
+      best->at++;
+      flight_cursor_load (best);
+    }
+}
+
+static void
+append_line_to_gstring (const char *line, guint len, gpointer data)
+{
+  g_string_append_len (data, line, len);
+}
+
+/**
+ * gsk_flight_recorder_snapshot:
+ *
+ * Get the events that all the threads have recorded,
+ * oldest first, one per line.
+ * Each line gives the number of seconds before now
+ * that the event happened, the thread which recorded it,
+ * and the event's name and numbers.
+ *
+ * returns: a newly allocated string.
+ */
+char *
+gsk_flight_recorder_snapshot (void)
+{
+  GString *str = g_string_new ("");
+  flight_recorder_foreach_line (append_line_to_gstring, str);
+  return g_string_free (str, FALSE);
+}
+
+static void
+write_line_to_fd (const char *line, guint len, gpointer data)
+{
+  int fd = GPOINTER_TO_INT (data);
+  while (len > 0)
+    {
+      gssize rv = write (fd, line, len);
+      if (rv <= 0)
+        return;
+      line += rv;
+      len -= rv;
+    }
+}
+
+/**
+ * gsk_flight_recorder_dump:
+ * @fd: the file-descriptor to write to.
+ *
+ * Write a snapshot of the flight recorder
+ * (see gsk_flight_recorder_snapshot()) to a file-descriptor.
+ *
+ * This is safe to call from a signal handler:
+ * it takes no locks and allocates no memory.
+ */
+void
+gsk_flight_recorder_dump (int fd)
+{
+  flight_recorder_foreach_line (write_line_to_fd, GINT_TO_POINTER (fd));
+}
+
+static void
+flight_fatal_signal_handler (int sig)
+{
+  static const char header[] = "--- flight recorder ---\n";
+  write_line_to_fd (header, sizeof (header) - 1, GINT_TO_POINTER (flight_dump_fd));
+  gsk_flight_recorder_dump (flight_dump_fd);
+
+  /* the handler was reset:  die the way we would have */
+  raise (sig);
+}
+
+/**
+ * gsk_flight_recorder_dump_on_fatal_signals:
+ * @fd: the file-descriptor to write to, often STDERR_FILENO.
+ *
+ * If the process gets a signal that means it has crashed
+ * (SIGSEGV, SIGBUS, SIGILL, SIGFPE or SIGABRT),
+ * write a snapshot of the flight recorder to @fd before dying.
+ */
+void
+gsk_flight_recorder_dump_on_fatal_signals (int fd)
+{
+  static const int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+  guint i;
+  flight_dump_fd = fd;
+  for (i = 0; i < G_N_ELEMENTS (signals); i++)
+    {
+      struct sigaction action;
+      memset (&action, 0, sizeof (action));
+      action.sa_handler = flight_fatal_signal_handler;
+      sigemptyset (&action.sa_mask);
+      action.sa_flags = SA_RESETHAND;
+      sigaction (signals[i], &action, NULL);
+    }
+}
@@ -26,6 +26,21 @@ void              gsk_log_ring_buffer_free(GskLogRingBuffer *buffer);
    for its timezone info. */
 char       * gsk_substitute_localtime_in_string (const char *str,
                                                  const char *strftime_format);
+/* --- the flight recorder --- */
+/* Each thread records events in its own fixed-size ring,
+   overwriting its oldest events.  Recording an event takes no locks,
+   so it can be left on all the time:  a snapshot then shows
+   what every thread did just before a problem.
+
+   Event names must be string constants. */
+void  gsk_flight_recorder_init   (guint       n_events_per_thread);
+void  gsk_flight_recorder_event  (const char *name,
+                                  guint64     a,
+                                  guint64     b);
+char *gsk_flight_recorder_snapshot (void);
+void  gsk_flight_recorder_dump   (int         fd);
+void  gsk_flight_recorder_dump_on_fatal_signals (int fd);
+
 G_END_DECLS
 
 #endif
@@ -1,17 +1,22 @@
+#include "gskmempool.h"
 
-
-/* TODO: these need to actually pool at some point ! */
+/* Declare type_alloc() and type_free(), which allocate
+   objects of Type from a per-thread GskTypePool.
+   pool_count is unused:  the pools grow as needed. */
 #define GSK_DECLARE_POOL_ALLOCATORS(Type, type, pool_count)	\
+static GskTypePool type ## _pool					\
+  = GSK_TYPE_POOL_STATIC_INIT (#Type, sizeof (Type));		\
+								\
 static inline Type *						\
 type ## _alloc ()						\
 {								\
-  return g_new (Type, 1);					\
+  return gsk_type_pool_alloc (&type ## _pool);			\
 }								\
 								\
 static inline void						\
 type ## _free (Type *p)						\
 {								\
-  g_free (p);							\
+  gsk_type_pool_free (&type ## _pool, p);			\
 }
 
 #define GSK_STRUCT_MEMBER_SIZE(type, member)    (sizeof(((type *)0)->member))
@@ -25,8 +25,10 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "gskmainloop.h"
+#include "gskthreadpool.h"
 #include "gskmacros.h"
 #include "gskrbtreemacros.h"
 #include "config.h"
@@ -35,8 +37,16 @@
 #include "gskerror.h"
 #include "gskinit.h"
 #include "gskdebug.h"
+#include "gskmemorybarrier.h"
 #include "cycle.h"
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 #include "debug.h"
+#if HAVE_EXECINFO_H
+#include <execinfo.h>
+#include <stdlib.h>
+#endif
 
 /* --- prototypes --- */
 static GObjectClass *parent_class = NULL;
@@ -78,12 +88,19 @@ struct _GskSource
   guint                  timer_adjusted_while_running : 1;
   guint                  timer_is_red : 1;
   guint                  timer_in_tree : 1;
+  guint                  timer_is_coarse : 1;
+  guint                  timer_in_wheel : 1;
+  guint                  timer_wheel_list : 9;
 
   GskMainLoop           *main_loop;
 
   gpointer               user_data;
   GDestroyNotify         destroy;
 
+  /* for instrumentation */
+  GQuark                 label;
+  gpointer               stats;
+
   union
   {
     struct 
@@ -97,7 +114,12 @@ struct _GskSource
       GTimeVal               expire_time;
       gint64                 milli_period;
       GskMainLoopTimeoutFunc func;
+
+      /* for coarse timers, left and right are the
+         prev and next pointers of the wheel's list */
       GskSource             *left, *right, *parent;
+      guint                  millis_slack;
+      gint64                 wheel_expire;
     } timer;
     struct
     {
@@ -154,6 +176,251 @@ struct _GskMainLoopContextList
   (main_loop)->timers, GskSource *, TIMER_GET_IS_RED, TIMER_SET_IS_RED,  \
   data.timer.parent, data.timer.left, data.timer.right, TIMER_COMPARE
 
+/* --- coarse timers --- */
+/* Coarse timers are kept in a hashed hierarchical timing wheel,
+ * so adding, adjusting and removing them is O(1):
+ * level L of the wheel has TIMER_WHEEL_SIZE lists, each of which
+ * holds the timers expiring in a span of TIMER_WHEEL_SIZE^L milliseconds.
+ * A timer is put in the lowest level whose current span
+ * contains its expiration time.  When the wheel reaches the start
+ * of a list at a higher level, its timers are moved to lower levels,
+ * until they reach level 0, whose lists are single milliseconds.
+ *
+ * A timer's slack is used to round its expiration time up,
+ * so that it lands on the start of a higher-level list,
+ * which saves moving it down, and groups it with similar timers.
+ */
+#define TIMER_WHEEL_BITS	6
+#define TIMER_WHEEL_SIZE	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS	4
+#define TIMER_WHEEL_N_SLOTS	(TIMER_WHEEL_SIZE * TIMER_WHEEL_LEVELS)
+
+/* timers beyond the top level's span */
+#define TIMER_WHEEL_OVERFLOW	TIMER_WHEEL_N_SLOTS
+/* timers which are due to run */
+#define TIMER_WHEEL_EXPIRED	(TIMER_WHEEL_N_SLOTS + 1)
+
+typedef struct _TimerWheel TimerWheel;
+struct _TimerWheel
+{
+  /* milliseconds since the epoch; all earlier lists have been processed */
+  gint64 time;
+
+  /* which lists in each level are nonempty */
+  guint64 occupied[TIMER_WHEEL_LEVELS];
+
+  GskSource *lists[TIMER_WHEEL_N_SLOTS + 2];
+};
+
+#define TIMER_WHEEL(main_loop)	((TimerWheel *) (main_loop)->timer_wheel)
+
+static inline guint
+lowest_bit_index (guint64 v)
+{
+#ifdef __GNUC__
+  return __builtin_ctzll (v);
+#else
+  guint rv = 0;
+  while ((v & 1) == 0)
+    {
+      v >>= 1;
+      rv++;
+    }
+  return rv;
+#endif
+}
+
+static inline gint64
+time_val_to_millis_ceil (const GTimeVal *tv)
+{
+  return (gint64) tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+}
+
+static inline gint64
+time_val_to_millis (const GTimeVal *tv)
+{
+  return (gint64) tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static void
+timer_wheel_insert (TimerWheel *wheel,
+                    GskSource  *source)
+{
+  gint64 expire = source->data.timer.wheel_expire;
+  guint index;
+  GskSource **plist;
+  if (expire <= wheel->time)
+    index = TIMER_WHEEL_EXPIRED;
+  else
+    {
+      guint level = 0;
+      while (level < TIMER_WHEEL_LEVELS
+          && (expire >> (TIMER_WHEEL_BITS * (level + 1)))
+             != (wheel->time >> (TIMER_WHEEL_BITS * (level + 1))))
+        level++;
+      if (level == TIMER_WHEEL_LEVELS)
+        index = TIMER_WHEEL_OVERFLOW;
+      else
+        {
+          guint slot = (expire >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SIZE - 1);
+          wheel->occupied[level] |= ((guint64) 1 << slot);
+          index = level * TIMER_WHEEL_SIZE + slot;
+        }
+    }
+  plist = wheel->lists + index;
+  source->data.timer.left = NULL;
+  source->data.timer.right = *plist;
+  if (*plist != NULL)
+    (*plist)->data.timer.left = source;
+  *plist = source;
+  source->timer_wheel_list = index;
+  source->timer_in_wheel = 1;
+}
+
+static void
+timer_wheel_remove (TimerWheel *wheel,
+                    GskSource  *source)
+{
+  guint index = source->timer_wheel_list;
+  GskSource *prev = source->data.timer.left;
+  GskSource *next = source->data.timer.right;
+  g_assert (source->timer_in_wheel);
+  if (prev != NULL)
+    prev->data.timer.right = next;
+  else
+    {
+      wheel->lists[index] = next;
+      if (next == NULL && index < TIMER_WHEEL_N_SLOTS)
+        wheel->occupied[index / TIMER_WHEEL_SIZE]
+          &= ~((guint64) 1 << (index % TIMER_WHEEL_SIZE));
+    }
+  if (next != NULL)
+    next->data.timer.left = prev;
+  source->timer_in_wheel = 0;
+}
+
+/* Compute when the timer should run, using its slack
+ * to round up to the largest power of TIMER_WHEEL_SIZE we can. */
+static inline void
+timer_wheel_add (TimerWheel *wheel,
+                 GskSource  *source)
+{
+  gint64 expire = time_val_to_millis_ceil (&source->data.timer.expire_time);
+  gint64 granularity = 1;
+  while (granularity * TIMER_WHEEL_SIZE <= (gint64) source->data.timer.millis_slack + 1
+      && granularity < ((gint64) 1 << (TIMER_WHEEL_BITS * (TIMER_WHEEL_LEVELS - 1))))
+    granularity *= TIMER_WHEEL_SIZE;
+  expire = (expire + granularity - 1) / granularity * granularity;
+  source->data.timer.wheel_expire = expire;
+  timer_wheel_insert (wheel, source);
+}
+
+/* The next time at which the wheel has a list to process,
+ * or G_MAXINT64.  (This ignores the TIMER_WHEEL_EXPIRED list.) */
+static gint64
+timer_wheel_next_time (TimerWheel *wheel)
+{
+  gint64 rv = G_MAXINT64;
+  guint level;
+  for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+      guint shift = TIMER_WHEEL_BITS * level;
+      guint cur = (wheel->time >> shift) & (TIMER_WHEEL_SIZE - 1);
+      guint64 later = wheel->occupied[level] & ~(((guint64) 2 << cur) - 1);
+      if (later != 0)
+        {
+          gint64 t = ((wheel->time >> (shift + TIMER_WHEEL_BITS)) << (shift + TIMER_WHEEL_BITS))
+                   + ((gint64) lowest_bit_index (later) << shift);
+          if (t < rv)
+            rv = t;
+        }
+    }
+  if (wheel->lists[TIMER_WHEEL_OVERFLOW] != NULL)
+    {
+      guint shift = TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS;
+      gint64 t = ((wheel->time >> shift) + 1) << shift;
+      if (t < rv)
+        rv = t;
+    }
+  return rv;
+}
+
+static void
+timer_wheel_redistribute (TimerWheel *wheel,
+                          guint       index)
+{
+  GskSource *list = wheel->lists[index];
+  wheel->lists[index] = NULL;
+  if (index < TIMER_WHEEL_N_SLOTS)
+    wheel->occupied[index / TIMER_WHEEL_SIZE]
+      &= ~((guint64) 1 << (index % TIMER_WHEEL_SIZE));
+  while (list != NULL)
+    {
+      GskSource *next = list->data.timer.right;
+      timer_wheel_insert (wheel, list);
+      list = next;
+    }
+}
+
+/* Process all lists up to 'now',
+ * moving due timers to the TIMER_WHEEL_EXPIRED list. */
+static void
+timer_wheel_advance (TimerWheel *wheel,
+                     gint64      now)
+{
+  while (wheel->time < now)
+    {
+      gint64 t = timer_wheel_next_time (wheel);
+      gint level;
+      if (t > now)
+        {
+          wheel->time = now;
+          break;
+        }
+      wheel->time = t;
+      if ((t & (((gint64) 1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)) == 0)
+        timer_wheel_redistribute (wheel, TIMER_WHEEL_OVERFLOW);
+      for (level = TIMER_WHEEL_LEVELS - 1; level >= 0; level--)
+        {
+          guint shift = TIMER_WHEEL_BITS * level;
+          guint slot;
+          if ((t & (((gint64) 1 << shift) - 1)) != 0)
+            continue;
+          slot = (t >> shift) & (TIMER_WHEEL_SIZE - 1);
+          if (wheel->occupied[level] & ((guint64) 1 << slot))
+            timer_wheel_redistribute (wheel, level * TIMER_WHEEL_SIZE + slot);
+        }
+    }
+}
+
+/* Put a timer into the rbtree or the wheel. */
+static inline void
+timer_queue (GskMainLoop *main_loop,
+             GskSource   *source)
+{
+  if (source->timer_is_coarse)
+    timer_wheel_add (TIMER_WHEEL (main_loop), source);
+  else
+    {
+      GskSource *unused;
+      GSK_RBTREE_INSERT (GET_MAIN_LOOP_TIMER_TREE (main_loop), source, unused);
+      source->timer_in_tree = 1;
+    }
+}
+
+static inline void
+timer_unqueue (GskMainLoop *main_loop,
+               GskSource   *source)
+{
+  if (source->timer_in_tree)
+    {
+      GSK_RBTREE_REMOVE (GET_MAIN_LOOP_TIMER_TREE (main_loop), source);
+      source->timer_in_tree = 0;
+    }
+  else if (source->timer_in_wheel)
+    timer_wheel_remove (TIMER_WHEEL (main_loop), source);
+}
+
 
 static inline GIOCondition
 get_io_events (GskMainLoop *main_loop,
@@ -217,6 +484,157 @@ gsk_main_loop_change_process (GskMainLoop  *main_loop,
 	       (add ? "adding" : "removing"), pid));
 }
 
+/* --- instrumentation --- */
+/* When the main-loop is instrumented, main_loop->stats
+ * holds histograms of the time taken by each iteration,
+ * by the poll, and by each callback, grouped by the source's label,
+ * or else by its callback function.
+ *
+ * Times are recorded in cpu ticks where available (converted to microseconds
+ * only when the stats are reported), so that an instrumented
+ * iteration costs just a few reads of the tick counter.
+ * Each source caches the entry for its callback,
+ * which is kept until the main-loop is finalized.
+ */
+typedef struct _MainLoopStats MainLoopStats;
+typedef struct _SourceStats SourceStats;
+
+struct _SourceStats
+{
+  gpointer func;
+  GQuark label;
+  GskMainLoopHistogram histogram;
+};
+
+struct _MainLoopStats
+{
+  GskMainLoopHistogram iteration;
+  GskMainLoopHistogram poll;
+  GskMainLoopHistogram events_per_wakeup;
+
+  GHashTable *sources_by_func;
+  GHashTable *sources_by_label;
+  GPtrArray *sources;		/* in order of creation */
+
+  /* for converting ticks to microseconds */
+  guint64 start_stamp;
+  GTimeVal start_time;
+};
+
+#define MAIN_LOOP_STATS(main_loop) ((MainLoopStats *) (main_loop)->stats)
+
+static inline guint64
+stats_now (void)
+{
+#ifdef HAVE_TICK_COUNTER
+  return getticks ();
+#else
+  GTimeVal tv;
+  g_get_current_time (&tv);
+  return (guint64) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+/* returns 0 if the main-loop is not instrumented */
+static inline guint64
+stats_start (GskMainLoop *main_loop)
+{
+  if (G_LIKELY (!main_loop->is_instrumented))
+    return 0;
+  return stats_now ();
+}
+
+static inline void
+histogram_add (GskMainLoopHistogram *histogram,
+               guint64               value)
+{
+  guint bucket;
+#if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4))
+  bucket = value ? 64 - __builtin_clzll (value) : 0;
+#else
+  guint64 v = value;
+  for (bucket = 0; v != 0; bucket++)
+    v >>= 1;
+#endif
+  if (bucket >= GSK_MAIN_LOOP_HISTOGRAM_N_BUCKETS)
+    bucket = GSK_MAIN_LOOP_HISTOGRAM_N_BUCKETS - 1;
+  histogram->count++;
+  histogram->total += value;
+  if (value > histogram->max)
+    histogram->max = value;
+  histogram->buckets[bucket]++;
+}
+
+static gpointer
+source_get_func (GskSource *source)
+{
+  switch (source->type)
+    {
+    case GSK_SOURCE_TYPE_IDLE: return (gpointer) source->data.idle.func;
+    case GSK_SOURCE_TYPE_TIMER: return (gpointer) source->data.timer.func;
+    case GSK_SOURCE_TYPE_IO: return (gpointer) source->data.io.func;
+    case GSK_SOURCE_TYPE_SIGNAL: return (gpointer) source->data.signal.func;
+    case GSK_SOURCE_TYPE_PROCESS: return (gpointer) source->data.process.func;
+    }
+  return NULL;
+}
+
+static SourceStats *
+lookup_source_stats (MainLoopStats *stats,
+                     GskSource     *source)
+{
+  SourceStats *rv;
+  gpointer func = NULL;
+  if (source->label != 0)
+    rv = g_hash_table_lookup (stats->sources_by_label,
+                              GUINT_TO_POINTER (source->label));
+  else
+    {
+      func = source_get_func (source);
+      rv = g_hash_table_lookup (stats->sources_by_func, func);
+    }
+  if (rv == NULL)
+    {
+      rv = g_new0 (SourceStats, 1);
+      rv->func = func;
+      rv->label = source->label;
+      if (source->label != 0)
+        g_hash_table_insert (stats->sources_by_label,
+                             GUINT_TO_POINTER (source->label), rv);
+      else
+        g_hash_table_insert (stats->sources_by_func, func, rv);
+      g_ptr_array_add (stats->sources, rv);
+    }
+  return rv;
+}
+
+/* call after a callback, with the return value of stats_start() */
+static inline void
+stats_end_source (GskMainLoop *main_loop,
+                  GskSource   *source,
+                  guint64      start)
+{
+  guint64 end;
+  if (G_LIKELY (start == 0))
+    return;
+  end = stats_now ();
+  if (G_UNLIKELY (source->stats == NULL))
+    source->stats = lookup_source_stats (MAIN_LOOP_STATS (main_loop), source);
+  histogram_add (&((SourceStats *) source->stats)->histogram, end - start);
+}
+
+static void
+free_stats (MainLoopStats *stats)
+{
+  guint i;
+  for (i = 0; i < stats->sources->len; i++)
+    g_free (stats->sources->pdata[i]);
+  g_ptr_array_free (stats->sources, TRUE);
+  g_hash_table_destroy (stats->sources_by_func);
+  g_hash_table_destroy (stats->sources_by_label);
+  g_free (stats);
+}
+
 static guint
 gsk_main_loop_run_io_sources (GskMainLoop     *main_loop,
 			      guint            fd,
@@ -237,10 +655,12 @@ gsk_main_loop_run_io_sources (GskMainLoop     *main_loop,
     }
   if (read_source == write_source)
     {
+      guint64 start = stats_start (main_loop);
       read_source->run_count++;
       if (!(*read_source->data.io.func) (fd, G_IO_IN | G_IO_OUT,
 			                 read_source->user_data))
 	read_source->must_remove = 1;
+      stats_end_source (main_loop, read_source, start);
       read_source->run_count--;
       if (read_source->run_count == 0 && read_source->must_remove)
 	gsk_source_remove (read_source);
@@ -250,20 +670,24 @@ gsk_main_loop_run_io_sources (GskMainLoop     *main_loop,
     {
       if (read_source != NULL)
 	{
+	  guint64 start = stats_start (main_loop);
 	  read_source->run_count++;
 	  if (!(*read_source->data.io.func) (fd, G_IO_IN,
 				             read_source->user_data))
 	    read_source->must_remove = 1;
+	  stats_end_source (main_loop, read_source, start);
 	  read_source->run_count--;
 	  if (read_source->run_count == 0 && read_source->must_remove)
 	    gsk_source_remove (read_source);
 	}
       if (write_source != NULL)
 	{
+	  guint64 start = stats_start (main_loop);
 	  write_source->run_count++;
 	  if (!(*write_source->data.io.func) (fd, G_IO_OUT,
 				              write_source->user_data))
 	    write_source->must_remove = 1;
+	  stats_end_source (main_loop, write_source, start);
 	  write_source->run_count--;
 	  if (write_source->run_count == 0 && write_source->must_remove)
 	    gsk_source_remove (write_source);
@@ -286,9 +710,11 @@ gsk_main_loop_run_signal_sources (GskMainLoop     *main_loop,
   while (at != NULL)
     {
       GskSource *next;
+      guint64 start = stats_start (main_loop);
       rv++;
       if (!(*at->data.signal.func) (signal, at->user_data))
 	at->must_remove = 1;
+      stats_end_source (main_loop, at, start);
       next = at->data.signal.next;
       if (next != NULL)
 	next->run_count++;
@@ -315,8 +741,10 @@ gsk_main_loop_run_process_sources (GskMainLoop     *main_loop,
   while (at != NULL)
     {
       GskSource *next;
+      guint64 start = stats_start (main_loop);
       rv++;
       (*at->data.process.func) (wait_info, at->user_data);
+      stats_end_source (main_loop, at, start);
       at->must_remove = 1;
       next = at->data.process.next;
       if (next != NULL)
@@ -565,6 +993,8 @@ handle_poll_fd_set (int          fd,
   return TRUE;
 }
 
+static void setup_invoke_source (GskMainLoop *main_loop);
+
 /**
  * gsk_main_loop_run:
  * @main_loop: the main loop to run.
@@ -590,8 +1020,12 @@ gsk_main_loop_run          (GskMainLoop       *main_loop,
   GskSource *at;
   GskMainLoopContextList *list;
   GskMainLoopContextList **plist;
+  guint64 iteration_start, start;
 
   g_return_val_if_fail (!main_loop->is_running, 0);
+  iteration_start = stats_start (main_loop);
+  if (G_UNLIKELY (main_loop->invoke_source == NULL))
+    setup_invoke_source (main_loop);
   main_loop->is_running = 1;
 
   gsk_main_loop_update_current_time (main_loop);
@@ -599,6 +1033,22 @@ gsk_main_loop_run          (GskMainLoop       *main_loop,
   old_time = *current_time;
   if (main_loop->first_idle != NULL)
     timeout = 0;
+  else if (TIMER_WHEEL (main_loop)->lists[TIMER_WHEEL_EXPIRED] != NULL)
+    timeout = 0;
+  else
+    {
+      gint64 wheel_time = timer_wheel_next_time (TIMER_WHEEL (main_loop));
+      if (wheel_time != G_MAXINT64)
+        {
+          gint64 t = wheel_time - time_val_to_millis (current_time);
+          if (t < 0)
+            t = 0;
+          else if (t > G_MAXINT)
+            t = G_MAXINT;
+          if (timeout < 0 || t < timeout)
+            timeout = t;
+        }
+    }
   GSK_RBTREE_FIRST (GET_MAIN_LOOP_TIMER_TREE (main_loop), at);
   if (at != NULL)
     {
@@ -688,7 +1138,14 @@ retry_query:
 	}
       plist = &((*plist)->next);
     }
+  start = stats_start (main_loop);
   num_events = (*class->poll) (main_loop, main_loop->max_events, events, timeout);
+  if (G_UNLIKELY (start != 0))
+    {
+      MainLoopStats *stats = MAIN_LOOP_STATS (main_loop);
+      histogram_add (&stats->poll, stats_now () - start);
+      histogram_add (&stats->events_per_wakeup, num_events);
+    }
   gsk_main_loop_update_current_time (main_loop);
   /* run i/o, signal and process handlers */
   for (i = 0; i < num_events; i++)
@@ -728,8 +1185,10 @@ retry_query:
   while (at != NULL)
     {
       GskSource *next;
+      guint64 start = stats_start (main_loop);
       if (!(*at->data.idle.func) (at->user_data))
 	at->must_remove = 1;
+      stats_end_source (main_loop, at, start);
       rv++;
       next = at->data.idle.next;
       if (next)
@@ -755,8 +1214,10 @@ retry_query:
       g_assert (at->timer_in_tree);
       GSK_RBTREE_REMOVE (GET_MAIN_LOOP_TIMER_TREE (main_loop), at);
       at->timer_in_tree = 0;
+      start = stats_start (main_loop);
       if (!(*at->data.timer.func) (at->user_data))
 	at->must_remove = 1;
+      stats_end_source (main_loop, at, start);
       rv++;
       at->run_count--;
       if (at->run_count == 0 && at->must_remove)
@@ -769,17 +1230,41 @@ retry_query:
 	    g_time_val_add_millis (&at->data.timer.expire_time, 
 				   at->data.timer.milli_period);
           g_assert (!at->timer_in_tree);
-          {
-            GskSource *unused;
-            GSK_RBTREE_INSERT (GET_MAIN_LOOP_TIMER_TREE (main_loop),
-                               at, unused);
-            at->timer_in_tree = 1;
-          }
+          timer_queue (main_loop, at);
+	}
+    }
+
+  /* expire coarse timers */
+  timer_wheel_advance (TIMER_WHEEL (main_loop), time_val_to_millis (current_time));
+  while ((at = TIMER_WHEEL (main_loop)->lists[TIMER_WHEEL_EXPIRED]) != NULL)
+    {
+      at->run_count++;
+      timer_wheel_remove (TIMER_WHEEL (main_loop), at);
+      start = stats_start (main_loop);
+      if (!(*at->data.timer.func) (at->user_data))
+	at->must_remove = 1;
+      stats_end_source (main_loop, at, start);
+      rv++;
+      at->run_count--;
+      if (at->run_count == 0 && at->must_remove)
+	gsk_source_remove (at);
+      else
+	{
+          if (at->timer_adjusted_while_running)
+	    at->timer_adjusted_while_running = 0;
+	  else
+	    g_time_val_add_millis (&at->data.timer.expire_time, 
+				   at->data.timer.milli_period);
+          g_assert (!at->timer_in_wheel);
+          timer_queue (main_loop, at);
 	}
     }
 
   g_return_val_if_fail (main_loop->is_running, rv);
   main_loop->is_running = 0;
+  if (G_UNLIKELY (iteration_start != 0))
+    histogram_add (&MAIN_LOOP_STATS (main_loop)->iteration,
+                   stats_now () - iteration_start);
 
   if (t_waited_out != NULL)
     {
@@ -822,6 +1307,8 @@ gsk_source_new   (GskSourceType     type,
   rv->must_remove = 0;
   rv->is_destroyed = 0;
   rv->is_reentrant = 0;
+  rv->label = 0;
+  rv->stats = NULL;
   return rv;
 }
 static inline void
@@ -996,6 +1483,8 @@ gsk_main_loop_add_waitpid  (GskMainLoop       *main_loop,
  * For example, if you read only part of the data when a input event is raised,
  * the @io_func will be invoked again at every iteration of the main-loop
  * until there is no data available.
+ * (Edge-triggered main-loops only learn that there is no more data
+ * when the handler calls gsk_source_io_would_block().)
  *
  * returns: a #GskSource which can be removed or altered.
  */
@@ -1132,6 +1621,34 @@ gsk_source_remove_io_events (GskSource *source,
   gsk_source_adjust_io (source, source->data.io.events & (~events));
 }
 
+/**
+ * gsk_source_io_would_block:
+ * @source: the input/output source whose file-descriptor would block.
+ * @events: G_IO_IN if a read just failed with EAGAIN,
+ * G_IO_OUT if a write did.
+ *
+ * Tell the main-loop that there is no more input on the source's
+ * file-descriptor, or no more room for output, for now.
+ *
+ * Level-triggered main-loops ask the kernel about that,
+ * and ignore this.  Edge-triggered ones (GSK_MAIN_LOOP_TYPE=epoll-et)
+ * only hear of new input or room once, so they keep invoking the source,
+ * as long as it wants those events, until they are told this.
+ */
+void
+gsk_source_io_would_block (GskSource *source,
+                           guint      events)
+{
+  GskMainLoop *main_loop;
+  g_return_if_fail (source != NULL);
+  g_return_if_fail (source->type == GSK_SOURCE_TYPE_IO);
+  main_loop = source->main_loop;
+  if (MAIN_LOOP_CLASS (main_loop)->io_would_block != NULL)
+    (*MAIN_LOOP_CLASS (main_loop)->io_would_block) (main_loop,
+                                                    source->data.io.fd,
+                                                    events);
+}
+
 /**
  * gsk_main_loop_add_timer:
  * @main_loop: the main-loop which should keep track and run the timeout.
@@ -1165,6 +1682,8 @@ gsk_main_loop_add_timer64  (GskMainLoop       *main_loop,
   source->data.timer.milli_period = milli_period;
   source->data.timer.func = timer_func;
   source->timer_adjusted_while_running = FALSE;
+  source->timer_is_coarse = 0;
+  source->timer_in_wheel = 0;
   GSK_RBTREE_INSERT (GET_MAIN_LOOP_TIMER_TREE (main_loop), source, unused);
   source->timer_in_tree = 1;
   main_loop->num_sources++;
@@ -1216,12 +1735,60 @@ gsk_main_loop_add_timer_absolute (GskMainLoop       *main_loop,
   source->data.timer.milli_period = -1;
   source->data.timer.func = timer_func;
   source->timer_adjusted_while_running = 0;
+  source->timer_is_coarse = 0;
+  source->timer_in_wheel = 0;
   GSK_RBTREE_INSERT (GET_MAIN_LOOP_TIMER_TREE (main_loop), source, unused);
   source->timer_in_tree = 1;
   main_loop->num_sources++;
   return source;
 }
 
+/**
+ * gsk_main_loop_add_timer_coarse:
+ * @main_loop: the main-loop which should keep track and run the timeout.
+ * @timer_func: function to call when the requested amount of time elapses.
+ * @timer_data: data to pass to @timer_func.
+ * @timer_destroy: optional function to call to destroy the @timer_data.
+ * @millis_expire: number of milliseconds to wait before running @timer_func.
+ * @milli_period: period between subsequent invocation of the timeout.
+ * This may be -1 to indicate that the timeout is a one-shot.
+ * @millis_slack: number of milliseconds late that the timer may run.
+ *
+ * Add a timeout function to the main-loop, like gsk_main_loop_add_timer(),
+ * except that it may run up to @millis_slack milliseconds late
+ * (but never early).
+ *
+ * Coarse timers are kept in a timer wheel instead of a tree,
+ * so adding, adjusting and removing them takes constant time.
+ * They are appropriate for idle-timeouts and the like,
+ * which are typically reset or removed many times
+ * for each time they expire.
+ *
+ * returns: #GskSource which can be removed or altered.
+ */
+GskSource *
+gsk_main_loop_add_timer_coarse (GskMainLoop       *main_loop,
+                                GskMainLoopTimeoutFunc timer_func,
+                                gpointer           timer_data,
+                                GDestroyNotify     timer_destroy,
+                                gint64             millis_expire,
+                                gint64             milli_period,
+                                guint              millis_slack)
+{
+  GskSource *source = gsk_source_new (GSK_SOURCE_TYPE_TIMER, main_loop, timer_data, timer_destroy);
+  source->data.timer.expire_time = main_loop->current_time;
+  g_time_val_add_millis (&source->data.timer.expire_time, millis_expire);
+  source->data.timer.milli_period = milli_period;
+  source->data.timer.func = timer_func;
+  source->data.timer.millis_slack = millis_slack;
+  source->timer_adjusted_while_running = 0;
+  source->timer_is_coarse = 1;
+  source->timer_in_tree = 0;
+  timer_wheel_add (TIMER_WHEEL (main_loop), source);
+  main_loop->num_sources++;
+  return source;
+}
+
 /**
  * gsk_source_adjust_timer:
  * @timer_source: the timeout source returned by gsk_main_loop_add_timer() or gsk_main_loop_add_timer_absolute().
@@ -1241,25 +1808,12 @@ gsk_source_adjust_timer   (GskSource         *timer_source,
 {
   GskMainLoop *main_loop = timer_source->main_loop;
   g_return_if_fail (timer_source->type == GSK_SOURCE_TYPE_TIMER);
-  if (timer_source->timer_in_tree)
-    {
-      GSK_RBTREE_REMOVE (GET_MAIN_LOOP_TIMER_TREE (main_loop), timer_source);
-      timer_source->timer_in_tree = 0;
-    }
+  timer_unqueue (main_loop, timer_source);
   timer_source->data.timer.expire_time = main_loop->current_time;
   g_time_val_add_millis (&timer_source->data.timer.expire_time, millis_expire);
   timer_source->data.timer.milli_period = milli_period;
   if (timer_source->run_count == 0)
-    {
-      if (!timer_source->timer_in_tree)
-        {
-          GskSource *unused;
-          GSK_RBTREE_INSERT (GET_MAIN_LOOP_TIMER_TREE (main_loop),
-                             timer_source,
-                             unused);
-          timer_source->timer_in_tree = 1;
-        }
-    }
+    timer_queue (main_loop, timer_source);
   else
     timer_source->timer_adjusted_while_running = 1;
 }
@@ -1290,11 +1844,7 @@ gsk_main_loop_block_io (GskMainLoop *main_loop,
 	break;
 
       case GSK_SOURCE_TYPE_TIMER:
-        if (source->timer_in_tree)
-          {
-            GSK_RBTREE_REMOVE (GET_MAIN_LOOP_TIMER_TREE (main_loop), source);
-            source->timer_in_tree = 0;
-          }
+        timer_unqueue (main_loop, source);
 	break;
 
       case GSK_SOURCE_TYPE_IO:
@@ -1449,6 +1999,457 @@ gsk_main_loop_quit (GskMainLoop       *main_loop)
   main_loop->quit = 1;
 }
 
+/* --- invoking functions from other threads --- */
+G_LOCK_DEFINE_STATIC (invoke_fd);
+
+/* The fd is made when first needed, by whichever thread needs it. */
+static void
+ensure_invoke_fd (GskMainLoop *main_loop)
+{
+  if (G_LIKELY (main_loop->invoke_write_fd >= 0))
+    {
+      /* pairs with the barrier below: see invoke_read_fd too */
+      GSK_MEMORY_BARRIER ();
+      return;
+    }
+  G_LOCK (invoke_fd);
+  if (main_loop->invoke_write_fd < 0)
+    {
+      int fds[2];
+#if HAVE_SYS_EVENTFD_H && defined(EFD_NONBLOCK)
+      fds[0] = fds[1] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (fds[0] < 0)
+#endif
+        {
+          if (pipe (fds) < 0)
+            g_error ("error creating pipe: %s", g_strerror (errno));
+          gsk_fd_set_nonblocking (fds[0]);
+          gsk_fd_set_nonblocking (fds[1]);
+          gsk_fd_set_close_on_exec (fds[0], TRUE);
+          gsk_fd_set_close_on_exec (fds[1], TRUE);
+        }
+      main_loop->invoke_read_fd = fds[0];
+
+      /* threads that see invoke_write_fd without taking
+         the lock must also see invoke_read_fd */
+      GSK_MEMORY_BARRIER ();
+      main_loop->invoke_write_fd = fds[1];
+    }
+  G_UNLOCK (invoke_fd);
+}
+
+static void
+wakeup_invoke_fd (GskMainLoop *main_loop)
+{
+  int fd = main_loop->invoke_write_fd;
+  ssize_t rv;
+  if (fd == main_loop->invoke_read_fd)
+    {
+      guint64 one = 1;
+      rv = write (fd, &one, sizeof (one));
+    }
+  else
+    {
+      guint8 one = 1;
+      rv = write (fd, &one, 1);
+    }
+
+  /* EAGAIN means the fd is already readable, so the main-loop
+     will wake up anyway. */
+  if (rv < 0 && errno != EAGAIN && !gsk_errno_is_ignorable (errno))
+    g_warning ("error waking main-loop: %s", g_strerror (errno));
+}
+
+static void
+push_invocation (GskMainLoop           *main_loop,
+                 GskMainLoopInvocation *invocation)
+{
+  GskMainLoopInvocation *old;
+  ensure_invoke_fd (main_loop);
+  do
+    {
+      old = g_atomic_pointer_get (&main_loop->invocations);
+      invocation->next = old;
+    }
+  while (!g_atomic_pointer_compare_and_exchange ((gpointer *) &main_loop->invocations,
+                                                 old, invocation));
+
+  /* Only the first function posted since the main-loop
+     last emptied the list needs to wake it up. */
+  if (old == NULL)
+    wakeup_invoke_fd (main_loop);
+}
+
+static void
+run_invocations (GskMainLoop *main_loop)
+{
+  GskMainLoopInvocation *list, *reversed = NULL;
+
+  /* take everything; it's a stack, so reverse it */
+  do
+    list = g_atomic_pointer_get (&main_loop->invocations);
+  while (list != NULL
+      && !g_atomic_pointer_compare_and_exchange ((gpointer *) &main_loop->invocations,
+                                                 list, NULL));
+  while (list != NULL)
+    {
+      GskMainLoopInvocation *next = list->next;
+      list->next = reversed;
+      reversed = list;
+      list = next;
+    }
+
+  while (reversed != NULL)
+    {
+      GskMainLoopInvocation *inv = reversed;
+      gboolean is_allocated = inv->is_allocated;
+      gpointer data = inv->data;
+      GDestroyNotify destroy = inv->destroy;
+      reversed = inv->next;
+
+      /* unless we allocated it, 'inv' may be freed by either of these */
+      (*inv->func) (data);
+      if (destroy != NULL)
+        (*destroy) (data);
+      if (is_allocated)
+        g_free (inv);
+    }
+}
+
+static gboolean
+handle_invoke_fd (int fd, GIOCondition condition, gpointer data)
+{
+  GskMainLoop *main_loop = data;
+  char buf[64];
+  ssize_t rv;
+
+  /* reset the wakeup before looking at the list,
+     so nothing can be missed */
+  while ((rv = read (fd, buf, sizeof (buf))) == sizeof (buf))
+    ;
+  /* a short read, like EAGAIN, means it is reset */
+  if (rv >= 0 || errno == EAGAIN)
+    gsk_source_io_would_block (main_loop->invoke_source, G_IO_IN);
+  run_invocations (main_loop);
+  return TRUE;
+}
+
+static void
+invoke_source_destroyed (gpointer data)
+{
+  GskMainLoop *main_loop = data;
+  main_loop->invoke_source = NULL;
+}
+
+static void
+setup_invoke_source (GskMainLoop *main_loop)
+{
+  ensure_invoke_fd (main_loop);
+  main_loop->invoke_source = gsk_main_loop_add_io (main_loop,
+                                                   main_loop->invoke_read_fd,
+                                                   G_IO_IN,
+                                                   handle_invoke_fd,
+                                                   main_loop,
+                                                   invoke_source_destroyed);
+}
+
+/**
+ * gsk_main_loop_post:
+ * @main_loop: the main-loop which should run the function.
+ * @invocation: the function to run, and its data.
+ *
+ * Like gsk_main_loop_invoke(), but the caller provides the
+ * memory for the invocation, typically embedded in @invocation->data,
+ * so that no allocation is needed.
+ * It must stay valid until @invocation->func is called;
+ * @invocation->func or @invocation->destroy may free it.
+ *
+ * This may be called from any thread.
+ */
+void
+gsk_main_loop_post (GskMainLoop           *main_loop,
+                    GskMainLoopInvocation *invocation)
+{
+  invocation->is_allocated = 0;
+  push_invocation (main_loop, invocation);
+}
+
+/**
+ * gsk_main_loop_invoke:
+ * @main_loop: the main-loop which should run the function.
+ * @func: the function to run.
+ * @data: data to pass to @func and @destroy.
+ * @destroy: optional function to call after @func.
+ *
+ * Arrange for @func to be called from @main_loop's thread,
+ * the next time it runs.  This is the way for other threads
+ * to hand work to a main-loop.
+ *
+ * Functions are run in the order they were invoked;
+ * any invoked in one iteration of the main-loop cost
+ * only one wakeup.
+ *
+ * This may be called from any thread.
+ */
+void
+gsk_main_loop_invoke (GskMainLoop          *main_loop,
+                      GskMainLoopInvokeFunc func,
+                      gpointer              data,
+                      GDestroyNotify        destroy)
+{
+  GskMainLoopInvocation *invocation = g_new (GskMainLoopInvocation, 1);
+  invocation->is_allocated = 1;
+  invocation->func = func;
+  invocation->data = data;
+  invocation->destroy = destroy;
+  push_invocation (main_loop, invocation);
+}
+
+/**
+ * gsk_main_loop_set_instrumented:
+ * @main_loop: the main-loop to instrument.
+ * @instrumented: whether to record timing statistics.
+ *
+ * Start or stop recording histograms of the wall time of each iteration,
+ * of the time spent blocked polling, of the number of events per wakeup,
+ * and of the time spent in each source's callback.
+ * Callbacks are grouped by the label given with gsk_source_set_label(),
+ * or else by the callback function.
+ *
+ * Stopping does not discard the statistics collected so far;
+ * use gsk_main_loop_reset_stats() for that.
+ */
+void
+gsk_main_loop_set_instrumented (GskMainLoop       *main_loop,
+                                gboolean           instrumented)
+{
+  if (instrumented && main_loop->stats == NULL)
+    {
+      MainLoopStats *stats = g_new0 (MainLoopStats, 1);
+      stats->sources_by_func = g_hash_table_new (NULL, NULL);
+      stats->sources_by_label = g_hash_table_new (NULL, NULL);
+      stats->sources = g_ptr_array_new ();
+      stats->start_stamp = stats_now ();
+      g_get_current_time (&stats->start_time);
+      main_loop->stats = stats;
+    }
+  main_loop->is_instrumented = instrumented ? 1 : 0;
+}
+
+/**
+ * gsk_main_loop_reset_stats:
+ * @main_loop: the main-loop whose statistics should be cleared.
+ *
+ * Zero all the histograms collected by an instrumented main-loop.
+ */
+void
+gsk_main_loop_reset_stats (GskMainLoop       *main_loop)
+{
+  MainLoopStats *stats = main_loop->stats;
+  guint i;
+  if (stats == NULL)
+    return;
+  memset (&stats->iteration, 0, sizeof (GskMainLoopHistogram));
+  memset (&stats->poll, 0, sizeof (GskMainLoopHistogram));
+  memset (&stats->events_per_wakeup, 0, sizeof (GskMainLoopHistogram));
+
+  /* sources keep pointers to their entries, so just zero them */
+  for (i = 0; i < stats->sources->len; i++)
+    {
+      SourceStats *source_stats = stats->sources->pdata[i];
+      memset (&source_stats->histogram, 0, sizeof (GskMainLoopHistogram));
+    }
+}
+
+/**
+ * gsk_main_loop_get_usecs_per_unit:
+ * @main_loop: the instrumented main-loop.
+ *
+ * Get the scale of the times in the main-loop's histograms.
+ * Where a cpu tick counter is available, this is measured
+ * over the time since instrumentation began, so it is
+ * imprecise for the first few milliseconds.
+ *
+ * returns: the number of microseconds per unit,
+ * or 0 if it is not yet known.
+ */
+gdouble
+gsk_main_loop_get_usecs_per_unit (GskMainLoop       *main_loop)
+{
+#ifdef HAVE_TICK_COUNTER
+  MainLoopStats *stats = main_loop->stats;
+  guint64 now;
+  GTimeVal tv;
+  gdouble dusecs;
+  if (stats == NULL)
+    return 0.0;
+  now = stats_now ();
+  g_get_current_time (&tv);
+  dusecs = ((gdouble) tv.tv_sec - stats->start_time.tv_sec) * 1e6
+         + ((gdouble) tv.tv_usec - stats->start_time.tv_usec);
+  if (now <= stats->start_stamp || dusecs <= 0)
+    return 0.0;
+  return dusecs / (gdouble) (now - stats->start_stamp);
+#else
+  return 1.0;
+#endif
+}
+
+static char *
+source_stats_get_name (SourceStats *source_stats)
+{
+  char *rv = NULL;
+#if HAVE_EXECINFO_H
+  char **symbols;
+#endif
+  if (source_stats->label != 0)
+    return g_strdup (g_quark_to_string (source_stats->label));
+#if HAVE_EXECINFO_H
+  /* symbols look like "binary(symbol+0x0) [0xaddress]" */
+  symbols = backtrace_symbols (&source_stats->func, 1);
+  if (symbols != NULL)
+    {
+      const char *start = strchr (symbols[0], '(');
+      const char *end = start ? strchr (start, '+') : NULL;
+      if (end != NULL && end > start + 1)
+        rv = g_strndup (start + 1, end - (start + 1));
+      free (symbols);
+    }
+#endif
+  if (rv == NULL)
+    rv = g_strdup_printf ("%p", source_stats->func);
+  return rv;
+}
+
+/**
+ * gsk_main_loop_foreach_stats:
+ * @main_loop: the instrumented main-loop.
+ * @func: function to call with each histogram.
+ * @data: data to pass to @func.
+ *
+ * Call @func with each histogram collected by the main-loop:
+ * "iteration", "poll" and "events-per-wakeup" first,
+ * then one for each source label or callback.
+ * "events-per-wakeup" is a count of events, not a time.
+ */
+void
+gsk_main_loop_foreach_stats (GskMainLoop       *main_loop,
+                             GskMainLoopStatsFunc func,
+                             gpointer           data)
+{
+  MainLoopStats *stats = main_loop->stats;
+  guint i;
+  if (stats == NULL)
+    return;
+  (*func) ("iteration", &stats->iteration, data);
+  (*func) ("poll", &stats->poll, data);
+  (*func) ("events-per-wakeup", &stats->events_per_wakeup, data);
+  for (i = 0; i < stats->sources->len; i++)
+    {
+      SourceStats *source_stats = stats->sources->pdata[i];
+      char *name = source_stats_get_name (source_stats);
+      (*func) (name, &source_stats->histogram, data);
+      g_free (name);
+    }
+}
+
+/* an upper bound on the given fraction of the values */
+static guint64
+histogram_get_percentile (const GskMainLoopHistogram *histogram,
+                          gdouble                     fraction)
+{
+  guint64 target = (guint64) (histogram->count * fraction + 0.5);
+  guint64 total = 0;
+  guint i;
+  if (target == 0)
+    target = 1;
+  for (i = 0; i < GSK_MAIN_LOOP_HISTOGRAM_N_BUCKETS - 1; i++)
+    {
+      total += histogram->buckets[i];
+      if (total >= target)
+        return i == 0 ? 0 : MIN (histogram->max, (G_GUINT64_CONSTANT (1) << i) - 1);
+    }
+  return histogram->max;
+}
+
+typedef struct
+{
+  GString *str;
+  gdouble usecs_per_unit;
+} StatsToStringInfo;
+
+static void
+append_histogram_to_string (const char                 *name,
+                            const GskMainLoopHistogram *histogram,
+                            gpointer                    data)
+{
+  StatsToStringInfo *info = data;
+  gdouble scale = info->usecs_per_unit;
+  if (strcmp (name, "events-per-wakeup") == 0)
+    scale = 1.0;		/* not a time */
+  if (histogram->count == 0)
+    g_string_append_printf (info->str, "%-32s count=0\n", name);
+  else
+    g_string_append_printf (info->str,
+                            "%-32s count=%" G_GUINT64_FORMAT
+                            " mean=%.2f p50<=%.2f p99<=%.2f max=%.2f\n",
+                            name, histogram->count,
+                            scale * histogram->total / histogram->count,
+                            scale * histogram_get_percentile (histogram, 0.50),
+                            scale * histogram_get_percentile (histogram, 0.99),
+                            scale * histogram->max);
+}
+
+/**
+ * gsk_main_loop_stats_to_string:
+ * @main_loop: the instrumented main-loop.
+ *
+ * Describe the main-loop's histograms in plain text,
+ * one line per histogram, with times in microseconds.
+ *
+ * returns: a newly allocated string.
+ */
+char *
+gsk_main_loop_stats_to_string (GskMainLoop       *main_loop)
+{
+  StatsToStringInfo info;
+  info.str = g_string_new ("");
+  info.usecs_per_unit = gsk_main_loop_get_usecs_per_unit (main_loop);
+  if (main_loop->stats == NULL)
+    g_string_append (info.str, "main-loop is not instrumented\n");
+  else
+    {
+      if (info.usecs_per_unit == 0)
+        {
+          g_string_append (info.str, "(times are in cpu ticks)\n");
+          info.usecs_per_unit = 1.0;
+        }
+      g_string_append_printf (info.str, "main-loop is %sinstrumented\n",
+                              main_loop->is_instrumented ? "" : "not ");
+      gsk_main_loop_foreach_stats (main_loop, append_histogram_to_string, &info);
+    }
+  return g_string_free (info.str, FALSE);
+}
+
+/**
+ * gsk_source_set_label:
+ * @source: the source to label.
+ * @label: the name to report the source's callback times under,
+ * or NULL to use the callback function's name.
+ *
+ * Group this source's callback times under @label
+ * in the main-loop's statistics, instead of under the name
+ * of its callback function.  This is useful for
+ * sources which share a callback, like those of #GskStreamFd.
+ */
+void
+gsk_source_set_label (GskSource         *source,
+                      const char        *label)
+{
+  source->label = label ? g_quark_from_string (label) : 0;
+  source->stats = NULL;
+}
+
 /**
  * gsk_main_loop_should_continue:
  * @main_loop: the main-loop to query.
@@ -1519,6 +2520,9 @@ gsk_main_loop_destroy_all_sources (GskMainLoop *main_loop)
   /* Destroy timers */
   while (main_loop->timers)
     gsk_source_remove (main_loop->timers);
+  for (i = 0; i < G_N_ELEMENTS (TIMER_WHEEL (main_loop)->lists); i++)
+    while (TIMER_WHEEL (main_loop)->lists[i] != NULL)
+      gsk_source_remove (TIMER_WHEEL (main_loop)->lists[i]);
 
   /* Destroy i/o handlers */
   for (i = 0; i < main_loop->read_sources->len; i++)
@@ -1580,11 +2584,16 @@ static void
 gsk_main_loop_finalize (GObject *object)
 {
   GskMainLoop *main_loop = GSK_MAIN_LOOP (object);
+  GskMainLoopInvocation *inv;
+  if (main_loop->thread_pool != NULL)
+    _gsk_thread_pool_destroy_sync (main_loop->thread_pool);
   gsk_main_loop_destroy_all_sources (main_loop);
 
   g_assert (main_loop->first_idle == NULL);
   g_assert (main_loop->last_idle == NULL);
   g_assert (main_loop->timers == NULL);
+  g_assert (timer_wheel_next_time (TIMER_WHEEL (main_loop)) == G_MAXINT64);
+  g_assert (TIMER_WHEEL (main_loop)->lists[TIMER_WHEEL_EXPIRED] == NULL);
   g_assert (g_hash_table_size (main_loop->process_source_lists) == 0);
   g_assert (main_loop->running_source == NULL);
   CHECK_INVARIANTS (main_loop);
@@ -1594,9 +2603,29 @@ gsk_main_loop_finalize (GObject *object)
   g_ptr_array_free (main_loop->write_sources, TRUE);
   g_ptr_array_free (main_loop->signal_source_lists, TRUE);
   g_free (main_loop->event_array_cache);
+  g_free (main_loop->timer_wheel);
 
   g_hash_table_destroy (main_loop->alive_pids);
 
+  /* functions which never got to run */
+  while ((inv = main_loop->invocations) != NULL)
+    {
+      main_loop->invocations = inv->next;
+      if (inv->destroy != NULL)
+        (*inv->destroy) (inv->data);
+      if (inv->is_allocated)
+        g_free (inv);
+    }
+  if (main_loop->invoke_write_fd >= 0)
+    {
+      if (main_loop->invoke_write_fd != main_loop->invoke_read_fd)
+        close (main_loop->invoke_write_fd);
+      close (main_loop->invoke_read_fd);
+    }
+
+  if (main_loop->stats != NULL)
+    free_stats (main_loop->stats);
+
   (*parent_class->finalize) (object);
 }
 
@@ -1613,6 +2642,9 @@ gsk_main_loop_init (GskMainLoop *main_loop)
   main_loop->max_events = INITIAL_MAX_EVENTS;
   main_loop->event_array_cache = g_new (GskMainLoopEvent, main_loop->max_events);
   gsk_main_loop_update_current_time (main_loop);
+  main_loop->timer_wheel = g_new0 (TimerWheel, 1);
+  TIMER_WHEEL (main_loop)->time = time_val_to_millis (&main_loop->current_time);
+  main_loop->invoke_read_fd = main_loop->invoke_write_fd = -1;
 }
 
 static void
@@ -1671,6 +2703,7 @@ GType gsk_main_loop_wait_info_get_type(void)
 #include "main-loops/gskmainloopkqueue.h"
 #include "main-loops/gskmainloopdevpoll.h"
 #include "main-loops/gskmainloopepoll.h"
+#include "main-loops/gskmainloopiouring.h"
 #include "main-loops/gskmainlooppoll.h"
 #include "main-loops/gskmainloopselect.h"
 
@@ -1679,23 +2712,31 @@ static struct
   GType (*get_type_func) () G_GNUC_CONST;
   const char *env_value;
   gboolean supports_threads;
+
+  /* if non-NULL, this must return TRUE before
+     the type is tried as a default */
+  gboolean (*probe_func) (void);
 } main_loop_types[] = {
+#if HAVE_IO_URING_SUPPORT
+  { gsk_main_loop_io_uring_get_type, "io-uring", TRUE, gsk_main_loop_io_uring_probe },
+#endif
 #if HAVE_EPOLL_SUPPORT
-  { gsk_main_loop_epoll_get_type,    "epoll",   TRUE  },
+  { gsk_main_loop_epoll_get_type,    "epoll",   TRUE,  NULL },
+  { gsk_main_loop_epoll_et_get_type, "epoll-et", TRUE, NULL },
 #endif
 #if HAVE_SYS_DEV_POLL
-  { gsk_main_loop_dev_poll_get_type, "devpoll", TRUE  },
+  { gsk_main_loop_dev_poll_get_type, "devpoll", TRUE,  NULL },
 #endif
 #if HAVE_KQUEUE
-  { gsk_main_loop_kqueue_get_type,   "kqueue",  FALSE },
+  { gsk_main_loop_kqueue_get_type,   "kqueue",  FALSE, NULL },
 #endif
 #if HAVE_POLL
-  { gsk_main_loop_poll_get_type,     "poll",    TRUE  },
+  { gsk_main_loop_poll_get_type,     "poll",    TRUE,  NULL },
 #endif
 #if HAVE_SELECT
-  { gsk_main_loop_select_get_type,   "select",  TRUE  },
+  { gsk_main_loop_select_get_type,   "select",  TRUE,  NULL },
 #endif
-  { NULL, NULL, FALSE }
+  { NULL, NULL, FALSE, NULL }
 };
 
 
@@ -1754,7 +2795,9 @@ gsk_main_loop_new (GskMainLoopCreateFlags create_flags)
   /* Try autoconf-detected defaults, in our preferred order. */
   for (i = 0; main_loop_types[i].get_type_func != NULL; i++)
     {
-      if (!threads || main_loop_types[i].supports_threads)
+      if ((!threads || main_loop_types[i].supports_threads)
+       && (main_loop_types[i].probe_func == NULL
+        || (*main_loop_types[i].probe_func) ()))
 	{
 	  GskMainLoop *main_loop;
 	  GskMainLoopClass *class;
@@ -1870,6 +2913,22 @@ _gsk_main_loop_fork_notify ()
     }
 }
 
+/* Destroy the calling thread's default main-loop now,
+   instead of when the thread exits.  The main-loop must not be
+   used afterward;  for threads that are about to exit. */
+void
+_gsk_main_loop_drop_default (void)
+{
+  if (gsk_init_get_support_threads ())
+    {
+      GskMainLoop *main_loop = g_private_get (private_main_loop_key);
+      if (main_loop == NULL)
+	return;
+      g_private_set (private_main_loop_key, NULL);
+      g_object_unref (main_loop);
+    }
+}
+
 /* --- initialization --- */
 void
 _gsk_main_loop_init (void)
@@ -36,6 +36,7 @@ typedef struct _GskMainLoop GskMainLoop;
 typedef struct _GskMainLoopWaitInfo GskMainLoopWaitInfo;
 typedef struct _GskSource GskSource;
 typedef struct _GskMainLoopContextList GskMainLoopContextList;
+typedef struct _GskMainLoopInvocation GskMainLoopInvocation;
 
 /* --- type macros --- */
 GType gsk_main_loop_get_type(void) G_GNUC_CONST;
@@ -115,6 +116,9 @@ struct _GskMainLoopClass
                       guint              max_events_out,
                       GskMainLoopEvent  *events,
                       gint               timeout);
+  void     (*io_would_block) (GskMainLoop  *main_loop,
+                              int           fd,
+                              GIOCondition  events);
 };
 
 struct _GskMainLoop 
@@ -127,6 +131,7 @@ struct _GskMainLoop
 
   /* timers */
   GskSource     *timers;
+  gpointer       timer_wheel;		/* coarse timers */
 
   /* i/o handlers by file-descriptor */
   GPtrArray     *read_sources;
@@ -152,6 +157,7 @@ struct _GskMainLoop
   guint          is_setup : 1;
   guint          is_running : 1;		/*< private >*/
   guint          quit : 1;			/*< public >*/
+  guint          is_instrumented : 1;	/*< private >*/
 
   gint		 exit_status;
 
@@ -161,6 +167,15 @@ struct _GskMainLoop
   /* a list of GMainContext's */
   GskMainLoopContextList *first_context;
   GskMainLoopContextList *last_context;
+
+  /* functions posted from other threads (a lock-free stack) */
+  GskMainLoopInvocation *volatile invocations;
+  int            invoke_read_fd;
+  volatile int   invoke_write_fd;	/* same as read fd for an eventfd */
+  GskSource     *invoke_source;
+
+  /* timing histograms:  see gsk_main_loop_set_instrumented() */
+  gpointer       stats;
 };
 
 /* --- Callback function typedefs. --- */
@@ -186,6 +201,23 @@ typedef gboolean (*GskMainLoopIOFunc)     (int                   fd,
                                            GIOCondition          condition,
                                            gpointer              user_data);
 
+/* callback for a function run by gsk_main_loop_invoke() */
+typedef void     (*GskMainLoopInvokeFunc) (gpointer              user_data);
+
+/* For gsk_main_loop_post():  embed this in your own structure
+   to avoid an allocation per call. */
+struct _GskMainLoopInvocation
+{
+  /*< private >*/
+  GskMainLoopInvocation *next;
+  guint                  is_allocated : 1;
+
+  /*< public >*/
+  GskMainLoopInvokeFunc  func;
+  gpointer               data;
+  GDestroyNotify         destroy;
+};
+
 
 /* --- prototypes --- */
 /* Create a main loop with selected options. */
@@ -232,6 +264,8 @@ void             gsk_source_add_io_events   (GskSource         *source,
                                              guint              events);
 void             gsk_source_remove_io_events(GskSource         *source,
                                              guint              events);
+void             gsk_source_io_would_block  (GskSource         *source,
+                                             guint              events);
 #define gsk_main_loop_add_timer gsk_main_loop_add_timer64
 #define gsk_source_adjust_timer gsk_source_adjust_timer64
 GskSource       *gsk_main_loop_add_timer    (GskMainLoop       *main_loop,
@@ -250,11 +284,65 @@ GskSource       *gsk_main_loop_add_timer_absolute
 void             gsk_source_adjust_timer    (GskSource         *timer_source,
                                              gint64             millis_expire,
                                              gint64             milli_period);
+
+/* Timers which may run up to millis_slack milliseconds late.
+ * They are much cheaper to add, adjust and remove
+ * than precise timers, so they suit timeouts which
+ * are usually reset or removed before they expire. */
+GskSource       *gsk_main_loop_add_timer_coarse
+                                            (GskMainLoop       *main_loop,
+                                             GskMainLoopTimeoutFunc timer_func,
+                                             gpointer           timer_data,
+                                             GDestroyNotify     timer_destroy,
+                                             gint64             millis_expire,
+                                             gint64             milli_period,
+                                             guint              millis_slack);
 void             gsk_source_remove          (GskSource         *source);
 void             gsk_main_loop_add_context  (GskMainLoop       *main_loop,
 					     GMainContext      *context);
 void             gsk_main_loop_quit         (GskMainLoop       *main_loop);
 
+/* Run a function in the main-loop's thread.
+ * These may be called from any thread. */
+void             gsk_main_loop_invoke       (GskMainLoop       *main_loop,
+                                             GskMainLoopInvokeFunc func,
+                                             gpointer           data,
+                                             GDestroyNotify     destroy);
+void             gsk_main_loop_post         (GskMainLoop       *main_loop,
+                                             GskMainLoopInvocation *invocation);
+
+/* Instrumentation:  log-scale histograms of how long
+ * each iteration, each poll and each callback take.
+ * Times are in the units given by gsk_main_loop_get_usecs_per_unit():
+ * cpu ticks where available, otherwise microseconds. */
+#define GSK_MAIN_LOOP_HISTOGRAM_N_BUCKETS	64
+typedef struct _GskMainLoopHistogram GskMainLoopHistogram;
+struct _GskMainLoopHistogram
+{
+  guint64 count;
+  guint64 total;
+  guint64 max;
+
+  /* bucket 0 counts zeroes; bucket i>0 counts values in [2^(i-1), 2^i) */
+  guint64 buckets[GSK_MAIN_LOOP_HISTOGRAM_N_BUCKETS];
+};
+typedef void (*GskMainLoopStatsFunc) (const char                 *name,
+                                      const GskMainLoopHistogram *histogram,
+                                      gpointer                    data);
+
+void             gsk_main_loop_set_instrumented
+                                            (GskMainLoop       *main_loop,
+                                             gboolean           instrumented);
+void             gsk_main_loop_reset_stats  (GskMainLoop       *main_loop);
+gdouble          gsk_main_loop_get_usecs_per_unit
+                                            (GskMainLoop       *main_loop);
+void             gsk_main_loop_foreach_stats(GskMainLoop       *main_loop,
+                                             GskMainLoopStatsFunc func,
+                                             gpointer           data);
+char            *gsk_main_loop_stats_to_string
+                                            (GskMainLoop       *main_loop);
+void             gsk_source_set_label       (GskSource         *source,
+                                             const char        *label);
 
 gboolean         gsk_main_loop_should_continue
                                             (GskMainLoop       *main_loop);
@@ -271,6 +359,7 @@ gboolean gsk_main_loop_do_waitpid (int                  pid,
 /*< private >*/
 void _gsk_main_loop_init ();
 void _gsk_main_loop_fork_notify ();
+void _gsk_main_loop_drop_default (void);
 
 /* for binary-compatibility, the library defines gsk_main_loop_add_timer()
    with native-int timeouts.  but people compiling with the latest version
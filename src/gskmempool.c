@@ -1,10 +1,20 @@
 #include "gskmempool.h"
+#include <stdlib.h>
 #include <string.h>
 
 #define ALIGN(size)	        _GSK_MEM_POOL_ALIGN(size)
 #define SLAB_GET_NEXT_PTR(slab) _GSK_MEM_POOL_SLAB_GET_NEXT_PTR(slab)
 #define CHUNK_SIZE	        8192
 
+/* fixed-size pools allocate slabs of about 16k, of 16 to 256 pieces */
+#define FIXED_SLAB_SIZE		16384
+#define FIXED_SLAB_MIN_PIECES	16
+#define FIXED_SLAB_MAX_PIECES	256
+#define FIXED_SLAB_N_PIECES(piece_size) \
+  CLAMP (FIXED_SLAB_SIZE / (piece_size), FIXED_SLAB_MIN_PIECES, FIXED_SLAB_MAX_PIECES)
+#define FIXED_SLAB_N_BYTES(piece_size) \
+  (FIXED_SLAB_N_PIECES (piece_size) * (piece_size) + sizeof (gpointer))
+
 /* --- Allocate-only Memory Pool --- */
 /**
  * gsk_mem_pool_construct:
@@ -179,8 +189,9 @@ gsk_mem_pool_fixed_construct (GskMemPoolFixed     *pool,
   pool->slab_list = NULL;
   pool->chunk = NULL;
   pool->pieces_left = 0;
-  pool->piece_size = MAX (ALIGN (size), sizeof (gpointer));
+  pool->piece_size = _GSK_MEM_POOL_FIXED_SIZE (size);
   pool->free_list = NULL;
+  pool->n_slabs = 0;
 }
 
 /**
@@ -202,12 +213,13 @@ gsk_mem_pool_fixed_alloc     (GskMemPoolFixed     *pool)
     }
   if (pool->pieces_left == 0)
     {
-      gpointer slab = g_malloc (256 * pool->piece_size + sizeof (gpointer));
+      gpointer slab = g_malloc (FIXED_SLAB_N_BYTES (pool->piece_size));
       SLAB_GET_NEXT_PTR (slab) = pool->slab_list;
       pool->slab_list = slab;
       pool->chunk = slab;
       pool->chunk += sizeof (gpointer);
-      pool->pieces_left = 256;
+      pool->pieces_left = FIXED_SLAB_N_PIECES (pool->piece_size);
+      pool->n_slabs++;
     }
   {
     gpointer rv = pool->chunk;
@@ -260,4 +272,744 @@ void     gsk_mem_pool_fixed_destruct  (GskMemPoolFixed     *pool)
       pool->slab_list = SLAB_GET_NEXT_PTR (kill);
       g_free (kill);
     }
+  pool->n_slabs = 0;
+}
+
+/* --- finding empty slabs --- */
+/* The pool does no bookkeeping per slab, so that alloc and free stay cheap.
+   Instead, the free pieces are counted per slab when needed,
+   by looking each one up in a sorted array of the slabs. */
+typedef struct _SlabInfo SlabInfo;
+struct _SlabInfo
+{
+  char *start;			/* first piece */
+  guint n_free;
+};
+
+typedef struct _SlabAnalysis SlabAnalysis;
+struct _SlabAnalysis
+{
+  guint n_slabs;
+  SlabInfo *slabs;		/* sorted by address */
+  guint n_pieces_per_slab;
+  guint n_free;
+  guint n_empty;
+};
+
+static int
+compare_slab_infos (gconstpointer a, gconstpointer b)
+{
+  const SlabInfo *A = a;
+  const SlabInfo *B = b;
+  return A->start < B->start ? -1 : A->start > B->start ? 1 : 0;
+}
+
+/* returns NULL for pieces not in a slab (eg. from a scratch-buffer) */
+static SlabInfo *
+find_slab (SlabAnalysis    *analysis,
+           GskMemPoolFixed *pool,
+           const char      *piece)
+{
+  guint start = 0, n = analysis->n_slabs;
+  gsize slab_bytes = analysis->n_pieces_per_slab * pool->piece_size;
+  while (n > 0)
+    {
+      guint mid = start + n / 2;
+      SlabInfo *info = analysis->slabs + mid;
+      if (piece < info->start)
+        n = mid - start;
+      else if (piece >= info->start + slab_bytes)
+        {
+          n -= mid + 1 - start;
+          start = mid + 1;
+        }
+      else
+        return info;
+    }
+  return NULL;
+}
+
+static void
+analyze_slabs (GskMemPoolFixed *pool,
+               SlabAnalysis    *analysis)
+{
+  gpointer at;
+  guint i;
+  SlabInfo *info;
+  analysis->n_slabs = 0;
+  analysis->slabs = g_new (SlabInfo, pool->n_slabs);
+  analysis->n_pieces_per_slab = FIXED_SLAB_N_PIECES (pool->piece_size);
+  analysis->n_free = 0;
+  analysis->n_empty = 0;
+  for (at = pool->slab_list; at != NULL; at = SLAB_GET_NEXT_PTR (at))
+    {
+      g_assert (analysis->n_slabs < pool->n_slabs);
+      info = analysis->slabs + analysis->n_slabs++;
+      info->start = (char *) at + sizeof (gpointer);
+      info->n_free = 0;
+    }
+  if (analysis->n_slabs > 1)
+    qsort (analysis->slabs, analysis->n_slabs, sizeof (SlabInfo), compare_slab_infos);
+
+  for (at = pool->free_list; at != NULL; at = SLAB_GET_NEXT_PTR (at))
+    {
+      info = find_slab (analysis, pool, at);
+      if (info != NULL)
+        info->n_free++;
+      analysis->n_free++;
+    }
+  if (pool->pieces_left > 0)
+    {
+      info = find_slab (analysis, pool, pool->chunk);
+      if (info != NULL)
+        info->n_free += pool->pieces_left;
+      analysis->n_free += pool->pieces_left;
+    }
+  for (i = 0; i < analysis->n_slabs; i++)
+    if (analysis->slabs[i].n_free == analysis->n_pieces_per_slab)
+      analysis->n_empty++;
+}
+
+/**
+ * gsk_mem_pool_fixed_trim:
+ * @pool: the pool to trim.
+ *
+ * Free the pool's slabs which have no pieces
+ * allocated from them.
+ *
+ * This takes time proportional to the number of free pieces,
+ * so it should be done occasionally, for example when
+ * the program is idle after a busy period.
+ */
+void
+gsk_mem_pool_fixed_trim (GskMemPoolFixed *pool)
+{
+  SlabAnalysis analysis;
+  gpointer *pnext;
+  gpointer at;
+  if (pool->n_slabs == 0)
+    return;
+  analyze_slabs (pool, &analysis);
+  if (analysis.n_empty == 0)
+    {
+      g_free (analysis.slabs);
+      return;
+    }
+
+  /* drop the empty slabs' pieces from the free list */
+  pnext = &pool->free_list;
+  while ((at = *pnext) != NULL)
+    {
+      SlabInfo *info = find_slab (&analysis, pool, at);
+      if (info != NULL && info->n_free == analysis.n_pieces_per_slab)
+        *pnext = SLAB_GET_NEXT_PTR (at);
+      else
+        pnext = &SLAB_GET_NEXT_PTR (at);
+    }
+  if (pool->pieces_left > 0)
+    {
+      SlabInfo *info = find_slab (&analysis, pool, pool->chunk);
+      if (info != NULL && info->n_free == analysis.n_pieces_per_slab)
+        {
+          pool->chunk = NULL;
+          pool->pieces_left = 0;
+        }
+    }
+
+  /* free the empty slabs */
+  pnext = &pool->slab_list;
+  while ((at = *pnext) != NULL)
+    {
+      SlabInfo *info = find_slab (&analysis, pool, (char *) at + sizeof (gpointer));
+      if (info->n_free == analysis.n_pieces_per_slab)
+        {
+          *pnext = SLAB_GET_NEXT_PTR (at);
+          g_free (at);
+          pool->n_slabs--;
+        }
+      else
+        pnext = &SLAB_GET_NEXT_PTR (at);
+    }
+  g_free (analysis.slabs);
+}
+
+/**
+ * gsk_mem_pool_fixed_get_stats:
+ * @pool: the pool to query.
+ * @stats_out: where to store the statistics.
+ *
+ * Find how much memory the pool holds, and how much of it is free.
+ * Like gsk_mem_pool_fixed_trim(), this looks at every free piece.
+ */
+void
+gsk_mem_pool_fixed_get_stats (GskMemPoolFixed *pool,
+                              GskMemPoolStats *stats_out)
+{
+  SlabAnalysis analysis;
+  analyze_slabs (pool, &analysis);
+  stats_out->n_slabs = pool->n_slabs;
+  stats_out->bytes_retained = (gsize) pool->n_slabs * FIXED_SLAB_N_BYTES (pool->piece_size);
+  stats_out->bytes_free = (gsize) analysis.n_free * pool->piece_size;
+  stats_out->n_empty_slabs = analysis.n_empty;
+  g_free (analysis.slabs);
+}
+
+/* === Size-Classed MemPool's === */
+static const guint16 sized_class_sizes[GSK_MEM_POOL_SIZED_N_CLASSES] =
+{ 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024 };
+
+/* the class of each size, in 16-byte steps */
+static guint8 sized_class_by_size16[GSK_MEM_POOL_SIZED_MAX / 16 + 1];
+static gboolean sized_classes_inited = FALSE;
+
+static void
+init_sized_classes (void)
+{
+  guint i, class = 0;
+  for (i = 0; i <= GSK_MEM_POOL_SIZED_MAX / 16; i++)
+    {
+      while (sized_class_sizes[class] < i * 16)
+        class++;
+      sized_class_by_size16[i] = class;
+    }
+  sized_classes_inited = TRUE;
+}
+
+#define SIZED_CLASS(size)  sized_class_by_size16[((size) + 15) / 16]
+
+/**
+ * gsk_mem_pool_sized_construct:
+ * @pool: the pool to initialize.
+ *
+ * Set up an allocator for small objects of varying sizes,
+ * which can be freed individually.
+ */
+void
+gsk_mem_pool_sized_construct (GskMemPoolSized *pool)
+{
+  guint i;
+  if (!sized_classes_inited)
+    init_sized_classes ();
+  for (i = 0; i < GSK_MEM_POOL_SIZED_N_CLASSES; i++)
+    gsk_mem_pool_fixed_construct (pool->classes + i, sized_class_sizes[i]);
+}
+
+/**
+ * gsk_mem_pool_sized_alloc:
+ * @pool: the pool to allocate from.
+ * @size: the number of bytes to allocate.
+ *
+ * Allocate memory from the pool's size-class for @size.
+ * Sizes over #GSK_MEM_POOL_SIZED_MAX use g_malloc().
+ *
+ * returns: the allocated memory.
+ */
+gpointer
+gsk_mem_pool_sized_alloc (GskMemPoolSized *pool,
+                          gsize            size)
+{
+  if (size > GSK_MEM_POOL_SIZED_MAX)
+    return g_malloc (size);
+  return gsk_mem_pool_fixed_alloc (pool->classes + SIZED_CLASS (size));
+}
+
+/**
+ * gsk_mem_pool_sized_alloc0:
+ * @pool: the pool to allocate from.
+ * @size: the number of bytes to allocate.
+ *
+ * Allocate memory from the pool, set to 0.
+ *
+ * returns: the allocated, zeroed memory.
+ */
+gpointer
+gsk_mem_pool_sized_alloc0 (GskMemPoolSized *pool,
+                           gsize            size)
+{
+  return memset (gsk_mem_pool_sized_alloc (pool, size), 0, size);
+}
+
+/**
+ * gsk_mem_pool_sized_free:
+ * @pool: the pool to return memory to.
+ * @from_pool: memory allocated from @pool.
+ * @size: the size that was passed to gsk_mem_pool_sized_alloc().
+ *
+ * Recycle memory back to the pool.
+ */
+void
+gsk_mem_pool_sized_free (GskMemPoolSized *pool,
+                         gpointer         from_pool,
+                         gsize            size)
+{
+  if (size > GSK_MEM_POOL_SIZED_MAX)
+    g_free (from_pool);
+  else
+    gsk_mem_pool_fixed_free (pool->classes + SIZED_CLASS (size), from_pool);
+}
+
+/**
+ * gsk_mem_pool_sized_trim:
+ * @pool: the pool to trim.
+ *
+ * Free the slabs of every size-class which
+ * have no pieces allocated from them.
+ * See gsk_mem_pool_fixed_trim().
+ */
+void
+gsk_mem_pool_sized_trim (GskMemPoolSized *pool)
+{
+  guint i;
+  for (i = 0; i < GSK_MEM_POOL_SIZED_N_CLASSES; i++)
+    gsk_mem_pool_fixed_trim (pool->classes + i);
+}
+
+/**
+ * gsk_mem_pool_sized_get_stats:
+ * @pool: the pool to query.
+ * @stats_out: where to store the statistics.
+ *
+ * Find how much memory the pool holds in all its size-classes,
+ * and how much of it is free.
+ * Memory for objects larger than #GSK_MEM_POOL_SIZED_MAX is not counted.
+ */
+void
+gsk_mem_pool_sized_get_stats (GskMemPoolSized *pool,
+                              GskMemPoolStats *stats_out)
+{
+  guint i;
+  memset (stats_out, 0, sizeof (GskMemPoolStats));
+  for (i = 0; i < GSK_MEM_POOL_SIZED_N_CLASSES; i++)
+    {
+      GskMemPoolStats class_stats;
+      gsk_mem_pool_fixed_get_stats (pool->classes + i, &class_stats);
+      stats_out->bytes_retained += class_stats.bytes_retained;
+      stats_out->bytes_free += class_stats.bytes_free;
+      stats_out->n_slabs += class_stats.n_slabs;
+      stats_out->n_empty_slabs += class_stats.n_empty_slabs;
+    }
+}
+
+/**
+ * gsk_mem_pool_sized_destruct:
+ * @pool: the pool to destroy.
+ *
+ * Free all memory associated with this pool.
+ * Objects larger than #GSK_MEM_POOL_SIZED_MAX
+ * must already have been freed.
+ */
+void
+gsk_mem_pool_sized_destruct (GskMemPoolSized *pool)
+{
+  guint i;
+  for (i = 0; i < GSK_MEM_POOL_SIZED_N_CLASSES; i++)
+    gsk_mem_pool_fixed_destruct (pool->classes + i);
+}
+
+/* === Per-Type Pools === */
+/* A thread keeps at most this many free pieces;
+   when it frees more (objects allocated by other threads, usually),
+   it gives all but a slab's worth to the shared pool. */
+#define TYPE_POOL_MAX_FREE(piece_size)	(2 * FIXED_SLAB_N_PIECES (piece_size))
+
+/* Each thread counts its allocations minus frees,
+   and adds them to the type's n_live when they reach this. */
+#define TYPE_POOL_LIVE_BATCH		32
+
+typedef struct _TypePoolThread TypePoolThread;
+struct _TypePoolThread
+{
+  GskTypePool *type_pool;
+  GskMemPoolFixed pool;
+  guint n_free;			/* length of pool.free_list */
+  gint n_live_delta;
+  guint64 n_allocs;
+  guint64 n_hits;
+  TypePoolThread *prev, *next;
+};
+
+static GskTypePool *first_registered_type_pool = NULL;
+G_LOCK_DEFINE_STATIC (registered_type_pools);
+
+static void
+register_type_pool (GskTypePool *type_pool)
+{
+  G_LOCK (registered_type_pools);
+  if (!type_pool->is_registered)
+    {
+      type_pool->next_registered = first_registered_type_pool;
+      first_registered_type_pool = type_pool;
+      type_pool->is_registered = TRUE;
+    }
+  G_UNLOCK (registered_type_pools);
+}
+
+static guint
+count_pieces (gpointer free_list)
+{
+  guint n = 0;
+  for (; free_list != NULL; free_list = SLAB_GET_NEXT_PTR (free_list))
+    n++;
+  return n;
+}
+
+static void
+update_peak (GskTypePool *type_pool,
+             gint         n_live)
+{
+  for (;;)
+    {
+      gint peak = g_atomic_int_get (&type_pool->n_peak);
+      if (n_live <= peak
+       || g_atomic_int_compare_and_exchange (&type_pool->n_peak, peak, n_live))
+        break;
+    }
+}
+
+static void
+flush_live_count (GskTypePool    *type_pool,
+                  TypePoolThread *thread)
+{
+  gint delta = thread->n_live_delta;
+  thread->n_live_delta = 0;
+  update_peak (type_pool,
+               g_atomic_int_exchange_and_add (&type_pool->n_live, delta) + delta);
+}
+
+/* give the 'n' pieces from 'first' to 'last' to the shared pool */
+static void
+give_free_pieces (GskTypePool *type_pool,
+                  gpointer     first,
+                  gpointer     last,
+                  guint        n)
+{
+  g_static_mutex_lock (&type_pool->lock);
+  SLAB_GET_NEXT_PTR (last) = type_pool->shared.free_list;
+  type_pool->shared.free_list = first;
+  type_pool->n_shared_free += n;
+  g_static_mutex_unlock (&type_pool->lock);
+}
+
+/* keep a slab's worth of the thread's free pieces,
+   the most recently freed ones, and give away the rest */
+static void
+release_free_pieces (GskTypePool    *type_pool,
+                     TypePoolThread *thread)
+{
+  guint n_keep = FIXED_SLAB_N_PIECES (type_pool->size);
+  gpointer last_kept = thread->pool.free_list;
+  gpointer first, last;
+  guint i;
+  for (i = 1; i < n_keep; i++)
+    last_kept = SLAB_GET_NEXT_PTR (last_kept);
+  first = last = SLAB_GET_NEXT_PTR (last_kept);
+  SLAB_GET_NEXT_PTR (last_kept) = NULL;
+  while (SLAB_GET_NEXT_PTR (last) != NULL)
+    last = SLAB_GET_NEXT_PTR (last);
+  give_free_pieces (type_pool, first, last, thread->n_free - n_keep);
+  thread->n_free = n_keep;
+}
+
+/* when a thread exits, give its memory to the shared pool:
+   pieces it allocated may still be in use. */
+static void
+type_pool_thread_destroy (gpointer data)
+{
+  TypePoolThread *thread = data;
+  GskTypePool *type_pool = thread->type_pool;
+  GskMemPoolFixed *pool = &thread->pool;
+
+  flush_live_count (type_pool, thread);
+
+  /* the rest of the current slab goes on the free list */
+  while (pool->pieces_left > 0)
+    {
+      gpointer piece = pool->chunk;
+      pool->chunk += pool->piece_size;
+      pool->pieces_left--;
+      gsk_mem_pool_fixed_free (pool, piece);
+      thread->n_free++;
+    }
+
+  if (pool->free_list != NULL)
+    {
+      gpointer last = pool->free_list;
+      while (SLAB_GET_NEXT_PTR (last) != NULL)
+        last = SLAB_GET_NEXT_PTR (last);
+      give_free_pieces (type_pool, pool->free_list, last, thread->n_free);
+    }
+
+  g_static_mutex_lock (&type_pool->lock);
+  if (pool->slab_list != NULL)
+    {
+      gpointer last = pool->slab_list;
+      while (SLAB_GET_NEXT_PTR (last) != NULL)
+        last = SLAB_GET_NEXT_PTR (last);
+      SLAB_GET_NEXT_PTR (last) = type_pool->shared.slab_list;
+      type_pool->shared.slab_list = pool->slab_list;
+      type_pool->shared.n_slabs += pool->n_slabs;
+    }
+  type_pool->n_allocs += thread->n_allocs;
+  type_pool->n_hits += thread->n_hits;
+  if (thread->prev == NULL)
+    type_pool->threads = thread->next;
+  else
+    thread->prev->next = thread->next;
+  if (thread->next != NULL)
+    thread->next->prev = thread->prev;
+  g_static_mutex_unlock (&type_pool->lock);
+  g_free (thread);
+}
+
+static TypePoolThread *
+get_type_pool_thread (GskTypePool *type_pool)
+{
+  TypePoolThread *thread = g_static_private_get (&type_pool->thread_key);
+  if (G_UNLIKELY (thread == NULL))
+    {
+      thread = g_new0 (TypePoolThread, 1);
+      thread->type_pool = type_pool;
+      gsk_mem_pool_fixed_construct (&thread->pool, type_pool->size);
+      g_static_mutex_lock (&type_pool->lock);
+      thread->next = type_pool->threads;
+      if (thread->next != NULL)
+        thread->next->prev = thread;
+      type_pool->threads = thread;
+      g_static_mutex_unlock (&type_pool->lock);
+      g_static_private_set (&type_pool->thread_key, thread,
+                            type_pool_thread_destroy);
+    }
+  return thread;
+}
+
+/**
+ * gsk_type_pool_alloc:
+ * @pool: the pool to allocate an object from.
+ *
+ * Allocate an object from the calling thread's pool.
+ * The memory is not initialized.
+ *
+ * returns: the allocated memory.
+ */
+gpointer
+gsk_type_pool_alloc (GskTypePool *pool)
+{
+  gpointer rv;
+  if (G_UNLIKELY (!pool->is_registered))
+    register_type_pool (pool);
+  if (!g_thread_supported ())
+    {
+      GskMemPoolFixed *fixed = &pool->shared;
+      if (fixed->free_list != NULL)
+        {
+          pool->n_hits++;
+          pool->n_shared_free--;
+        }
+      pool->n_allocs++;
+      rv = gsk_mem_pool_fixed_alloc (fixed);
+      update_peak (pool, ++pool->n_live);
+    }
+  else
+    {
+      TypePoolThread *thread = get_type_pool_thread (pool);
+      GskMemPoolFixed *fixed = &thread->pool;
+      if (fixed->free_list == NULL && fixed->pieces_left == 0
+       && pool->shared.free_list != NULL)
+        {
+          /* take the memory given away by other threads
+             before allocating more */
+          g_static_mutex_lock (&pool->lock);
+          fixed->free_list = pool->shared.free_list;
+          thread->n_free = pool->n_shared_free;
+          pool->shared.free_list = NULL;
+          pool->n_shared_free = 0;
+          g_static_mutex_unlock (&pool->lock);
+        }
+      if (fixed->free_list != NULL)
+        {
+          thread->n_hits++;
+          thread->n_free--;
+        }
+      thread->n_allocs++;
+      rv = gsk_mem_pool_fixed_alloc (fixed);
+      if (++thread->n_live_delta >= TYPE_POOL_LIVE_BATCH)
+        flush_live_count (pool, thread);
+    }
+  return rv;
+}
+
+/**
+ * gsk_type_pool_free:
+ * @pool: the pool to return memory to.
+ * @from_pool: memory allocated with gsk_type_pool_alloc()
+ * from this pool, maybe in another thread.
+ *
+ * Recycle an object into the calling thread's pool.
+ * If that pool has too much free memory,
+ * some of it goes to the shared pool.
+ */
+void
+gsk_type_pool_free (GskTypePool *pool,
+                    gpointer     from_pool)
+{
+  if (!g_thread_supported ())
+    {
+      gsk_mem_pool_fixed_free (&pool->shared, from_pool);
+      pool->n_shared_free++;
+      pool->n_live--;
+    }
+  else
+    {
+      TypePoolThread *thread = get_type_pool_thread (pool);
+      gsk_mem_pool_fixed_free (&thread->pool, from_pool);
+      if (++thread->n_free > TYPE_POOL_MAX_FREE (pool->size))
+        release_free_pieces (pool, thread);
+      if (--thread->n_live_delta <= -TYPE_POOL_LIVE_BATCH)
+        flush_live_count (pool, thread);
+    }
+}
+
+/**
+ * gsk_type_pool_get_stats:
+ * @pool: the pool to query.
+ * @stats_out: where to store the statistics.
+ *
+ * Get the number of objects allocated from the pool,
+ * and how many of those allocations reused a freed object.
+ * Other threads' counts may be slightly out-of-date.
+ */
+void
+gsk_type_pool_get_stats (GskTypePool      *pool,
+                         GskTypePoolStats *stats_out)
+{
+  TypePoolThread *thread;
+  guint n_slabs;
+  gint n_live;
+  stats_out->name = pool->name;
+  stats_out->size = pool->size;
+  n_live = g_atomic_int_get (&pool->n_live);
+  stats_out->n_peak = g_atomic_int_get (&pool->n_peak);
+  g_static_mutex_lock (&pool->lock);
+  stats_out->n_allocs = pool->n_allocs;
+  stats_out->n_hits = pool->n_hits;
+  n_slabs = pool->shared.n_slabs;
+  for (thread = pool->threads; thread != NULL; thread = thread->next)
+    {
+      n_live += thread->n_live_delta;
+      stats_out->n_allocs += thread->n_allocs;
+      stats_out->n_hits += thread->n_hits;
+      n_slabs += thread->pool.n_slabs;
+    }
+  g_static_mutex_unlock (&pool->lock);
+  stats_out->n_live = MAX (n_live, 0);
+  stats_out->n_peak = MAX (stats_out->n_peak, stats_out->n_live);
+  stats_out->bytes_retained = (gsize) n_slabs
+                            * FIXED_SLAB_N_BYTES (pool->shared.piece_size);
+}
+
+/**
+ * gsk_type_pool_foreach_stats:
+ * @func: function to call with each pool's statistics.
+ * @data: data to pass to @func.
+ *
+ * Get the statistics of every pool that
+ * has allocated an object.
+ */
+void
+gsk_type_pool_foreach_stats (GskTypePoolStatsFunc func,
+                             gpointer             data)
+{
+  GskTypePool *at;
+  G_LOCK (registered_type_pools);
+  at = first_registered_type_pool;
+  G_UNLOCK (registered_type_pools);
+
+  /* pools are only ever added to the front of the list */
+  for (; at != NULL; at = at->next_registered)
+    {
+      GskTypePoolStats stats;
+      gsk_type_pool_get_stats (at, &stats);
+      (*func) (&stats, data);
+    }
+}
+
+static void
+append_stats_to_string (const GskTypePoolStats *stats,
+                        gpointer                data)
+{
+  g_string_append_printf ((GString *) data,
+                          "%-32s size=%u live=%u peak=%u allocs=%" G_GUINT64_FORMAT
+                          " hit-rate=%.1f%% retained=%u unused=%.1f%%\n",
+                          stats->name, (guint) stats->size,
+                          stats->n_live, stats->n_peak, stats->n_allocs,
+                          stats->n_allocs ? 100.0 * stats->n_hits / stats->n_allocs
+                                          : 100.0,
+                          (guint) stats->bytes_retained,
+                          stats->bytes_retained
+                            ? 100.0 - 100.0 * stats->n_live * stats->size
+                                              / stats->bytes_retained
+                            : 0.0);
+}
+
+/**
+ * gsk_type_pool_stats_to_string:
+ *
+ * Describe every pool's statistics in plain text,
+ * one line per type.
+ *
+ * returns: a newly allocated string.
+ */
+char *
+gsk_type_pool_stats_to_string (void)
+{
+  GString *str = g_string_new ("");
+  gsk_type_pool_foreach_stats (append_stats_to_string, str);
+  return g_string_free (str, FALSE);
+}
+
+/**
+ * gsk_type_pool_trim:
+ * @pool: the pool to trim.
+ *
+ * Free the slabs of the calling thread's pool,
+ * and of the memory of exited threads,
+ * which have no objects allocated from them.
+ * Slabs in other threads' pools are not affected:
+ * each thread should trim its own pools.
+ */
+void
+gsk_type_pool_trim (GskTypePool *pool)
+{
+  if (g_thread_supported ())
+    {
+      TypePoolThread *thread = g_static_private_get (&pool->thread_key);
+      if (thread != NULL)
+        {
+          gsk_mem_pool_fixed_trim (&thread->pool);
+          thread->n_free = count_pieces (thread->pool.free_list);
+        }
+    }
+  g_static_mutex_lock (&pool->lock);
+  gsk_mem_pool_fixed_trim (&pool->shared);
+  pool->n_shared_free = count_pieces (pool->shared.free_list);
+  g_static_mutex_unlock (&pool->lock);
+}
+
+/**
+ * gsk_type_pool_trim_all:
+ *
+ * Trim every pool declared with GSK_DECLARE_POOL_ALLOCATORS()
+ * (that has been used), as with gsk_type_pool_trim().
+ * A program may call this when it becomes idle,
+ * to give back the memory used during a busy period.
+ */
+void
+gsk_type_pool_trim_all (void)
+{
+  GskTypePool *at;
+  G_LOCK (registered_type_pools);
+  at = first_registered_type_pool;
+  G_UNLOCK (registered_type_pools);
+  for (; at != NULL; at = at->next_registered)
+    gsk_type_pool_trim (at);
 }
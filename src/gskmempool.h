@@ -7,6 +7,10 @@ G_BEGIN_DECLS
 
 typedef struct _GskMemPool GskMemPool;
 typedef struct _GskMemPoolFixed GskMemPoolFixed;
+typedef struct _GskMemPoolSized GskMemPoolSized;
+typedef struct _GskMemPoolStats GskMemPoolStats;
+typedef struct _GskTypePool GskTypePool;
+typedef struct _GskTypePoolStats GskTypePoolStats;
 
 /* --- Allocate-only Memory Pool --- */
 struct _GskMemPool
@@ -44,10 +48,11 @@ struct _GskMemPoolFixed
   guint pieces_left;
   guint piece_size;
   gpointer free_list;
+  guint n_slabs;
 };
 
 #define GSK_MEM_POOL_FIXED_STATIC_INIT(size) \
-                          { NULL, NULL, 0, size, NULL } 
+                          { NULL, NULL, 0, size, NULL, 0 } 
 
 G_INLINE_FUNC void     gsk_mem_pool_fixed_construct_with_scratch_buf
                                                  (GskMemPoolFixed *pool,
@@ -62,6 +67,112 @@ void     gsk_mem_pool_fixed_free      (GskMemPoolFixed  *pool,
                                        gpointer          from_pool);
 void     gsk_mem_pool_fixed_destruct  (GskMemPoolFixed  *pool);
 
+/* Memory held by a pool, for GskMemPoolFixed and GskMemPoolSized.
+   The free bytes include pieces of slabs never yet handed out. */
+struct _GskMemPoolStats
+{
+  gsize bytes_retained;		/* in slabs */
+  gsize bytes_free;		/* free within those slabs */
+  guint n_slabs;
+  guint n_empty_slabs;		/* which trimming would release */
+};
+
+/* Give slabs with no allocated pieces back to the system.
+   This takes time proportional to the number of free pieces,
+   so it is best done when idle. */
+void     gsk_mem_pool_fixed_trim      (GskMemPoolFixed  *pool);
+void     gsk_mem_pool_fixed_get_stats (GskMemPoolFixed  *pool,
+                                       GskMemPoolStats  *stats_out);
+
+/* --- Allocate and free Memory Pool of small objects of any size --- */
+/* Objects up to GSK_MEM_POOL_SIZED_MAX bytes are taken from
+   a GskMemPoolFixed for their size-class; larger ones are malloced.
+   Like g_slice_free1(), freeing requires the size allocated. */
+#define GSK_MEM_POOL_SIZED_N_CLASSES	12
+#define GSK_MEM_POOL_SIZED_MAX		1024
+struct _GskMemPoolSized
+{
+  /*< private >*/
+  GskMemPoolFixed classes[GSK_MEM_POOL_SIZED_N_CLASSES];
+};
+
+void     gsk_mem_pool_sized_construct (GskMemPoolSized  *pool);
+gpointer gsk_mem_pool_sized_alloc     (GskMemPoolSized  *pool,
+                                       gsize             size);
+gpointer gsk_mem_pool_sized_alloc0    (GskMemPoolSized  *pool,
+                                       gsize             size);
+void     gsk_mem_pool_sized_free      (GskMemPoolSized  *pool,
+                                       gpointer          from_pool,
+                                       gsize             size);
+void     gsk_mem_pool_sized_trim      (GskMemPoolSized  *pool);
+void     gsk_mem_pool_sized_get_stats (GskMemPoolSized  *pool,
+                                       GskMemPoolStats  *stats_out);
+void     gsk_mem_pool_sized_destruct  (GskMemPoolSized  *pool);
+
+/* --- Per-Type Pools --- */
+/* A GskMemPoolFixed for each thread, for objects of one type.
+ * Memory freed by a thread is reused by that thread, up to a limit:
+ * beyond that, and when a thread exits, its free memory goes
+ * to the type's shared pool, from which other threads take
+ * memory before allocating more.
+ * The memory is never returned to the system.
+ * Usually these are declared with GSK_DECLARE_POOL_ALLOCATORS(). */
+struct _GskTypePool
+{
+  /*< private >*/
+  const char *name;
+  gsize size;
+  gboolean is_registered;
+  GskTypePool *next_registered;
+
+  GStaticMutex lock;
+  GStaticPrivate thread_key;
+  gpointer threads;
+
+  /* used when threads are not enabled, and for the
+     memory of threads that have exited (protected by lock) */
+  GskMemPoolFixed shared;
+  guint n_shared_free;
+  guint64 n_allocs;
+  guint64 n_hits;
+
+  /* each thread adds its allocations minus frees here in batches */
+  volatile gint n_live;
+  volatile gint n_peak;
+};
+
+#define GSK_TYPE_POOL_STATIC_INIT(name, size)                           \
+  { name, size, FALSE, NULL, G_STATIC_MUTEX_INIT, G_STATIC_PRIVATE_INIT,\
+    NULL, GSK_MEM_POOL_FIXED_STATIC_INIT (_GSK_MEM_POOL_FIXED_SIZE (size)),\
+    0, 0, 0, 0, 0 }
+
+struct _GskTypePoolStats
+{
+  const char *name;
+  gsize size;
+  guint n_live;
+  guint n_peak;			/* may be low by a few objects per thread */
+  guint64 n_allocs;
+  guint64 n_hits;		/* allocations which reused a freed object */
+  gsize bytes_retained;		/* in the slabs of all threads */
+};
+typedef void (*GskTypePoolStatsFunc) (const GskTypePoolStats *stats,
+                                      gpointer                data);
+
+gpointer gsk_type_pool_alloc          (GskTypePool      *pool);
+void     gsk_type_pool_free           (GskTypePool      *pool,
+                                       gpointer          from_pool);
+void     gsk_type_pool_get_stats      (GskTypePool      *pool,
+                                       GskTypePoolStats *stats_out);
+void     gsk_type_pool_foreach_stats  (GskTypePoolStatsFunc func,
+                                       gpointer          data);
+char    *gsk_type_pool_stats_to_string(void);
+
+/* Trim the calling thread's pool, and the memory of exited threads.
+   gsk_type_pool_trim_all() does that for every type. */
+void     gsk_type_pool_trim           (GskTypePool      *pool);
+void     gsk_type_pool_trim_all       (void);
+
 
 
 /* private */
@@ -75,6 +186,8 @@ gpointer gsk_mem_pool_must_alloc (GskMemPool *pool,
   (((size) + sizeof(gpointer) - 1) / sizeof (gpointer) * sizeof (gpointer))
 #define _GSK_MEM_POOL_SLAB_GET_NEXT_PTR(slab) \
   (* (gpointer*) (slab))
+#define _GSK_MEM_POOL_FIXED_SIZE(size) \
+  MAX (_GSK_MEM_POOL_ALIGN (size), sizeof (gpointer))
 
 #if defined(G_CAN_INLINE) || defined(GSK_INTERNAL_IMPLEMENT_INLINES)
 G_INLINE_FUNC void     gsk_mem_pool_construct    (GskMemPool     *pool)
@@ -150,6 +263,7 @@ G_INLINE_FUNC void     gsk_mem_pool_fixed_construct_with_scratch_buf
   pool->pieces_left = buffer_n_elements;
   pool->piece_size = elt_size;
   pool->free_list = NULL;
+  pool->n_slabs = 0;
 }
 
 #endif /* G_CAN_INLINE */
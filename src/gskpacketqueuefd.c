@@ -63,6 +63,18 @@ gsk_packet_queue_fd_bind (GskPacketQueue    *queue,
   return TRUE;
 }
 
+/* EAGAIN: tell an edge-triggered main-loop to stop
+   reporting the fd as readable (or writable) */
+static inline void
+note_would_block (GskPacketQueueFd *queue_fd,
+                  GIOCondition      events)
+{
+#if !USE_GLIB_MAIN_LOOP
+  if (queue_fd->source != NULL)
+    gsk_source_io_would_block (queue_fd->source, events);
+#endif
+}
+
 static GskPacket *
 gsk_packet_queue_fd_read (GskPacketQueue    *queue,
 			  gboolean           save_address,
@@ -87,6 +99,8 @@ gsk_packet_queue_fd_read (GskPacketQueue    *queue,
   if (rv < 0)
     {
       int e = errno;
+      if (e == EAGAIN)
+        note_would_block (queue_fd, G_IO_IN);
       if (!gsk_errno_is_ignorable (e))
 	g_set_error (error, GSK_G_ERROR_DOMAIN,
 		     gsk_error_code_from_errno (e),
@@ -139,6 +153,8 @@ gsk_packet_queue_fd_write (GskPacketQueue    *queue,
   if (rv < 0)
     {
       int e = errno;
+      if (e == EAGAIN)
+        note_would_block (queue_fd, G_IO_OUT);
       if (!gsk_errno_is_ignorable (e))
 	g_set_error (error, GSK_G_ERROR_DOMAIN,
 		     gsk_error_code_from_errno (e),
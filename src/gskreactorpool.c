@@ -0,0 +1,427 @@
+#include "gskreactorpool.h"
+#include "gskstreamlistenersocket.h"
+#include "gskerrno.h"
+#include "gskerror.h"
+#include "gskghelpers.h"
+#include "gskinit.h"
+#include "gskutils.h"
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+
+typedef struct _Reactor Reactor;
+typedef struct _SharedListener SharedListener;
+
+struct _Reactor
+{
+  GskReactorPool *pool;
+  guint index;
+  GThread *thread;
+  int quit_read_fd;
+  int quit_write_fd;
+
+  /* made by gsk_reactor_pool_listen() in this reactor's thread;
+     they are unreferenced when it stops. */
+  GSList *listeners;
+};
+
+/* When SO_REUSEPORT is not available, all the reactors
+   accept() from (duplicates of) the same socket. */
+struct _SharedListener
+{
+  GskSocketAddress *address;
+  int fd;
+};
+
+struct _GskReactorPool
+{
+  guint n_reactors;
+  Reactor *reactors;
+  gboolean is_running;
+  gboolean can_reuse_port;
+
+  GMutex *lock;
+  GCond *setup_done;
+  guint n_setup_done;
+  GError *setup_error;
+  GskReactorSetupFunc setup;
+  gpointer setup_data;
+
+  GSList *shared_listeners;
+};
+
+static GStaticPrivate current_reactor_key = G_STATIC_PRIVATE_INIT;
+
+/* a byte, or end-of-file, on the pipe means quit */
+static gboolean
+handle_quit (int fd, GIOCondition condition, gpointer data)
+{
+  char buf[16];
+  if (read (fd, buf, sizeof (buf)) < 0)
+    {
+      if (gsk_errno_is_ignorable (errno))
+        return TRUE;
+      g_warning ("error reading reactor's quit pipe: %s", g_strerror (errno));
+    }
+  gsk_main_loop_quit (GSK_MAIN_LOOP (data));
+  return TRUE;
+}
+
+static gpointer
+reactor_thread_func (gpointer data)
+{
+  Reactor *reactor = data;
+  GskReactorPool *pool = reactor->pool;
+  GskMainLoop *main_loop = gsk_main_loop_default ();
+  GskSource *quit_source;
+  GError *error = NULL;
+  gboolean ok;
+
+  g_static_private_set (&current_reactor_key, reactor, NULL);
+  quit_source = gsk_main_loop_add_io (main_loop, reactor->quit_read_fd,
+                                      G_IO_IN, handle_quit, main_loop, NULL);
+  ok = (*pool->setup) (pool, reactor->index, pool->setup_data, &error);
+
+  g_mutex_lock (pool->lock);
+  if (!ok && pool->setup_error == NULL)
+    {
+      if (error == NULL)
+        error = g_error_new (GSK_G_ERROR_DOMAIN, GSK_ERROR_UNKNOWN,
+                             "setting up reactor %u failed", reactor->index);
+      pool->setup_error = error;
+      error = NULL;
+    }
+  pool->n_setup_done++;
+  g_cond_broadcast (pool->setup_done);
+  g_mutex_unlock (pool->lock);
+  if (error != NULL)
+    g_error_free (error);
+
+  if (ok)
+    while (gsk_main_loop_should_continue (main_loop))
+      gsk_main_loop_run (main_loop, -1, NULL);
+
+  /* Tear down in this thread, since the listeners'
+     sources belong to its main-loop. */
+  gsk_source_remove (quit_source);
+  while (reactor->listeners != NULL)
+    {
+      GskStreamListener *listener = reactor->listeners->data;
+      reactor->listeners = g_slist_remove (reactor->listeners, listener);
+      g_object_unref (listener);
+    }
+  _gsk_main_loop_drop_default ();
+  g_static_private_set (&current_reactor_key, NULL, NULL);
+  return NULL;
+}
+
+static void
+stop_reactors (GskReactorPool *pool,
+               guint           n_started)
+{
+  guint i;
+  for (i = 0; i < n_started; i++)
+    {
+      Reactor *reactor = pool->reactors + i;
+      guint8 dummy = 0;
+      while (write (reactor->quit_write_fd, &dummy, 1) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          /* the reactor will see end-of-file instead */
+          g_warning ("error writing reactor's quit pipe: %s", g_strerror (errno));
+          close (reactor->quit_write_fd);
+          reactor->quit_write_fd = -1;
+          break;
+        }
+    }
+  for (i = 0; i < n_started; i++)
+    {
+      Reactor *reactor = pool->reactors + i;
+      g_thread_join (reactor->thread);
+      reactor->thread = NULL;
+      close (reactor->quit_read_fd);
+      if (reactor->quit_write_fd >= 0)
+        close (reactor->quit_write_fd);
+    }
+  pool->is_running = FALSE;
+}
+
+/**
+ * gsk_reactor_pool_new:
+ * @n_reactors: number of threads to run, or 0 to use one per CPU.
+ *
+ * Create a pool of reactors:  each reactor is a thread
+ * running its own default #GskMainLoop.
+ * The pool does nothing until gsk_reactor_pool_start() is called.
+ *
+ * GSK must have been initialized with thread support.
+ *
+ * returns: the new pool.
+ */
+GskReactorPool *
+gsk_reactor_pool_new (guint n_reactors)
+{
+  GskReactorPool *pool;
+  g_return_val_if_fail (gsk_init_get_support_threads (), NULL);
+  if (n_reactors == 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+      long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      n_reactors = n_cpus > 0 ? n_cpus : 1;
+#else
+      n_reactors = 1;
+#endif
+    }
+  pool = g_new0 (GskReactorPool, 1);
+  pool->n_reactors = n_reactors;
+  pool->reactors = g_new0 (Reactor, n_reactors);
+  pool->lock = g_mutex_new ();
+  pool->setup_done = g_cond_new ();
+
+#ifdef SO_REUSEPORT
+  {
+    int fd = socket (PF_INET, SOCK_STREAM, 0);
+    if (fd >= 0)
+      {
+        int one = 1;
+        pool->can_reuse_port = setsockopt (fd, SOL_SOCKET, SO_REUSEPORT,
+                                           &one, sizeof (one)) == 0;
+        close (fd);
+      }
+  }
+#endif
+  return pool;
+}
+
+/**
+ * gsk_reactor_pool_get_n_reactors:
+ * @pool: the pool to query.
+ *
+ * returns: the number of reactor threads the pool runs.
+ */
+guint
+gsk_reactor_pool_get_n_reactors (GskReactorPool *pool)
+{
+  return pool->n_reactors;
+}
+
+/**
+ * gsk_reactor_pool_start:
+ * @pool: the pool to start.
+ * @setup: function to run in each reactor's thread before
+ * it starts running its main-loop.
+ * @setup_data: data to pass to @setup.
+ * @error: where to put an error if any setup function failed.
+ *
+ * Start all the reactor threads, and wait for
+ * them to run @setup.
+ *
+ * @setup should create the servers for its reactor:
+ * anything it creates uses gsk_main_loop_default(),
+ * which is that reactor's main-loop.
+ * Use gsk_reactor_pool_listen() to get a listener for each reactor.
+ *
+ * If any setup function fails, the pool is stopped
+ * and the first error is returned.
+ *
+ * returns: whether all the reactors were set up.
+ */
+gboolean
+gsk_reactor_pool_start (GskReactorPool     *pool,
+                        GskReactorSetupFunc setup,
+                        gpointer            setup_data,
+                        GError            **error)
+{
+  guint n_started;
+  g_return_val_if_fail (!pool->is_running, FALSE);
+  pool->setup = setup;
+  pool->setup_data = setup_data;
+  pool->n_setup_done = 0;
+  pool->is_running = TRUE;
+
+  for (n_started = 0; n_started < pool->n_reactors; n_started++)
+    {
+      Reactor *reactor = pool->reactors + n_started;
+      int fds[2];
+      reactor->pool = pool;
+      reactor->index = n_started;
+      if (pipe (fds) < 0)
+        {
+          int e = errno;
+          g_set_error (error, GSK_G_ERROR_DOMAIN, gsk_error_code_from_errno (e),
+                       "error creating pipe for reactor: %s", g_strerror (e));
+          break;
+        }
+      gsk_fd_set_close_on_exec (fds[0], TRUE);
+      gsk_fd_set_close_on_exec (fds[1], TRUE);
+      gsk_fd_set_nonblocking (fds[0]);
+      reactor->quit_read_fd = fds[0];
+      reactor->quit_write_fd = fds[1];
+      reactor->thread = g_thread_create (reactor_thread_func, reactor, TRUE, error);
+      if (reactor->thread == NULL)
+        {
+          close (fds[0]);
+          close (fds[1]);
+          break;
+        }
+    }
+
+  g_mutex_lock (pool->lock);
+  while (pool->n_setup_done < n_started)
+    g_cond_wait (pool->setup_done, pool->lock);
+  g_mutex_unlock (pool->lock);
+
+  if (n_started < pool->n_reactors || pool->setup_error != NULL)
+    {
+      if (pool->setup_error != NULL)
+        {
+          g_propagate_error (error, pool->setup_error);
+          pool->setup_error = NULL;
+        }
+      stop_reactors (pool, n_started);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/**
+ * gsk_reactor_pool_stop:
+ * @pool: the pool to stop.
+ *
+ * Make each reactor's main-loop quit, and wait for its thread to exit.
+ * Each reactor's listeners from gsk_reactor_pool_listen()
+ * and its main-loop are destroyed before its thread exits.
+ * Objects that a reactor's setup function created
+ * should not be used after this.
+ */
+void
+gsk_reactor_pool_stop (GskReactorPool *pool)
+{
+  if (pool->is_running)
+    stop_reactors (pool, pool->n_reactors);
+}
+
+/**
+ * gsk_reactor_pool_free:
+ * @pool: the pool to free.
+ *
+ * Stop the pool if it is running, and free it.
+ */
+void
+gsk_reactor_pool_free (GskReactorPool *pool)
+{
+  gsk_reactor_pool_stop (pool);
+  while (pool->shared_listeners != NULL)
+    {
+      SharedListener *shared = pool->shared_listeners->data;
+      pool->shared_listeners = g_slist_remove (pool->shared_listeners, shared);
+      close (shared->fd);
+      g_object_unref (shared->address);
+      g_free (shared);
+    }
+  g_mutex_free (pool->lock);
+  g_cond_free (pool->setup_done);
+  g_free (pool->reactors);
+  g_free (pool);
+}
+
+static GskStreamListener *
+make_listener (GskReactorPool   *pool,
+               GskSocketAddress *address,
+               GError          **error)
+{
+  GskStreamListener *listener;
+  SharedListener *shared = NULL;
+  GSList *at;
+  int fd;
+
+  if (pool->can_reuse_port && !GSK_IS_SOCKET_ADDRESS_LOCAL (address))
+    return gsk_stream_listener_socket_new_bind_full (address,
+                                                     GSK_STREAM_LISTENER_SOCKET_REUSE_PORT,
+                                                     error);
+
+  g_mutex_lock (pool->lock);
+  for (at = pool->shared_listeners; at != NULL; at = at->next)
+    if (gsk_socket_address_equals (((SharedListener *) at->data)->address, address))
+      {
+        shared = at->data;
+        break;
+      }
+  if (shared == NULL)
+    {
+      listener = gsk_stream_listener_socket_new_bind (address, error);
+      if (listener != NULL)
+        {
+          fd = dup (GSK_STREAM_LISTENER_SOCKET (listener)->fd);
+          if (fd < 0)
+            {
+              int e = errno;
+              g_mutex_unlock (pool->lock);
+              g_object_unref (listener);
+              g_set_error (error, GSK_G_ERROR_DOMAIN, gsk_error_code_from_errno (e),
+                           "error duplicating listening socket: %s", g_strerror (e));
+              return NULL;
+            }
+          gsk_fd_set_close_on_exec (fd, TRUE);
+          shared = g_new (SharedListener, 1);
+          shared->address = g_object_ref (address);
+          shared->fd = fd;
+          pool->shared_listeners = g_slist_prepend (pool->shared_listeners, shared);
+        }
+      g_mutex_unlock (pool->lock);
+      return listener;
+    }
+  fd = dup (shared->fd);
+  g_mutex_unlock (pool->lock);
+
+  if (fd < 0)
+    {
+      int e = errno;
+      g_set_error (error, GSK_G_ERROR_DOMAIN, gsk_error_code_from_errno (e),
+                   "error duplicating listening socket: %s", g_strerror (e));
+      return NULL;
+    }
+  gsk_fd_set_close_on_exec (fd, TRUE);
+  return gsk_stream_listener_socket_new_from_fd (fd, error);
+}
+
+/**
+ * gsk_reactor_pool_listen:
+ * @pool: the pool whose reactor is calling.
+ * @address: the address to listen on.
+ * @error: where to put an error if the listener cannot be created.
+ *
+ * Create a listener for the calling reactor's main-loop,
+ * which should be called from a #GskReactorSetupFunc.
+ * Each reactor should call this with the same address.
+ *
+ * Where SO_REUSEPORT is available, each reactor binds
+ * its own socket, and the kernel distributes new connections
+ * between them.  Otherwise (and for local-socket addresses)
+ * the first reactor binds the socket and all the
+ * reactors accept connections from it.
+ *
+ * The listener belongs to the pool, and is
+ * unreferenced when the reactor stops;  ref it to keep it longer.
+ *
+ * returns: a new listener.
+ */
+GskStreamListener *
+gsk_reactor_pool_listen (GskReactorPool   *pool,
+                         GskSocketAddress *address,
+                         GError          **error)
+{
+  Reactor *reactor = g_static_private_get (&current_reactor_key);
+  GskStreamListener *listener;
+
+  g_return_val_if_fail (reactor != NULL && reactor->pool == pool, NULL);
+  listener = make_listener (pool, address, error);
+  if (listener != NULL)
+    reactor->listeners = g_slist_prepend (reactor->listeners, listener);
+  return listener;
+}
+
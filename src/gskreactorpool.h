@@ -0,0 +1,40 @@
+#ifndef __GSK_REACTOR_POOL_H_
+#define __GSK_REACTOR_POOL_H_
+
+#include "gskmainloop.h"
+#include "gskstreamlistener.h"
+#include "gsksocketaddress.h"
+
+G_BEGIN_DECLS
+
+/* A GskReactorPool runs a number of threads,
+   each running its own default GskMainLoop.
+   Since GSK objects are not thread-safe,
+   each reactor gets its own servers;  they are created
+   by a setup function which runs in every reactor's thread. */
+typedef struct _GskReactorPool GskReactorPool;
+
+typedef gboolean (*GskReactorSetupFunc) (GskReactorPool *pool,
+                                         guint           index,
+                                         gpointer        data,
+                                         GError        **error);
+
+GskReactorPool    *gsk_reactor_pool_new           (guint               n_reactors);
+guint              gsk_reactor_pool_get_n_reactors(GskReactorPool     *pool);
+gboolean           gsk_reactor_pool_start         (GskReactorPool     *pool,
+                                                   GskReactorSetupFunc setup,
+                                                   gpointer            setup_data,
+                                                   GError            **error);
+void               gsk_reactor_pool_stop          (GskReactorPool     *pool);
+void               gsk_reactor_pool_free          (GskReactorPool     *pool);
+
+/* For use by setup functions:  a listener for the calling reactor
+   that shares 'address' with the other reactors.
+   The pool unrefs it when the reactor stops. */
+GskStreamListener *gsk_reactor_pool_listen        (GskReactorPool     *pool,
+                                                   GskSocketAddress   *address,
+                                                   GError            **error);
+
+G_END_DECLS
+
+#endif
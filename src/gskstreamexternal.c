@@ -47,6 +47,8 @@ gsk_stream_external_raw_write (GskStream     *stream,
       int rv = write (external->write_fd, data, length);
       if (rv < 0)
 	{
+	  if (errno == EAGAIN)
+	    gsk_source_io_would_block (external->write_source, G_IO_OUT);
 	  if (gsk_errno_is_ignorable (errno))
 	    {
 	      to_buffer = length;
@@ -117,6 +119,8 @@ gsk_stream_external_raw_write_buffer (GskStream    *stream,
       int rv = gsk_buffer_writev (buffer, external->write_fd);
       if (rv < 0)
 	{
+	  if (errno == EAGAIN)
+	    gsk_source_io_would_block (external->write_source, G_IO_OUT);
 	  if (gsk_errno_is_ignorable (errno))
 	    return 0;
 	  g_set_error (error, GSK_G_ERROR_DOMAIN,
@@ -289,6 +293,8 @@ handle_read_fd_ready (int                   fd,
   rv = gsk_buffer_read_in_fd (&external->read_buffer, fd);
   if (rv < 0)
     {
+      if (errno == EAGAIN)
+        gsk_source_io_would_block (external->read_source, G_IO_IN);
       if (gsk_errno_is_ignorable (errno))
 	{
 	  return TRUE;
@@ -346,6 +352,8 @@ handle_write_fd_ready (int                   fd,
   rv = gsk_buffer_writev (&external->write_buffer, fd);
   if (rv < 0)
     {
+      if (errno == EAGAIN)
+        gsk_source_io_would_block (external->write_source, G_IO_OUT);
       if (gsk_errno_is_ignorable (errno))
 	{
 	  return TRUE;
@@ -408,6 +416,8 @@ handle_read_err_fd_ready (int                   fd,
   rv = gsk_buffer_read_in_fd (&external->read_err_buffer, fd);
   if (rv < 0)
     {
+      if (errno == EAGAIN)
+        gsk_source_io_would_block (external->read_err_source, G_IO_IN);
       if (gsk_errno_is_ignorable (errno))
 	{
 	  return TRUE;
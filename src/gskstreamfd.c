@@ -306,6 +306,19 @@ gsk_stream_fd_set_poll_write  (GskIO         *io,
 }
 
 /* --- reading and writing --- */
+
+/* EAGAIN: tell an edge-triggered main-loop to stop
+   reporting the fd as readable (or writable) */
+static inline void
+note_would_block (GskStreamFd  *stream_fd,
+                  GIOCondition  events)
+{
+#if !USE_GLIB_MAIN_LOOP
+  if (stream_fd->source != NULL)
+    gsk_source_io_would_block (stream_fd->source, events);
+#endif
+}
+
 static guint
 gsk_stream_fd_raw_read        (GskStream     *stream,
 			       gpointer       data,
@@ -317,6 +330,8 @@ gsk_stream_fd_raw_read        (GskStream     *stream,
   if (rv < 0)
     {
       gint e = errno;
+      if (e == EAGAIN)
+        note_would_block (stream_fd, G_IO_IN);
       if (gsk_errno_is_ignorable (e))
 	return 0;
       if (e == ECONNRESET)
@@ -352,6 +367,8 @@ gsk_stream_fd_raw_write       (GskStream     *stream,
   if (rv < 0)
     {
       gint e = errno;
+      if (e == EAGAIN)
+        note_would_block (stream_fd, G_IO_OUT);
       if (gsk_errno_is_ignorable (e))
 	return 0;
       if (e == ECONNRESET)
@@ -384,6 +401,8 @@ gsk_stream_fd_raw_read_buffer(GskStream    *stream,
   if (rv < 0)
     {
       gint e = errno;
+      if (e == EAGAIN)
+        note_would_block (stream_fd, G_IO_IN);
       if (gsk_errno_is_ignorable (e))
 	return 0;
       g_set_error (error, GSK_G_ERROR_DOMAIN,
@@ -412,6 +431,8 @@ gsk_stream_fd_raw_write_buffer (GskStream     *stream,
   if (rv < 0)
     {
       gint e = errno;
+      if (e == EAGAIN)
+        note_would_block (stream_fd, G_IO_OUT);
       if (gsk_errno_is_ignorable (e))
 	return 0;
       g_set_error (error, GSK_G_ERROR_DOMAIN,
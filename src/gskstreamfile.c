@@ -0,0 +1,383 @@
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gskstreamfile.h"
+#include "gskerrno.h"
+#include "gskutils.h"
+#include "gskmacros.h"
+
+G_DEFINE_TYPE(GskStreamFile, gsk_stream_file, GSK_TYPE_STREAM);
+
+#define DEFAULT_READ_SIZE	(64*1024)
+#define DEFAULT_MAX_READS	4
+#define DEFAULT_READ_AHEAD	(256*1024)
+
+struct _GskStreamFileRead
+{
+  GskStreamFile *file;
+  int fd;
+  guint64 offset;
+  guint length;
+
+  /* set by the thread that does the read */
+  char *data;
+  guint n_read;
+  int error_no;
+
+  gboolean is_done;
+  GskStreamFileRead *next;
+
+  /* one for the file's list of reads, one for the thread-pool task */
+  guint ref_count;
+};
+
+static void maybe_start_reads (GskStreamFile *file);
+
+static void
+close_fd (GskStreamFile *file)
+{
+  if (file->fd >= 0)
+    {
+      close (file->fd);
+      file->fd = -1;
+    }
+}
+
+static void
+update_idle_notify (GskStreamFile *file)
+{
+  if (file->buffer.size > 0 || file->got_eof)
+    gsk_io_mark_idle_notify_read (file);
+  else
+    gsk_io_clear_idle_notify_read (file);
+}
+
+/* --- reading in the thread-pool --- */
+static gpointer
+run_read (gpointer run_data)
+{
+  GskStreamFileRead *read = run_data;
+  read->data = g_malloc (read->length);
+  while (read->n_read < read->length)
+    {
+      gssize rv = pread (read->fd, read->data + read->n_read,
+                         read->length - read->n_read,
+                         read->offset + read->n_read);
+      if (rv < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          read->error_no = errno;
+          break;
+        }
+      if (rv == 0)
+        break;
+      read->n_read += rv;
+    }
+  return read;
+}
+
+static void
+unref_read (GskStreamFileRead *read)
+{
+  if (--(read->ref_count) > 0)
+    return;
+  g_free (read->data);
+  g_object_unref (read->file);
+  g_free (read);
+}
+
+/* Reads may finish out of order:  each read is kept
+   until all the reads before it are done too. */
+static void
+take_done_reads (GskStreamFile *file)
+{
+  GskStreamFileRead *read;
+  while (file->first_read != NULL && file->first_read->is_done)
+    {
+      read = file->first_read;
+      file->first_read = read->next;
+      if (file->first_read == NULL)
+        file->last_read = NULL;
+      file->n_reads--;
+
+      if (file->is_closed || file->got_eof)
+        {
+          unref_read (read);
+          continue;
+        }
+      if (read->n_read > 0)
+        {
+          gsk_buffer_append_foreign (&file->buffer, read->data, read->n_read,
+                                     g_free, read->data);
+          read->data = NULL;
+        }
+      if (read->error_no != 0 && read->n_read == 0)
+        {
+          gsk_io_set_error (GSK_IO (file), GSK_IO_ERROR_READ,
+                            gsk_error_code_from_errno (read->error_no),
+                            "error reading file: %s",
+                            g_strerror (read->error_no));
+          file->got_eof = 1;
+        }
+      else if (read->n_read < read->length
+            || read->offset + read->n_read >= file->file_size)
+        file->got_eof = 1;
+      unref_read (read);
+    }
+}
+
+static void
+handle_read_done (gpointer run_data, gpointer result_data)
+{
+  GskStreamFileRead *read = run_data;
+  GskStreamFile *file = g_object_ref (read->file);
+  read->is_done = TRUE;
+  take_done_reads (file);
+
+  if (file->is_closed)
+    {
+      if (file->n_reads == 0)
+        close_fd (file);
+    }
+  else
+    {
+      update_idle_notify (file);
+      maybe_start_reads (file);
+    }
+  g_object_unref (file);
+}
+
+/* If the thread-pool is destroyed before handle_read_done() runs,
+   the stream ends at this read. */
+static void
+destroy_read (gpointer run_data, gpointer result_data)
+{
+  GskStreamFileRead *read = run_data;
+  if (!read->is_done)
+    {
+      GskStreamFile *file = g_object_ref (read->file);
+      if (read->n_read == 0)
+        read->error_no = ECANCELED;
+      read->is_done = TRUE;
+      take_done_reads (file);
+      if (file->is_closed && file->n_reads == 0)
+        close_fd (file);
+      g_object_unref (file);
+    }
+  unref_read (read);
+}
+
+/* Keep up to max_reads reads going, as long as that
+   doesn't buffer more than read_ahead bytes. */
+static void
+maybe_start_reads (GskStreamFile *file)
+{
+  while (!file->is_closed
+      && !file->got_eof
+      && file->next_offset < file->file_size
+      && file->n_reads < file->max_reads
+      && file->buffer.size + file->n_reads * file->read_size < file->read_ahead)
+    {
+      GskStreamFileRead *read = g_new (GskStreamFileRead, 1);
+      read->file = g_object_ref (file);
+      read->fd = file->fd;
+      read->offset = file->next_offset;
+      read->length = MIN (file->read_size, file->file_size - file->next_offset);
+      read->data = NULL;
+      read->n_read = 0;
+      read->error_no = 0;
+      read->is_done = FALSE;
+      read->next = NULL;
+      read->ref_count = 2;
+      if (file->last_read == NULL)
+        file->first_read = read;
+      else
+        file->last_read->next = read;
+      file->last_read = read;
+      file->n_reads++;
+      file->next_offset += read->length;
+      gsk_thread_pool_push (file->thread_pool, run_read, handle_read_done,
+                            read, destroy_read);
+    }
+}
+
+/* --- GskStream methods --- */
+static void
+after_buffer_read (GskStreamFile *file)
+{
+  if (file->buffer.size == 0 && file->got_eof)
+    gsk_io_notify_read_shutdown (file);
+  else
+    {
+      update_idle_notify (file);
+      maybe_start_reads (file);
+    }
+}
+
+static guint
+gsk_stream_file_raw_read (GskStream     *stream,
+                          gpointer       data,
+                          guint          length,
+                          GError       **error)
+{
+  GskStreamFile *file = GSK_STREAM_FILE (stream);
+  guint rv = gsk_buffer_read (&file->buffer, data, length);
+  after_buffer_read (file);
+  return rv;
+}
+
+static guint
+gsk_stream_file_raw_read_buffer (GskStream     *stream,
+                                 GskBuffer     *buffer,
+                                 GError       **error)
+{
+  GskStreamFile *file = GSK_STREAM_FILE (stream);
+  guint rv = gsk_buffer_drain (buffer, &file->buffer);
+  after_buffer_read (file);
+  return rv;
+}
+
+/* --- GskIO methods --- */
+static void
+gsk_stream_file_set_poll_read (GskIO      *io,
+                               gboolean    do_poll)
+{
+  /* Nothing to do:  the read-hook is idle-notified
+     whenever there is data (or end-of-file). */
+}
+
+static gboolean
+gsk_stream_file_shutdown_read (GskIO      *io,
+                               GError    **error)
+{
+  return TRUE;
+}
+
+static void
+gsk_stream_file_close (GskIO *io)
+{
+  GskStreamFile *file = GSK_STREAM_FILE (io);
+  file->is_closed = 1;
+  gsk_buffer_destruct (&file->buffer);
+
+  /* the fd is closed once the reads in progress are done */
+  if (file->n_reads == 0)
+    close_fd (file);
+}
+
+/* --- GObject methods --- */
+static void
+gsk_stream_file_finalize (GObject *object)
+{
+  GskStreamFile *file = GSK_STREAM_FILE (object);
+  g_assert (file->n_reads == 0);
+  close_fd (file);
+  gsk_buffer_destruct (&file->buffer);
+  G_OBJECT_CLASS (gsk_stream_file_parent_class)->finalize (object);
+}
+
+static void
+gsk_stream_file_init (GskStreamFile *file)
+{
+  file->fd = -1;
+  file->read_size = DEFAULT_READ_SIZE;
+  file->max_reads = DEFAULT_MAX_READS;
+  file->read_ahead = DEFAULT_READ_AHEAD;
+  gsk_stream_mark_is_readable (file);
+}
+
+static void
+gsk_stream_file_class_init (GskStreamFileClass *class)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (class);
+  GskIOClass *io_class = GSK_IO_CLASS (class);
+  GskStreamClass *stream_class = GSK_STREAM_CLASS (class);
+  object_class->finalize = gsk_stream_file_finalize;
+  io_class->set_poll_read = gsk_stream_file_set_poll_read;
+  io_class->shutdown_read = gsk_stream_file_shutdown_read;
+  io_class->close = gsk_stream_file_close;
+  stream_class->raw_read = gsk_stream_file_raw_read;
+  stream_class->raw_read_buffer = gsk_stream_file_raw_read_buffer;
+}
+
+/**
+ * gsk_stream_file_new:
+ * @filename: regular file to open for reading.
+ * @error: optional error return value.
+ *
+ * Open a regular file for reading as a #GskStream.
+ *
+ * Unlike gsk_stream_fd_new_read_file(), the reads are done
+ * in the thread-pool from gsk_thread_pool_default(),
+ * so the main-loop never blocks waiting for the disk.
+ * The stream ends at the size the file had when it was opened.
+ *
+ * returns: a new read-only GskStream, or NULL if the file
+ * could not be opened or is not a regular file.
+ */
+GskStream *
+gsk_stream_file_new (const char     *filename,
+                     GError        **error)
+{
+  GskStreamFile *file;
+  struct stat stat_buf;
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    {
+      int e = errno;
+      gsk_errno_fd_creation_failed_errno (e);
+      g_set_error (error, GSK_G_ERROR_DOMAIN,
+                   gsk_error_code_from_errno (e),
+                   "error opening %s: %s",
+                   filename, g_strerror (e));
+      return NULL;
+    }
+  if (fstat (fd, &stat_buf) < 0 || !S_ISREG (stat_buf.st_mode))
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN,
+                   GSK_ERROR_INVALID_ARGUMENT,
+                   "%s is not a regular file", filename);
+      close (fd);
+      return NULL;
+    }
+  gsk_fd_set_close_on_exec (fd, TRUE);
+
+  file = g_object_new (GSK_TYPE_STREAM_FILE, NULL);
+  file->fd = fd;
+  file->file_size = stat_buf.st_size;
+  file->thread_pool = gsk_thread_pool_default ();
+  if (file->file_size == 0)
+    file->got_eof = 1;
+  update_idle_notify (file);
+  maybe_start_reads (file);
+  return GSK_STREAM (file);
+}
+
+/**
+ * gsk_stream_file_set_read_ahead:
+ * @file: the file stream to tune.
+ * @read_size: number of bytes to read at once.
+ * @max_reads: maximum number of reads to do at once.
+ * @read_ahead: maximum number of bytes to have buffered and being read.
+ *
+ * Change how much of the file is read before it is needed.
+ * Larger values use more memory, but make it less likely
+ * that the reader has to wait for the disk.
+ * Reads already started are not affected.
+ */
+void
+gsk_stream_file_set_read_ahead (GskStreamFile  *file,
+                                guint           read_size,
+                                guint           max_reads,
+                                guint           read_ahead)
+{
+  g_return_if_fail (read_size > 0 && max_reads > 0);
+  file->read_size = read_size;
+  file->max_reads = max_reads;
+  file->read_ahead = MAX (read_ahead, read_size);
+  maybe_start_reads (file);
+}
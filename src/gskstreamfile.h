@@ -0,0 +1,68 @@
+#ifndef __GSK_STREAM_FILE_H_
+#define __GSK_STREAM_FILE_H_
+
+typedef struct _GskStreamFileClass GskStreamFileClass;
+typedef struct _GskStreamFile GskStreamFile;
+
+#include "gskstream.h"
+#include "gskthreadpool.h"
+
+G_BEGIN_DECLS
+
+/* A read-only stream of a regular file.
+   The reads are done by a thread-pool, so that
+   a read that must wait for the disk does not block the main-loop.
+   Up to 'max_reads' reads of 'read_size' bytes are done at once,
+   keeping at most 'read_ahead' bytes buffered or being read. */
+
+GType gsk_stream_file_get_type(void) G_GNUC_CONST;
+#define GSK_TYPE_STREAM_FILE              (gsk_stream_file_get_type ())
+#define GSK_STREAM_FILE(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GSK_TYPE_STREAM_FILE, GskStreamFile))
+#define GSK_STREAM_FILE_CLASS(klass)      (G_TYPE_CHECK_CLASS_CAST ((klass), GSK_TYPE_STREAM_FILE, GskStreamFileClass))
+#define GSK_STREAM_FILE_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS ((obj), GSK_TYPE_STREAM_FILE, GskStreamFileClass))
+#define GSK_IS_STREAM_FILE(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GSK_TYPE_STREAM_FILE))
+#define GSK_IS_STREAM_FILE_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE ((klass), GSK_TYPE_STREAM_FILE))
+
+typedef struct _GskStreamFileRead GskStreamFileRead;
+
+struct _GskStreamFileClass
+{
+  GskStreamClass base_class;
+};
+struct _GskStreamFile
+{
+  GskStream base_instance;
+
+  /*< public read-only >*/
+  guint64 file_size;		/* as of when the file was opened */
+
+  /*< private >*/
+  int fd;
+  GskThreadPool *thread_pool;
+  guint read_size;
+  guint max_reads;
+  guint read_ahead;
+
+  /* data read, but not yet read from the stream */
+  GskBuffer buffer;
+
+  /* reads being done, in file order */
+  GskStreamFileRead *first_read;
+  GskStreamFileRead *last_read;
+  guint n_reads;
+  guint64 next_offset;
+
+  guint got_eof : 1;
+  guint is_closed : 1;
+};
+
+GskStream *gsk_stream_file_new            (const char     *filename,
+                                           GError        **error);
+void       gsk_stream_file_set_read_ahead (GskStreamFile  *file,
+                                           guint           read_size,
+                                           guint           max_reads,
+                                           guint           read_ahead);
+
+G_END_DECLS
+
+#endif
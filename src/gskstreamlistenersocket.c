@@ -29,6 +29,7 @@ enum
   PROP_FILE_DESCRIPTOR,
   PROP_LISTENING_ADDRESS,
   PROP_MAY_REUSE_ADDRESS,
+  PROP_MAY_REUSE_PORT,
 
   /* anytime before finalize, only for local addresses */
   PROP_UNLINK_WHEN_DONE
@@ -69,6 +70,11 @@ handle_input_event (GskStreamListenerSocket *listener)
   if (accept_fd < 0)
     {
       int e = errno;
+#if !USE_GLIB_MAIN_LOOP
+      /* nothing more to accept, for an edge-triggered main-loop */
+      if (e == EAGAIN && listener->source != NULL)
+        gsk_source_io_would_block (listener->source, G_IO_IN);
+#endif
       if (gsk_errno_is_ignorable (e))
         return;
       gsk_errno_fd_creation_failed_errno (e);
@@ -238,6 +244,10 @@ gsk_stream_listener_socket_set_property (GObject         *object,
       socket->may_reuse_address = g_value_get_boolean (value);
       return;
 
+    case PROP_MAY_REUSE_PORT:
+      socket->may_reuse_port = g_value_get_boolean (value);
+      return;
+
     case PROP_UNLINK_WHEN_DONE:
       if (g_value_get_boolean (value))
         {
@@ -277,6 +287,10 @@ gsk_stream_listener_socket_get_property (GObject        *object,
       g_value_set_boolean (value, socket->may_reuse_address);
       return;
 
+    case PROP_MAY_REUSE_PORT:
+      g_value_set_boolean (value, socket->may_reuse_port);
+      return;
+
     case PROP_UNLINK_WHEN_DONE:
       g_value_set_boolean (value, socket->unlink_when_done);
       return;
@@ -392,6 +406,33 @@ try_init_fd (GskStreamListenerSocket *listener_socket)
 		 g_strerror (errno));
     }
 
+  if (listener_socket->may_reuse_port)
+    {
+      /* let other sockets bind the same port;
+         the kernel spreads the connections between them */
+#ifdef SO_REUSEPORT
+      int one = 1;
+      int e = 0;
+      if (setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof (one)) < 0)
+        e = errno;
+#else
+      int e = ENOPROTOOPT;
+#endif
+      if (e != 0)
+        {
+          char *addr_str = gsk_socket_address_to_string (address);
+          gsk_stream_listener_notify_error (listener,
+            g_error_new (GSK_G_ERROR_DOMAIN,
+                         gsk_error_code_from_errno (e),
+                         _("SO_REUSEPORT failed when creating a listener (%s): %s"),
+                         addr_str,
+                         g_strerror (e)));
+          g_free (addr_str);
+          close (fd);
+          return FALSE;
+        }
+    }
+
   if (GSK_IS_SOCKET_ADDRESS_LOCAL (address) && may_reuse_address)
     _gsk_socket_address_local_maybe_delete_stale_socket (address);
 
@@ -525,6 +566,14 @@ gsk_stream_listener_socket_class_init (GskStreamListenerSocketClass *class)
 			       | G_PARAM_READWRITE);
   g_object_class_install_property (object_class, PROP_MAY_REUSE_ADDRESS, pspec);
 
+  pspec = g_param_spec_boolean ("may-reuse-port",
+			       _("May Reuse Port"),
+			       _("Whether other sockets may listen on the same port at the same time"),
+			       FALSE,
+			       G_PARAM_CONSTRUCT_ONLY
+			       | G_PARAM_READWRITE);
+  g_object_class_install_property (object_class, PROP_MAY_REUSE_PORT, pspec);
+
   pspec = g_param_spec_boolean ("unlink-when-done",
                                 _("Unlink when done"),
                                 _("Unlink the file from the file-system (only for local socket-listeners)"),
@@ -573,6 +622,13 @@ GType gsk_stream_listener_socket_get_type()
  * may be bound are ignored.  This only really affects
  * TCP/IP socket listeners.
  *
+ * If @flags contains @GSK_STREAM_LISTENER_SOCKET_REUSE_PORT,
+ * the socket is bound with SO_REUSEPORT, so that
+ * several listeners (typically in different threads) may
+ * share the port, and the kernel will divide
+ * the incoming connections between them.
+ * This fails if the platform does not support it.
+ *
  * returns: the newly created stream-listener.
  */
 GskStreamListener *
@@ -581,9 +637,11 @@ gsk_stream_listener_socket_new_bind_full (GskSocketAddress   *address,
 			             GError            **error)
 {
   gboolean may_reuse_addr = (flags & GSK_STREAM_LISTENER_SOCKET_DONT_REUSE_ADDRESS) ? 0 : 1;
+  gboolean may_reuse_port = (flags & GSK_STREAM_LISTENER_SOCKET_REUSE_PORT) ? 1 : 0;
   GObject *rv = g_object_new (GSK_TYPE_STREAM_LISTENER_SOCKET,
 		              "listening-address", address,
 			      "may-reuse-address", may_reuse_addr,
+			      "may-reuse-port", may_reuse_port,
 			      NULL);
   GskStreamListener *listener = GSK_STREAM_LISTENER (rv);
   if (listener->last_error != NULL)
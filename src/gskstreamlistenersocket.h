@@ -41,6 +41,7 @@ struct _GskStreamListenerSocket
 #endif 
   GskSocketAddress      *listening_address;
   gboolean               may_reuse_address;
+  gboolean               may_reuse_port;        /* SO_REUSEPORT */
   gboolean               unlink_when_done;      /* only available if listening_address is 'local' */
 };
 
@@ -58,7 +59,8 @@ gsk_stream_listener_socket_new_from_fd (int      fd,
 typedef enum
 {
   GSK_STREAM_LISTENER_SOCKET_DONT_REUSE_ADDRESS = (1<<0),
-  GSK_STREAM_LISTENER_SOCKET_UNLINK_WHEN_DONE = (1<<1)
+  GSK_STREAM_LISTENER_SOCKET_UNLINK_WHEN_DONE = (1<<1),
+  GSK_STREAM_LISTENER_SOCKET_REUSE_PORT = (1<<2)
 } GskStreamListenerSocketFlags;
 GType gsk_stream_listener_socket_flags_get_type (void) G_GNUC_CONST;
 
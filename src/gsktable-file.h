@@ -15,11 +15,16 @@ struct _GskTableFileHints
   guint min_key_size, max_key_size;
   guint min_value_size, max_value_size;
   gboolean allocate_disk_space_based_on_max_sizes;
+
+  /* if non-zero, build a filter of keys' hashes
+     (see gsk_table_file_hash_key()), sized for max_entries */
+  gdouble filter_false_positive_rate;
 };
 #define GSK_TABLE_FILE_HINTS_DEFAULTS \
 { G_MAXUINT64, G_MAXUINT64, G_MAXUINT64, \
   0, G_MAXUINT, 0, G_MAXUINT,  \
-  FALSE  /* allocate_disk_space_based_on_max_sizes */ \
+  FALSE, /* allocate_disk_space_based_on_max_sizes */ \
+  0.0    /* filter_false_positive_rate */ \
 }
 
 
@@ -44,13 +49,32 @@ struct _GskTableFileQuery
                    gpointer      compare_data);
   gpointer compare_data;
 
+  /* only set if keys which compare equal are identical,
+     so that a file's filter can rule out the key */
+  gboolean has_key_hash;
+  guint64 key_hash;
+
   gboolean found;
   GskTableBuffer value;
+
+  /* for a series of queries on one file with ascending keys:
+     the file may note in 'position' where each query ended,
+     and keep whatever else it needs to start the next one there
+     in 'cursor', freed by 'cursor_destroy'.  Set 'ascending'
+     and call gsk_table_file_query_restart() before the first query
+     of the series. */
+  gboolean ascending;
+  guint64 position;
+  gpointer cursor;
+  GDestroyNotify cursor_destroy;
 };
 
-#define GSK_TABLE_FILE_QUERY_INIT  { NULL, NULL, FALSE, GSK_TABLE_BUFFER_INIT }
+#define GSK_TABLE_FILE_QUERY_INIT  { NULL, NULL, FALSE, 0, FALSE, GSK_TABLE_BUFFER_INIT, FALSE, 0, NULL, NULL }
 
+G_INLINE_FUNC void    gsk_table_file_query_restart (GskTableFileQuery *query);
 G_INLINE_FUNC void    gsk_table_file_query_clear (GskTableFileQuery *query);
+G_INLINE_FUNC guint64 gsk_table_file_hash_key    (guint              key_len,
+                                                  const guint8      *key_data);
 
 /* Copy "dir" as passed into create_file(), open_building_file(), etc.
    This isn't necessary b/c the "dir" is always a member of the
@@ -173,10 +197,40 @@ GskTableFileFactory *gsk_table_file_factory_new_btree (void);
   (factory)->destroy_factory (factory)
 
 #if defined (G_CAN_INLINE) || defined (__GSK_DEFINE_INLINES__)
+G_INLINE_FUNC void    gsk_table_file_query_restart (GskTableFileQuery *query)
+{
+  if (query->cursor != NULL)
+    {
+      query->cursor_destroy (query->cursor);
+      query->cursor = NULL;
+    }
+  query->position = 0;
+}
 G_INLINE_FUNC void    gsk_table_file_query_clear (GskTableFileQuery *query)
 {
+  gsk_table_file_query_restart (query);
   gsk_table_buffer_clear (&query->value);
 }
+
+/* FNV-1a, with a final mix so that every bit
+   depends on every byte of the key */
+G_INLINE_FUNC guint64 gsk_table_file_hash_key (guint         key_len,
+                                               const guint8 *key_data)
+{
+  guint64 h = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+  guint i;
+  for (i = 0; i < key_len; i++)
+    {
+      h ^= key_data[i];
+      h *= G_GUINT64_CONSTANT (0x100000001b3);
+    }
+  h ^= h >> 33;
+  h *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= G_GUINT64_CONSTANT (0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+  return h;
+}
 #endif
 
 
@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <zlib.h>
 #include <errno.h>
 
@@ -73,7 +74,6 @@ struct _FlatFactory
   guint n_recycled_builders;
   guint max_recycled_builders;
   FlatFileBuilder *recycled_builders;
-  guint max_cache_entries;
 };
 
 
@@ -133,8 +133,16 @@ struct _CacheEntry
 {
   guint n_entries;
   guint64 index;
-  CacheEntry *prev_lru, *next_lru;
+  gsize size;                           /* allocated size */
+
+  /* for entries in the block cache */
+  FlatFile *file;
+  guint ref_count;
+  gboolean referenced;                  /* since the clock last passed */
+  CacheEntry *prev_clock, *next_clock;
+  CacheEntry *prev_in_file, *next_in_file;
   CacheEntry *bin_next;
+
   CacheEntryRecord records[1];          /* must be last! */
 };
 
@@ -148,11 +156,15 @@ struct _FlatFile
                                    cannot be set at the same time */
   MmapReader readers[N_FILES];
 
-  guint cache_entries_len;
-  CacheEntry **cache_entries;
-  guint cache_entries_count;
-  guint max_cache_entries;
-  CacheEntry *most_recently_used, *least_recently_used;
+  /* this file's chunks in the block cache */
+  CacheEntry *first_cached, *last_cached;
+
+  /* filter of the keys' hashes, or NULL;
+     it is only consulted once the file is built */
+  guint8 *filter;
+  guint64 filter_n_blocks;
+  guint filter_n_hashes;
+  gint filter_fd;               /* only while building */
 };
 
 struct _FlatFileReader
@@ -165,9 +177,11 @@ struct _FlatFileReader
   guint64 index_entry_index;
 };
 
-#define GET_LRU_LIST(file) \
-  CacheEntry *, (file)->most_recently_used, (file)->least_recently_used, \
-  prev_lru, next_lru
+#define GET_CLOCK_LIST() \
+  CacheEntry *, block_cache.first, block_cache.last, prev_clock, next_clock
+#define GET_FILE_CACHE_LIST(file) \
+  CacheEntry *, (file)->first_cached, (file)->last_cached, \
+  prev_in_file, next_in_file
 
 typedef struct _IndexEntry IndexEntry;
 struct _IndexEntry
@@ -306,6 +320,7 @@ cache_entry_deserialize (guint64       index,
   uncompress_buf.avail_out = uncompressed_data_len;
   uncompress_buf.next_out = uncompressed_data;
   zrv = inflate (&uncompress_buf, Z_SYNC_FLUSH);
+  inflateEnd (&uncompress_buf);
   if (zrv != Z_OK)
     {
       g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_CORRUPT,
@@ -369,6 +384,11 @@ cache_entry_deserialize (guint64       index,
   
   rv->n_entries = n_compressed_entries;
   rv->index = index;
+  rv->size = sizeof (CacheEntry)
+           + (n_compressed_entries-1) * sizeof (CacheEntryRecord)
+           + data_size;
+  rv->file = NULL;
+  rv->ref_count = 1;
 
   for (i = 0; i < n_compressed_entries; i++)
     {
@@ -390,6 +410,144 @@ cache_entry_deserialize (guint64       index,
   return rv;
 }
 
+/* --- the block cache --- */
+/* Decompressed chunks of all flat files share one cache,
+   bounded in bytes.  It evicts by second chance (CLOCK):
+   the oldest chunk goes, unless it has been used since it
+   was last considered, in which case it becomes the newest. */
+#define DEFAULT_CACHE_MAX_BYTES         (16*1024*1024)
+
+static struct
+{
+  guint n_bins;
+  CacheEntry **bins;
+  guint n_entries;
+  gsize n_bytes;
+  gsize max_bytes;
+  CacheEntry *first, *last;             /* oldest to newest */
+  guint64 n_hits, n_misses;
+} block_cache = { 0, NULL, 0, 0, DEFAULT_CACHE_MAX_BYTES, NULL, NULL, 0, 0 };
+G_LOCK_DEFINE_STATIC (block_cache);
+
+#define BLOCK_CACHE_HASH(file, index) \
+  ((guint) ((gsize) (file) / sizeof (gpointer)) * 33 + (guint) (index))
+
+static CacheEntry *
+cache_entry_ref (CacheEntry *entry)
+{
+  G_LOCK (block_cache);
+  entry->ref_count++;
+  G_UNLOCK (block_cache);
+  return entry;
+}
+
+static void
+cache_entry_unref (CacheEntry *entry)
+{
+  gboolean do_free;
+  G_LOCK (block_cache);
+  do_free = --(entry->ref_count) == 0;
+  G_UNLOCK (block_cache);
+  if (do_free)
+    g_free (entry);
+}
+
+/* the following must be called with the block_cache lock held */
+static void
+block_cache_remove (CacheEntry *entry)
+{
+  guint bin = BLOCK_CACHE_HASH (entry->file, entry->index) % block_cache.n_bins;
+  CacheEntry **pprev;
+  for (pprev = block_cache.bins + bin;
+       *pprev != entry;
+       pprev = &((*pprev)->bin_next))
+    ;
+  *pprev = entry->bin_next;
+  GSK_LIST_REMOVE (GET_CLOCK_LIST (), entry);
+  GSK_LIST_REMOVE (GET_FILE_CACHE_LIST (entry->file), entry);
+  block_cache.n_entries--;
+  block_cache.n_bytes -= entry->size;
+
+  /* a query may still be using it */
+  if (--(entry->ref_count) == 0)
+    g_free (entry);
+}
+
+static void
+block_cache_evict (gsize needed)
+{
+  while (block_cache.first != NULL
+      && block_cache.n_bytes + needed > block_cache.max_bytes)
+    {
+      CacheEntry *oldest = block_cache.first;
+      if (oldest->referenced)
+        {
+          oldest->referenced = FALSE;
+          GSK_LIST_REMOVE_FIRST (GET_CLOCK_LIST ());
+          GSK_LIST_APPEND (GET_CLOCK_LIST (), oldest);
+        }
+      else
+        block_cache_remove (oldest);
+    }
+}
+
+static void
+block_cache_insert (CacheEntry *entry)
+{
+  guint bin;
+  if (block_cache.n_entries >= block_cache.n_bins)
+    {
+      /* resize the hash-table */
+      guint new_n_bins = g_spaced_primes_closest (block_cache.n_entries * 2 + 64);
+      CacheEntry **new_bins = g_new0 (CacheEntry *, new_n_bins);
+      guint i;
+      for (i = 0; i < block_cache.n_bins; i++)
+        while (block_cache.bins[i] != NULL)
+          {
+            CacheEntry *e = block_cache.bins[i];
+            guint new_bin = BLOCK_CACHE_HASH (e->file, e->index) % new_n_bins;
+            block_cache.bins[i] = e->bin_next;
+            e->bin_next = new_bins[new_bin];
+            new_bins[new_bin] = e;
+          }
+      g_free (block_cache.bins);
+      block_cache.bins = new_bins;
+      block_cache.n_bins = new_n_bins;
+    }
+  bin = BLOCK_CACHE_HASH (entry->file, entry->index) % block_cache.n_bins;
+  entry->bin_next = block_cache.bins[bin];
+  block_cache.bins[bin] = entry;
+  GSK_LIST_APPEND (GET_CLOCK_LIST (), entry);
+  GSK_LIST_APPEND (GET_FILE_CACHE_LIST (entry->file), entry);
+  block_cache.n_entries++;
+  block_cache.n_bytes += entry->size;
+}
+
+static CacheEntry *
+block_cache_lookup (FlatFile *ffile,
+                    guint64   index)
+{
+  CacheEntry *entry;
+  if (block_cache.n_bins == 0)
+    return NULL;
+  entry = block_cache.bins[BLOCK_CACHE_HASH (ffile, index) % block_cache.n_bins];
+  for (; entry != NULL; entry = entry->bin_next)
+    if (entry->file == ffile && entry->index == index)
+      return entry;
+  return NULL;
+}
+
+static void
+block_cache_purge_file (FlatFile *ffile)
+{
+  G_LOCK (block_cache);
+  while (ffile->first_cached != NULL)
+    block_cache_remove (ffile->first_cached);
+  G_UNLOCK (block_cache);
+}
+
+/* Get the decompressed chunk, which the caller must
+   release with cache_entry_unref(). */
 static CacheEntry *
 cache_entry_force (FlatFile  *ffile,
                    guint64    index,
@@ -397,46 +555,22 @@ cache_entry_force (FlatFile  *ffile,
                    guint8     *firstkey_data,
                    GError    **error)
 {
-  guint bin;
   CacheEntry *entry;
 #if DEBUG_CACHE_ENTRY_FORCE
   g_message ("cache_entry_force: index=%llu [key offset/length=%llu/%u; data offset/length=%llu/%u]", index,index_entry->firstkeys_offset,index_entry->firstkeys_len, index_entry->compressed_data_offset, index_entry->compressed_data_len);
 #endif
-  if (ffile->cache_entries_len == 0)
-    {
-      ffile->cache_entries_len = g_spaced_primes_closest (ffile->max_cache_entries);
-      ffile->cache_entries = g_new0 (CacheEntry *, ffile->cache_entries_len);
-    }
-  bin = (guint) index % ffile->cache_entries_len;
-  for (entry = ffile->cache_entries[bin]; entry != NULL; entry = entry->bin_next)
-    if (entry->index == index)
-      {
-        if (entry->prev_lru != NULL)
-          {
-            GSK_LIST_REMOVE (GET_LRU_LIST (ffile), entry);
-            GSK_LIST_PREPEND (GET_LRU_LIST (ffile), entry);
-          }
-        return entry;
-      }
-
-  /* possibly evict old cache entry */
-  if (ffile->cache_entries_count == ffile->max_cache_entries)
+  G_LOCK (block_cache);
+  entry = block_cache_lookup (ffile, index);
+  if (entry != NULL)
     {
-      CacheEntry *evicted = ffile->least_recently_used;
-      guint bin = (guint) evicted->index % ffile->cache_entries_len;
-      CacheEntry **pprev;
-      GSK_LIST_REMOVE_LAST (GET_LRU_LIST (ffile));
-
-      /* remove from hash-table */
-      for (pprev = ffile->cache_entries + bin;
-           *pprev != evicted;
-           pprev = &((*pprev)->bin_next))
-        ;
-      *pprev = evicted->bin_next;
-
-      ffile->cache_entries_count--;
-      g_free (evicted);
+      entry->referenced = TRUE;
+      entry->ref_count++;
+      block_cache.n_hits++;
+      G_UNLOCK (block_cache);
+      return entry;
     }
+  block_cache.n_misses++;
+  G_UNLOCK (block_cache);
 
   /* create new entry */
   guint8 *compressed_data;
@@ -456,20 +590,61 @@ cache_entry_force (FlatFile  *ffile,
                                    index_entry->compressed_data_len,
                                    compressed_data,
                                    error);
+  g_free (compressed_data);
   if (entry == NULL)
+    return NULL;
+
+  /* another thread may have cached the chunk in the meantime */
+  G_LOCK (block_cache);
+  if (entry->size <= block_cache.max_bytes
+   && block_cache_lookup (ffile, index) == NULL)
     {
-      g_free (compressed_data);
-      return NULL;
+      block_cache_evict (entry->size);
+      entry->file = ffile;
+      entry->referenced = FALSE;
+      entry->ref_count++;
+      block_cache_insert (entry);
     }
-  entry->bin_next = ffile->cache_entries[bin];
-  ffile->cache_entries[bin] = entry;
-  ffile->cache_entries_count++;
-  g_free (compressed_data);
-  GSK_LIST_PREPEND (GET_LRU_LIST (ffile), entry);
+  G_UNLOCK (block_cache);
 
   return entry;
 }
 
+/**
+ * gsk_table_set_cache_max_bytes:
+ * @max_bytes: the most memory that cached chunks may use.
+ *
+ * Set the size of the cache of decompressed chunks,
+ * which all tables in the process share.
+ * The default is 16 megabytes.
+ */
+void
+gsk_table_set_cache_max_bytes (gsize max_bytes)
+{
+  G_LOCK (block_cache);
+  block_cache.max_bytes = max_bytes;
+  block_cache_evict (0);
+  G_UNLOCK (block_cache);
+}
+
+/**
+ * gsk_table_get_cache_stats:
+ * @stats_out: the statistics to fill in.
+ *
+ * Find how well the cache of decompressed chunks is working.
+ */
+void
+gsk_table_get_cache_stats (GskTableCacheStats *stats_out)
+{
+  G_LOCK (block_cache);
+  stats_out->n_hits = block_cache.n_hits;
+  stats_out->n_misses = block_cache.n_misses;
+  stats_out->n_chunks = block_cache.n_entries;
+  stats_out->n_bytes = block_cache.n_bytes;
+  stats_out->max_bytes = block_cache.max_bytes;
+  G_UNLOCK (block_cache);
+}
+
 /* --- mmap reading implementation --- */
 static gboolean
 mmap_reader_init (MmapReader     *reader,
@@ -794,6 +969,200 @@ index_entry_deserialize (const guint8     *data_in,
   index_entry_out->compressed_data_len = GUINT32_FROM_LE (tmp32_le);
 }
 
+/* --- filters --- */
+/* A blocked Bloom filter:  a key's hash picks one
+   cache-line-sized block, and sets filter_n_hashes bits in it.
+   The filter file is:
+     4 bytes -- magic
+     4 bytes -- number of bits set per key
+     8 bytes -- number of blocks
+   followed by the blocks.  It is absent if the file
+   was built without a filter. */
+#define FILTER_MAGIC            0x3a97f1e3
+#define FILTER_HEADER_SIZE      16
+#define FILTER_BLOCK_SIZE       64
+#define FILTER_BLOCK_BITS       (FILTER_BLOCK_SIZE * 8)
+
+static const char filter_extension[] = "filter";
+
+/* the top 32 bits of the hash pick the block */
+#define FILTER_GET_BLOCK(ffile, hash) \
+  ((ffile)->filter + FILTER_BLOCK_SIZE * ((((hash) >> 32) * (ffile)->filter_n_blocks) >> 32))
+
+static void
+filter_add (FlatFile *ffile,
+            guint64   hash)
+{
+  guint8 *block = FILTER_GET_BLOCK (ffile, hash);
+  guint32 h1 = hash;
+  guint32 h2 = ((hash * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15)) >> 32) | 1;
+  guint i;
+  for (i = 0; i < ffile->filter_n_hashes; i++)
+    {
+      guint bit = (h1 + i * h2) % FILTER_BLOCK_BITS;
+      block[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+static inline gboolean
+filter_may_contain (const FlatFile *ffile,
+                    guint64         hash)
+{
+  const guint8 *block = FILTER_GET_BLOCK (ffile, hash);
+  guint32 h1 = hash;
+  guint32 h2 = ((hash * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15)) >> 32) | 1;
+  guint i;
+  for (i = 0; i < ffile->filter_n_hashes; i++)
+    {
+      guint bit = (h1 + i * h2) % FILTER_BLOCK_BITS;
+      if ((block[bit / 8] & (1 << (bit % 8))) == 0)
+        return FALSE;
+    }
+  return TRUE;
+}
+
+/* allocate an empty filter for up to max_entries keys;
+   leaves ffile->filter NULL if it would be useless */
+static void
+filter_init (FlatFile *ffile,
+             guint64   max_entries,
+             gdouble   false_positive_rate)
+{
+  guint halvings = 0;
+  guint bits_per_key;
+
+  ffile->filter = NULL;
+  if (false_positive_rate <= 0.0 || false_positive_rate >= 1.0)
+    return;
+
+  /* about 1.44*log2(1/rate) bits per key, and ln(2) hashes per bit;
+     plus a few bits for the uneven loading of the blocks */
+  while (false_positive_rate < 1.0 && halvings < 32)
+    {
+      false_positive_rate *= 2;
+      halvings++;
+    }
+  bits_per_key = (halvings * 1477 + 1023) / 1024 + halvings * halvings / 32;
+  if (max_entries == 0
+   || max_entries > (guint64) G_MAXUINT32 * FILTER_BLOCK_BITS / bits_per_key)
+    return;
+  ffile->filter_n_hashes = MAX (1, (bits_per_key * 710 + 512) / 1024);
+  ffile->filter_n_blocks = (max_entries * bits_per_key + FILTER_BLOCK_BITS - 1)
+                         / FILTER_BLOCK_BITS;
+  ffile->filter = g_malloc0 (ffile->filter_n_blocks * FILTER_BLOCK_SIZE);
+}
+
+static void
+filter_clear (FlatFile *ffile)
+{
+  g_free (ffile->filter);
+  ffile->filter = NULL;
+  if (ffile->filter_fd >= 0)
+    {
+      close (ffile->filter_fd);
+      ffile->filter_fd = -1;
+    }
+}
+
+static gboolean
+filter_write (FlatFile *ffile,
+              GError  **error)
+{
+  guint8 header[FILTER_HEADER_SIZE];
+  guint32 tmp32_le;
+  guint64 tmp64_le;
+  struct iovec iov[2];
+  gssize expected = FILTER_HEADER_SIZE
+                  + ffile->filter_n_blocks * FILTER_BLOCK_SIZE;
+  gssize rv;
+
+  tmp32_le = GUINT32_TO_LE (FILTER_MAGIC);
+  memcpy (header + 0, &tmp32_le, 4);
+  tmp32_le = GUINT32_TO_LE (ffile->filter_n_hashes);
+  memcpy (header + 4, &tmp32_le, 4);
+  tmp64_le = GUINT64_TO_LE (ffile->filter_n_blocks);
+  memcpy (header + 8, &tmp64_le, 8);
+  iov[0].iov_base = header;
+  iov[0].iov_len = FILTER_HEADER_SIZE;
+  iov[1].iov_base = ffile->filter;
+  iov[1].iov_len = ffile->filter_n_blocks * FILTER_BLOCK_SIZE;
+  rv = writev (ffile->filter_fd, iov, 2);
+  if (rv < 0)
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_FILE_WRITE,
+                   "error writing filter file: %s", g_strerror (errno));
+      return FALSE;
+    }
+  if (rv < expected)
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_FILE_WRITE,
+                   "partial write of filter file");
+      return FALSE;
+    }
+  close (ffile->filter_fd);
+  ffile->filter_fd = -1;
+  return TRUE;
+}
+
+/* load a built file's filter, if it has one */
+static gboolean
+filter_read (FlatFile   *ffile,
+             const char *dir,
+             GError    **error)
+{
+  char fname_buf[GSK_TABLE_MAX_PATH];
+  guint8 header[FILTER_HEADER_SIZE];
+  guint32 tmp32_le;
+  guint64 tmp64_le;
+  struct stat stat_buf;
+  gsize filter_size;
+  int fd;
+
+  ffile->filter = NULL;
+  gsk_table_mk_fname (fname_buf, dir, ffile->base_file.id, filter_extension);
+  fd = open (fname_buf, O_RDONLY);
+  if (fd < 0)
+    {
+      if (errno == ENOENT)
+        return TRUE;
+      g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_FILE_OPEN,
+                   "error opening %s: %s", fname_buf, g_strerror (errno));
+      return FALSE;
+    }
+  if (fstat (fd, &stat_buf) < 0
+   || stat_buf.st_size < FILTER_HEADER_SIZE
+   || pread (fd, header, FILTER_HEADER_SIZE, 0) != FILTER_HEADER_SIZE)
+    goto corrupt;
+  memcpy (&tmp32_le, header + 0, 4);
+  if (GUINT32_FROM_LE (tmp32_le) != FILTER_MAGIC)
+    goto corrupt;
+  memcpy (&tmp32_le, header + 4, 4);
+  ffile->filter_n_hashes = GUINT32_FROM_LE (tmp32_le);
+  memcpy (&tmp64_le, header + 8, 8);
+  ffile->filter_n_blocks = GUINT64_FROM_LE (tmp64_le);
+  if (ffile->filter_n_blocks == 0
+   || ffile->filter_n_blocks > G_MAXUINT32
+   || (guint64) stat_buf.st_size != FILTER_HEADER_SIZE
+                                  + ffile->filter_n_blocks * FILTER_BLOCK_SIZE)
+    goto corrupt;
+  filter_size = ffile->filter_n_blocks * FILTER_BLOCK_SIZE;
+  ffile->filter = g_malloc (filter_size);
+  if (pread (fd, ffile->filter, filter_size, FILTER_HEADER_SIZE) != (gssize) filter_size)
+    {
+      g_free (ffile->filter);
+      ffile->filter = NULL;
+      goto corrupt;
+    }
+  close (fd);
+  return TRUE;
+
+corrupt:
+  g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_CORRUPT,
+               "filter file %s is corrupt", fname_buf);
+  close (fd);
+  return FALSE;
+}
+
 
 static voidpf my_mem_pool_alloc (voidpf opaque, uInt items, uInt size)
 {
@@ -834,21 +1203,30 @@ reinit_compressor (FlatFileBuilder *builder,
   gsk_table_buffer_set_len (&builder->compressed, 0);
 }
 
+/* tables that merge in the background build files in two threads */
+G_LOCK_DEFINE_STATIC (recycled_builders);
+
 static FlatFileBuilder *
 flat_file_builder_new (FlatFactory *factory)
 {
-  if (factory->recycled_builders)
+  FlatFileBuilder *builder;
+  G_LOCK (recycled_builders);
+  builder = factory->recycled_builders;
+  if (builder != NULL)
     {
-      FlatFileBuilder *builder = factory->recycled_builders;
       factory->recycled_builders = builder->next_recycled_builder;
       factory->n_recycled_builders--;
+    }
+  G_UNLOCK (recycled_builders);
+  if (builder != NULL)
+    {
       g_assert (builder->n_compressed_entries == 0
              && builder->uncompressed_data_len == 0);
       return builder;
     }
   else
     {
-      FlatFileBuilder *builder = g_slice_new (FlatFileBuilder);
+      builder = g_slice_new (FlatFileBuilder);
       gsk_table_buffer_init (&builder->input);
       gsk_table_buffer_init (&builder->first_key);
       gsk_table_buffer_init (&builder->last_key);
@@ -865,7 +1243,13 @@ static void
 builder_recycle (FlatFactory *ffactory,
                  FlatFileBuilder *builder)
 {
-  if (ffactory->n_recycled_builders == ffactory->max_recycled_builders)
+  gboolean recycle;
+  G_LOCK (recycled_builders);
+  recycle = ffactory->n_recycled_builders < ffactory->max_recycled_builders;
+  if (recycle)
+    ffactory->n_recycled_builders++;
+  G_UNLOCK (recycled_builders);
+  if (!recycle)
     {
       gsk_table_buffer_clear (&builder->input);
       gsk_table_buffer_clear (&builder->first_key);
@@ -879,9 +1263,10 @@ builder_recycle (FlatFactory *ffactory,
   else
     {
       reinit_compressor (builder, ffactory->compression_level, TRUE);
+      G_LOCK (recycled_builders);
       builder->next_recycled_builder = ffactory->recycled_builders;
       ffactory->recycled_builders = builder;
-      ffactory->n_recycled_builders++;
+      G_UNLOCK (recycled_builders);
     }
 }
 
@@ -949,13 +1334,36 @@ flat__create_file      (GskTableFileFactory      *factory,
 {
   FlatFactory *ffactory = (FlatFactory *) factory;
   FlatFile *rv = g_slice_new (FlatFile);
+  char fname_buf[GSK_TABLE_MAX_PATH];
   guint f;
   rv->base_file.factory = factory;
   rv->base_file.id = id;
   rv->base_file.n_entries = 0;
 
+  /* remove any filter left by an earlier attempt at building this file */
+  gsk_table_mk_fname (fname_buf, dir, id, filter_extension);
+  rv->filter_fd = -1;
+  filter_init (rv, hints->max_entries, hints->filter_false_positive_rate);
+  if (rv->filter != NULL)
+    {
+      rv->filter_fd = open (fname_buf, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (rv->filter_fd < 0)
+        {
+          g_set_error (error, GSK_G_ERROR_DOMAIN,
+                       GSK_ERROR_FILE_CREATE,
+                       "error creating %s: %s",
+                       fname_buf, g_strerror (errno));
+          filter_clear (rv);
+          g_slice_free (FlatFile, rv);
+          return NULL;
+        }
+    }
+  else
+    unlink (fname_buf);
+
   if (!open_3_files (rv, dir, id, OPEN_MODE_CREATE, error))
     {
+      filter_clear (rv);
       g_slice_free (FlatFile, rv);
       return NULL;
     }
@@ -970,6 +1378,7 @@ flat__create_file      (GskTableFileFactory      *factory,
           for (f = 0; f < N_FILES; f++)
             close (rv->fds[f]);
           builder_recycle (ffactory, rv->builder);
+          filter_clear (rv);
           g_slice_free (FlatFile, rv);
           return NULL;
         }
@@ -987,6 +1396,7 @@ flat__create_file      (GskTableFileFactory      *factory,
             close (rv->fds[f]);
           }
         builder_recycle (ffactory, rv->builder);
+        filter_clear (rv);
         g_slice_free (FlatFile, rv);
         return NULL;
       }
@@ -994,10 +1404,7 @@ flat__create_file      (GskTableFileFactory      *factory,
 
 
   rv->has_readers = FALSE;
-  rv->cache_entries_len = 0;
-  rv->cache_entries = NULL;
-  rv->cache_entries_count = 0;
-  rv->max_cache_entries = ffactory->max_cache_entries;
+  rv->first_cached = rv->last_cached = NULL;
   return &rv->base_file;
 }
 
@@ -1011,8 +1418,17 @@ flat__open_building_file(GskTableFileFactory     *factory,
 {
   FlatFactory *ffactory = (FlatFactory *) factory;
   FlatFile *rv = g_slice_new (FlatFile);
+  char fname_buf[GSK_TABLE_MAX_PATH];
   rv->base_file.factory = factory;
   rv->base_file.id = id;
+
+  /* the keys fed before the build was interrupted
+     are not in any filter, so this file cannot have one */
+  gsk_table_mk_fname (fname_buf, dir, id, filter_extension);
+  unlink (fname_buf);
+  rv->filter = NULL;
+  rv->filter_fd = -1;
+
   if (!open_3_files (rv, dir, id, OPEN_MODE_CONTINUE_CREATE, error))
     {
       g_slice_free (FlatFile, rv);
@@ -1053,10 +1469,7 @@ flat__open_building_file(GskTableFileFactory     *factory,
   }
   rv->has_readers = FALSE;
 
-  rv->cache_entries_len = 0;
-  rv->cache_entries = NULL;
-  rv->cache_entries_count = 0;
-  rv->max_cache_entries = ffactory->max_cache_entries;
+  rv->first_cached = rv->last_cached = NULL;
 
   return &rv->base_file;
 }
@@ -1067,7 +1480,6 @@ flat__open_file        (GskTableFileFactory      *factory,
                         guint64                   id,
                         GError                  **error)
 {
-  FlatFactory *ffactory = (FlatFactory *) factory;
   FlatFile *rv = g_slice_new (FlatFile);
   guint f;
   rv->base_file.factory = factory;
@@ -1122,10 +1534,19 @@ flat__open_file        (GskTableFileFactory      *factory,
     }
   rv->has_readers = TRUE;
 
-  rv->cache_entries_len = 0;
-  rv->cache_entries = NULL;
-  rv->cache_entries_count = 0;
-  rv->max_cache_entries = ffactory->max_cache_entries;
+  rv->filter_fd = -1;
+  if (!filter_read (rv, dir, error))
+    {
+      for (f = 0; f < N_FILES; f++)
+        {
+          mmap_reader_clear (&rv->readers[f]);
+          close (rv->fds[f]);
+        }
+      g_slice_free (FlatFile, rv);
+      return NULL;
+    }
+
+  rv->first_cached = rv->last_cached = NULL;
 
   return &rv->base_file;
 }
@@ -1273,6 +1694,8 @@ flat__feed_entry      (GskTableFile             *file,
   g_assert (builder != NULL);
 
   file->n_entries++;
+  if (ffile->filter != NULL)
+    filter_add (ffile, gsk_table_file_hash_key (key_len, key_data));
 
   if (builder->has_last_key)
     {
@@ -1386,6 +1809,9 @@ flat__done_feeding     (GskTableFile             *file,
       }
   }
 
+  if (ffile->filter != NULL && !filter_write (ffile, error))
+    return FALSE;
+
   /* mmap for reading small files */
   for (f = 0; f < N_FILES; f++)
     if (!mmap_reader_init (&ffile->readers[f], ffile->fds[f], error))
@@ -1470,17 +1896,66 @@ do_pread (FlatFile *ffile,
     }
 }
 
+/* What a series of ascending queries keeps between queries
+   (see GskTableFileQuery):  the chunk where the last one ended,
+   and the first key of the chunk after it.  Keys before that key
+   are in the same chunk, and need no index search at all. */
+typedef struct _FlatQueryCursor FlatQueryCursor;
+struct _FlatQueryCursor
+{
+  CacheEntry *cache_entry;              /* or NULL */
+  guint64 upper_bound_index;            /* chunk whose first key is upper_bound */
+  GskTableBuffer upper_bound;
+};
+
+static void
+flat_query_cursor_destroy (gpointer data)
+{
+  FlatQueryCursor *cursor = data;
+  if (cursor->cache_entry != NULL)
+    cache_entry_unref (cursor->cache_entry);
+  gsk_table_buffer_clear (&cursor->upper_bound);
+  g_slice_free (FlatQueryCursor, cursor);
+}
+
+static FlatQueryCursor *
+peek_query_cursor (GskTableFileQuery *query)
+{
+  FlatQueryCursor *cursor = query->cursor;
+  if (cursor == NULL)
+    {
+      cursor = g_slice_new (FlatQueryCursor);
+      cursor->cache_entry = NULL;
+      cursor->upper_bound_index = 0;    /* chunk 0 is no one's upper bound */
+      gsk_table_buffer_init (&cursor->upper_bound);
+      query->cursor = cursor;
+      query->cursor_destroy = flat_query_cursor_destroy;
+    }
+  return cursor;
+}
+
 static gboolean 
 flat__query_file       (GskTableFile             *file,
                         GskTableFileQuery        *query_inout,
                         GError                  **error)
 {
   FlatFile *ffile = (FlatFile *) file;
+  FlatQueryCursor *cursor = NULL;
   guint64 n_index_records, first, n;
   CacheEntry *cache_entry;
   IndexEntry index_entry;
   gboolean index_entry_up_to_date = FALSE;
   guint8 index_entry_data[SIZEOF_INDEX_ENTRY];
+
+  if (ffile->filter != NULL
+   && ffile->builder == NULL
+   && query_inout->has_key_hash
+   && !filter_may_contain (ffile, query_inout->key_hash))
+    {
+      query_inout->found = FALSE;
+      return TRUE;
+    }
+
   if (ffile->builder != NULL)
     n_index_records = (mmap_writer_offset (&ffile->builder->writers[FILE_INDEX]) - INDEX_HEADER_SIZE)
                     / SIZEOF_INDEX_ENTRY;
@@ -1504,6 +1979,51 @@ flat__query_file       (GskTableFile             *file,
   n = n_index_records;
   GskTableBuffer firstkey;
   gsk_table_buffer_init (&firstkey);
+
+  if (query_inout->ascending && query_inout->position < n_index_records)
+    {
+      /* the key is in the chunk where the last query ended, or after it:
+         check the next chunk's first key, since neighbouring
+         keys are often in the same chunk.  The cursor keeps that key,
+         and the chunk itself, for the queries that follow. */
+      cursor = peek_query_cursor (query_inout);
+      first = query_inout->position;
+      n = n_index_records - first;
+      if (n > 1)
+        {
+          gint compare_rv;
+          gboolean read_next = cursor->upper_bound_index != first + 1;
+          if (read_next)
+            {
+              if (!do_pread (ffile, FILE_INDEX, (first + 1) * SIZEOF_INDEX_ENTRY + INDEX_HEADER_SIZE, SIZEOF_INDEX_ENTRY, index_entry_data, error))
+                return FALSE;
+              index_entry_deserialize (index_entry_data, &index_entry);
+              gsk_table_buffer_set_len (&cursor->upper_bound, index_entry.firstkeys_len);
+              cursor->upper_bound_index = 0;
+              if (!do_pread (ffile, FILE_FIRSTKEYS, index_entry.firstkeys_offset, index_entry.firstkeys_len,
+                             cursor->upper_bound.data, error))
+                return FALSE;
+              cursor->upper_bound_index = first + 1;
+            }
+          compare_rv = query_inout->compare (cursor->upper_bound.len,
+                                             cursor->upper_bound.data,
+                                             query_inout->compare_data);
+          if (compare_rv < 0)
+            n = 1;
+          else
+            {
+              first++;
+              n--;
+              if (read_next)
+                {
+                  memcpy (gsk_table_buffer_set_len (&firstkey, cursor->upper_bound.len),
+                          cursor->upper_bound.data, cursor->upper_bound.len);
+                  index_entry_up_to_date = TRUE;
+                }
+            }
+        }
+    }
+
   while (n > 1)
     {
       guint64 mid = first + n / 2;
@@ -1535,6 +2055,14 @@ flat__query_file       (GskTableFile             *file,
         {
           n = mid - first;
           index_entry_up_to_date = FALSE;
+          if (cursor != NULL)
+            {
+              /* the smallest such key so far: the upper bound,
+                 if the search ends in the chunk before */
+              memcpy (gsk_table_buffer_set_len (&cursor->upper_bound, firstkey.len),
+                      firstkey.data, firstkey.len);
+              cursor->upper_bound_index = mid;
+            }
         }
       else if (compare_rv > 0)
         {
@@ -1557,16 +2085,38 @@ flat__query_file       (GskTableFile             *file,
           memcpy (gsk_table_buffer_set_len (&query_inout->value, record->value_len),
                   record->value_data, record->value_len);
           query_inout->found = TRUE;
+          query_inout->position = mid;
+          if (cursor != NULL)
+            {
+              if (cursor->cache_entry != NULL)
+                cache_entry_unref (cursor->cache_entry);
+              cursor->cache_entry = cache_entry;
+            }
+          else
+            cache_entry_unref (cache_entry);
           gsk_table_buffer_clear (&firstkey);
           return TRUE;
         }
     }
 
+  if (cursor != NULL
+   && cursor->cache_entry != NULL
+   && cursor->cache_entry->index == first)
+    {
+      /* still in the chunk the cursor holds */
+      cache_entry = cache_entry_ref (cursor->cache_entry);
+      gsk_table_buffer_clear (&firstkey);
+      goto search_chunk;
+    }
+
   if (!index_entry_up_to_date)
     {
       /* read index entry */
       if (!do_pread (ffile, FILE_INDEX, first * SIZEOF_INDEX_ENTRY + INDEX_HEADER_SIZE, SIZEOF_INDEX_ENTRY, index_entry_data, error))
-        return FALSE;
+        {
+          gsk_table_buffer_clear (&firstkey);
+          return FALSE;
+        }
       index_entry_deserialize (index_entry_data, &index_entry);
 
       /* read firstkey */
@@ -1583,13 +2133,22 @@ flat__query_file       (GskTableFile             *file,
   cache_entry = cache_entry_force (ffile, first,
                                    &index_entry, firstkey.data,
                                    error);
+  gsk_table_buffer_clear (&firstkey);
   if (cache_entry == NULL)
+    return FALSE;
+  if (cursor != NULL)
     {
-      gsk_table_buffer_clear (&firstkey);
-      return FALSE;
+      /* hold the chunk for the next query of the series */
+      if (cursor->cache_entry != NULL)
+        cache_entry_unref (cursor->cache_entry);
+      cursor->cache_entry = cache_entry_ref (cache_entry);
     }
 
+search_chunk:
+  query_inout->position = first;
+
   /* bsearch the uncompressed block */
+  query_inout->found = FALSE;
   {
     guint first = 0;
     guint n = cache_entry->n_entries;
@@ -1613,10 +2172,10 @@ flat__query_file       (GskTableFile             *file,
             memcpy (gsk_table_buffer_set_len (&query_inout->value, record->value_len),
                     record->value_data, record->value_len);
             query_inout->found = TRUE;
-            return TRUE;
+            break;
           }
       }
-    if (n == 1 && first < cache_entry->n_entries)
+    if (!query_inout->found && n == 1 && first < cache_entry->n_entries)
       {
         CacheEntryRecord *record = cache_entry->records + first;
         int compare_rv = query_inout->compare (record->key_len, record->key_data,
@@ -1626,11 +2185,10 @@ flat__query_file       (GskTableFile             *file,
             memcpy (gsk_table_buffer_set_len (&query_inout->value, record->value_len),
                     record->value_data, record->value_len);
             query_inout->found = TRUE;
-            return TRUE;
           }
       }
   }
-  query_inout->found = FALSE;
+  cache_entry_unref (cache_entry);
   return TRUE;
 }
 
@@ -1862,8 +2420,6 @@ flat__recreate_reader  (GskTableFile             *file,
 {
   FlatFileReader *freader;
   guint f;
-  if (freader == NULL)
-    return NULL;
   switch (state_data[0])
     {
     case 0:             /* in progress */
@@ -1963,14 +2519,18 @@ flat__destroy_file     (GskTableFile             *file,
     }
   for (f = 0; f < N_FILES; f++)
     close (ffile->fds[f]);
+  filter_clear (ffile);
+  block_cache_purge_file (ffile);
   if (erase)
     {
+      char fname_buf[GSK_TABLE_MAX_PATH];
       for (f = 0; f < N_FILES; f++)
         {
-          char fname_buf[GSK_TABLE_MAX_PATH];
           gsk_table_mk_fname (fname_buf, dir, file->id, file_extensions[f]);
           unlink (fname_buf);
         }
+      gsk_table_mk_fname (fname_buf, dir, file->id, filter_extension);
+      unlink (fname_buf);
     }
   g_slice_free (FlatFile, ffile);
   return TRUE;
@@ -2008,8 +2568,7 @@ GskTableFileFactory *gsk_table_file_factory_new_flat (void)
       3,                        /* zlib compression level */
       0,                        /* n recycled builders */
       8,                        /* max recycled builders */
-      NULL,                     /* recycled builder list */
-      24                        /* max cache entries */
+      NULL                      /* recycled builder list */
     };
 
   return &the_factory.base_factory;
@@ -16,9 +16,11 @@ MANGLE_FUNC_NAME(copy_file_reader) (GskTable  *table,
 {
   GskTableReader *reader = task->info.started.inputs[input_index].reader;
   GskTableFile *output = task->info.started.output;
+  gboolean stop = FALSE;
   for (;;)
     {
       n_written++;
+      table->n_merge_bytes += reader->key_len + reader->value_len;
       switch (gsk_table_file_feed_entry (output,
                                          reader->key_len, reader->key_data,
                                          reader->value_len, reader->value_data,
@@ -32,7 +34,7 @@ MANGLE_FUNC_NAME(copy_file_reader) (GskTable  *table,
           task->info.started.has_last_queryable_key = TRUE;
 #if DO_FLUSH
           if (n_written >= iterations)
-            return TRUE;
+            stop = TRUE;
 #endif
           break;
         case GSK_TABLE_FEED_ENTRY_ERROR:
@@ -43,11 +45,10 @@ MANGLE_FUNC_NAME(copy_file_reader) (GskTable  *table,
       n_written++;
 #if !DO_FLUSH
       if (n_written >= iterations)
-        {
-          *is_done_out = FALSE;
-          return TRUE;
-        }
+        stop = TRUE;
 #endif
+
+      /* advance before stopping, so the entry isn't written twice */
       gsk_table_reader_advance (reader);
       if (reader->error != NULL)
         {
@@ -60,6 +61,11 @@ MANGLE_FUNC_NAME(copy_file_reader) (GskTable  *table,
           *is_done_out = TRUE;
           return TRUE;
         }
+      if (stop)
+        {
+          *is_done_out = FALSE;
+          return TRUE;
+        }
     }
 }
 
@@ -102,7 +108,7 @@ MANGLE_FUNC_NAME(run_merge_task)  (GskTable      *table,
   gpointer user_data = table->user_data;
 #endif
 #if HAS_MERGE
-  GskTableBuffer *merge_buf = &table->merge_buffer;
+  GskTableBuffer *merge_buf = &table->task_merge_buffer;
 #endif
 
 #if DO_FLUSH
@@ -193,6 +199,7 @@ restart_with_both_readers:
           value_data = readers[0]->value_data;
 #endif
           n_written++;
+          table->n_merge_bytes += readers[0]->key_len + value_len;
           switch (gsk_table_file_feed_entry (output,
                                              readers[0]->key_len,
                                              readers[0]->key_data,
@@ -248,8 +255,8 @@ do_advance_a:
           const guint8 *value_data;
           switch (merge (MAYBE_LEN (readers[0]->key_len)
                          readers[0]->key_data,
-                         MAYBE_LEN (readers[1]->value_len)
-                         readers[1]->value_data,
+                         MAYBE_LEN (readers[0]->value_len)
+                         readers[0]->value_data,
                          MAYBE_LEN (readers[1]->value_len)
                          readers[1]->value_data,
                          merge_buf,
@@ -294,6 +301,7 @@ do_advance_a:
             }
 #endif
           n_written++;
+          table->n_merge_bytes += readers[0]->key_len + value_len;
           switch (gsk_table_file_feed_entry (output,
                                              readers[0]->key_len,
                                              readers[0]->key_data,
@@ -380,6 +388,7 @@ do_advance_a_and_b:
           value_data = readers[1]->value_data;
 #endif
           n_written++;
+          table->n_merge_bytes += readers[1]->key_len + value_len;
           switch (gsk_table_file_feed_entry (output,
                                              readers[1]->key_len,
                                              readers[1]->key_data,
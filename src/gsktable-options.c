@@ -7,6 +7,8 @@ GskTableOptions     *gsk_table_options_new    (void)
   rv->max_in_memory_bytes = 1024*1024;
   rv->max_in_memory_entries = 2048;
   rv->journal_mode = GSK_TABLE_JOURNAL_DEFAULT;
+  rv->filter_false_positive_rate = 0.01;
+  rv->background_max_files = 32;
   return rv;
 }
 
@@ -26,11 +26,13 @@
 #include "gsktable.h"
 #include "gsktable-file.h"
 #include "gskerror.h"
+#include "gskinit.h"
 
 typedef struct _TableUserData TableUserData;
 typedef struct _MergeTask MergeTask;
 typedef struct _FileInfo FileInfo;
 typedef struct _TreeNode TreeNode;
+typedef struct _PendingWrite PendingWrite;
 
 #define ID_FMT  "%" G_GUINT64_FORMAT
 
@@ -41,6 +43,10 @@ typedef struct _TreeNode TreeNode;
 #define DEBUG_JOURNAL_WRITING 0
 #define DEBUG_JOURNAL_REPLAY 0
 
+/* number of entries the background thread merges
+   each time it takes merge_lock */
+#define BACKGROUND_MERGE_SLICE  256
+
 #define TASK_IS_UNSTARTED(task) \
   ((task) == NULL || !(task)->is_started)
 
@@ -73,6 +79,7 @@ struct _MergeTask
     } unstarted;
     struct {
       GskTableFile *output;
+      gboolean in_journal;      /* the current journal resumes it */
       gboolean has_last_queryable_key;
       GskTableBuffer last_queryable_key;
       struct {
@@ -185,6 +192,21 @@ struct _GskTable
   guint journal_size;                   /* size of journal data */
   GskTableJournalMode journal_mode;
   guint journal_flush_index;
+  GskTableBuffer journal_batch_buffer;  /* records of several batches */
+
+  /* records that are journalled but not yet in the tree,
+     which reset_journal() copies into the new journal:
+     see commit_writes() */
+  const guint8 *journal_tail_data;
+  guint journal_tail_len;
+
+  /* group commit: with background merging, several threads may
+     call gsk_table_write() at once.  One of them commits the
+     batches of all that are waiting, while the rest sleep. */
+  GMutex *commit_lock;
+  GCond *commit_cond;
+  gboolean committing;
+  PendingWrite *first_pending_write, *last_pending_write;
 
   /* files */
   guint n_files;
@@ -201,6 +223,30 @@ struct _GskTable
   /* heap of merge tasks (sorted by n_entries ascending) */
   MergeTask *run_list;
   guint n_running_tasks;
+  guint64 n_merge_bytes;                /* key and value bytes merged */
+
+  /* background merging: the merge thread runs the run_list,
+     holding merge_lock for each slice.  The foreground holds merge_lock
+     only to flush the tree and write the journal, which read
+     the running tasks' state.
+
+     Tasks pass between the threads under handoff_lock,
+     which neither thread holds for long:  the foreground puts
+     the tasks it starts on new_tasks, and the merge thread
+     leaves the tasks it finishes (or gives up on) on finished_tasks
+     (or failed_tasks) and increments background_pending.
+     handoff_lock also protects n_running_tasks. */
+  gboolean background_merging;
+  GThread *merge_thread;
+  GMutex *merge_lock;
+  GMutex *handoff_lock;
+  GCond *handoff_cond;
+  gboolean stop_merge_thread;
+  MergeTask *new_tasks;
+  MergeTask *finished_tasks;
+  MergeTask *failed_tasks;
+  volatile gint background_pending;     /* finished tasks or an error */
+  GError *background_error;
 
   /* tree of in-memory entries */
   TreeNode *in_memory_tree;
@@ -218,6 +264,7 @@ struct _GskTable
   /* buffers */
   GskTableBuffer result_buffers[2];
   GskTableBuffer merge_buffer;
+  GskTableBuffer task_merge_buffer;     /* for merge tasks */
   GskTableBuffer simplify_buffer;
   GskTableFileQuery file_query;
   guint file_query_key_len;
@@ -232,6 +279,9 @@ struct _GskTable
   guint max_in_memory_bytes;
   guint max_in_memory_entries;
   guint journal_flush_period;
+  gdouble filter_false_positive_rate;   /* for new files; 0 for no filters */
+  guint background_max_files;
+  gsize background_bytes_per_second;    /* or 0 */
 
 };
 
@@ -281,6 +331,9 @@ copy_buffer (GskTableBuffer *buffer,
 static void create_unstarted_merge_task (GskTable *table,
                                          FileInfo *prev,
                                          FileInfo *next);
+static void install_merged_file (GskTable  *table,
+                                 MergeTask *task);
+static gpointer background_merge_thread (gpointer data);
 
 /* --- file-info ref-counting --- */
 static inline FileInfo *
@@ -693,6 +746,9 @@ read_journal (GskTable  *table,
       merge_task->is_started = TRUE;
       merge_task->inputs[0] = inputs[0].file_info;
       merge_task->inputs[1] = inputs[1].file_info;
+      merge_task->info.started.in_journal = TRUE;
+      merge_task->info.started.has_last_queryable_key = FALSE;
+      gsk_table_buffer_init (&merge_task->info.started.last_queryable_key);
 
       for (j = 0; j < 2; j++)
         {
@@ -1043,10 +1099,31 @@ reset_journal (GskTable   *table,
           g_free (build_state);
         }
 
+        task->info.started.in_journal = TRUE;
         n_merge_tasks_written++;
       }
   g_assert (n_merge_tasks_written == table->n_running_tasks);
 
+  /* align journal pointer */
+  if (at % 4 != 0)
+    at += 4 - (at % 4);
+
+  /* the rest of the batch being committed */
+  if (table->journal_tail_len > 0)
+    {
+      if (at + table->journal_tail_len + 4 > table->journal_size)
+        {
+          if (!resize_journal (journal_fd,
+                               &journal_mmap, &table->journal_size,
+                               at + table->journal_tail_len + 4,
+                               error))
+            return FALSE;
+        }
+      memcpy (journal_mmap + at, table->journal_tail_data,
+              table->journal_tail_len);
+      at += table->journal_tail_len;
+    }
+
   /* move the journal into place */
   if (rename (table->journal_tmp_fname, table->journal_cur_fname) < 0)
     {
@@ -1057,14 +1134,9 @@ reset_journal (GskTable   *table,
     }
 
 #if DEBUG_JOURNAL_WRITING
-  g_message ("reset-journal: header length %u", at);
+  g_message ("reset-journal: length %u", at);
 #endif
 
-
-  /* align journal pointer */
-  if (at % 4 != 0)
-    at += 4 - (at % 4);
-
   table->journal_len = at;
   table->journal_mmap = journal_mmap;
 
@@ -1295,6 +1367,19 @@ gsk_table_new         (const char            *dir,
   run_funcs = table_options_get_run_funcs (options, &has_len, error);
   if (run_funcs == NULL)
     return NULL;
+  if (options->filter_false_positive_rate < 0.0
+   || options->filter_false_positive_rate >= 1.0)
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_INVALID_ARGUMENT,
+                   "filter_false_positive_rate must be at least 0 and less than 1");
+      return NULL;
+    }
+  if (options->background_merging && !gsk_init_get_support_threads ())
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_INVALID_ARGUMENT,
+                   "background_merging requires gsk_init() with thread support");
+      return NULL;
+    }
   factory = table_options_get_file_factory (options, error);
   if (factory == NULL)
     return NULL;
@@ -1345,11 +1430,14 @@ gsk_table_new         (const char            *dir,
                : has_len ? tree_node_compare_with_len
                : tree_node_compare_no_len;
   table->journal_mode = options->journal_mode;
+  table->query_reverse_chronologically = TRUE;
   table->max_running_tasks = 4;
   table->max_merge_ratio_b16 = 3<<16;
   table->max_in_memory_bytes = options->max_in_memory_bytes;
   table->max_in_memory_entries = options->max_in_memory_entries;
   table->journal_flush_period = 3;
+  table->background_max_files = options->background_max_files;
+  table->background_bytes_per_second = options->background_bytes_per_second;
   table->tree_node_pool = g_new0 (TreeNode, table->max_in_memory_entries);
   table->journal_cur_fname = g_strdup_printf ("%s/journal", dir);
   table->journal_tmp_fname = g_strdup_printf ("%s/journal.tmp", dir);
@@ -1378,6 +1466,12 @@ gsk_table_new         (const char            *dir,
     }
   table->is_stable_func = options->is_stable;
 
+  /* filters hash the key's bytes, so they only work
+     if equal keys have the same bytes */
+  table->file_query.has_key_hash = table->compare.no_len == NULL;
+  table->filter_false_positive_rate
+    = table->file_query.has_key_hash ? options->filter_false_positive_rate : 0.0;
+
   if (did_mkdir)
     {
       /* make an empty journal file */
@@ -1412,11 +1506,54 @@ gsk_table_new         (const char            *dir,
         }
     }
 
+  if (options->background_merging)
+    {
+      table->background_merging = TRUE;
+      table->merge_lock = g_mutex_new ();
+      table->handoff_lock = g_mutex_new ();
+      table->handoff_cond = g_cond_new ();
+      table->commit_lock = g_mutex_new ();
+      table->commit_cond = g_cond_new ();
+      table->merge_thread = g_thread_create (background_merge_thread, table,
+                                             TRUE, error);
+      if (table->merge_thread == NULL)
+        {
+          gsk_g_error_add_prefix (error, "starting merge thread");
+          gsk_table_destroy (table);
+          return NULL;
+        }
+    }
+
   return table;
 }
 
 
 /* --- starting a merge-task */
+/* the run-list is sorted by number of input entries */
+static void
+insert_running_task (GskTable  *table,
+                     MergeTask *merge_task)
+{
+  guint64 n_input_entries = merge_task->inputs[0]->file->n_entries
+                          + merge_task->inputs[1]->file->n_entries;
+  MergeTask **p_next = &table->run_list;
+  for (;;)
+    {
+      MergeTask *next = *p_next;
+      guint64 next_n_input_entries;
+      if (next == NULL)
+        break;
+      next_n_input_entries = next->inputs[0]->file->n_entries
+                           + next->inputs[1]->file->n_entries;
+      if (next_n_input_entries > n_input_entries)
+        break;
+
+      p_next = &next->info.started.next_run;
+    }
+  merge_task->info.started.next_run = *p_next;
+  *p_next = merge_task;
+}
+
 static gboolean
 start_merge_task (GskTable   *table,
                   MergeTask  *merge_task,
@@ -1430,6 +1567,8 @@ start_merge_task (GskTable   *table,
   guint input;
   GskTableReader *readers[2];
   guint64 n_input_entries = prev->file->n_entries + next->file->n_entries;
+  file_hints.max_entries = n_input_entries;
+  file_hints.filter_false_positive_rate = table->filter_false_positive_rate;
 #if DEBUG_MERGE_TASKS
   g_message ("starting mergetask between "ID_FMT" and "ID_FMT" [%"G_GUINT64_FORMAT" input entries]",
              prev->file->id, next->file->id, n_input_entries);
@@ -1488,35 +1627,45 @@ start_merge_task (GskTable   *table,
   merge_task->info.started.output = output;
   merge_task->info.started.inputs[0].reader = readers[0];
   merge_task->info.started.inputs[1].reader = readers[1];
+  merge_task->info.started.in_journal = FALSE;
   merge_task->info.started.has_last_queryable_key = FALSE;
   gsk_table_buffer_init (&merge_task->info.started.last_queryable_key);
 
-  /* insert into run-list */
-  MergeTask **p_next = &table->run_list;
-  for (;;)
+  if (table->background_merging)
     {
-      MergeTask *next = *p_next;
-      guint64 next_n_input_entries;
-      if (next == NULL)
-        break;
-      next_n_input_entries = next->inputs[0]->file->n_entries
-                           + next->inputs[1]->file->n_entries;
-      if (next_n_input_entries > n_input_entries)
-        break;
-
-      p_next = &next->info.started.next_run;
+      /* the merge thread puts it in the run-list */
+      g_mutex_lock (table->handoff_lock);
+      merge_task->info.started.next_run = table->new_tasks;
+      table->new_tasks = merge_task;
+      table->n_running_tasks++;
+      g_cond_broadcast (table->handoff_cond);
+      g_mutex_unlock (table->handoff_lock);
+    }
+  else
+    {
+      insert_running_task (table, merge_task);
+      table->n_running_tasks++;
     }
-  merge_task->info.started.next_run = *p_next;
-  *p_next = merge_task;
-  table->n_running_tasks++;
   return TRUE;
 }
 
+static guint
+get_n_running_tasks (GskTable *table)
+{
+  guint rv;
+  if (!table->background_merging)
+    return table->n_running_tasks;
+  g_mutex_lock (table->handoff_lock);
+  rv = table->n_running_tasks;
+  g_mutex_unlock (table->handoff_lock);
+  return rv;
+}
+
 static gboolean
 maybe_start_tasks (GskTable *table,
                    GError  **error)
 {
-  while (table->n_running_tasks < table->max_running_tasks
+  while (get_n_running_tasks (table) < table->max_running_tasks
       && table->unstarted_merges != NULL)
     {
       MergeTask *bottom_heaviest;
@@ -1558,6 +1707,240 @@ run_merge_task (GskTable   *table,
   return (*func) (table, count, error);
 }
 
+/* Run each running merge-task to the end of an output chunk,
+   so that the build state that reset_journal() writes
+   agrees with the states of the task's readers.
+   Tasks that finish meanwhile are done as usual
+   (see merge_task_done()).  The order of the run-list is kept.
+   With background merging, merge_lock must be held. */
+static gboolean
+flush_running_tasks (GskTable   *table,
+                     GError    **error)
+{
+  MergeTask *rest = table->run_list;
+  MergeTask *kept = NULL;
+  MergeTask **kept_tail = &kept;
+  gboolean ok = TRUE;
+  while (rest != NULL)
+    {
+      MergeTask *task = rest;
+      rest = task->info.started.next_run;
+      task->info.started.next_run = NULL;
+      table->run_list = task;
+      if (ok && !run_merge_task (table, 0, TRUE, error))
+        ok = FALSE;
+      if (table->run_list == task)
+        {
+          /* still running (or failed) */
+          *kept_tail = task;
+          kept_tail = &task->info.started.next_run;
+        }
+    }
+  table->run_list = kept;
+  return ok;
+}
+
+/* --- background merging --- */
+/* Give up on the task at the head of the run-list, which failed:
+   its output is closed, and the foreground
+   unlinks it from its inputs (see abandon_failed_task()).
+   It is not retried.  merge_lock must be held. */
+static void
+fail_background_task (GskTable *table,
+                      GError   *error)
+{
+  MergeTask *task = table->run_list;
+  table->run_list = task->info.started.next_run;
+  gsk_table_reader_destroy (task->info.started.inputs[0].reader);
+  gsk_table_reader_destroy (task->info.started.inputs[1].reader);
+  /* if the journal resumes the task, replaying needs the output;
+     otherwise the next open deletes it as an unknown file */
+  gsk_table_file_destroy (task->info.started.output, table->dir,
+                          !task->info.started.in_journal, NULL);
+  gsk_table_buffer_clear (&task->info.started.last_queryable_key);
+
+  gsk_g_error_add_prefix (&error, "background merge");
+  g_mutex_lock (table->handoff_lock);
+  table->n_running_tasks--;
+  task->info.started.next_run = table->failed_tasks;
+  table->failed_tasks = task;
+  if (table->background_error == NULL)
+    table->background_error = error;
+  else
+    g_error_free (error);
+  g_atomic_int_inc (&table->background_pending);
+  g_cond_broadcast (table->handoff_cond);
+  g_mutex_unlock (table->handoff_lock);
+}
+
+/* Move the tasks the foreground started into the run-list.
+   merge_lock must be held. */
+static void
+splice_new_tasks (GskTable *table)
+{
+  g_mutex_lock (table->handoff_lock);
+  while (table->new_tasks != NULL)
+    {
+      MergeTask *task = table->new_tasks;
+      table->new_tasks = task->info.started.next_run;
+      insert_running_task (table, task);
+    }
+  g_mutex_unlock (table->handoff_lock);
+}
+
+static gpointer
+background_merge_thread (gpointer data)
+{
+  GskTable *table = data;
+  GTimeVal start;                       /* of this burst of merging */
+  guint64 start_n_merge_bytes = 0;
+  gboolean idle = TRUE;
+
+  for (;;)
+    {
+      GError *error = NULL;
+
+      /* wait for work; after an error, wait for
+         the foreground to report it */
+      g_mutex_lock (table->handoff_lock);
+      while (!table->stop_merge_thread
+          && table->new_tasks == NULL
+          && (table->run_list == NULL || table->background_error != NULL))
+        {
+          g_cond_wait (table->handoff_cond, table->handoff_lock);
+          idle = TRUE;
+        }
+      if (table->stop_merge_thread)
+        {
+          g_mutex_unlock (table->handoff_lock);
+          break;
+        }
+      g_mutex_unlock (table->handoff_lock);
+
+      g_mutex_lock (table->merge_lock);
+      splice_new_tasks (table);
+      if (table->run_list == NULL)
+        {
+          /* the foreground finished them: see flush_running_tasks() */
+          g_mutex_unlock (table->merge_lock);
+          continue;
+        }
+      if (idle)
+        {
+          g_get_current_time (&start);
+          start_n_merge_bytes = table->n_merge_bytes;
+          idle = FALSE;
+        }
+      if (!run_merge_task (table, BACKGROUND_MERGE_SLICE, FALSE, &error))
+        fail_background_task (table, error);
+      g_mutex_unlock (table->merge_lock);
+
+      if (table->background_bytes_per_second != 0)
+        {
+          /* sleep until this burst is back within its budget */
+          GTimeVal now;
+          gint64 budget_usecs, elapsed_usecs;
+          budget_usecs = (table->n_merge_bytes - start_n_merge_bytes)
+                       * G_USEC_PER_SEC / table->background_bytes_per_second;
+          g_get_current_time (&now);
+          elapsed_usecs = (gint64) (now.tv_sec - start.tv_sec) * G_USEC_PER_SEC
+                        + (now.tv_usec - start.tv_usec);
+          if (budget_usecs > elapsed_usecs)
+            g_usleep (budget_usecs - elapsed_usecs);
+          else
+            g_thread_yield ();
+        }
+      else
+        {
+          /* give the foreground a chance at merge_lock */
+          g_thread_yield ();
+        }
+    }
+  return NULL;
+}
+
+/* the failed task's inputs become ordinary files again */
+static void
+abandon_failed_task (GskTable  *table,
+                     MergeTask *task)
+{
+  g_assert (task->inputs[0]->next_task == task);
+  g_assert (task->inputs[1]->prev_task == task);
+  task->inputs[0]->next_task = NULL;
+  task->inputs[1]->prev_task = NULL;
+  g_slice_free (MergeTask, task);
+}
+
+/* Install the files that the merge thread has finished,
+   and start more tasks.  Called from the foreground,
+   which need not hold merge_lock. */
+static gboolean
+collect_background_merges (GskTable *table,
+                           GError  **error)
+{
+  MergeTask *finished, *failed;
+  GError *background_error;
+
+  g_mutex_lock (table->handoff_lock);
+  finished = table->finished_tasks;
+  failed = table->failed_tasks;
+  background_error = table->background_error;
+  table->finished_tasks = NULL;
+  table->failed_tasks = NULL;
+  table->background_error = NULL;
+  g_atomic_int_add (&table->background_pending, -table->background_pending);
+  g_mutex_unlock (table->handoff_lock);
+
+  while (failed != NULL)
+    {
+      MergeTask *task = failed;
+      failed = task->info.started.next_run;
+      abandon_failed_task (table, task);
+    }
+  while (finished != NULL)
+    {
+      MergeTask *task = finished;
+      finished = task->info.started.next_run;
+      install_merged_file (table, task);
+    }
+  if (background_error != NULL)
+    {
+      /* the merge thread resumes its other tasks now */
+      g_propagate_error (error, background_error);
+      g_mutex_lock (table->handoff_lock);
+      g_cond_broadcast (table->handoff_cond);
+      g_mutex_unlock (table->handoff_lock);
+      return FALSE;
+    }
+  return maybe_start_tasks (table, error);
+}
+
+/* Wait for the merge thread until flushing another file
+   won't leave more than background_max_files,
+   unless there's nothing running that could get us there.
+   merge_lock must not be held. */
+static gboolean
+wait_for_background_merges (GskTable *table,
+                            GError  **error)
+{
+  for (;;)
+    {
+      if (!collect_background_merges (table, error))
+        return FALSE;
+      if (table->n_files < table->background_max_files)
+        return TRUE;
+      g_mutex_lock (table->handoff_lock);
+      if (table->background_pending == 0 && table->n_running_tasks == 0)
+        {
+          g_mutex_unlock (table->handoff_lock);
+          return TRUE;
+        }
+      while (table->background_pending == 0)
+        g_cond_wait (table->handoff_cond, table->handoff_lock);
+      g_mutex_unlock (table->handoff_lock);
+    }
+}
+
 static gboolean
 dump_tree_recursively (TreeNode    *node,
                        GskTableFile *file,
@@ -1582,13 +1965,16 @@ flush_tree (GskTable   *table,
 {
   guint64 id = ++(table->last_file_id);
   GskTableFileHints file_hints = GSK_TABLE_FILE_HINTS_DEFAULTS;
-  GskTableFile *file = gsk_table_file_factory_create_file (table->file_factory,
-                                                           table->dir,
-                                                           id,
-                                                           &file_hints,
-                                                           error);
+  GskTableFile *file;
   FileInfo *fi;
   gboolean done;
+  file_hints.max_entries = table->in_memory_entry_count;
+  file_hints.filter_false_positive_rate = table->filter_false_positive_rate;
+  file = gsk_table_file_factory_create_file (table->file_factory,
+                                             table->dir,
+                                             id,
+                                             &file_hints,
+                                             error);
   if (file == NULL)
     {
       gsk_g_error_add_prefix (error, "flushing in-memory tree");
@@ -1630,37 +2016,26 @@ flush_tree (GskTable   *table,
   return TRUE;
 }
 
-/**
- * gsk_table_add:
- * @table: the table to add data to.
- * @key_len:
- * @key_data:
- * @value_len:
- * @value_data:
- * @error: place to put the error if something goes wrong.
- *
- * Add a new key/value pair to a GskTable.
- * If the key already exists, the semantics are dependent
- * on the merge function; if no merge function is given,
- * then both rows will exist in the table.
- *
- * returns: whether the addition was successful.
- */
-gboolean
-gsk_table_add         (GskTable              *table,
+/* Add an entry to the in-memory tree, flushing the tree if full,
+   but do not journal it.  If the flush wrote a new journal,
+   *journal_reset_out is set:  the entry is then in a file,
+   with every entry before it. */
+static gboolean
+add_entry             (GskTable              *table,
                        guint                  key_len,
                        const guint8          *key_data,
                        guint                  value_len,
                        const guint8          *value_data,
+                       gboolean              *journal_reset_out,
                        GError               **error)
 {
   TreeNode *found;
-  gboolean must_write_journal = table->journal_mode == GSK_TABLE_JOURNAL_DEFAULT;
   g_assert (table->key_fixed_length < 0
          || (guint) table->key_fixed_length == key_len);
   g_assert (table->value_fixed_length < 0
          || (guint) table->value_fixed_length == value_len);
 
+  *journal_reset_out = FALSE;
   table->n_input_entries++;
 
   if (table->merge.no_len == NULL)
@@ -1723,11 +2098,24 @@ gsk_table_add         (GskTable              *table,
   if (table->in_memory_entry_count == table->max_in_memory_entries
    || table->in_memory_bytes >= table->max_in_memory_bytes)
     {
+      /* The journal and the new tasks involve the running tasks,
+         so the merge thread must be paused, with none of
+         its finished tasks left uninstalled. */
+      if (table->background_merging)
+        {
+          if (!wait_for_background_merges (table, error))
+            return FALSE;
+          g_mutex_lock (table->merge_lock);
+          if (!collect_background_merges (table, error))
+            goto failed_flushing;
+          splice_new_tasks (table);
+        }
+
       /* flush the tree */
       if (!flush_tree (table, error))
         {
           gsk_g_error_add_prefix (error, "flushing tree");
-          return FALSE;
+          goto failed_flushing;
         }
 
       /* maybe flush journal */
@@ -1735,27 +2123,77 @@ gsk_table_add         (GskTable              *table,
        && (++(table->journal_flush_index) == table->journal_flush_period))
         {
           /* write new journal */
-          if (!reset_journal (table, error))
+          if (!flush_running_tasks (table, error)
+           || (table->background_merging
+               && !collect_background_merges (table, error))
+           || !reset_journal (table, error))
             {
               gsk_g_error_add_prefix (error, "error flushing journal");
-              return FALSE;
+              goto failed_flushing;
             }
 
           table->journal_flush_index = 0;
-          must_write_journal = FALSE;
+          *journal_reset_out = TRUE;
         }
 
       if (!maybe_start_tasks (table, error))
-        return FALSE;
+        goto failed_flushing;
+
+      if (table->background_merging)
+        g_mutex_unlock (table->merge_lock);
     }
 
-  if (table->run_list != NULL)
+  if (table->background_merging)
+    {
+      /* install finished merges as soon as they are done */
+      if (g_atomic_int_get (&table->background_pending) != 0
+       && !collect_background_merges (table, error))
+        return FALSE;
+    }
+  else if (table->run_list != NULL)
     {
       if (!run_merge_task (table, 32, FALSE, error))
         return FALSE;
     }
 
-  if (must_write_journal)
+  return TRUE;
+
+failed_flushing:
+  if (table->background_merging)
+    g_mutex_unlock (table->merge_lock);
+  return FALSE;
+}
+
+/**
+ * gsk_table_add:
+ * @table: the table to add data to.
+ * @key_len:
+ * @key_data:
+ * @value_len:
+ * @value_data:
+ * @error: place to put the error if something goes wrong.
+ *
+ * Add a new key/value pair to a GskTable.
+ * If the key already exists, the semantics are dependent
+ * on the merge function; if no merge function is given,
+ * then both rows will exist in the table.
+ *
+ * returns: whether the addition was successful.
+ */
+gboolean
+gsk_table_add         (GskTable              *table,
+                       guint                  key_len,
+                       const guint8          *key_data,
+                       guint                  value_len,
+                       const guint8          *value_data,
+                       GError               **error)
+{
+  gboolean journal_reset;
+  if (!add_entry (table, key_len, key_data, value_len, value_data,
+                  &journal_reset, error))
+    return FALSE;
+
+  if (table->journal_mode == GSK_TABLE_JOURNAL_DEFAULT && !journal_reset)
     {
       guint new_journal_len = 4 + key_len + 4 + value_len + table->journal_len;
       if (new_journal_len % 4 != 0)
@@ -1790,6 +2228,342 @@ gsk_table_add         (GskTable              *table,
   return TRUE;
 }
 
+/* --- write batches --- */
+struct _GskTableWriteBatch
+{
+  guint n_entries;
+  GskTableBuffer records;               /* in journal format */
+};
+
+struct _PendingWrite
+{
+  GskTableWriteBatch *batch;
+  gboolean sync;
+  gboolean done;
+  gboolean success;
+  GError *error;
+  PendingWrite *next;
+};
+
+/**
+ * gsk_table_write_batch_new:
+ *
+ * Create a batch of entries to add to a table
+ * with gsk_table_write().
+ *
+ * returns: the new, empty batch.
+ */
+GskTableWriteBatch *
+gsk_table_write_batch_new   (void)
+{
+  GskTableWriteBatch *batch = g_new (GskTableWriteBatch, 1);
+  batch->n_entries = 0;
+  gsk_table_buffer_init (&batch->records);
+  return batch;
+}
+
+/**
+ * gsk_table_write_batch_add:
+ * @batch: the batch to add to.
+ * @key_len:
+ * @key_data:
+ * @value_len:
+ * @value_data:
+ *
+ * Append a key/value pair to the batch.
+ * The data is copied.
+ */
+void
+gsk_table_write_batch_add   (GskTableWriteBatch    *batch,
+                             guint                  key_len,
+                             const guint8          *key_data,
+                             guint                  value_len,
+                             const guint8          *value_data)
+{
+  guint len = 8 + key_len + value_len;
+  guint pad = (4 - len % 4) % 4;
+  guint8 *at = gsk_table_buffer_append (&batch->records, len + pad);
+  ((guint32 *) at)[0] = GUINT32_TO_LE (key_len + 1);
+  ((guint32 *) at)[1] = GUINT32_TO_LE (value_len);
+  memcpy (at + 8, key_data, key_len);
+  memcpy (at + 8 + key_len, value_data, value_len);
+  memset (at + len, 0, pad);
+  batch->n_entries++;
+}
+
+/**
+ * gsk_table_write_batch_get_n_entries:
+ * @batch: the batch to query.
+ *
+ * returns: the number of entries added to the batch
+ * since it was created or cleared.
+ */
+guint
+gsk_table_write_batch_get_n_entries (GskTableWriteBatch *batch)
+{
+  return batch->n_entries;
+}
+
+/**
+ * gsk_table_write_batch_clear:
+ * @batch: the batch to empty.
+ *
+ * Remove all entries from the batch, so that it may be reused.
+ */
+void
+gsk_table_write_batch_clear (GskTableWriteBatch    *batch)
+{
+  batch->n_entries = 0;
+  batch->records.len = 0;
+}
+
+/**
+ * gsk_table_write_batch_free:
+ * @batch: the batch to free.
+ *
+ * Free the batch and its entries.
+ */
+void
+gsk_table_write_batch_free  (GskTableWriteBatch    *batch)
+{
+  gsk_table_buffer_clear (&batch->records);
+  g_free (batch);
+}
+
+static gboolean
+msync_journal (GskTable   *table,
+               guint       start,
+               guint       end,
+               int         flags,
+               GError    **error)
+{
+  guint page_start = start - start % getpagesize ();
+  if (msync (table->journal_mmap + page_start, end - page_start, flags) < 0)
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_FILE_WRITE,
+                   "error syncing journal: %s",
+                   g_strerror (errno));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* Append records, already in journal format, with one copy.
+   The first record's length is written last, as gsk_table_add() does:
+   until then the journal ends where it did.  If sync is set,
+   the rest is synced before the length, so that a crash
+   keeps all or none, and the length is on disk too when this returns. */
+static gboolean
+write_journal_records (GskTable     *table,
+                       guint         len,
+                       const guint8 *data,
+                       gboolean      sync,
+                       GError      **error)
+{
+  guint old_journal_len = table->journal_len;
+  guint new_journal_len = old_journal_len + len;
+  if (new_journal_len + 4 > table->journal_size)
+    {
+      if (!resize_journal (table->journal_fd,
+                           &table->journal_mmap,
+                           &table->journal_size,
+                           new_journal_len + 4,
+                           error))
+        {
+          gsk_g_error_add_prefix (error, "expanding journal");
+          return FALSE;
+        }
+    }
+  memset (table->journal_mmap + new_journal_len, 0, 4);
+  memcpy (table->journal_mmap + old_journal_len + 4, data + 4, len - 4);
+  if (sync
+   && !msync_journal (table, old_journal_len + 4, new_journal_len + 4,
+                      MS_SYNC, error))
+    return FALSE;
+  GSK_MEMORY_BARRIER ();
+  memcpy (table->journal_mmap + old_journal_len, data, 4);
+  if (sync
+   && !msync_journal (table, old_journal_len, old_journal_len + 4,
+                      MS_SYNC, error))
+    return FALSE;
+  table->journal_len = new_journal_len;
+  return TRUE;
+}
+
+static gboolean
+sync_journal (GskTable   *table,
+              GError    **error)
+{
+  return msync_journal (table, 0, table->journal_len + 4, MS_SYNC, error);
+}
+
+/* Journal the records of a list of batches in one write,
+   then add their entries, syncing the journal once
+   if any writer asked to.
+
+   The records are journalled before any entry is added,
+   so that a crash keeps all of them or none.
+   Adding them may flush the tree and write a new journal:
+   the records not yet added are then carried into it
+   by reset_journal(). */
+static gboolean
+commit_writes (GskTable     *table,
+               PendingWrite *writes,
+               GError      **error)
+{
+  gboolean must_write_journal = table->journal_mode == GSK_TABLE_JOURNAL_DEFAULT;
+  gboolean must_sync = FALSE;
+  gboolean any_journal_reset = FALSE;
+  const guint8 *records;
+  guint records_len;
+  guint at;
+  PendingWrite *w;
+
+  if (writes->next == NULL)
+    {
+      records = writes->batch->records.data;
+      records_len = writes->batch->records.len;
+      must_sync = writes->sync;
+    }
+  else
+    {
+      GskTableBuffer *buf = &table->journal_batch_buffer;
+      buf->len = 0;
+      for (w = writes; w != NULL; w = w->next)
+        {
+          guint len = w->batch->records.len;
+          if (len > 0)
+            memcpy (gsk_table_buffer_append (buf, len),
+                    w->batch->records.data, len);
+          if (w->sync)
+            must_sync = TRUE;
+        }
+      records = buf->data;
+      records_len = buf->len;
+    }
+  if (records_len == 0)
+    return TRUE;
+
+  if (must_write_journal
+   && !write_journal_records (table, records_len, records, must_sync, error))
+    return FALSE;
+
+  for (at = 0; at < records_len; )
+    {
+      guint key_len = GUINT32_FROM_LE (((guint32 *) (records + at))[0]) - 1;
+      guint value_len = GUINT32_FROM_LE (((guint32 *) (records + at))[1]);
+      guint next = at + ((8 + key_len + value_len + 3) & ~3);
+      gboolean journal_reset;
+      gboolean ok;
+      if (must_write_journal)
+        {
+          table->journal_tail_data = records + next;
+          table->journal_tail_len = records_len - next;
+        }
+      ok = add_entry (table,
+                      key_len, records + at + 8,
+                      value_len, records + at + 8 + key_len,
+                      &journal_reset, error);
+      table->journal_tail_data = NULL;
+      table->journal_tail_len = 0;
+      if (!ok)
+        return FALSE;
+      if (journal_reset)
+        any_journal_reset = TRUE;
+      at = next;
+    }
+
+  /* the new journal has the records that were synced to the old one */
+  if (any_journal_reset && must_sync && !sync_journal (table, error))
+    return FALSE;
+  return TRUE;
+}
+
+/**
+ * gsk_table_write:
+ * @table: the table to add data to.
+ * @batch: the entries to add.
+ * @sync: whether to wait for the journal to reach the disk.
+ * @error: place to put the error if something goes wrong.
+ *
+ * Add all the entries in @batch, as gsk_table_add() would,
+ * in order.  With GSK_TABLE_JOURNAL_DEFAULT they are journalled
+ * together, in one write, so that after a crash either all or none
+ * of them are replayed.  If @sync is set, the journal is synced
+ * before returning, making the write durable;  otherwise,
+ * as with gsk_table_add(), the records reach the disk
+ * when the system gets to them.  The batch is not cleared.
+ *
+ * If the table merges in the background, several threads
+ * may call this at once (but no other function on the table):
+ * the batches that arrive while one is being written
+ * are then written together, and synced together if any asked to be.
+ *
+ * returns: whether the addition was successful.
+ * On failure, some of the entries may have been added.
+ */
+gboolean
+gsk_table_write       (GskTable              *table,
+                       GskTableWriteBatch    *batch,
+                       gboolean               sync,
+                       GError               **error)
+{
+  PendingWrite write;
+  PendingWrite *group, *w;
+  GError *e = NULL;
+  gboolean rv;
+
+  write.batch = batch;
+  write.sync = sync;
+  write.done = FALSE;
+  write.success = FALSE;
+  write.error = NULL;
+  write.next = NULL;
+  if (!table->background_merging)
+    return commit_writes (table, &write, error);
+
+  g_mutex_lock (table->commit_lock);
+  if (table->last_pending_write == NULL)
+    table->first_pending_write = &write;
+  else
+    table->last_pending_write->next = &write;
+  table->last_pending_write = &write;
+  while (table->committing && !write.done)
+    g_cond_wait (table->commit_cond, table->commit_lock);
+  if (write.done)
+    {
+      /* another writer committed our batch */
+      g_mutex_unlock (table->commit_lock);
+      if (write.error != NULL)
+        g_propagate_error (error, write.error);
+      return write.success;
+    }
+
+  /* commit our batch, and all that queued up behind it */
+  table->committing = TRUE;
+  group = table->first_pending_write;
+  table->first_pending_write = table->last_pending_write = NULL;
+  g_mutex_unlock (table->commit_lock);
+
+  rv = commit_writes (table, group, &e);
+
+  g_mutex_lock (table->commit_lock);
+  for (w = group; w != NULL; w = w->next)
+    {
+      w->success = rv;
+      if (!rv && w != &write)
+        w->error = g_error_copy (e);
+      w->done = TRUE;
+    }
+  table->committing = FALSE;
+  g_cond_broadcast (table->commit_cond);
+  g_mutex_unlock (table->commit_lock);
+
+  if (e != NULL)
+    g_propagate_error (error, e);
+  return rv;
+}
+
 static inline int
 do_compare (GskTable *table,
             guint     a_len,
@@ -1805,6 +2579,102 @@ do_compare (GskTable *table,
     return table->compare.no_len (a_data, b_data, table->user_data);
 }
 
+/* --- querying --- */
+typedef struct _QueryResult QueryResult;
+struct _QueryResult
+{
+  gboolean has_result;
+  gboolean is_final;            /* no older value can change it */
+  gboolean skip_file;           /* for gsk_table_query_many() */
+  GskTableBuffer *result;
+  GskTableBuffer *other_result;
+};
+
+/* Combine a value found for the key with the result so far.
+   Querying reverse-chronologically, the value is older than
+   the result; otherwise, it is newer. */
+static void
+query_result_add (GskTable     *table,
+                  guint         key_len,
+                  const guint8 *key_data,
+                  QueryResult  *qr,
+                  guint         value_len,
+                  const guint8 *value_data)
+{
+  if (qr->has_result)
+    {
+      gboolean value_is_a = table->query_reverse_chronologically;
+      guint a_len = value_is_a ? value_len : qr->result->len;
+      const guint8 *a_data = value_is_a ? value_data : qr->result->data;
+      guint b_len = value_is_a ? qr->result->len : value_len;
+      const guint8 *b_data = value_is_a ? qr->result->data : value_data;
+      GskTableMergeResult merge_result;
+      merge_result
+        = table->has_len ?
+             table->merge.with_len (key_len, key_data,
+                                    a_len, a_data, b_len, b_data,
+                                    qr->other_result,
+                                    table->user_data)
+           : table->merge.no_len (key_data, a_data, b_data,
+                                  qr->other_result,
+                                  table->user_data);
+      switch (merge_result)
+        {
+        case GSK_TABLE_MERGE_RETURN_A:
+          if (value_is_a)
+            set_buffer (qr->result, value_len, value_data);
+          break;
+        case GSK_TABLE_MERGE_RETURN_B:
+          if (!value_is_a)
+            set_buffer (qr->result, value_len, value_data);
+          break;
+        case GSK_TABLE_MERGE_SUCCESS:
+          {
+            GskTableBuffer *tmp = qr->result;
+            qr->result = qr->other_result;
+            qr->other_result = tmp;
+            break;
+          }
+        case GSK_TABLE_MERGE_DROP:
+          qr->has_result = FALSE;
+          break;
+        default:
+          g_assert_not_reached ();
+        }
+    }
+  else
+    {
+      qr->has_result = TRUE;
+      set_buffer (qr->result, value_len, value_data);
+      if (table->merge.no_len == NULL)
+        {
+          /* without a merge function, the first value found is it */
+          qr->is_final = TRUE;
+          return;
+        }
+    }
+
+  /* are we done? */
+  if (qr->has_result
+   && table->is_stable_func != NULL
+   && table->is_stable_func (key_len, key_data,
+                             qr->result->len, qr->result->data,
+                             table->user_data))
+    qr->is_final = TRUE;
+}
+
+static void
+query_tree (GskTable     *table,
+            guint         key_len,
+            const guint8 *key_data,
+            QueryResult  *qr)
+{
+  TreeNode *node = table->in_memory_tree_lookup (table, key_len, key_data);
+  if (node != NULL)
+    query_result_add (table, key_len, key_data, qr,
+                      node->value.len, node->value.data);
+}
+
 gboolean
 gsk_table_query       (GskTable              *table,
                        guint                  key_len,
@@ -1815,17 +2685,22 @@ gsk_table_query       (GskTable              *table,
                        GError               **error)
 {
   gboolean reverse = table->query_reverse_chronologically;
-  gboolean has_result = FALSE;
-  GskTableBuffer *result_buffers = table->result_buffers;       /* [2] */
-  GskTableBuffer *result = result_buffers;
-  GskTableBuffer *other_result = result_buffers+1;
+  QueryResult qr;
   GskTableFileQuery *query = &table->file_query;
   FileInfo *fi;
-  gboolean use_merge_tasks = TRUE;
-  gpointer user_data = table->user_data;
+  /* the merge thread is still writing the merge-task outputs */
+  gboolean use_merge_tasks = !table->background_merging;
+
+  qr.has_result = FALSE;
+  qr.is_final = FALSE;
+  qr.skip_file = FALSE;
+  qr.result = table->result_buffers + 0;
+  qr.other_result = table->result_buffers + 1;
 
   table->file_query_key_len = key_len;
   table->file_query_key_data = key_data;
+  if (query->has_key_hash)
+    query->key_hash = gsk_table_file_hash_key (key_len, key_data);
 
 #if DEBUG_PRINT_QUERIES
   {
@@ -1837,25 +2712,11 @@ gsk_table_query       (GskTable              *table,
 
   /* first query rbtree (if in reverse-chronological mode (default)) */
   if (reverse)
-    {
-      TreeNode *node = table->in_memory_tree_lookup (table, key_len, key_data);
-      if (node != NULL)
-        {
-          has_result = TRUE;
-          copy_buffer (result, &node->value);
-
-          /* are we done? */
-          if (table->is_stable_func != NULL
-           && table->is_stable_func (key_len, key_data,
-                                     result->len, result->data,
-                                     table->user_data))
-            goto done_querying_copy_result;
-        }
-    }
+    query_tree (table, key_len, key_data, &qr);
 
   /* walk through files, using merge-jobs as appropriate */
   for (fi = reverse ? table->last_file : table->first_file;
-       fi != NULL;
+       fi != NULL && !qr.is_final;
        fi = reverse ? fi->prev_file : fi->next_file)
     {
       MergeTask *mt = reverse ? fi->prev_task : fi->next_task;
@@ -1894,86 +2755,8 @@ cannot_use_merge_output:
 
 handle_file_query_result:
       if (query->found)
-        {
-          if (has_result)
-            {
-              /* merge values */
-              GskTableMergeResult merge_result;
-              if (reverse)
-                merge_result
-                  = table->has_len ?
-                       table->merge.with_len (key_len, key_data,
-                                              query->value.len,
-                                              query->value.data,
-                                              result->len, result->data,
-                                              other_result,
-                                              user_data)
-                     : table->merge.no_len (key_data,
-                                            query->value.data,
-                                            result->data,
-                                            other_result,
-                                            user_data);
-              else
-                merge_result
-                  = table->has_len ?
-                       table->merge.with_len (key_len, key_data,
-                                              result->len, result->data,
-                                              query->value.len,
-                                              query->value.data,
-                                              other_result,
-                                              user_data)
-                     : table->merge.no_len (key_data,
-                                            result->data,
-                                            query->value.data,
-                                            other_result,
-                                            user_data);
-              switch (merge_result)
-                {
-                case GSK_TABLE_MERGE_RETURN_A:
-                  if (reverse)
-                    copy_buffer (result, &query->value);
-                  else
-                    (void) 0; /* do nothing: result is already correct */
-                  break;
-                case GSK_TABLE_MERGE_RETURN_B:
-                  if (!reverse)
-                    copy_buffer (result, &query->value);
-                  else
-                    (void) 0; /* do nothing: result is already correct */
-                  break;
-                case GSK_TABLE_MERGE_SUCCESS:
-                  {
-                    GskTableBuffer *tmp = result;
-                    result = other_result;
-                    other_result = tmp;
-                    break;
-                  }
-                case GSK_TABLE_MERGE_DROP:
-                  has_result = FALSE;
-                  break;
-                default:
-                  g_assert_not_reached ();
-                }
-            }
-          else if (table->merge.no_len == NULL)
-            {
-              *found_value_out = TRUE;
-              copy_buffer (result, &query->value);
-              goto done_querying_copy_result;
-            }
-          else
-            {
-              has_result = TRUE;
-              copy_buffer (result, &query->value);
-            }
-
-          /* are we done? */
-          if (table->is_stable_func != NULL
-           && table->is_stable_func (key_len, key_data,
-                                     result->len, result->data,
-                                     table->user_data))
-            goto done_querying_copy_result;
-        }
+        query_result_add (table, key_len, key_data, &qr,
+                          query->value.len, query->value.data);
 
       /* skip one extra file */
       if (used_merge_output)
@@ -1981,73 +2764,222 @@ handle_file_query_result:
     }
 
   /* last query rbtree (if in chronological mode) */
-  if (!reverse)
+  if (!reverse && !qr.is_final)
+    query_tree (table, key_len, key_data, &qr);
+
+  *found_value_out = qr.has_result;
+  if (qr.has_result)
+    {
+      *value_len_out = qr.result->len;
+      *value_data_out = g_memdup (qr.result->data, qr.result->len);
+    }
+  return TRUE;
+
+failed:
+  return FALSE;
+}
+
+typedef struct
+{
+  GskTable *table;
+  const guint *key_lens;
+  const guint8 **key_datas;
+} SortKeysInfo;
+
+static gint
+compare_key_indices (gconstpointer a,
+                     gconstpointer b,
+                     gpointer      data)
+{
+  SortKeysInfo *info = data;
+  guint ia = * (const guint *) a;
+  guint ib = * (const guint *) b;
+  return do_compare (info->table,
+                     info->key_lens[ia], info->key_datas[ia],
+                     info->key_lens[ib], info->key_datas[ib]);
+}
+
+/**
+ * gsk_table_query_many:
+ * @table: the table to query.
+ * @n_keys: the number of keys to look up.
+ * @key_lens: the lengths of the keys.
+ * @key_datas: the keys.
+ * @found_values_out: set to whether each key was found.
+ * @value_lens_out: set to the length of each value found.
+ * @value_datas_out: set to each value found, which must be freed
+ * with g_free(), or NULL for keys not found.
+ * @error: place to put the error if something goes wrong.
+ *
+ * Look up many keys at once, giving the same results
+ * as gsk_table_query() would for each, in the same order.
+ * The keys are probed in sorted order, one file at a time,
+ * so that neighbouring keys share the search through
+ * the file's index and the chunks it reads.
+ *
+ * returns: whether the queries were successful.
+ */
+gboolean
+gsk_table_query_many  (GskTable              *table,
+                       guint                  n_keys,
+                       const guint           *key_lens,
+                       const guint8         **key_datas,
+                       gboolean              *found_values_out,
+                       guint                 *value_lens_out,
+                       guint8               **value_datas_out,
+                       GError               **error)
+{
+  gboolean reverse = table->query_reverse_chronologically;
+  GskTableFileQuery *query = &table->file_query;
+  gboolean use_merge_tasks = !table->background_merging;
+  QueryResult *qrs;
+  GskTableBuffer *buffers;
+  guint64 *key_hashes = NULL;
+  guint *order;
+  guint n_final = 0;
+  gboolean rv = FALSE;
+  FileInfo *fi;
+  guint i, j;
+
+  if (n_keys == 0)
+    return TRUE;
+
+  /* sort the keys, remembering where they came from */
+  order = g_new (guint, n_keys);
+  for (i = 0; i < n_keys; i++)
+    order[i] = i;
+  {
+    SortKeysInfo info;
+    info.table = table;
+    info.key_lens = key_lens;
+    info.key_datas = key_datas;
+    g_qsort_with_data (order, n_keys, sizeof (guint),
+                       compare_key_indices, &info);
+  }
+
+  qrs = g_new (QueryResult, n_keys);
+  buffers = g_new0 (GskTableBuffer, n_keys * 2);
+  for (i = 0; i < n_keys; i++)
+    {
+      qrs[i].has_result = FALSE;
+      qrs[i].is_final = FALSE;
+      qrs[i].skip_file = FALSE;
+      qrs[i].result = buffers + 2 * i;
+      qrs[i].other_result = buffers + 2 * i + 1;
+    }
+  if (query->has_key_hash)
+    {
+      key_hashes = g_new (guint64, n_keys);
+      for (i = 0; i < n_keys; i++)
+        key_hashes[i] = gsk_table_file_hash_key (key_lens[i], key_datas[i]);
+    }
+
+  if (reverse)
+    for (i = 0; i < n_keys; i++)
+      {
+        query_tree (table, key_lens[i], key_datas[i], qrs + i);
+        if (qrs[i].is_final)
+          n_final++;
+      }
+
+  /* Walk through the files, querying each for the keys in order.
+     As in gsk_table_query(), keys up to a merge-task's
+     last queryable key are looked up in its output instead,
+     and then skip the task's other input:  since the keys
+     are sorted, they come first. */
+  query->ascending = TRUE;
+  for (fi = reverse ? table->last_file : table->first_file;
+       fi != NULL && n_final < n_keys;
+       fi = reverse ? fi->prev_file : fi->next_file)
     {
-      TreeNode *node = table->in_memory_tree_lookup (table, key_len, key_data);
-      if (node != NULL)
+      MergeTask *mt = reverse ? fi->prev_task : fi->next_task;
+      GskTableFile *output = NULL;
+      if (use_merge_tasks && mt != NULL && mt->is_started
+       && mt->info.started.has_last_queryable_key)
+        output = mt->info.started.output;
+
+      gsk_table_file_query_restart (query);
+      for (j = 0; j < n_keys; j++)
         {
-          if (has_result)
+          GskTableFile *file = fi->file;
+          i = order[j];
+          if (qrs[i].skip_file)
+            {
+              /* the merge-task output covered this file */
+              qrs[i].skip_file = FALSE;
+              continue;
+            }
+          if (qrs[i].is_final)
+            continue;
+          if (output != NULL)
             {
-              /* merge */
-              GskTableMergeResult merge_result;
-              merge_result
-                = table->has_len
-                     ? table->merge.with_len (key_len, key_data,
-                                              result->len, result->data,
-                                              node->value.len, node->value.data,
-                                              other_result,
-                                              user_data)
-                     : table->merge.no_len (key_data,
-                                            result->data,
-                                            node->value.data,
-                                            other_result,
-                                            user_data);
-              switch (merge_result)
+              if (do_compare (table,
+                              mt->info.started.last_queryable_key.len,
+                              mt->info.started.last_queryable_key.data,
+                              key_lens[i], key_datas[i]) >= 0)
+                {
+                  file = output;
+                  qrs[i].skip_file = TRUE;
+                }
+              else
                 {
-                case GSK_TABLE_MERGE_RETURN_A:
-                  break;
-                case GSK_TABLE_MERGE_RETURN_B:
-                  copy_buffer (result, &node->value);
-                  break;
-                case GSK_TABLE_MERGE_SUCCESS:
-                  {
-                    GskTableBuffer *tmp = result;
-                    result = other_result;
-                    other_result = tmp;
-                    break;
-                  }
-                case GSK_TABLE_MERGE_DROP:
-                  has_result = FALSE;
-                  break;
-                default:
-                  g_assert_not_reached ();
+                  /* this and the remaining keys are in fi's file */
+                  output = NULL;
+                  gsk_table_file_query_restart (query);
                 }
             }
-          else
+          table->file_query_key_len = key_lens[i];
+          table->file_query_key_data = key_datas[i];
+          if (key_hashes != NULL)
+            query->key_hash = key_hashes[i];
+          if (!gsk_table_file_query (file, query, error))
             {
-              has_result = TRUE;
-              copy_buffer (result, &node->value);
+              gsk_g_error_add_prefix (error, "querying file");
+              goto cleanup;
+            }
+          if (query->found)
+            {
+              query_result_add (table, key_lens[i], key_datas[i], qrs + i,
+                                query->value.len, query->value.data);
+              if (qrs[i].is_final)
+                n_final++;
             }
-
-          /* note: no need to check stability,
-             since there's nothing more to do anyways. */
         }
     }
 
-done_querying_copy_result:
-  *found_value_out = has_result;
-  if (has_result)
+  if (!reverse)
+    for (i = 0; i < n_keys; i++)
+      if (!qrs[i].is_final)
+        query_tree (table, key_lens[i], key_datas[i], qrs + i);
+
+  for (i = 0; i < n_keys; i++)
     {
-      *value_len_out = result->len;
-      *value_data_out = g_memdup (result->data, result->len);
+      found_values_out[i] = qrs[i].has_result;
+      if (qrs[i].has_result)
+        {
+          /* hand over the buffer's data, rather than copying it */
+          value_lens_out[i] = qrs[i].result->len;
+          value_datas_out[i] = qrs[i].result->data;
+          gsk_table_buffer_init (qrs[i].result);
+        }
+      else
+        {
+          value_lens_out[i] = 0;
+          value_datas_out[i] = NULL;
+        }
     }
-  /* fall through */
-
-//done_querying:
-  return TRUE;
-
-failed:
-  return FALSE;
+  rv = TRUE;
+
+cleanup:
+  query->ascending = FALSE;
+  gsk_table_file_query_restart (query);
+  for (i = 0; i < n_keys * 2; i++)
+    gsk_table_buffer_clear (buffers + i);
+  g_free (buffers);
+  g_free (qrs);
+  g_free (key_hashes);
+  g_free (order);
+  return rv;
 }
 
 const char *
@@ -2061,6 +2993,24 @@ gsk_table_destroy     (GskTable              *table)
 {
   guint i;
   FileInfo *fi, *next=NULL;
+  if (table->merge_thread != NULL)
+    {
+      g_mutex_lock (table->handoff_lock);
+      table->stop_merge_thread = TRUE;
+      g_cond_broadcast (table->handoff_cond);
+      g_mutex_unlock (table->handoff_lock);
+      g_thread_join (table->merge_thread);
+    }
+  if (table->merge_lock != NULL)
+    {
+      g_mutex_free (table->merge_lock);
+      g_mutex_free (table->handoff_lock);
+      g_cond_free (table->handoff_cond);
+      g_mutex_free (table->commit_lock);
+      g_cond_free (table->commit_cond);
+    }
+  if (table->background_error != NULL)
+    g_error_free (table->background_error);
   for (fi = table->first_file; fi != NULL; fi = next)
     {
       next = fi->next_file;
@@ -2075,6 +3025,8 @@ gsk_table_destroy     (GskTable              *table)
   gsk_table_buffer_clear (&table->result_buffers[0]);
   gsk_table_buffer_clear (&table->result_buffers[1]);
   gsk_table_buffer_clear (&table->merge_buffer);
+  gsk_table_buffer_clear (&table->task_merge_buffer);
+  gsk_table_buffer_clear (&table->journal_batch_buffer);
   gsk_table_buffer_clear (&table->simplify_buffer);
   g_slice_free (GskTable, table);
 }
@@ -2087,16 +3039,11 @@ merge_task_done (GskTable    *table,
                  GError     **error)
 {
   gboolean done;
-  FileInfo *new_file;
 
   g_assert (task == table->run_list);
   g_assert (task->inputs[0]->prev_task == NULL);
   g_assert (task->inputs[1]->next_task == NULL);
 
-  /* remove this task from the run list */
-  table->run_list = task->info.started.next_run;
-  table->n_running_tasks--;
-
 #if DEBUG_MERGE_TASKS
   g_message ("finished mergetask between "ID_FMT" and "ID_FMT, task->inputs[0]->file->id, task->inputs[1]->file->id);
 #endif
@@ -2107,10 +3054,40 @@ merge_task_done (GskTable    *table,
   if (done == FALSE)
     g_error ("gsk_table_file_done_feeding not ready not handled yet");
 
+  /* remove this task from the run list:
+     on failure it stays, so it can be abandoned */
+  table->run_list = task->info.started.next_run;
+
   /* destroy the input readers */
   gsk_table_reader_destroy (task->info.started.inputs[0].reader);
   gsk_table_reader_destroy (task->info.started.inputs[1].reader);
 
+  if (table->background_merging)
+    {
+      /* the foreground installs it: see collect_background_merges() */
+      g_mutex_lock (table->handoff_lock);
+      table->n_running_tasks--;
+      task->info.started.next_run = table->finished_tasks;
+      table->finished_tasks = task;
+      g_atomic_int_inc (&table->background_pending);
+      g_cond_broadcast (table->handoff_cond);
+      g_mutex_unlock (table->handoff_lock);
+    }
+  else
+    {
+      table->n_running_tasks--;
+      install_merged_file (table, task);
+    }
+  return TRUE;
+}
+
+/* replace a finished merge-task's inputs with its output */
+static void
+install_merged_file (GskTable  *table,
+                     MergeTask *task)
+{
+  FileInfo *new_file;
+
   /* create a new FileInfo */
   new_file = g_slice_new0 (FileInfo);
   new_file->ref_count = 1;
@@ -2127,6 +3104,20 @@ merge_task_done (GskTable    *table,
   table->n_files -= 1;
   CHECK_FILES_CONTIGUOUS (table);
 
+  /* replaying the journal would resume this task,
+     so the output must be kept until the journal is reset,
+     even if it is merged away before then */
+  if (task->info.started.in_journal)
+    {
+      table->old_files = g_renew (FileInfo *, table->old_files,
+                                  table->n_old_files + 1);
+      table->old_files[table->n_old_files++] = file_info_ref (new_file);
+    }
+
+  /* the inputs are erased once the journal no longer refers to them */
+  file_info_unref (task->inputs[0], table->dir, TRUE);
+  file_info_unref (task->inputs[1], table->dir, TRUE);
+
   /* possibly create more unstarted merge-tasks */
   if (new_file->prev_file != NULL
    && TASK_IS_UNSTARTED (new_file->prev_file->prev_task))
@@ -2136,8 +3127,6 @@ merge_task_done (GskTable    *table,
     create_unstarted_merge_task (table, new_file, new_file->next_file);
 
   g_slice_free (MergeTask, task);
-
-  return TRUE;
 }
 
 /* --- optimizing run_merge_task variants --- */
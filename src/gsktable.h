@@ -123,6 +123,26 @@ struct _GskTableOptions
   /* tunables */
   gsize max_in_memory_entries;
   gsize max_in_memory_bytes;
+
+  /* Each file gets a filter that rules out most keys
+     it does not contain, so that queries for them needn't search it.
+     This is the fraction of such keys that get through anyway;
+     0 means not to build filters.  The filter hashes the key's bytes,
+     so it is only used by tables with the default (memcmp) compare. */
+  gdouble filter_false_positive_rate;
+
+  /* Run merge tasks in a background thread, instead of
+     a bit at a time in gsk_table_add().  (gsk_init() must
+     have enabled threads.)  The merge and compare functions
+     are then called from both threads.
+
+     gsk_table_add() waits for merges to finish when a flush
+     would leave more than background_max_files files;
+     background_bytes_per_second limits the rate keys and values
+     are merged, or is 0 for no limit. */
+  gboolean background_merging;
+  guint background_max_files;
+  gsize background_bytes_per_second;
 };
 
 GskTableOptions     *gsk_table_options_new    (void);
@@ -149,6 +169,24 @@ gboolean    gsk_table_add         (GskTable              *table,
                                    guint                  value_len,
 	          	           const guint8          *value_data,
                                    GError               **error);
+
+/* Adding many entries at once:  they are journalled with
+   one write, and optionally synced to disk together. */
+typedef struct _GskTableWriteBatch GskTableWriteBatch;
+GskTableWriteBatch *gsk_table_write_batch_new   (void);
+void        gsk_table_write_batch_add   (GskTableWriteBatch    *batch,
+                                         guint                  key_len,
+                                         const guint8          *key_data,
+                                         guint                  value_len,
+                                         const guint8          *value_data);
+guint       gsk_table_write_batch_get_n_entries (GskTableWriteBatch *batch);
+void        gsk_table_write_batch_clear (GskTableWriteBatch    *batch);
+void        gsk_table_write_batch_free  (GskTableWriteBatch    *batch);
+gboolean    gsk_table_write       (GskTable              *table,
+                                   GskTableWriteBatch    *batch,
+                                   gboolean               sync,
+                                   GError               **error);
+
 gboolean    gsk_table_query       (GskTable              *table,
                                    guint                  key_len,
 			           const guint8          *key_data,
@@ -156,9 +194,31 @@ gboolean    gsk_table_query       (GskTable              *table,
 			           guint                 *value_len_out,
 			           guint8               **value_data_out,
                                    GError               **error);
+gboolean    gsk_table_query_many  (GskTable              *table,
+                                   guint                  n_keys,
+                                   const guint           *key_lens,
+                                   const guint8         **key_datas,
+                                   gboolean              *found_values_out,
+                                   guint                 *value_lens_out,
+                                   guint8               **value_datas_out,
+                                   GError               **error);
 const char *gsk_table_peek_dir    (GskTable              *table);
 void        gsk_table_destroy     (GskTable              *table);
 
+/* Decompressed chunks of table files are kept in a cache
+   shared by all tables, bounded by max_bytes. */
+typedef struct _GskTableCacheStats GskTableCacheStats;
+struct _GskTableCacheStats
+{
+  guint64 n_hits;
+  guint64 n_misses;
+  guint n_chunks;
+  gsize n_bytes;
+  gsize max_bytes;
+};
+void        gsk_table_set_cache_max_bytes (gsize               max_bytes);
+void        gsk_table_get_cache_stats     (GskTableCacheStats *stats_out);
+
 
 struct _GskTableReader
 {
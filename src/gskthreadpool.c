@@ -1,35 +1,39 @@
 #include "gskthreadpool.h"
-#include "gskerrno.h"
-#include "gskghelpers.h"
-#include <unistd.h>
-#include <errno.h>
+#include <string.h>
 
-typedef struct _TaskInfo TaskInfo;
-typedef struct _ThreadInfo ThreadInfo;
+/* The pool is a work-stealing scheduler:  every worker thread
+   owns a Chase-Lev deque, and so does the main-loop's thread
+   (for tasks pushed from it).  An owner pushes and pops at the
+   bottom of its deque without locking;  other workers steal
+   from the top with a single compare-and-exchange.
 
-struct _GskThreadPool
-{
+   Idle workers spin for a while before sleeping on a condition,
+   so that a steady stream of tasks doesn't cost a wakeup per task.
 
-  /*< private >*/
-  GskSource *wakeup_source;
-  int wakeup_read_fd;
-  int wakeup_write_fd;
+   Results of short tasks are handed back to the main-loop
+   in batches, with one gsk_main_loop_post() per batch. */
 
-  guint num_threads;
-  guint max_threads;
+/* maximum number of results handed back at once */
+#define MAX_RESULT_BATCH	32
 
-  GCond *task_available;
-  GMutex *task_available_mutex;
+/* a task that ran longer than this is returned immediately:
+   batching its result would only delay it. */
+#define SHORT_TASK_USECS	100
 
-  GMutex *lock;
-  GQueue *unstarted_tasks;
-  GQueue *done_results;
-  GQueue *idle_threads;
+/* number of times an idle worker looks for work before sleeping */
+#define SPIN_ROUNDS		64
 
-  gboolean destroy_pending;
-  GDestroyNotify destroy_notify;
-  gpointer destroy_data;
-};
+/* maximum number of threads in the pool made by gsk_thread_pool_default() */
+#define DEFAULT_POOL_MAX_THREADS	8
+
+#define INITIAL_DEQUE_SIZE	64
+#define INITIAL_WORKERS_SIZE	8
+
+typedef struct _TaskInfo TaskInfo;
+typedef struct _DequeArray DequeArray;
+typedef struct _WorkDeque WorkDeque;
+typedef struct _Worker Worker;
+typedef struct _WorkerArray WorkerArray;
 
 /* Per task information */
 struct _TaskInfo
@@ -39,80 +43,300 @@ struct _TaskInfo
   gpointer                 run_data;
   gpointer                 result_data;
   GskThreadPoolDestroyFunc destroy;
+
+  GTimeVal                 push_time;
+
+  /* finished tasks are chained together to be handed to the main-loop;
+     the invocation of the first task in the chain is used. */
+  TaskInfo                *next_done;
+  GskMainLoopInvocation    invocation;
 };
 
+/* --- Chase-Lev deques --- */
+/* The deque indices only ever increase (wrapping around), so they
+   are compared by their difference. */
+#define DEQUE_LENGTH(bottom, top)  ((gint) ((guint) (bottom) - (guint) (top)))
+
+struct _DequeArray
+{
+  guint       mask;
+  DequeArray *retired_next;	/* smaller arrays thieves may still see */
+  TaskInfo   *slots[1];
+};
+
+struct _WorkDeque
+{
+  gint        top;		/* changed by thieves */
+  char        pad[64 - sizeof (gint)];
+  gint        bottom;		/* changed only by the owner */
+  DequeArray *array;
+};
+
+static DequeArray *
+deque_array_new (guint size)
+{
+  DequeArray *array = g_malloc (sizeof (DequeArray)
+                                + sizeof (TaskInfo *) * (size - 1));
+  array->mask = size - 1;
+  array->retired_next = NULL;
+  return array;
+}
+
+static void
+deque_init (WorkDeque *deque)
+{
+  deque->top = deque->bottom = 0;
+  deque->array = deque_array_new (INITIAL_DEQUE_SIZE);
+}
+
+/* must only be used once no-one else can see the deque;
+   tasks which never ran are destroyed, with a NULL result. */
+static void
+deque_clear (WorkDeque *deque)
+{
+  DequeArray *array = deque->array;
+  guint i;
+  for (i = deque->top; i != (guint) deque->bottom; i++)
+    {
+      TaskInfo *task = array->slots[i & array->mask];
+      if (task->destroy != NULL)
+        (*task->destroy) (task->run_data, NULL);
+      g_free (task);
+    }
+  while (array != NULL)
+    {
+      DequeArray *next = array->retired_next;
+      g_free (array);
+      array = next;
+    }
+}
+
+/* owner only */
+static void
+deque_push (WorkDeque *deque,
+            TaskInfo  *task)
+{
+  gint bottom = deque->bottom;
+  gint top = g_atomic_int_get (&deque->top);
+  DequeArray *array = deque->array;
+  if (DEQUE_LENGTH (bottom, top) > (gint) array->mask)
+    {
+      /* Full:  copy into an array twice the size.
+         Thieves may still be reading from the old array,
+         so it is kept until the deque is cleared. */
+      DequeArray *new_array = deque_array_new (2 * (array->mask + 1));
+      guint i;
+      for (i = top; i != (guint) bottom; i++)
+        new_array->slots[i & new_array->mask] = array->slots[i & array->mask];
+      new_array->retired_next = array;
+      g_atomic_pointer_compare_and_exchange ((gpointer *) &deque->array,
+                                             array, new_array);
+      array = new_array;
+    }
+  array->slots[(guint) bottom & array->mask] = task;
+
+  /* the task must be visible before the new bottom is */
+  g_atomic_int_add (&deque->bottom, 1);
+}
+
+/* owner only */
+static TaskInfo *
+deque_pop (WorkDeque *deque)
+{
+  gint bottom = g_atomic_int_exchange_and_add (&deque->bottom, -1) - 1;
+  gint top = g_atomic_int_get (&deque->top);
+  gint length = DEQUE_LENGTH (bottom, top);
+  TaskInfo *task;
+
+  if (length < 0)
+    {
+      /* empty */
+      g_atomic_int_add (&deque->bottom, 1);
+      return NULL;
+    }
+  task = deque->array->slots[(guint) bottom & deque->array->mask];
+  if (length > 0)
+    return task;
+
+  /* the last task:  a thief may be taking it too */
+  if (!g_atomic_int_compare_and_exchange (&deque->top, top, (gint) ((guint) top + 1)))
+    task = NULL;
+  g_atomic_int_add (&deque->bottom, 1);
+  return task;
+}
+
+/* any thread; returns NULL if the deque is empty,
+   or if another thread took the task first. */
+static TaskInfo *
+deque_steal (WorkDeque *deque)
+{
+  gint top = g_atomic_int_get (&deque->top);
+  gint bottom = g_atomic_int_get (&deque->bottom);
+  DequeArray *array;
+  TaskInfo *task;
+
+  if (DEQUE_LENGTH (bottom, top) <= 0)
+    return NULL;
+  array = g_atomic_pointer_get (&deque->array);
+  task = array->slots[(guint) top & array->mask];
+  if (!g_atomic_int_compare_and_exchange (&deque->top, top, (gint) ((guint) top + 1)))
+    return NULL;
+  return task;
+}
+
+static guint
+deque_length (WorkDeque *deque)
+{
+  gint length = DEQUE_LENGTH (g_atomic_int_get (&deque->bottom),
+                              g_atomic_int_get (&deque->top));
+  return length > 0 ? length : 0;
+}
+
+/* --- the pool --- */
 /* Per GThread information */
-struct _ThreadInfo
+struct _Worker
 {
+  WorkDeque                deque;
   GskThreadPool           *pool;
-  GThread                 *thread;
-  GCond                   *cond;
-  TaskInfo                *running_task;
-  gboolean                 cancelled;
+  guint32                  random_state;
+
+  /* finished tasks not yet given to the main-loop */
+  TaskInfo                *first_done;
+  TaskInfo                *last_done;
+  guint                    n_done;
+
+  /* statistics:  only written by this worker */
+  guint64                  n_tasks_run;
+  guint64                  n_steals;
+  guint64                  total_wait_usecs;
+  guint64                  max_wait_usecs;
+  guint64                  total_run_usecs;
 };
 
+/* Workers are only added, never removed, until the pool is destroyed.
+   When the array fills up, it is replaced by a larger copy;
+   workers looking for tasks may still be using the old one,
+   so it is kept until the pool is destroyed. */
+struct _WorkerArray
+{
+  gint         n_workers;
+  guint        n_alloced;
+  WorkerArray *retired_next;
+  Worker      *workers[1];
+};
+
+struct _GskThreadPool
+{
+
+  /*< private >*/
+  GskMainLoop *main_loop;
+  gboolean owns_main_loop;	/* FALSE for gsk_thread_pool_default() */
+
+  /* tasks pushed from the main-loop's thread,
+     which is the only thread that may push to it */
+  WorkDeque submitted;
+  GThread *submitting_thread;
+
+  WorkerArray *workers;
+
+  guint num_threads;
+  guint max_threads;
+  guint n_exit_pending;		/* exited threads not yet seen by main_loop */
+
+  /* number of workers spinning or sleeping, waiting for tasks */
+  gint n_spinning;
+  gint n_sleeping;
+
+  GMutex *lock;
+  GCond *task_available;
+
+  gboolean destroy_pending;
+  gboolean main_loop_finalizing;	/* see _gsk_thread_pool_destroy_sync() */
+  GDestroyNotify destroy_notify;
+  gpointer destroy_data;
+};
+
+static GStaticPrivate current_worker_key = G_STATIC_PRIVATE_INIT;
+
+static GskThreadPool *thread_pool_new (GskMainLoop *main_loop,
+                                       guint        max_threads);
+
+static WorkerArray *
+worker_array_new (guint n_alloced)
+{
+  WorkerArray *array = g_malloc (sizeof (WorkerArray)
+                                 + sizeof (Worker *) * (n_alloced - 1));
+  array->n_workers = 0;
+  array->n_alloced = n_alloced;
+  array->retired_next = NULL;
+  return array;
+}
+
 static void
 destroy_now (GskThreadPool *pool)
 {
-  if (pool->wakeup_source != NULL)
-    gsk_source_remove (pool->wakeup_source);
+  WorkerArray *workers = pool->workers;
+  gint i;
+  for (i = 0; i < workers->n_workers; i++)
+    {
+      deque_clear (&workers->workers[i]->deque);
+      g_free (workers->workers[i]);
+    }
+  while (workers != NULL)
+    {
+      WorkerArray *next = workers->retired_next;
+      g_free (workers);
+      workers = next;
+    }
+  deque_clear (&pool->submitted);
 
   g_mutex_free (pool->lock);
-  g_queue_free (pool->done_results);
-  g_queue_free (pool->idle_threads);
+  g_cond_free (pool->task_available);
+  if (pool->owns_main_loop)
+    g_object_unref (pool->main_loop);
   if (pool->destroy_notify)
     (*pool->destroy_notify) (pool->destroy_data);
   g_free (pool);
 }
 
-
-static gboolean
-handle_wakeup_fd_pinged (int fd, GIOCondition condition, gpointer data)
+/* invoked in the main-loop's thread */
+static void
+handle_done_tasks (gpointer data)
 {
-  GskThreadPool *pool = data;
-  char buf[4096];
-  int rv = read (pool->wakeup_read_fd, buf, sizeof (buf));
   TaskInfo *task_info;
-  if (rv == 0)
-    {
-      /* end-of-file??? */
-      g_message ("got eof from pipe");
-      return TRUE;
-    }
-  else if (rv < 0)
-    {
-      int e = errno;
-      if (!gsk_errno_is_ignorable (e))
-	{
-	  g_warning ("error reading wakeup pipe: %s", g_strerror (e));
-	  return TRUE;
-	}
-    }
-  g_mutex_lock (pool->lock);
-  while ((task_info = g_queue_pop_head (pool->done_results)) != NULL)
+  for (task_info = data; task_info != NULL; task_info = task_info->next_done)
+    (*task_info->handle_result) (task_info->run_data, task_info->result_data);
+}
+
+/* invoked in the main-loop's thread after handle_done_tasks(),
+   or alone if the main-loop is finalized first */
+static void
+destroy_done_tasks (gpointer data)
+{
+  TaskInfo *task_info = data;
+  while (task_info != NULL)
     {
-      g_mutex_unlock (pool->lock);
-      (*task_info->handle_result) (task_info->run_data, task_info->result_data);
+      TaskInfo *next = task_info->next_done;
       if (task_info->destroy != NULL)
-	(*task_info->destroy) (task_info->run_data, task_info->result_data);
+        (*task_info->destroy) (task_info->run_data, task_info->result_data);
       g_free (task_info);
-      g_mutex_lock (pool->lock);
+      task_info = next;
     }
-  g_mutex_unlock (pool->lock);
-
-  if (pool->destroy_pending && pool->num_threads == 0)
-    return FALSE;
-
-  return TRUE;
 }
 
+/* invoked in the main-loop's thread */
 static void
-wakefd_source_destroyed (gpointer data)
+handle_thread_exited (gpointer data)
 {
   GskThreadPool *pool = data;
-  pool->wakeup_source = NULL;
-
-  if (pool->destroy_pending && pool->num_threads == 0)
+  gboolean do_destroy;
+  g_mutex_lock (pool->lock);
+  --pool->n_exit_pending;
+  do_destroy = pool->destroy_pending
+            && pool->num_threads == 0
+            && pool->n_exit_pending == 0;
+  g_mutex_unlock (pool->lock);
+  if (do_destroy)
     destroy_now (pool);
 }
 
@@ -130,80 +354,270 @@ wakefd_source_destroyed (gpointer data)
 GskThreadPool *gsk_thread_pool_new     (GskMainLoop             *main_loop,
                                         guint                    max_threads)
 {
-  GskThreadPool *thread_pool;
-  int pipe_fds[2];
-  if (pipe (pipe_fds) < 0)
-    {
-      g_error ("error creating pipe: %s", g_strerror (errno));
-    }
-
-  gsk_fd_set_nonblocking (pipe_fds[0]);
+  GskThreadPool *thread_pool = thread_pool_new (main_loop, max_threads);
+  g_object_ref (main_loop);
+  thread_pool->owns_main_loop = TRUE;
+  return thread_pool;
+}
 
+static GskThreadPool *
+thread_pool_new (GskMainLoop *main_loop,
+                 guint        max_threads)
+{
+  GskThreadPool *thread_pool;
   thread_pool = g_new (GskThreadPool, 1);
-  thread_pool->wakeup_read_fd = pipe_fds[0];
-  thread_pool->wakeup_write_fd = pipe_fds[1];
-  thread_pool->wakeup_source = gsk_main_loop_add_io (main_loop,
-						     pipe_fds[0],
-						     G_IO_IN,
-						     handle_wakeup_fd_pinged,
-						     thread_pool,
-						     wakefd_source_destroyed);
+  thread_pool->main_loop = main_loop;
+  thread_pool->owns_main_loop = FALSE;
+  deque_init (&thread_pool->submitted);
+  thread_pool->submitting_thread = g_thread_self ();
+  thread_pool->workers = worker_array_new (max_threads ? max_threads
+                                                       : INITIAL_WORKERS_SIZE);
   thread_pool->num_threads = 0;
   thread_pool->max_threads = max_threads;
+  thread_pool->n_exit_pending = 0;
+  thread_pool->n_spinning = 0;
+  thread_pool->n_sleeping = 0;
   thread_pool->destroy_pending = FALSE;
+  thread_pool->main_loop_finalizing = FALSE;
   thread_pool->lock = g_mutex_new ();
-  thread_pool->idle_threads = g_queue_new ();
-  thread_pool->unstarted_tasks = g_queue_new ();
-  thread_pool->done_results = g_queue_new ();
+  thread_pool->task_available = g_cond_new ();
   return thread_pool;
 }
 
 static void
-write_byte (int fd)
+flush_done_tasks (Worker *worker)
 {
-  char zero = 0;
-  write (fd, &zero, 1);
+  TaskInfo *first = worker->first_done;
+  if (first == NULL)
+    return;
+  worker->first_done = worker->last_done = NULL;
+  worker->n_done = 0;
+  first->invocation.func = handle_done_tasks;
+  first->invocation.data = first;
+  first->invocation.destroy = destroy_done_tasks;
+  gsk_main_loop_post (worker->pool->main_loop, &first->invocation);
+}
+
+static TaskInfo *
+find_task (Worker *worker)
+{
+  GskThreadPool *pool = worker->pool;
+  WorkerArray *workers;
+  TaskInfo *task;
+  guint i, n, start;
+
+  task = deque_pop (&worker->deque);
+  if (task != NULL)
+    return task;
+
+  task = deque_steal (&pool->submitted);
+  if (task != NULL)
+    return task;
+
+  /* only tasks taken from another worker count as steals */
+  workers = g_atomic_pointer_get (&pool->workers);
+  n = g_atomic_int_get (&workers->n_workers);
+  if (n == 0)
+    return NULL;
+  worker->random_state = worker->random_state * 1103515245 + 12345;
+  start = (worker->random_state >> 16) % n;
+  for (i = 0; i < n; i++)
+    {
+      Worker *victim = workers->workers[(start + i) % n];
+      if (victim == worker)
+        continue;
+      task = deque_steal (&victim->deque);
+      if (task != NULL)
+        {
+          worker->n_steals++;
+          return task;
+        }
+    }
+  return NULL;
+}
+
+static void
+wake_sleeping_worker (GskThreadPool *pool)
+{
+  g_mutex_lock (pool->lock);
+  g_cond_signal (pool->task_available);
+  g_mutex_unlock (pool->lock);
+}
+
+/* Spin, then sleep, until a task is found;
+   returns NULL if the pool is being destroyed. */
+static TaskInfo *
+wait_for_task (Worker *worker)
+{
+  GskThreadPool *pool = worker->pool;
+  TaskInfo *task = NULL;
+  guint i;
+
+  g_atomic_int_inc (&pool->n_spinning);
+  for (i = 0; i < SPIN_ROUNDS && task == NULL; i++)
+    {
+      if (g_atomic_int_get (&pool->destroy_pending))
+        break;
+      g_thread_yield ();
+      task = find_task (worker);
+    }
+
+  /* If the last spinning worker found a task, there may be more:
+     pushers only wake a sleeping worker when no one is spinning. */
+  if (g_atomic_int_dec_and_test (&pool->n_spinning)
+   && task != NULL
+   && g_atomic_int_get (&pool->n_sleeping) > 0)
+    wake_sleeping_worker (pool);
+  if (task != NULL)
+    return task;
+
+  g_mutex_lock (pool->lock);
+  g_atomic_int_inc (&pool->n_sleeping);
+  while (!pool->destroy_pending
+      && (task = find_task (worker)) == NULL)
+    g_cond_wait (pool->task_available, pool->lock);
+  g_atomic_int_add (&pool->n_sleeping, -1);
+  g_mutex_unlock (pool->lock);
+  return task;
+}
+
+static inline guint64
+usecs_between (const GTimeVal *start, const GTimeVal *end)
+{
+  gint64 usecs = (gint64) (end->tv_sec - start->tv_sec) * 1000000
+               + (end->tv_usec - start->tv_usec);
+  return usecs > 0 ? usecs : 0;
+}
+
+static void
+run_task (Worker   *worker,
+          TaskInfo *task)
+{
+  GTimeVal start_time, end_time;
+  guint64 wait_usecs, run_usecs;
+
+  g_get_current_time (&start_time);
+  task->result_data = (*task->run) (task->run_data);
+  g_get_current_time (&end_time);
+
+  wait_usecs = usecs_between (&task->push_time, &start_time);
+  run_usecs = usecs_between (&start_time, &end_time);
+  worker->n_tasks_run++;
+  worker->total_wait_usecs += wait_usecs;
+  worker->total_run_usecs += run_usecs;
+  if (wait_usecs > worker->max_wait_usecs)
+    worker->max_wait_usecs = wait_usecs;
+
+  task->next_done = NULL;
+  if (worker->last_done == NULL)
+    worker->first_done = task;
+  else
+    worker->last_done->next_done = task;
+  worker->last_done = task;
+
+  /* Assume the next task takes about as long as this one:
+     if it is short, hold this result until it is done too. */
+  if (++worker->n_done >= MAX_RESULT_BATCH || run_usecs >= SHORT_TASK_USECS)
+    flush_done_tasks (worker);
 }
 
 static gpointer
 the_thread_func (gpointer data)
 {
-  ThreadInfo *thread_info = data;
-  GskThreadPool *pool = thread_info->pool;
-  while (thread_info->running_task
-      && !thread_info->cancelled
-      && !pool->destroy_pending)
+  Worker *worker = data;
+  GskThreadPool *pool = worker->pool;
+
+  g_static_private_set (&current_worker_key, worker, NULL);
+  while (!g_atomic_int_get (&pool->destroy_pending))
     {
-      TaskInfo *task = thread_info->running_task;
-      task->result_data = (*task->run) (task->run_data);
-
-      g_mutex_lock (pool->lock);
-      g_queue_push_tail (pool->done_results, task);
-      write_byte (pool->wakeup_write_fd);
-      thread_info->running_task = g_queue_pop_head (pool->unstarted_tasks);
-      if (thread_info->running_task == NULL)
-	{
-	  g_queue_push_tail (pool->idle_threads, thread_info);
-	  while (!pool->destroy_pending
-             && !thread_info->cancelled
-             && thread_info->running_task == NULL)
-	    {
-	      g_cond_wait (thread_info->cond, pool->lock);
-	    }
-	}
-      g_mutex_unlock (pool->lock);
+      TaskInfo *task = find_task (worker);
+      if (task == NULL)
+        {
+          flush_done_tasks (worker);
+          task = wait_for_task (worker);
+          if (task == NULL)
+            break;
+        }
+      run_task (worker, task);
     }
+  flush_done_tasks (worker);
 
+  /* the pool cannot be destroyed until handle_thread_exited() runs,
+     unless the main-loop is waiting for us to exit */
   g_mutex_lock (pool->lock);
   --pool->num_threads;
+  if (pool->main_loop_finalizing)
+    {
+      g_cond_broadcast (pool->task_available);
+      g_mutex_unlock (pool->lock);
+      return NULL;
+    }
+  ++pool->n_exit_pending;
   g_mutex_unlock (pool->lock);
+  gsk_main_loop_invoke (pool->main_loop, handle_thread_exited, pool, NULL);
+
+  return NULL;
+}
 
-  write_byte (pool->wakeup_write_fd);
+/* called with the lock held */
+static void
+start_worker (GskThreadPool *pool)
+{
+  WorkerArray *workers = pool->workers;
+  Worker *worker;
+  GError *error = NULL;
 
-  g_cond_free (thread_info->cond);
-  g_free (thread_info);
+  if ((guint) workers->n_workers == workers->n_alloced)
+    {
+      WorkerArray *new_workers = worker_array_new (workers->n_alloced * 2);
+      memcpy (new_workers->workers, workers->workers,
+              sizeof (Worker *) * workers->n_workers);
+      new_workers->n_workers = workers->n_workers;
+      new_workers->retired_next = workers;
+      g_atomic_pointer_compare_and_exchange ((gpointer *) &pool->workers,
+                                             workers, new_workers);
+      workers = new_workers;
+    }
 
-  return NULL;
+  worker = g_new0 (Worker, 1);
+  deque_init (&worker->deque);
+  worker->pool = pool;
+  worker->random_state = workers->n_workers + 1;
+  if (g_thread_create (the_thread_func, worker, FALSE, &error) == NULL)
+    {
+      g_message ("error creating thread: %s", error->message);
+      g_error_free (error);
+      deque_clear (&worker->deque);
+      g_free (worker);
+      return;
+    }
+  workers->workers[workers->n_workers] = worker;
+  g_atomic_int_add (&workers->n_workers, 1);
+  pool->num_threads++;
+}
+
+/* Make sure some worker will see a newly pushed task. */
+static void
+notify_workers (GskThreadPool *pool)
+{
+  /* a spinning worker will find it */
+  if (g_atomic_int_get (&pool->n_spinning) > 0)
+    return;
+
+  if (g_atomic_int_get (&pool->n_sleeping) > 0)
+    {
+      wake_sleeping_worker (pool);
+      return;
+    }
+
+  /* all workers are busy */
+  if (pool->max_threads != 0
+   && (guint) g_atomic_int_get ((gint *) &pool->num_threads) >= pool->max_threads)
+    return;
+  g_mutex_lock (pool->lock);
+  if (pool->max_threads == 0 || pool->num_threads < pool->max_threads)
+    start_worker (pool);
+  g_mutex_unlock (pool->lock);
 }
 
 /**
@@ -228,6 +642,13 @@ the_thread_func (gpointer data)
  *
  * The @destroy function will be invoked in the main thread,
  * after @run and @handle_result are done.
+ * If the pool is destroyed before the task runs,
+ * only @destroy is called, with a NULL result.
+ *
+ * This must be called from the thread that made the pool,
+ * or from a @run function of this pool,
+ * to split work into smaller tasks:  they are queued for the
+ * calling thread, and idle threads will steal them.
  */
 void
 gsk_thread_pool_push   (GskThreadPool           *pool,
@@ -236,45 +657,101 @@ gsk_thread_pool_push   (GskThreadPool           *pool,
 			gpointer                 run_data,
 			GskThreadPoolDestroyFunc destroy)
 {
-  TaskInfo *info = g_new (TaskInfo, 1);
-  ThreadInfo *thread_info;
+  TaskInfo *info;
+  Worker *worker;
   g_return_if_fail (pool->destroy_pending == FALSE);
+
+  worker = g_static_private_get (&current_worker_key);
+  if (worker != NULL && worker->pool != pool)
+    worker = NULL;
+  g_return_if_fail (worker != NULL
+                 || pool->submitting_thread == g_thread_self ());
+
+  info = g_new (TaskInfo, 1);
   info->run = run;
   info->handle_result = handle_result;
   info->run_data = run_data;
   info->destroy = destroy;
+  g_get_current_time (&info->push_time);
 
-  g_mutex_lock (pool->lock);
-  thread_info = g_queue_pop_head (pool->idle_threads);
+  if (worker != NULL)
+    deque_push (&worker->deque, info);
+  else
+    deque_push (&pool->submitted, info);
+  notify_workers (pool);
+}
 
-  if (thread_info != NULL)
-    {
-      thread_info->running_task = info;
-      g_cond_signal (thread_info->cond);
-    }
-  else if (pool->max_threads == 0 || pool->num_threads < pool->max_threads)
+/**
+ * gsk_thread_pool_get_stats:
+ * @pool: the pool to query.
+ * @stats: the statistics to fill in.
+ *
+ * Get statistics about the tasks run by the pool.
+ * Since the threads update them without locking,
+ * they are only approximately consistent with each other.
+ */
+void
+gsk_thread_pool_get_stats (GskThreadPool      *pool,
+                           GskThreadPoolStats *stats)
+{
+  WorkerArray *workers = pool->workers;
+  gint i;
+  memset (stats, 0, sizeof (GskThreadPoolStats));
+  stats->n_threads = pool->num_threads;
+  stats->queue_depth = deque_length (&pool->submitted);
+  for (i = 0; i < workers->n_workers; i++)
     {
-      GError *error = NULL;
-      thread_info = g_new (ThreadInfo, 1);
-      thread_info->pool = pool;
-      thread_info->cond = g_cond_new ();
-      thread_info->running_task = info;
-      thread_info->cancelled = FALSE;
-      thread_info->thread = g_thread_create (the_thread_func, thread_info, TRUE, &error);
-      if (thread_info->thread == NULL)
-	{
-	  /* uh, destroy thread_info and print a warning. */
-	  g_message ("error creating thread: %s", error->message);
-	  g_cond_free (thread_info->cond);
-	  g_free (thread_info);
-	  thread_info = NULL;
-	}
-      else
-	pool->num_threads++;
+      Worker *worker = workers->workers[i];
+      stats->queue_depth += deque_length (&worker->deque);
+      stats->n_tasks_run += worker->n_tasks_run;
+      stats->n_steals += worker->n_steals;
+      stats->total_wait_usecs += worker->total_wait_usecs;
+      stats->total_run_usecs += worker->total_run_usecs;
+      if (worker->max_wait_usecs > stats->max_wait_usecs)
+        stats->max_wait_usecs = worker->max_wait_usecs;
     }
-  if (thread_info == NULL)
-    g_queue_push_tail (pool->unstarted_tasks, info);
+}
+
+/**
+ * gsk_thread_pool_default:
+ *
+ * Get a thread pool for the calling thread's default main-loop,
+ * to be shared by everything that needs to do
+ * blocking work (like disk I/O) in the background.
+ *
+ * It is made the first time it is needed,
+ * and is destroyed along with the main-loop;
+ * do not call gsk_thread_pool_destroy() on it.
+ *
+ * returns: the shared thread pool.
+ */
+GskThreadPool *
+gsk_thread_pool_default (void)
+{
+  GskMainLoop *main_loop = gsk_main_loop_default ();
+
+  /* the main-loop owns the pool, so the pool must not ref it */
+  if (main_loop->thread_pool == NULL)
+    main_loop->thread_pool = thread_pool_new (main_loop, DEFAULT_POOL_MAX_THREADS);
+  return main_loop->thread_pool;
+}
+
+/* Called as the main-loop that owns @pool is finalized:
+   wait for the threads to finish their current tasks, then free the pool.
+   Results they post are never handled; the main-loop
+   destroys them with its other unrun invocations. */
+void
+_gsk_thread_pool_destroy_sync (GskThreadPool *pool)
+{
+  g_return_if_fail (pool->destroy_pending == FALSE);
+  g_mutex_lock (pool->lock);
+  pool->destroy_pending = TRUE;
+  pool->main_loop_finalizing = TRUE;
+  g_cond_broadcast (pool->task_available);
+  while (pool->num_threads > 0)
+    g_cond_wait (pool->task_available, pool->lock);
   g_mutex_unlock (pool->lock);
+  destroy_now (pool);
 }
 
 /**
@@ -286,7 +763,7 @@ gsk_thread_pool_push   (GskThreadPool           *pool,
  *
  * Destroy a thread-pool.
  * This may take some time,
- * so you may register a handler that will be 
+ * so you may register a handler that will be
  * called from the main thread once the thread-pool
  * is destructed.  (The memory is not yet deallocated though,
  * so that hash-tables keyed off the thread-pool
@@ -297,20 +774,14 @@ gsk_thread_pool_destroy (GskThreadPool           *pool,
 			 GDestroyNotify           destroy,
 			 gpointer                 destroy_data)
 {
-  ThreadInfo *info;
   gboolean do_destroy;
   g_return_if_fail (pool->destroy_pending == FALSE);
-  pool->destroy_pending = TRUE;
   pool->destroy_notify = destroy;
   pool->destroy_data = destroy_data;
   g_mutex_lock (pool->lock);
-  while ((info = g_queue_pop_head (pool->idle_threads)) != NULL)
-    {
-      /* Destroy the idle thread. */
-      info->cancelled = TRUE;
-      g_cond_signal (info->cond);
-    }
-  do_destroy = pool->num_threads == 0;
+  pool->destroy_pending = TRUE;
+  g_cond_broadcast (pool->task_available);
+  do_destroy = pool->num_threads == 0 && pool->n_exit_pending == 0;
   g_mutex_unlock (pool->lock);
 
   if (do_destroy)
@@ -6,6 +6,7 @@
 G_BEGIN_DECLS
 
 typedef struct _GskThreadPool GskThreadPool;
+typedef struct _GskThreadPoolStats GskThreadPoolStats;
 
 typedef gpointer (*GskThreadPoolRunFunc)    (gpointer  run_data);
 typedef void     (*GskThreadPoolResultFunc) (gpointer  run_data,
@@ -13,17 +14,34 @@ typedef void     (*GskThreadPoolResultFunc) (gpointer  run_data,
 typedef void     (*GskThreadPoolDestroyFunc)(gpointer  run_data,
                                              gpointer  result_data);
 
+struct _GskThreadPoolStats
+{
+  guint    n_threads;
+  guint    queue_depth;		/* tasks waiting for a thread */
+  guint64  n_tasks_run;
+  guint64  n_steals;		/* tasks taken from another thread's queue */
+  guint64  total_wait_usecs;	/* time between push and run */
+  guint64  max_wait_usecs;
+  guint64  total_run_usecs;
+};
+
 GskThreadPool *gsk_thread_pool_new     (GskMainLoop             *main_loop,
                                         guint                    max_threads);
+GskThreadPool *gsk_thread_pool_default (void);
 void           gsk_thread_pool_push    (GskThreadPool           *pool,
                                         GskThreadPoolRunFunc     run,
 			                GskThreadPoolResultFunc  handle_result,
                                         gpointer                 run_data,
 			                GskThreadPoolDestroyFunc destroy);
+void           gsk_thread_pool_get_stats(GskThreadPool          *pool,
+                                        GskThreadPoolStats     *stats);
 void           gsk_thread_pool_destroy (GskThreadPool           *pool,
 					GDestroyNotify           destroy,
 					gpointer                 destroy_data);
 
+/*< private >*/
+void          _gsk_thread_pool_destroy_sync (GskThreadPool     *pool);
+
 G_END_DECLS
 
 #endif
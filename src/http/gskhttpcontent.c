@@ -3,7 +3,7 @@
 #include "../url/gskurl.h"
 #include "../gskmemory.h"
 #include "../gskutils.h"
-#include "../gskstreamfd.h"
+#include "../gskstreamfile.h"
 #include "../gskstreamlistenersocket.h"
 #include "../mime/gskmimemultipartdecoder.h"
 #include <string.h>
@@ -1144,9 +1144,8 @@ handle_file_request (GskHttpContent        *content,
   FileInfo *fi = data;
   GskHttpResponse *response;
   GskStream *stream;
-  gint64 size = -1;
-  struct stat stat_buf;
   const char *end;
+  GskMemPool *pool;
   char *path;
 
   /* compute path (check if it's ok) */
@@ -1173,12 +1172,22 @@ handle_file_request (GskHttpContent        *content,
       return GSK_HTTP_CONTENT_OK;
     }
 
+  pool = gsk_http_server_peek_request_pool (server, request);
   if (fi->file_type == GSK_HTTP_CONTENT_FILE_EXACT)
-    path = g_strdup (fi->fs_path);
+    path = fi->fs_path;
   else
-    path = g_strdup_printf ("%s/%s", fi->fs_path, request->path);
+    {
+      guint fs_path_len = strlen (fi->fs_path);
+      guint request_path_len = strlen (request->path);
+      path = gsk_mem_pool_alloc_unaligned (pool, fs_path_len + 1 + request_path_len + 1);
+      memcpy (path, fi->fs_path, fs_path_len);
+      path[fs_path_len] = '/';
+      memcpy (path + fs_path_len + 1, request->path, request_path_len + 1);
+    }
 
-  stream = gsk_stream_fd_new_read_file (path, NULL);
+  /* read in the thread-pool:  a cold-cache file
+     must not stall every other connection */
+  stream = gsk_stream_file_new (path, NULL);
   if (stream == NULL)
     {
       /* serve 404 page */
@@ -1192,18 +1201,15 @@ handle_file_request (GskHttpContent        *content,
                              "</body>\n"
                              "</html>\n",
                              path, request->path);
-      g_free (path);
       return GSK_HTTP_CONTENT_OK;
     }
 
-  if (fstat (GSK_STREAM_FD (stream)->fd, &stat_buf) == 0)
-    size = stat_buf.st_size;
-  response = gsk_http_response_from_request (request, GSK_HTTP_STATUS_OK, size);
+  response = gsk_http_response_from_request (request, GSK_HTTP_STATUS_OK,
+                                             GSK_STREAM_FILE (stream)->file_size);
   try_add_content_type (content, request, response);
   gsk_http_server_respond (server, request, response, stream);
   g_object_unref (response);
   g_object_unref (stream);
-  g_free (path);
   return GSK_HTTP_CONTENT_OK;
 }
 
@@ -1371,3 +1377,32 @@ gsk_http_content_listen (GskHttpContent   *content,
                                      content, NULL);
   return TRUE;
 }
+
+/**
+ * gsk_http_content_listen_reactor:
+ * @content: the content database which will handle requests.
+ * @pool: the reactor-pool that is running the caller.
+ * @address: the address to bind to, typically in the TCP or Unix namespaces.
+ * @error: where to put the error if something goes wrong.
+ *
+ * Like gsk_http_content_listen(), but for use from
+ * a #GskReactorSetupFunc:  each reactor should create its
+ * own @content and call this with the same @address.
+ * Connections will be spread across the reactors.
+ *
+ * returns: whether the listen call succeeded.
+ */
+gboolean
+gsk_http_content_listen_reactor (GskHttpContent   *content,
+                                 GskReactorPool   *pool,
+                                 GskSocketAddress *address,
+                                 GError          **error)
+{
+  GskStreamListener *listener = gsk_reactor_pool_listen (pool, address, error);
+  if (listener == NULL)
+    return FALSE;
+  gsk_stream_listener_handle_accept (listener, handler_new_connection,
+                                     handler_listener_failed,
+                                     content, NULL);
+  return TRUE;
+}
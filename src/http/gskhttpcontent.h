@@ -4,6 +4,7 @@
 #include "gskhttpserver.h"
 #include "../mime/gskmimemultipartpiece.h"
 #include "../gsksocketaddress.h"
+#include "../gskreactorpool.h"
 
 G_BEGIN_DECLS
 
@@ -166,6 +167,10 @@ void           gsk_http_content_add_file_by_id
 gboolean gsk_http_content_listen (GskHttpContent *content,
                                   GskSocketAddress *address,
                                   GError          **error);
+gboolean gsk_http_content_listen_reactor (GskHttpContent *content,
+                                          GskReactorPool *pool,
+                                          GskSocketAddress *address,
+                                          GError          **error);
 void gsk_http_content_respond    (GskHttpContent *content,
                                   GskHttpServer  *server,
                                   GskHttpRequest *request,
@@ -101,8 +101,13 @@ gsk_http_request_parse_first_line (GskHttpRequest *request,
       return GSK_HTTP_REQUEST_FIRST_LINE_ERROR;
     }
 
-  g_free (request->path);
-  request->path = g_new (char, request_length + 1);
+  if (header->pool != NULL)
+    request->path = gsk_mem_pool_alloc_unaligned (header->pool, request_length + 1);
+  else
+    {
+      g_free (request->path);
+      request->path = g_new (char, request_length + 1);
+    }
   memcpy (request->path, line + request_start, request_length);
   request->path[request_length] = '\0';
 
@@ -733,10 +738,10 @@ handle_range (GskHttpHeader *header,
 
 static gboolean
 parse_str_quality (const char **pstr,
-                   char       **word_out,
+                   const char **word_start_out,
+                   guint       *word_len_out,
                    gfloat      *quality_out)
 {
-  char *word;
   const char *str = *pstr;
   const char *start;
   const char *end;
@@ -752,10 +757,6 @@ parse_str_quality (const char **pstr,
     end++;
   if (start == end)
     HEADER_HANDLER_FAIL(("bad character in quality spec (end=%c)",*end));
-  word = g_new (char, end - start + 1);
-  memcpy (word, start, end - start);
-  word[end - start] = '\0';
-  
   str = end;
   
   if (*str == ';')
@@ -773,7 +774,8 @@ parse_str_quality (const char **pstr,
     }
   while (*str != '\0' && isspace (*str))
     str++;
-  *word_out = word;
+  *word_start_out = start;
+  *word_len_out = end - start;
   *quality_out = quality;
   comma = strchr (str, ',');
   if (comma != NULL)
@@ -787,16 +789,17 @@ parse_str_quality (const char **pstr,
  * See RFC 2616, Section 3.4
  */
 static GskHttpCharSet *
-parse_charset (const char **pstr)
+parse_charset (GskMemPool  *pool,
+               const char **pstr)
 {
+  const char *start;
+  guint len;
   char *charset;
-  GskHttpCharSet *rv;
   gfloat quality = -1;
-  if (!parse_str_quality (pstr, &charset, &quality))
+  if (!parse_str_quality (pstr, &start, &len, &quality))
     return NULL;
-  rv = gsk_http_char_set_new (charset, quality);
-  g_free (charset);
-  return rv;
+  charset = str0cpy (g_alloca (len + 1), start, len);
+  return gsk_http_char_set_new_pooled (pool, charset, quality);
 }
 
 
@@ -805,6 +808,9 @@ handle_accept_charset (GskHttpHeader *header,
 		       const char *value,
 		       gpointer data)
 {
+  GskHttpCharSet **p_last = &GSK_HTTP_REQUEST (header)->accept_charsets;
+  while (*p_last != NULL)
+    p_last = &((*p_last)->next);
   while (*value != '\0')
     {
       GskHttpCharSet *set;
@@ -812,10 +818,13 @@ handle_accept_charset (GskHttpHeader *header,
       while (*value != '\0' && (isspace (*value) || *value == ','))
         value++;
       start = value;
-      set = parse_charset (&value);
+      set = parse_charset (header->pool, &value);
       if (set == NULL)
         HEADER_HANDLER_FAIL(("error parsing charset from %s", value));
-      gsk_http_request_add_charsets (GSK_HTTP_REQUEST (header), set);
+
+      /* not gsk_http_request_add_charsets(), which would copy a pooled set */
+      *p_last = set;
+      p_last = &set->next;
     }
   return TRUE;
 }
@@ -972,7 +981,8 @@ handle_accept_ranges (GskHttpHeader *header,
 }
 
 static GskHttpLanguageSet *
-parse_language_set_list (const char *value)
+parse_language_set_list (GskMemPool *pool,
+                         const char *value)
 {
   /* Parse
    *      LANGUAGE-RANGE [ ';' 'q' '=' VALUE ] ','
@@ -1029,7 +1039,7 @@ parse_language_set_list (const char *value)
           GSK_SKIP_WHITESPACE (value);
 	}
 
-      set = gsk_http_language_set_new (language, quality);
+      set = gsk_http_language_set_new_pooled (pool, language, quality);
       if (rv == NULL)
 	rv = set;
       else
@@ -1064,7 +1074,7 @@ parse_language_set_list (const char *value)
   return rv;
 
 error:
-  while (rv)
+  while (rv && pool == NULL)
     {
       GskHttpLanguageSet *next = rv->next;
       gsk_http_language_set_free (rv);
@@ -1078,7 +1088,7 @@ handle_accept_language (GskHttpHeader *header,
 		        const char *value,
 		        gpointer data)
 {
-  GskHttpLanguageSet *set = parse_language_set_list (value);
+  GskHttpLanguageSet *set = parse_language_set_list (header->pool, value);
   GskHttpLanguageSet *last;
   GskHttpRequest *request = GSK_HTTP_REQUEST (header);
   if (set == NULL)
@@ -1099,7 +1109,8 @@ handle_accept_language (GskHttpHeader *header,
 }
 
 static GskHttpMediaTypeSet *
-parse_media_type (const char **pstr)
+parse_media_type (GskMemPool  *pool,
+                  const char **pstr)
 {
   /* Parse
    *      { TYPE | '*' } / { SUBTYPE | '*' } [ ';' 'q' '=' VALUE ] ','
@@ -1173,7 +1184,7 @@ parse_media_type (const char **pstr)
         }
     }
   *pstr = end_str;
-  return gsk_http_media_type_set_new (type, subtype, quality);
+  return gsk_http_media_type_set_new_pooled (pool, type, subtype, quality);
 }
 
 static gboolean
@@ -1181,6 +1192,9 @@ handle_accept (GskHttpHeader *header,
 	       const char *value,
 	       gpointer data)
 {
+  GskHttpMediaTypeSet **p_last = &GSK_HTTP_REQUEST (header)->accept_media_types;
+  while (*p_last != NULL)
+    p_last = &((*p_last)->next);
   while (*value != '\0')
     {
       GskHttpMediaTypeSet *media_type;
@@ -1188,14 +1202,17 @@ handle_accept (GskHttpHeader *header,
       while (*value != '\0' && (isspace (*value) || *value == ','))
         value++;
       start = value;
-      media_type = parse_media_type (&value);
+      media_type = parse_media_type (header->pool, &value);
       if (media_type == NULL)
         {
           /* XXX: error handling */
           g_warning ("error parsing media_type from %s", value);
           return FALSE;
         }
-      gsk_http_request_add_media (GSK_HTTP_REQUEST (header), media_type);
+
+      /* not gsk_http_request_add_media(), which would copy a pooled set */
+      *p_last = media_type;
+      p_last = &media_type->next;
     }
   return TRUE;
 }
@@ -1963,15 +1980,21 @@ gsk_http_header_get_parser_table (gboolean is_request)
   return table_table[index];
 }
 
-static void
-snip_between (GskBufferIterator *start,
-	      GskBufferIterator *end,
-              gsize *line_size,
-	      char **line_mem,
-	      gboolean *line_mem_from_stack)
+/* Get the line between two iterators, without its terminal '\r',
+ * pointing into the buffer if the line is all in one fragment.
+ * *line_mem is grown to hold the line and a NUL,
+ * and is used as scratch if the line straddles fragments. */
+static const char *
+peek_line (GskBufferIterator *start,
+           GskBufferIterator *end,
+           gsize *line_size,
+           char **line_mem,
+           gboolean *line_mem_from_stack,
+           guint *len_out)
 {
   gboolean must_realloc = FALSE;
   guint len = end->offset - start->offset;
+  const char *rv;
   while (len + 1 > *line_size)
     {
       *line_size += *line_size;
@@ -1985,11 +2008,28 @@ snip_between (GskBufferIterator *start,
 	*line_mem_from_stack = FALSE;
       *line_mem = g_malloc (*line_size);
     }
-  gsk_buffer_iterator_peek (start, *line_mem, len);
-  if (len > 0 && (*line_mem)[len - 1] == '\r')
-    (*line_mem)[len-1] = '\0';
-  else
-    (*line_mem)[len] = '\0';
+  rv = (const char *) gsk_buffer_iterator_peek_contiguous (start, len, &len, *line_mem);
+  if (len > 0 && rv[len - 1] == '\r')
+    len--;
+  *len_out = len;
+  return rv;
+}
+
+/* Copy the line between two iterators into *line_mem,
+ * as a NUL-terminated string. */
+static void
+snip_between (GskBufferIterator *start,
+	      GskBufferIterator *end,
+              gsize *line_size,
+	      char **line_mem,
+	      gboolean *line_mem_from_stack)
+{
+  guint len;
+  const char *line = peek_line (start, end, line_size, line_mem,
+                                line_mem_from_stack, &len);
+  if (line != *line_mem)
+    memcpy (*line_mem, line, len);
+  (*line_mem)[len] = '\0';
 }
 
 /**
@@ -2075,26 +2115,37 @@ gsk_http_header_from_buffer (GskBuffer     *input,
   for (;;)
     {
       /* Assert:  newline == iterator */
-      char *at, *colon;
+      const char *line, *colon, *value;
+      guint line_len, key_len, value_len, i;
+      char *at;
       GskHttpHeaderLineParser *parser;
 
       if (!gsk_buffer_iterator_find_char (&newline, '\n'))
 	ERROR_RETURN ();
-      snip_between (&iterator, &newline, &line_size, &line_mem, &line_mem_from_stack);
-      if (line_mem[0] == '\0' || isspace (line_mem[0]))
+
+      /* Look at the line in place; only the lowercased key
+         and the value are copied, as NUL-terminated strings.
+         line_mem may be the same memory as line, but each byte
+         is only written after it has been read. */
+      line = peek_line (&iterator, &newline, &line_size, &line_mem,
+                        &line_mem_from_stack, &line_len);
+      if (line_len == 0 || isspace (line[0]))
 	break;
 
-      colon = strchr (line_mem, ':');
+      colon = memchr (line, ':', line_len);
       if (colon == NULL)
 	ERROR_RETURN ();
-      at = line_mem;
-      while (at < colon)
-	{
-	  *at = tolower (*at);
-	  at++;
-	}
-      *at++ = 0;
-      GSK_SKIP_WHITESPACE (at);
+      key_len = colon - line;
+      for (i = 0; i < key_len; i++)
+        line_mem[i] = tolower (line[i]);
+      line_mem[key_len] = 0;
+      value = colon + 1;
+      while (value < line + line_len && isspace (*value))
+        value++;
+      value_len = line + line_len - value;
+      at = line_mem + key_len + 1;
+      memmove (at, value, value_len);
+      at[value_len] = 0;
       parser = g_hash_table_lookup (parser_table, line_mem);
       if (parser == NULL)
 	{
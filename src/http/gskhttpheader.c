@@ -722,6 +722,19 @@ gsk_http_header_add_misc    (GskHttpHeader *header,
 {
   /* TODO: should use a case-insensitive hash function,
            instead of g_ascii_strdown()!!! */
+  if (header->pool != NULL)
+    {
+      /* the keys and values are freed with the pool */
+      char *lower = gsk_mem_pool_strdup (header->pool, key);
+      char *at;
+      for (at = lower; *at != '\0'; at++)
+        *at = g_ascii_tolower (*at);
+      if (header->header_lines == NULL)
+        header->header_lines = g_hash_table_new (g_str_hash, g_str_equal);
+      g_hash_table_insert (header->header_lines, lower,
+                           gsk_mem_pool_strdup (header->pool, value));
+      return;
+    }
   if (header->header_lines == NULL)
     header->header_lines = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
   g_hash_table_insert (header->header_lines, g_ascii_strdown (key, -1), g_strdup (value));
@@ -1351,6 +1364,23 @@ gsk_http_char_set_new (const char *charset_name,
   return char_set;
 }
 
+/* private:  for the header parsers.
+   A set from @pool must not be passed to gsk_http_char_set_free(). */
+GskHttpCharSet *
+gsk_http_char_set_new_pooled (GskMemPool *pool,
+                              const char *charset_name,
+		              gfloat      quality)
+{
+  GskHttpCharSet *char_set;
+  if (pool == NULL)
+    return gsk_http_char_set_new (charset_name, quality);
+  char_set = gsk_mem_pool_alloc (pool, sizeof (GskHttpCharSet));
+  char_set->charset_name = gsk_mem_pool_strdup (pool, charset_name);
+  char_set->quality = quality;
+  char_set->next = NULL;
+  return char_set;
+}
+
 static GskHttpCharSet *
 gsk_http_char_set_copy (GskHttpCharSet *char_set)
 {
@@ -1586,11 +1616,22 @@ gsk_http_transfer_encoding_set_free(GskHttpTransferEncodingSet *encoding_set)
 GskHttpLanguageSet *
 gsk_http_language_set_new       (const char *language,
 			         gfloat      quality)
+{
+  return gsk_http_language_set_new_pooled (NULL, language, quality);
+}
+
+/* private:  for the header parsers.
+   A set from @pool must not be passed to gsk_http_language_set_free(). */
+GskHttpLanguageSet *
+gsk_http_language_set_new_pooled (GskMemPool *pool,
+                                  const char *language,
+			          gfloat      quality)
 {
   /* ugh, these macros come from gsk_http_cookie_new above */
   guint alloc_length = sizeof (GskHttpLanguageSet)
                      + strlen (language) + 1;
-  GskHttpLanguageSet *rv = g_malloc (alloc_length);
+  GskHttpLanguageSet *rv = pool ? gsk_mem_pool_alloc (pool, alloc_length)
+                                : g_malloc (alloc_length);
   char *mem_at = (char*)(rv + 1);
   rv->quality = quality;
   rv->next = NULL;
@@ -1637,13 +1678,25 @@ GskHttpMediaTypeSet *
 gsk_http_media_type_set_new (const char *type,
 			     const char *subtype,
 			     gfloat      quality)
+{
+  return gsk_http_media_type_set_new_pooled (NULL, type, subtype, quality);
+}
+
+/* private:  for the header parsers.
+   A set from @pool must not be passed to gsk_http_media_type_set_free(). */
+GskHttpMediaTypeSet *
+gsk_http_media_type_set_new_pooled (GskMemPool *pool,
+                                    const char *type,
+			            const char *subtype,
+			            gfloat      quality)
 {
   /* ugh, these macros come from gsk_http_cookie_new above */
   guint alloc_length = sizeof (GskHttpMediaTypeSet)
                      + ACTUAL_LENGTH (type)
                      + ACTUAL_LENGTH (subtype);
   guint at = sizeof (GskHttpMediaTypeSet);
-  char *raw = g_new (char, alloc_length);
+  char *raw = pool ? gsk_mem_pool_alloc (pool, alloc_length)
+                   : g_new (char, alloc_length);
   GskHttpMediaTypeSet *rv = (GskHttpMediaTypeSet *) raw;
   rv->quality = quality;
   rv->next = NULL;
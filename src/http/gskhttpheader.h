@@ -31,6 +31,7 @@
 
 #include <glib-object.h>
 #include "../gskbuffer.h"
+#include "../gskmempool.h"
 
 G_BEGIN_DECLS
 
@@ -606,6 +607,11 @@ struct _GskHttpHeader
 
   /* and actual accumulated parse error (a bit of a hack) */
   GError                       *g_error;
+
+  /*< private >*/
+  /* if set, parsed fields are allocated from here:
+     see gsk_http_request_set_pool() */
+  GskMemPool                   *pool;
 };
 
 
@@ -764,6 +770,18 @@ void gsk_http_header_set_content_encoding_string  (GskHttpHeader *header,
 void gsk_http_header_set_transfer_encoding_string (GskHttpHeader *header,
                                                    const char    *str);
 
+/* like the public constructors, but allocated from @pool if it is non-NULL */
+GskHttpCharSet      *gsk_http_char_set_new_pooled       (GskMemPool *pool,
+                                                         const char *charset_name,
+                                                         gfloat      quality);
+GskHttpLanguageSet  *gsk_http_language_set_new_pooled   (GskMemPool *pool,
+                                                         const char *language,
+                                                         gfloat      quality);
+GskHttpMediaTypeSet *gsk_http_media_type_set_new_pooled (GskMemPool *pool,
+                                                         const char *type,
+                                                         const char *subtype,
+                                                         gfloat      quality);
+
 #define gsk_http_header_set_content_type(header, content_type)	      \
   g_object_set (GSK_HTTP_HEADER(header), "content-type", (const char *)(content_type), NULL)
 #define gsk_http_header_get_content_type(header)			      \
@@ -42,7 +42,11 @@ gsk_http_request_set_property   (GObject        *object,
       gsk_http_header_set_string_val (request, &request->user_agent, value);
       break;
     case PROP_REQUEST_PATH:
-      gsk_http_header_set_string_val (request, &request->path, value);
+      if (GSK_HTTP_HEADER (request)->pool != NULL)
+        request->path = gsk_mem_pool_strdup (GSK_HTTP_HEADER (request)->pool,
+                                             g_value_get_string (value));
+      else
+        gsk_http_header_set_string_val (request, &request->path, value);
       break;
     case PROP_REQUEST_REFERRER:
       gsk_http_header_set_string_val (request, &request->referrer, value);
@@ -115,14 +119,19 @@ gsk_http_request_finalize (GObject *object)
         free_func (at);                                                 \
       }                                                                 \
   }G_STMT_END
-  FREE_LIST (GskHttpCharSet, gsk_http_char_set_free, accept_charsets);
   FREE_LIST (GskHttpContentEncodingSet, gsk_http_content_encoding_set_free, accept_content_encodings);
   FREE_LIST (GskHttpTransferEncodingSet, gsk_http_transfer_encoding_set_free, accept_transfer_encodings);
-  FREE_LIST (GskHttpMediaTypeSet, gsk_http_media_type_set_free, accept_media_types);
-  FREE_LIST (GskHttpLanguageSet, gsk_http_language_set_free, accept_languages);
+
+  /* with a pool, these are freed with the pool */
+  if (GSK_HTTP_HEADER (request)->pool == NULL)
+    {
+      FREE_LIST (GskHttpCharSet, gsk_http_char_set_free, accept_charsets);
+      FREE_LIST (GskHttpMediaTypeSet, gsk_http_media_type_set_free, accept_media_types);
+      FREE_LIST (GskHttpLanguageSet, gsk_http_language_set_free, accept_languages);
+      g_free (request->path);
+    }
 #undef FREE_LIST
 
-  g_free (request->path);
   g_free (request->host);
   if (request->had_if_match)
     g_strfreev (request->if_match);
@@ -273,6 +282,126 @@ gsk_http_request_new           (GskHttpVerb  verb,
 		       "path", path, NULL);
 }
 
+/* --- pooled fields --- */
+/* Each of these copies a list into the pool @to (or onto the heap),
+   freeing the old nodes if they were on the heap. */
+static GskHttpCharSet *
+move_char_sets (GskHttpCharSet *sets,
+                GskMemPool     *from,
+                GskMemPool     *to)
+{
+  GskHttpCharSet *rv = NULL;
+  GskHttpCharSet **p_last = &rv;
+  while (sets != NULL)
+    {
+      GskHttpCharSet *next = sets->next;
+      *p_last = gsk_http_char_set_new_pooled (to, sets->charset_name,
+                                              sets->quality);
+      p_last = &((*p_last)->next);
+      if (from == NULL)
+        gsk_http_char_set_free (sets);
+      sets = next;
+    }
+  return rv;
+}
+
+static GskHttpLanguageSet *
+move_language_sets (GskHttpLanguageSet *sets,
+                    GskMemPool         *from,
+                    GskMemPool         *to)
+{
+  GskHttpLanguageSet *rv = NULL;
+  GskHttpLanguageSet **p_last = &rv;
+  while (sets != NULL)
+    {
+      GskHttpLanguageSet *next = sets->next;
+      *p_last = gsk_http_language_set_new_pooled (to, sets->language,
+                                                  sets->quality);
+      p_last = &((*p_last)->next);
+      if (from == NULL)
+        gsk_http_language_set_free (sets);
+      sets = next;
+    }
+  return rv;
+}
+
+static GskHttpMediaTypeSet *
+move_media_type_sets (GskHttpMediaTypeSet *sets,
+                      GskMemPool          *from,
+                      GskMemPool          *to)
+{
+  GskHttpMediaTypeSet *rv = NULL;
+  GskHttpMediaTypeSet **p_last = &rv;
+  while (sets != NULL)
+    {
+      GskHttpMediaTypeSet *next = sets->next;
+      *p_last = gsk_http_media_type_set_new_pooled (to, sets->type,
+                                                    sets->subtype,
+                                                    sets->quality);
+      p_last = &((*p_last)->next);
+      if (from == NULL)
+        gsk_http_media_type_set_free (sets);
+      sets = next;
+    }
+  return rv;
+}
+
+static void
+readd_misc (gpointer key, gpointer value, gpointer data)
+{
+  gsk_http_header_add_misc (data, key, value);
+}
+
+/**
+ * gsk_http_request_set_pool:
+ * @request: the request to affect.
+ * @pool: the pool to allocate the request's fields from, or NULL.
+ *
+ * private:  used by #GskHttpServer, which parses each request
+ * into the memory pool of its response.
+ *
+ * While a request has a pool, its path, its Accept-Charset,
+ * Accept-Language and Accept sets and its miscellaneous
+ * header lines are allocated from the pool,
+ * and are only freed with it.
+ *
+ * The fields already set are moved into @pool;
+ * if @pool is NULL, they are copied out of the old pool,
+ * so that the request may outlive it.
+ */
+void
+gsk_http_request_set_pool (GskHttpRequest *request,
+                           GskMemPool     *pool)
+{
+  GskHttpHeader *header = GSK_HTTP_HEADER (request);
+  GskMemPool *old_pool = header->pool;
+  if (old_pool == pool)
+    return;
+  header->pool = pool;
+
+  if (request->path != NULL)
+    {
+      char *path = pool ? gsk_mem_pool_strdup (pool, request->path)
+                        : g_strdup (request->path);
+      if (old_pool == NULL)
+        g_free (request->path);
+      request->path = path;
+    }
+  request->accept_charsets = move_char_sets (request->accept_charsets,
+                                             old_pool, pool);
+  request->accept_languages = move_language_sets (request->accept_languages,
+                                                  old_pool, pool);
+  request->accept_media_types = move_media_type_sets (request->accept_media_types,
+                                                      old_pool, pool);
+  if (header->header_lines != NULL)
+    {
+      GHashTable *old_lines = header->header_lines;
+      header->header_lines = NULL;
+      g_hash_table_foreach (old_lines, readd_misc, header);
+      g_hash_table_destroy (old_lines);
+    }
+}
+
 /* GskHttpRequest public methods */
 
 /**
@@ -355,6 +484,8 @@ gsk_http_request_add_charsets   (GskHttpRequest *header,
 				 GskHttpCharSet *char_sets)
 {
   GskHttpCharSet *last = header->accept_charsets;
+  if (GSK_HTTP_HEADER (header)->pool != NULL)
+    char_sets = move_char_sets (char_sets, NULL, GSK_HTTP_HEADER (header)->pool);
   if (last == NULL)
     {
       header->accept_charsets = char_sets;
@@ -379,6 +510,8 @@ gsk_http_request_clear_charsets (GskHttpRequest *header)
 {
   GskHttpCharSet *set = header->accept_charsets;
   header->accept_charsets = NULL;
+  if (GSK_HTTP_HEADER (header)->pool != NULL)
+    return;
   while (set != NULL)
     {
       GskHttpCharSet *next = set->next;
@@ -530,6 +663,8 @@ gsk_http_request_add_media      (GskHttpRequest *header,
 				 GskHttpMediaTypeSet *set)
 {
   GskHttpMediaTypeSet *last = header->accept_media_types;
+  if (GSK_HTTP_HEADER (header)->pool != NULL)
+    set = move_media_type_sets (set, NULL, GSK_HTTP_HEADER (header)->pool);
   if (last == NULL)
     {
       header->accept_media_types = set;
@@ -551,6 +686,8 @@ gsk_http_request_clear_media    (GskHttpRequest *header)
 {
   GskHttpMediaTypeSet *set = header->accept_media_types;
   header->accept_media_types = NULL;
+  if (GSK_HTTP_HEADER (header)->pool != NULL)
+    return;
   while (set != NULL)
     {
       GskHttpMediaTypeSet *next = set->next;
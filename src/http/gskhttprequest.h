@@ -86,6 +86,10 @@ void gsk_http_request_set_cache_control (GskHttpRequest               *request,
 
 gboolean        gsk_http_request_has_content_body (GskHttpRequest *request);
 
+/*< private >*/
+void            gsk_http_request_set_pool         (GskHttpRequest *request,
+                                                   GskMemPool     *pool);
+
 /* request specific functions */
 /* unhandled: if_match */
 void            gsk_http_request_add_charsets            (GskHttpRequest *header,
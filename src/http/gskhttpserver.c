@@ -2,6 +2,7 @@
 #include <string.h>
 #include "gskhttpserver.h"
 #include "../gskmacros.h"
+#include "../gskmempool.h"
 
 static GObjectClass *parent_class = NULL;
 
@@ -65,6 +66,11 @@ struct _GskHttpServerResponse
   /* number of bytes of content written thus far */
   guint content_written;
 
+  /* memory for the request, freed with the response:
+     see gsk_http_server_peek_request_pool().
+     It allocates nothing until it is first used. */
+  GskMemPool pool;
+
   GskHttpServerResponse *next;
 };
 GSK_DECLARE_POOL_ALLOCATORS(GskHttpServerResponse, gsk_http_server_response, 6)
@@ -110,7 +116,13 @@ gsk_http_server_response_destroy (GskHttpServerResponse *response,
 				  gboolean               is_server_dying)
 {
   if (response->request)
-    g_object_unref (response->request);
+    {
+      /* the request's fields are in the pool:
+         copy them out if the request is still referenced */
+      if (G_OBJECT (response->request)->ref_count > 1)
+        gsk_http_request_set_pool (response->request, NULL);
+      g_object_unref (response->request);
+    }
   if (response->post_data)
     {
       gsk_http_server_post_stream_detach (response->post_data, is_server_dying);
@@ -122,6 +134,7 @@ gsk_http_server_response_destroy (GskHttpServerResponse *response,
     g_object_unref (response->response);
   if (response->content)
     g_object_unref (response->content);
+  gsk_mem_pool_destruct (&response->pool);
   gsk_http_server_response_free (response);
 }
 
@@ -265,10 +278,13 @@ add_keepalive_idle_timeout (GskHttpServer *server)
 {
   g_assert (server->keepalive_idle_timeout == NULL);
   g_assert (server->keepalive_idle_timeout_ms >= 0);
+  /* this is removed and re-added as data arrives, so use a coarse timer;
+     nobody will notice if an idle connection lives an extra 1/8th. */
   server->keepalive_idle_timeout
-    = gsk_main_loop_add_timer (gsk_main_loop_default (),
-                               handle_keepalive_idle_timeout, server, NULL,
-                               server->keepalive_idle_timeout_ms, -1);
+    = gsk_main_loop_add_timer_coarse (gsk_main_loop_default (),
+                                      handle_keepalive_idle_timeout, server, NULL,
+                                      server->keepalive_idle_timeout_ms, -1,
+                                      server->keepalive_idle_timeout_ms / 8);
 }
 
 static void
@@ -499,6 +515,7 @@ create_new_response (GskHttpServer *server)
   response->user_fetched = 0;
   response->content_written = 0;
   response->failed = 0;
+  gsk_mem_pool_construct (&response->pool);
   response->next = NULL;
 
   /* append this response to the queue */
@@ -518,6 +535,7 @@ first_line_parser_callback  (GskHttpServerResponse *response,
   GError *error = NULL;
   g_assert (response->request == NULL);
   response->request = gsk_http_request_new_blank ();
+  gsk_http_request_set_pool (response->request, &response->pool);
 
   switch (gsk_http_request_parse_first_line (response->request, text, &error))
     {
@@ -548,16 +566,24 @@ first_line_parser_callback  (GskHttpServerResponse *response,
     }
 }
 
+#define MAX_STACK_ALLOC	4096
+
+/* 'line' is not NUL-terminated:  it points directly
+ * into the incoming buffer whenever possible.
+ * Trailing whitespace has been removed. */
 static void
 header_line_parser_callback (GskHttpServerResponse *response,
-			     const char            *line)
+			     const char            *line,
+			     guint                  line_len)
 {
   GskHttpHeaderLineParser *parser;
   char *lowercase;
   const char *colon;
   unsigned i;
-  const char *val;
-  if (line[0] == 0)
+  const char *val_start;
+  char *val;
+  guint val_len;
+  if (line_len == 0)
     {
       GskHttpVerb verb = response->request->verb;
       if (verb == GSK_HTTP_VERB_PUT
@@ -580,7 +606,7 @@ header_line_parser_callback (GskHttpServerResponse *response,
       return;
     }
 
-  colon = strchr (line, ':');
+  colon = memchr (line, ':', line_len);
   if (colon == NULL)
     {
       g_warning ("no colon in header line");
@@ -588,35 +614,38 @@ header_line_parser_callback (GskHttpServerResponse *response,
     }
 
   /* lowercase the header */
-  lowercase = g_alloca (colon - (char*)line + 1);
-  for (i = 0; line[i] != ':'; i++)
+  lowercase = g_alloca (colon - line + 1);
+  for (i = 0; line + i < colon; i++)
     lowercase[i] = g_ascii_tolower (line[i]);
   lowercase[i] = '\0';
 
-  val = colon + 1;
-  GSK_SKIP_WHITESPACE (val);
+  val_start = colon + 1;
+  while (val_start < line + line_len && isspace (*val_start))
+    val_start++;
+  val_len = line + line_len - val_start;
+  if (val_len > MAX_STACK_ALLOC - 1)
+    val = gsk_mem_pool_alloc_unaligned (&response->pool, val_len + 1);
+  else
+    val = g_alloca (val_len + 1);
+  memcpy (val, val_start, val_len);
+  val[val_len] = '\0';
   
   parser = g_hash_table_lookup (response->request_parser_table, lowercase);
   if (parser == NULL)
     {
       /* XXX: error handling */
-      gboolean is_nonstandard = (line[0] == 'x' || line[0] == 'X')
-                              && line[1] == '-';
+      gboolean is_nonstandard = (lowercase[0] == 'x' && lowercase[1] == '-');
       if (!is_nonstandard)
-        g_warning ("couldn't handle header line %s", line);
+        g_warning ("couldn't handle header line %.*s", (int) line_len, line);
       gsk_http_header_add_misc (GSK_HTTP_HEADER (response->request), lowercase, val);
-      return;
     }
-
-  if (! ((*parser->func) (GSK_HTTP_HEADER (response->request), val, parser->data)))
+  else if (! ((*parser->func) (GSK_HTTP_HEADER (response->request), val, parser->data)))
     {
       /* XXX: error handling */
-      g_warning ("error parsing header line %s", line);
-      return;
+      g_warning ("error parsing header line %.*s", (int) line_len, line);
     }
 }
 
-#define MAX_STACK_ALLOC	4096
 
 static guint
 gsk_http_server_raw_write     (GskStream     *stream,
@@ -654,37 +683,50 @@ gsk_http_server_raw_write     (GskStream     *stream,
           {
             int nl = gsk_buffer_index_of (&server->incoming, '\n');
             char *first_line;
-            char *free_line = NULL;
             if (nl < 0)
               goto done;
             if (nl > MAX_STACK_ALLOC - 1)
-              free_line = first_line = g_malloc (nl + 1);
+              first_line = gsk_mem_pool_alloc_unaligned (&at->pool, nl + 1);
             else
               first_line = stack_buf;
             gsk_buffer_read (&server->incoming, first_line, nl + 1);
             first_line[nl] = '\0';
             g_strchomp (first_line);
             first_line_parser_callback (at, first_line);
-            g_free (free_line);
           }
           break;
 
         case READING_REQUEST:
           {
             int nl = gsk_buffer_index_of (&server->incoming, '\n');
-            char *header_line;
-            char *free_line = NULL;
+            const char *header_line;
+            char *scratch = stack_buf;
+            guint len;
             if (nl < 0)
               goto done;
-            if (nl > MAX_STACK_ALLOC - 1)
-              free_line = header_line = g_malloc (nl + 1);
+
+            /* the scratch space is only used if the line
+               straddles fragments of the incoming buffer */
+            if (nl > MAX_STACK_ALLOC)
+              scratch = gsk_mem_pool_alloc_unaligned (&at->pool, nl);
+            header_line = (const char *) gsk_buffer_peek_contiguous (&server->incoming, 0, nl,
+                                                                     scratch);
+            len = nl;
+            while (len > 0 && isspace (header_line[len - 1]))
+              len--;
+
+            if (len == 0)
+              {
+                /* the end of the header may notify the user,
+                   so finish with the buffer first */
+                gsk_buffer_discard (&server->incoming, nl + 1);
+                header_line_parser_callback (at, "", 0);
+              }
             else
-              header_line = stack_buf;
-            gsk_buffer_read (&server->incoming, header_line, nl + 1);
-            header_line[nl] = '\0';
-            g_strchomp (header_line);
-            header_line_parser_callback (at, header_line);
-            g_free (free_line);
+              {
+                header_line_parser_callback (at, header_line, len);
+                gsk_buffer_discard (&server->incoming, nl + 1);
+              }
           }
           break;
         case READING_POST:
@@ -1148,6 +1190,39 @@ gsk_http_server_respond     (GskHttpServer   *server,
     }
 }
 
+/**
+ * gsk_http_server_peek_request_pool:
+ * @server: the server which received the request.
+ * @request: the request obtained with gsk_http_server_get_request().
+ *
+ * Get a memory pool for allocations which are only needed
+ * while handling @request.  All of it is freed at once,
+ * when the response to @request has been written.
+ *
+ * Nothing allocated from the pool may be kept after that,
+ * even if the request itself is still referenced.
+ *
+ * The server parses the request into the pool:
+ * its path, its Accept-Charset, Accept-Language and Accept sets
+ * and its miscellaneous header lines are allocated from it.
+ * If the request is still referenced when the response is done,
+ * those fields are copied out of the pool first.
+ *
+ * returns: the request's memory pool.
+ */
+GskMemPool *
+gsk_http_server_peek_request_pool (GskHttpServer   *server,
+                                   GskHttpRequest  *request)
+{
+  GskHttpServerResponse *sresponse;
+  for (sresponse = server->first_response;
+       sresponse != NULL;
+       sresponse = sresponse->next)
+    if (sresponse->request == request)
+      return &sresponse->pool;
+  g_return_val_if_reached (NULL);
+}
+
 /* TODO: we should have an idle_time member
    so that we can start the timer from
    when the server went idle, as opposed to from
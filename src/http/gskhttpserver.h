@@ -6,6 +6,7 @@
 #include "gskhttpresponse.h"
 #include "../gskstream.h"
 #include "../gskmainloop.h"
+#include "../gskmempool.h"
 
 G_BEGIN_DECLS
 
@@ -69,6 +70,12 @@ void            gsk_http_server_set_idle_timeout
                                             (GskHttpServer   *server,
                                              gint             millis);
 
+/* memory that is freed when the response to 'request' is done;
+   the server parses the request's fields into it too. */
+GskMemPool     *gsk_http_server_peek_request_pool
+                                            (GskHttpServer   *server,
+                                             GskHttpRequest  *request);
+
 
 
 
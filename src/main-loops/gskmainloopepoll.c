@@ -9,16 +9,41 @@ static GObjectClass *parent_class = NULL;
 
 #include <sys/epoll.h>
 #include <errno.h>
+#include <string.h>
 
 /* epoll_create() etc based main-loop.
 
-   Note that we use Level-Triggered behavior,
-   not edge-triggered, since that is how GskMainLoops are.
+   GskMainLoops are level-triggered, so that is the default behavior.
+   Changes to the set of events we are interested in are
+   coalesced and applied just before the next epoll_wait(),
+   since sources often add and remove G_IO_OUT (and G_IO_IN)
+   several times before we poll again.
+
+   GskMainLoopEpollEt uses edge-triggered notification instead:
+   each fd is registered once for both input and output,
+   and interest changes never make a system call.
+   Readiness is tracked here instead:  once an edge is seen,
+   the fd is reported on every iteration, without a system call,
+   for as long as a source wants that condition, until the
+   source says that a read or write failed with EAGAIN
+   (see gsk_source_io_would_block()).  So handlers may read
+   or write as much as they like, as with level-triggered loops.
  */
 
 #define EPOLL_INITIAL_SIZE	2048
 #define MAX_EPOLL_EVENTS	512
 
+struct _GskMainLoopEpollFd
+{
+  guint8 wanted;		/* GIOConditions sources want */
+  guint8 registered;		/* GIOConditions the kernel has */
+  guint8 ready;			/* edge-triggered: seen, no EAGAIN since */
+  guint is_dirty : 1;		/* level-triggered: in 'dirty_fds' */
+  guint is_ready : 1;		/* edge-triggered: in 'ready_fds' */
+  guint is_emitted : 1;		/* in the events being returned */
+  guint event_index;		/* ... at this index */
+};
+
 static inline const char *
 op_to_string (int op)
 {
@@ -28,6 +53,116 @@ op_to_string (int op)
        : "op-unknown";
 }
 
+static GskMainLoopEpollFd *
+get_fd_info (GskMainLoopEpoll *epoll,
+             int               fd)
+{
+  if ((guint) fd >= epoll->fd_info_alloced)
+    {
+      guint old_alloced = epoll->fd_info_alloced;
+      guint new_alloced = old_alloced ? old_alloced : 64;
+      while ((guint) fd >= new_alloced)
+        new_alloced *= 2;
+      epoll->fd_info = g_renew (GskMainLoopEpollFd, epoll->fd_info, new_alloced);
+      memset (epoll->fd_info + old_alloced, 0,
+              sizeof (GskMainLoopEpollFd) * (new_alloced - old_alloced));
+      epoll->fd_info_alloced = new_alloced;
+    }
+  return epoll->fd_info + fd;
+}
+
+static gboolean
+do_epoll_ctl (GskMainLoopEpoll *epoll,
+              int               op,
+              int               fd,
+              guint             events)
+{
+  struct epoll_event event;
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl (epoll->fd, op, fd, &event) < 0)
+    {
+      /* the fd may have been closed and reopened
+         since we last told the kernel about it. */
+      if (op == EPOLL_CTL_MOD && errno == ENOENT)
+        return do_epoll_ctl (epoll, EPOLL_CTL_ADD, fd, events);
+      g_warning ("epoll_ctl: op=%s, fd=%d, new_events=%x failed: %s",
+		 op_to_string (op), fd, event.events, g_strerror (errno));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static inline guint
+io_conditions_to_epoll (GIOCondition io_conditions)
+{
+  return ((io_conditions & G_IO_IN) ? (EPOLLIN) : 0)
+       | ((io_conditions & G_IO_OUT) ? (EPOLLOUT) : 0)
+       | ((io_conditions & G_IO_HUP) ? (EPOLLHUP) : 0)
+       ;
+}
+
+static inline GIOCondition
+epoll_to_io_conditions (guint e)
+{
+  GIOCondition condition = 0;
+  if (e & EPOLLIN)
+    condition |= G_IO_IN;
+  if (e & EPOLLHUP)
+    condition |= (G_IO_HUP|G_IO_IN);
+  if (e & EPOLLERR)
+    condition |= (G_IO_ERR|G_IO_IN|G_IO_OUT);
+  if (e & EPOLLOUT)
+    condition |= G_IO_OUT;
+  return condition;
+}
+
+/* Apply the coalesced level-triggered changes. */
+static void
+flush_dirty_fds (GskMainLoopEpoll *epoll)
+{
+  guint i;
+  for (i = 0; i < epoll->n_dirty_fds; i++)
+    {
+      int fd = epoll->dirty_fds[i];
+      GskMainLoopEpollFd *info = epoll->fd_info + fd;
+      info->is_dirty = 0;
+      if (info->wanted == info->registered)
+        continue;
+      if (do_epoll_ctl (epoll,
+                        info->registered == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+                        fd, io_conditions_to_epoll (info->wanted)))
+        info->registered = info->wanted;
+    }
+  epoll->n_dirty_fds = 0;
+}
+
+static inline void
+append_fd (int **fds_inout,
+           guint *n_inout,
+           guint *alloced_inout,
+           int fd)
+{
+  if (*n_inout == *alloced_inout)
+    {
+      *alloced_inout = *alloced_inout ? *alloced_inout * 2 : 64;
+      *fds_inout = g_renew (int, *fds_inout, *alloced_inout);
+    }
+  (*fds_inout)[(*n_inout)++] = fd;
+}
+
+static inline void
+add_ready (GskMainLoopEpoll   *epoll,
+           GskMainLoopEpollFd *info)
+{
+  if (!info->is_ready)
+    {
+      info->is_ready = 1;
+      append_fd (&epoll->ready_fds, &epoll->n_ready_fds,
+                 &epoll->ready_fds_alloced, info - epoll->fd_info);
+    }
+}
+
 /* --- GskMainLoopPollBase methods --- */
 static gboolean
 gsk_main_loop_epoll_setup  (GskMainLoop       *main_loop)
@@ -52,24 +187,98 @@ gsk_main_loop_epoll_config_fd (GskMainLoopPollBase   *main_loop,
                                GIOCondition           io_conditions)
 {
   GskMainLoopEpoll *epoll = GSK_MAIN_LOOP_EPOLL (main_loop);
-  int op = (io_conditions == 0) ? EPOLL_CTL_DEL
-         : (old_io_conditions == 0) ? EPOLL_CTL_ADD
-	 : EPOLL_CTL_MOD;
-  struct epoll_event event;
+  GskMainLoopEpollFd *info;
   if (old_io_conditions == 0 && io_conditions == 0)
     return;
-  event.events = ((io_conditions & G_IO_IN) ? (EPOLLIN) : 0)
-               | ((io_conditions & G_IO_OUT) ? (EPOLLOUT) : 0)
-               | ((io_conditions & G_IO_HUP) ? (EPOLLHUP) : 0)
-	       ;
-  event.data.fd = fd;
-  if (epoll_ctl (epoll->fd, op, fd, &event) < 0)
+  info = get_fd_info (epoll, fd);
+
+  /* Removals are done at once, since the fd
+     is probably about to be closed. */
+  if (io_conditions == 0)
     {
-      g_warning ("epoll_ctl: op=%s, fd=%d, new_events=%x failed: %s",
-		 op_to_string (op), fd, event.events, g_strerror (errno));
+      if (info->registered != 0)
+        do_epoll_ctl (epoll, EPOLL_CTL_DEL, fd, 0);
+      info->wanted = info->registered = info->ready = 0;
+      return;
+    }
+
+  if (epoll->edge_triggered)
+    {
+      GIOCondition new_conditions = io_conditions & ~info->wanted;
+      info->wanted = io_conditions;
+      if (info->registered == 0)
+        {
+          info->ready = 0;
+          if (do_epoll_ctl (epoll, EPOLL_CTL_ADD, fd,
+                            EPOLLIN | EPOLLOUT | EPOLLET))
+            info->registered = G_IO_IN | G_IO_OUT;
+        }
+      else if ((new_conditions & info->ready) != 0)
+        {
+          /* it became ready while nobody was interested */
+          add_ready (epoll, info);
+        }
+    }
+  else
+    {
+      info->wanted = io_conditions;
+      if (!info->is_dirty)
+        {
+          info->is_dirty = 1;
+          append_fd (&epoll->dirty_fds, &epoll->n_dirty_fds,
+                     &epoll->dirty_fds_alloced, fd);
+        }
     }
 }
 
+static inline void
+emit_event (GskMainLoopEpollFd *info,
+            int                 fd,
+            GIOCondition        condition,
+            GskMainLoopEvent   *events,
+            guint              *n_out_inout)
+{
+  if (info->is_emitted)
+    events[info->event_index].data.io.events |= condition;
+  else
+    {
+      guint n_out = *n_out_inout;
+      info->is_emitted = 1;
+      info->event_index = n_out;
+      events[n_out].type = GSK_MAIN_LOOP_EVENT_IO;
+      events[n_out].data.io.events = condition;
+      events[n_out].data.io.fd = fd;
+      *n_out_inout = n_out + 1;
+    }
+}
+
+/* Edge-triggered mode:  report the fds that are still ready
+   for what their sources want.  They stay on the list until
+   they would block, or nobody wants what they are ready for. */
+static guint
+report_ready (GskMainLoopEpoll   *epoll,
+              guint               max_events,
+              GskMainLoopEvent   *events)
+{
+  guint i, n_left = 0, n_out = 0;
+  for (i = 0; i < epoll->n_ready_fds; i++)
+    {
+      int fd = epoll->ready_fds[i];
+      GskMainLoopEpollFd *info = epoll->fd_info + fd;
+      GIOCondition condition = info->wanted & info->ready & (G_IO_IN|G_IO_OUT);
+      if (condition == 0)
+        {
+          info->is_ready = 0;
+          continue;
+        }
+      epoll->ready_fds[n_left++] = fd;
+      if (n_out < max_events)
+        emit_event (info, fd, condition, events, &n_out);
+    }
+  epoll->n_ready_fds = n_left;
+  return n_out;
+}
+
 static gboolean
 gsk_main_loop_epoll_do_polling (GskMainLoopPollBase   *main_loop,
                                 int                    max_timeout,
@@ -82,10 +291,24 @@ gsk_main_loop_epoll_do_polling (GskMainLoopPollBase   *main_loop,
   int n_events;
   int i;
   guint n_out = 0;
+  gboolean et = main_loop_epoll->edge_triggered;
+
+  if (et)
+    {
+      if (main_loop_epoll->n_ready_fds > 0)
+        n_out = report_ready (main_loop_epoll, max_events, events);
+      if (n_out > 0)
+        max_timeout = 0;
+    }
+  else if (main_loop_epoll->n_dirty_fds > 0)
+    flush_dirty_fds (main_loop_epoll);
+
   errno = EINTR;		/* HACK: ignore errors which don't set errno !?! */
-  n_events = epoll_wait (main_loop_epoll->fd, e_events,
-			 MIN (max_events, MAX_EPOLL_EVENTS),
-			 max_timeout);
+  n_events = 0;
+  if (n_out < max_events)
+    n_events = epoll_wait (main_loop_epoll->fd, e_events,
+                           MIN (max_events - n_out, MAX_EPOLL_EVENTS),
+                           max_timeout);
 #if 0
   g_message ("epoll_wait: max_timeout=%d, max_events=%u, n_events out=%d",
 	     max_timeout, max_events, n_events);
@@ -93,41 +316,63 @@ gsk_main_loop_epoll_do_polling (GskMainLoopPollBase   *main_loop,
   if (n_events < 0)
     {
       int e = errno;
-      *num_events_out = 0;
-      if (gsk_errno_is_ignorable (e))
-	return TRUE;
-      g_warning ("error running epoll_wait: %s", g_strerror (e));
-      return TRUE;
+      if (!gsk_errno_is_ignorable (e))
+        g_warning ("error running epoll_wait: %s", g_strerror (e));
+      n_events = 0;
     }
 
   for (i = 0; i < n_events; i++)
     {
       int fd = e_events[i].data.fd;
-      unsigned e = e_events[i].events;
-      GIOCondition condition = 0;
-      if (e & EPOLLIN)
-	condition |= G_IO_IN;
-      if (e & EPOLLHUP)
-	condition |= (G_IO_HUP|G_IO_IN);
-      if (e & EPOLLERR)
-	condition |= (G_IO_ERR|G_IO_IN|G_IO_OUT);
-      if (e & EPOLLOUT)
-	condition |= G_IO_OUT;
-      events[n_out].type = GSK_MAIN_LOOP_EVENT_IO;
-      events[n_out].data.io.events = condition;
-      events[n_out].data.io.fd = fd;
-      n_out++;
+      GIOCondition condition = epoll_to_io_conditions (e_events[i].events);
+      if (et)
+        {
+          GskMainLoopEpollFd *info = main_loop_epoll->fd_info + fd;
+
+          /* the fd stays ready until a source sees EAGAIN */
+          info->ready |= condition & (G_IO_IN|G_IO_OUT);
+          if ((info->ready & info->wanted) != 0)
+            add_ready (main_loop_epoll, info);
+          condition &= info->wanted | G_IO_HUP | G_IO_ERR;
+          if (condition == 0)
+            continue;
+          emit_event (info, fd, condition, events, &n_out);
+        }
+      else
+        {
+          events[n_out].type = GSK_MAIN_LOOP_EVENT_IO;
+          events[n_out].data.io.events = condition;
+          events[n_out].data.io.fd = fd;
+          n_out++;
+        }
     }
+
+  if (et)
+    for (i = 0; i < (int) n_out; i++)
+      main_loop_epoll->fd_info[events[i].data.io.fd].is_emitted = 0;
   *num_events_out = n_out;
 
   return TRUE;
 }
 
+static void
+gsk_main_loop_epoll_io_would_block (GskMainLoop *main_loop,
+                                    int          fd,
+                                    GIOCondition events)
+{
+  GskMainLoopEpoll *epoll = GSK_MAIN_LOOP_EPOLL (main_loop);
+  if (epoll->edge_triggered && (guint) fd < epoll->fd_info_alloced)
+    epoll->fd_info[fd].ready &= ~events;
+}
+
 static void
 gsk_main_loop_epoll_finalize (GObject *object)
 {
   GskMainLoopEpoll *main_loop_epoll = GSK_MAIN_LOOP_EPOLL (object);
   g_free (main_loop_epoll->epoll_events);
+  g_free (main_loop_epoll->fd_info);
+  g_free (main_loop_epoll->dirty_fds);
+  g_free (main_loop_epoll->ready_fds);
   (*parent_class->finalize) (object);
 }
 #endif  /* HAVE_EPOLL_SUPPORT */
@@ -150,6 +395,7 @@ gsk_main_loop_epoll_class_init (GskMainLoopEpollClass *class)
   GskMainLoopClass *main_loop_class = GSK_MAIN_LOOP_CLASS (class);
   GObjectClass *object_class = G_OBJECT_CLASS (class);
   main_loop_class->setup = gsk_main_loop_epoll_setup;
+  main_loop_class->io_would_block = gsk_main_loop_epoll_io_would_block;
   main_loop_poll_base_class->config_fd = gsk_main_loop_epoll_config_fd;
   main_loop_poll_base_class->do_polling = gsk_main_loop_epoll_do_polling;
   object_class->finalize = gsk_main_loop_epoll_finalize;
@@ -181,3 +427,35 @@ GType gsk_main_loop_epoll_get_type()
     }
   return main_loop_epoll_type;
 }
+
+/* --- edge-triggered variant --- */
+static void
+gsk_main_loop_epoll_et_init (GskMainLoopEpoll *main_loop_epoll)
+{
+  main_loop_epoll->edge_triggered = TRUE;
+}
+
+GType gsk_main_loop_epoll_et_get_type()
+{
+  static GType main_loop_epoll_et_type = 0;
+  if (!main_loop_epoll_et_type)
+    {
+      static const GTypeInfo main_loop_epoll_et_info =
+      {
+	sizeof(GskMainLoopEpollClass),
+	(GBaseInitFunc) NULL,
+	(GBaseFinalizeFunc) NULL,
+	(GClassInitFunc) NULL,
+	NULL,		/* class_finalize */
+	NULL,		/* class_data */
+	sizeof (GskMainLoopEpoll),
+	0,		/* n_preallocs */
+	(GInstanceInitFunc) gsk_main_loop_epoll_et_init,
+	NULL		/* value_table */
+      };
+      main_loop_epoll_et_type = g_type_register_static (GSK_TYPE_MAIN_LOOP_EPOLL,
+                                                  "GskMainLoopEpollEt",
+						  &main_loop_epoll_et_info, 0);
+    }
+  return main_loop_epoll_et_type;
+}
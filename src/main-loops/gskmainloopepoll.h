@@ -8,6 +8,7 @@ G_BEGIN_DECLS
 /* --- typedefs --- */
 typedef struct _GskMainLoopEpoll GskMainLoopEpoll;
 typedef struct _GskMainLoopEpollClass GskMainLoopEpollClass;
+typedef struct _GskMainLoopEpollFd GskMainLoopEpollFd;
 
 /* --- type macros --- */
 GType gsk_main_loop_epoll_get_type(void) G_GNUC_CONST;
@@ -18,6 +19,12 @@ GType gsk_main_loop_epoll_get_type(void) G_GNUC_CONST;
 #define GSK_IS_MAIN_LOOP_EPOLL(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GSK_TYPE_MAIN_LOOP_EPOLL))
 #define GSK_IS_MAIN_LOOP_EPOLL_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE ((klass), GSK_TYPE_MAIN_LOOP_EPOLL))
 
+/* The edge-triggered variant (GSK_MAIN_LOOP_TYPE=epoll-et).
+   An fd stays ready, and its sources keep being invoked, until they
+   report EAGAIN with gsk_source_io_would_block(). */
+GType gsk_main_loop_epoll_et_get_type(void) G_GNUC_CONST;
+#define GSK_TYPE_MAIN_LOOP_EPOLL_ET		(gsk_main_loop_epoll_et_get_type ())
+
 /* --- structures --- */
 struct _GskMainLoopEpollClass 
 {
@@ -28,6 +35,21 @@ struct _GskMainLoopEpoll
   GskMainLoopPollBase      main_loop_poll_base;
   int                      fd;
   gpointer                 epoll_events;
+  gboolean                 edge_triggered;
+
+  /* indexed by fd */
+  GskMainLoopEpollFd      *fd_info;
+  guint                    fd_info_alloced;
+
+  /* level-triggered: fds whose events must be reconfigured */
+  int                     *dirty_fds;
+  guint                    n_dirty_fds;
+  guint                    dirty_fds_alloced;
+
+  /* edge-triggered: fds that may still be ready */
+  int                     *ready_fds;
+  guint                    n_ready_fds;
+  guint                    ready_fds_alloced;
 };
 
 /* --- prototypes --- */
@@ -0,0 +1,558 @@
+#include "gskmainloopiouring.h"
+#include "../config.h"
+#include "../gskerrno.h"
+#include "../gskutils.h"
+
+static GObjectClass *parent_class = NULL;
+
+#if HAVE_IO_URING_SUPPORT
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+/* io_uring based main-loop.
+
+   We use one-shot IORING_OP_POLL_ADD requests:  a request
+   that completes is rearmed just before we wait again,
+   if anyone is still interested, which gives us GskMainLoop's
+   level-triggered behavior.  All the (re)arming and any changes
+   are submitted by the same io_uring_enter() call that waits
+   for completions, so a whole iteration is one system call.
+
+   We require IORING_FEAT_EXT_ARG (linux 5.11) to wait with a timeout;
+   on older kernels (or if io_uring is disabled), setup fails
+   and gsk_main_loop_new() will use another main-loop.
+ */
+
+#define IO_URING_ENTRIES	256
+
+/* user_data for requests whose completion we ignore */
+#define USER_DATA_IGNORE	G_MAXUINT64
+
+typedef struct _Rings Rings;
+struct _Rings
+{
+  guint *sq_head, *sq_tail, *sq_mask, *sq_array;
+  guint *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  guint sq_entries;
+  guint n_unsubmitted;
+
+  gpointer sq_map;
+  gsize sq_map_size;
+  gpointer cq_map;		/* may be sq_map */
+  gsize cq_map_size;
+  gsize sqes_size;
+};
+
+struct _GskMainLoopIoUringFd
+{
+  GIOCondition wanted;
+  guint32 generation;		/* of the current poll request */
+  guint is_armed : 1;		/* a poll request is outstanding */
+  guint is_arming : 1;		/* in 'arm_fds' */
+  guint armed_events;		/* ... for these POLL* events */
+};
+
+static inline int
+sys_io_uring_setup (guint entries, struct io_uring_params *params)
+{
+  return syscall (__NR_io_uring_setup, entries, params);
+}
+
+static inline int
+sys_io_uring_enter (int fd,
+                    guint to_submit,
+                    guint min_complete,
+                    guint flags,
+                    gconstpointer arg,
+                    gsize arg_size)
+{
+  return syscall (__NR_io_uring_enter, fd, to_submit, min_complete,
+                  flags, arg, arg_size);
+}
+
+static void
+rings_free (Rings *rings)
+{
+  if (rings->sqes != NULL)
+    munmap (rings->sqes, rings->sqes_size);
+  if (rings->cq_map != NULL && rings->cq_map != rings->sq_map)
+    munmap (rings->cq_map, rings->cq_map_size);
+  if (rings->sq_map != NULL)
+    munmap (rings->sq_map, rings->sq_map_size);
+  g_free (rings);
+}
+
+static Rings *
+rings_map (int fd, const struct io_uring_params *p)
+{
+  Rings *rings = g_new0 (Rings, 1);
+  guint8 *sq, *cq;
+  guint i;
+
+  rings->sq_map_size = p->sq_off.array + p->sq_entries * sizeof (guint);
+  rings->cq_map_size = p->cq_off.cqes + p->cq_entries * sizeof (struct io_uring_cqe);
+  if (p->features & IORING_FEAT_SINGLE_MMAP)
+    rings->sq_map_size = rings->cq_map_size = MAX (rings->sq_map_size, rings->cq_map_size);
+
+  sq = mmap (NULL, rings->sq_map_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED)
+    goto fail;
+  rings->sq_map = sq;
+  if (p->features & IORING_FEAT_SINGLE_MMAP)
+    cq = sq;
+  else
+    {
+      cq = mmap (NULL, rings->cq_map_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq == MAP_FAILED)
+        goto fail;
+    }
+  rings->cq_map = cq;
+  rings->sqes_size = p->sq_entries * sizeof (struct io_uring_sqe);
+  rings->sqes = mmap (NULL, rings->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (rings->sqes == MAP_FAILED)
+    {
+      rings->sqes = NULL;
+      goto fail;
+    }
+
+  rings->sq_head = (guint *) (sq + p->sq_off.head);
+  rings->sq_tail = (guint *) (sq + p->sq_off.tail);
+  rings->sq_mask = (guint *) (sq + p->sq_off.ring_mask);
+  rings->sq_array = (guint *) (sq + p->sq_off.array);
+  rings->cq_head = (guint *) (cq + p->cq_off.head);
+  rings->cq_tail = (guint *) (cq + p->cq_off.tail);
+  rings->cq_mask = (guint *) (cq + p->cq_off.ring_mask);
+  rings->cqes = (struct io_uring_cqe *) (cq + p->cq_off.cqes);
+  rings->sq_entries = p->sq_entries;
+
+  /* we always fill the sqes in order */
+  for (i = 0; i < p->sq_entries; i++)
+    rings->sq_array[i] = i;
+  return rings;
+
+fail:
+  rings_free (rings);
+  return NULL;
+}
+
+static int
+submit (GskMainLoopIoUring *uring,
+        guint               min_complete,
+        guint               flags,
+        gconstpointer       arg,
+        gsize               arg_size)
+{
+  Rings *rings = uring->rings;
+  int rv;
+  if (min_complete > 0 || arg != NULL)
+    flags |= IORING_ENTER_GETEVENTS;
+  rv = sys_io_uring_enter (uring->fd, rings->n_unsubmitted, min_complete,
+                           flags, arg, arg_size);
+  if (rv >= 0)
+    rings->n_unsubmitted -= MIN ((guint) rv, rings->n_unsubmitted);
+  return rv;
+}
+
+static inline gboolean
+sq_is_full (Rings *rings)
+{
+  return *rings->sq_tail - __atomic_load_n (rings->sq_head, __ATOMIC_ACQUIRE)
+      >= rings->sq_entries;
+}
+
+/* Returns NULL if the submission queue is still full after
+   handing it to the kernel, for example because the kernel
+   is busy until we reap completions (EBUSY). */
+static struct io_uring_sqe *
+get_sqe (GskMainLoopIoUring *uring)
+{
+  Rings *rings = uring->rings;
+  struct io_uring_sqe *sqe;
+  if (sq_is_full (rings))
+    {
+      /* submission queue is full:  hand it to the kernel now, and retry */
+      if (submit (uring, 0, 0, NULL, 0) < 0
+       && errno != EBUSY
+       && !gsk_errno_is_ignorable (errno))
+        g_warning ("io_uring_enter: %s", g_strerror (errno));
+      if (sq_is_full (rings))
+        return NULL;
+    }
+  sqe = rings->sqes + (*rings->sq_tail & *rings->sq_mask);
+  memset (sqe, 0, sizeof (struct io_uring_sqe));
+  return sqe;
+}
+
+static inline void
+commit_sqe (GskMainLoopIoUring *uring)
+{
+  Rings *rings = uring->rings;
+  __atomic_store_n (rings->sq_tail, *rings->sq_tail + 1, __ATOMIC_RELEASE);
+  rings->n_unsubmitted++;
+}
+
+static inline guint64
+make_user_data (int fd, guint32 generation)
+{
+  return ((guint64) generation << 32) | (guint) fd;
+}
+
+static inline guint
+io_conditions_to_poll (GIOCondition io_conditions)
+{
+  return ((io_conditions & G_IO_IN) ? POLLIN : 0)
+       | ((io_conditions & G_IO_OUT) ? POLLOUT : 0)
+       | ((io_conditions & G_IO_HUP) ? POLLHUP : 0);
+}
+
+static GskMainLoopIoUringFd *
+get_fd_info (GskMainLoopIoUring *uring,
+             int                 fd)
+{
+  if ((guint) fd >= uring->fd_info_alloced)
+    {
+      guint old_alloced = uring->fd_info_alloced;
+      guint new_alloced = old_alloced ? old_alloced : 64;
+      while ((guint) fd >= new_alloced)
+        new_alloced *= 2;
+      uring->fd_info = g_renew (GskMainLoopIoUringFd, uring->fd_info, new_alloced);
+      memset (uring->fd_info + old_alloced, 0,
+              sizeof (GskMainLoopIoUringFd) * (new_alloced - old_alloced));
+      uring->fd_info_alloced = new_alloced;
+    }
+  return uring->fd_info + fd;
+}
+
+static void
+cancel_poll (GskMainLoopIoUring   *uring,
+             int                   fd,
+             GskMainLoopIoUringFd *info)
+{
+  struct io_uring_sqe *sqe = get_sqe (uring);
+  if (sqe != NULL)
+    {
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = make_user_data (fd, info->generation);
+      sqe->user_data = USER_DATA_IGNORE;
+      commit_sqe (uring);
+    }
+
+  /* any completion of the old request will be ignored */
+  info->generation++;
+  info->is_armed = 0;
+}
+
+/* returns FALSE if there was no room to submit the request */
+static gboolean
+arm_poll (GskMainLoopIoUring   *uring,
+          int                   fd,
+          GskMainLoopIoUringFd *info)
+{
+  struct io_uring_sqe *sqe = get_sqe (uring);
+  if (sqe == NULL)
+    return FALSE;
+  info->armed_events = io_conditions_to_poll (info->wanted);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = info->armed_events;
+  sqe->user_data = make_user_data (fd, info->generation);
+  commit_sqe (uring);
+  info->is_armed = 1;
+  return TRUE;
+}
+
+static inline void
+need_arm (GskMainLoopIoUring   *uring,
+          int                   fd,
+          GskMainLoopIoUringFd *info)
+{
+  if (!info->is_arming)
+    {
+      info->is_arming = 1;
+      if (uring->n_arm_fds == uring->arm_fds_alloced)
+        {
+          uring->arm_fds_alloced = uring->arm_fds_alloced ? uring->arm_fds_alloced * 2 : 64;
+          uring->arm_fds = g_renew (int, uring->arm_fds, uring->arm_fds_alloced);
+        }
+      uring->arm_fds[uring->n_arm_fds++] = fd;
+    }
+}
+
+/* --- GskMainLoopPollBase methods --- */
+static gboolean
+setup_ring (int *fd_out, Rings **rings_out)
+{
+  struct io_uring_params params;
+  int fd;
+  memset (&params, 0, sizeof (params));
+  fd = sys_io_uring_setup (IO_URING_ENTRIES, &params);
+  if (fd < 0)
+    return FALSE;
+  if ((params.features & IORING_FEAT_EXT_ARG) == 0
+   || (params.features & IORING_FEAT_NODROP) == 0)
+    {
+      close (fd);
+      return FALSE;
+    }
+  if (rings_out != NULL)
+    {
+      *rings_out = rings_map (fd, &params);
+      if (*rings_out == NULL)
+        {
+          close (fd);
+          return FALSE;
+        }
+    }
+  if (fd_out != NULL)
+    *fd_out = fd;
+  else
+    close (fd);
+  return TRUE;
+}
+
+static gboolean
+gsk_main_loop_io_uring_setup  (GskMainLoop       *main_loop)
+{
+  GskMainLoopClass *pclass = GSK_MAIN_LOOP_CLASS (parent_class);
+  GskMainLoopIoUring *uring = GSK_MAIN_LOOP_IO_URING (main_loop);
+  Rings *rings;
+  int fd;
+  if (pclass->setup != NULL)
+    if (!(*pclass->setup) (main_loop))
+      return FALSE;
+  if (!setup_ring (&fd, &rings))
+    return FALSE;
+  gsk_fd_set_close_on_exec (fd, TRUE);
+  uring->fd = fd;
+  uring->rings = rings;
+  return TRUE;
+}
+
+static void
+gsk_main_loop_io_uring_config_fd (GskMainLoopPollBase   *main_loop,
+                                  int                    fd,
+			          GIOCondition           old_io_conditions,
+                                  GIOCondition           io_conditions)
+{
+  GskMainLoopIoUring *uring = GSK_MAIN_LOOP_IO_URING (main_loop);
+  GskMainLoopIoUringFd *info;
+  if (old_io_conditions == 0 && io_conditions == 0)
+    return;
+  info = get_fd_info (uring, fd);
+  info->wanted = io_conditions;
+
+  /* An outstanding request for other events must be replaced;
+     we wait until the next poll to arm the new one,
+     since interest often changes several times in an iteration. */
+  if (info->is_armed
+   && info->armed_events != io_conditions_to_poll (io_conditions))
+    cancel_poll (uring, fd, info);
+  if (io_conditions != 0 && !info->is_armed)
+    need_arm (uring, fd, info);
+}
+
+static gboolean
+gsk_main_loop_io_uring_do_polling (GskMainLoopPollBase   *main_loop,
+                                   int                    max_timeout,
+                                   guint                  max_events,
+                                   guint                 *num_events_out,
+                                   GskMainLoopEvent      *events)
+{
+  GskMainLoopIoUring *uring = GSK_MAIN_LOOP_IO_URING (main_loop);
+  Rings *rings = uring->rings;
+  guint i, head, tail, n_left = 0;
+  guint n_out = 0;
+  int rv;
+
+  /* fds we had no room to arm are kept for next time */
+  for (i = 0; i < uring->n_arm_fds; i++)
+    {
+      int fd = uring->arm_fds[i];
+      GskMainLoopIoUringFd *info = uring->fd_info + fd;
+      if (info->wanted == 0 || info->is_armed || arm_poll (uring, fd, info))
+        info->is_arming = 0;
+      else
+        uring->arm_fds[n_left++] = fd;
+    }
+  uring->n_arm_fds = n_left;
+
+  /* ...without sleeping long before trying again */
+  if (n_left > 0 && (max_timeout < 0 || max_timeout > 1))
+    max_timeout = 1;
+
+  /* submit, and wait for at least one completion */
+  head = *rings->cq_head;
+  tail = __atomic_load_n (rings->cq_tail, __ATOMIC_ACQUIRE);
+  if (head != tail || max_timeout == 0)
+    rv = rings->n_unsubmitted ? submit (uring, 0, 0, NULL, 0) : 0;
+  else if (max_timeout < 0)
+    rv = submit (uring, 1, 0, NULL, 0);
+  else
+    {
+      struct io_uring_getevents_arg arg;
+      struct __kernel_timespec ts;
+      ts.tv_sec = max_timeout / 1000;
+      ts.tv_nsec = (max_timeout % 1000) * 1000000;
+      memset (&arg, 0, sizeof (arg));
+      arg.ts = (guint64) (gsize) &ts;
+      rv = submit (uring, 1, IORING_ENTER_EXT_ARG, &arg, sizeof (arg));
+    }
+  if (rv < 0 && errno != ETIME && errno != EBUSY
+   && !gsk_errno_is_ignorable (errno))
+    g_warning ("io_uring_enter: %s", g_strerror (errno));
+
+  /* reap completions */
+  head = *rings->cq_head;
+  tail = __atomic_load_n (rings->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail && n_out < max_events)
+    {
+      struct io_uring_cqe *cqe = rings->cqes + (head & *rings->cq_mask);
+      guint64 user_data = cqe->user_data;
+      int res = cqe->res;
+      int fd;
+      GskMainLoopIoUringFd *info;
+      GIOCondition condition = 0;
+      head++;
+
+      if (user_data == USER_DATA_IGNORE)
+        continue;
+      fd = (int) (user_data & 0xffffffff);
+      if ((guint) fd >= uring->fd_info_alloced)
+        continue;
+      info = uring->fd_info + fd;
+      if ((guint32) (user_data >> 32) != info->generation || !info->is_armed)
+        continue;		/* stale */
+      info->is_armed = 0;
+      info->generation++;
+
+      if (res < 0)
+        {
+          if (res != -ECANCELED)
+            condition = G_IO_ERR | G_IO_IN | G_IO_OUT;
+        }
+      else
+        {
+          if (res & (POLLIN|POLLPRI))
+            condition |= G_IO_IN;
+          if (res & POLLHUP)
+            condition |= (G_IO_HUP|G_IO_IN);
+          if (res & (POLLERR|POLLNVAL))
+            condition |= (G_IO_ERR|G_IO_IN|G_IO_OUT);
+          if (res & POLLOUT)
+            condition |= G_IO_OUT;
+        }
+
+      /* rearm before the next wait, if still wanted */
+      if (info->wanted != 0)
+        need_arm (uring, fd, info);
+
+      condition &= info->wanted | G_IO_HUP | G_IO_ERR;
+      if (condition == 0)
+        continue;
+      events[n_out].type = GSK_MAIN_LOOP_EVENT_IO;
+      events[n_out].data.io.events = condition;
+      events[n_out].data.io.fd = fd;
+      n_out++;
+    }
+  __atomic_store_n (rings->cq_head, head, __ATOMIC_RELEASE);
+  *num_events_out = n_out;
+  return TRUE;
+}
+
+static void
+gsk_main_loop_io_uring_finalize (GObject *object)
+{
+  GskMainLoopIoUring *uring = GSK_MAIN_LOOP_IO_URING (object);
+  if (uring->rings != NULL)
+    rings_free (uring->rings);
+  if (uring->fd >= 0)
+    close (uring->fd);
+  g_free (uring->fd_info);
+  g_free (uring->arm_fds);
+  (*parent_class->finalize) (object);
+}
+#endif  /* HAVE_IO_URING_SUPPORT */
+
+/**
+ * gsk_main_loop_io_uring_probe:
+ *
+ * Find out whether the running kernel supports
+ * the io_uring features that #GskMainLoopIoUring needs.
+ * If not, creating one will fail;  gsk_main_loop_new() will
+ * fall back to another type of main-loop.
+ *
+ * returns: whether a #GskMainLoopIoUring can be used.
+ */
+gboolean
+gsk_main_loop_io_uring_probe (void)
+{
+#if HAVE_IO_URING_SUPPORT
+  static gint result = -1;
+  if (result < 0)
+    result = setup_ring (NULL, NULL) ? 1 : 0;
+  return result;
+#else
+  return FALSE;
+#endif
+}
+
+/* --- functions --- */
+static void
+gsk_main_loop_io_uring_init (GskMainLoopIoUring *main_loop_io_uring)
+{
+#if HAVE_IO_URING_SUPPORT
+  main_loop_io_uring->fd = -1;
+#endif  /* HAVE_IO_URING_SUPPORT */
+}
+
+static void
+gsk_main_loop_io_uring_class_init (GskMainLoopIoUringClass *class)
+{
+#if HAVE_IO_URING_SUPPORT
+  GskMainLoopPollBaseClass *main_loop_poll_base_class = GSK_MAIN_LOOP_POLL_BASE_CLASS (class);
+  GskMainLoopClass *main_loop_class = GSK_MAIN_LOOP_CLASS (class);
+  GObjectClass *object_class = G_OBJECT_CLASS (class);
+  main_loop_class->setup = gsk_main_loop_io_uring_setup;
+  main_loop_poll_base_class->config_fd = gsk_main_loop_io_uring_config_fd;
+  main_loop_poll_base_class->do_polling = gsk_main_loop_io_uring_do_polling;
+  object_class->finalize = gsk_main_loop_io_uring_finalize;
+#endif  /* HAVE_IO_URING_SUPPORT */
+  parent_class = g_type_class_peek_parent (class);
+}
+
+GType gsk_main_loop_io_uring_get_type()
+{
+  static GType main_loop_io_uring_type = 0;
+  if (!main_loop_io_uring_type)
+    {
+      static const GTypeInfo main_loop_io_uring_info =
+      {
+	sizeof(GskMainLoopIoUringClass),
+	(GBaseInitFunc) NULL,
+	(GBaseFinalizeFunc) NULL,
+	(GClassInitFunc) gsk_main_loop_io_uring_class_init,
+	NULL,		/* class_finalize */
+	NULL,		/* class_data */
+	sizeof (GskMainLoopIoUring),
+	0,		/* n_preallocs */
+	(GInstanceInitFunc) gsk_main_loop_io_uring_init,
+	NULL		/* value_table */
+      };
+      main_loop_io_uring_type = g_type_register_static (GSK_TYPE_MAIN_LOOP_POLL_BASE,
+                                                  "GskMainLoopIoUring",
+						  &main_loop_io_uring_info, 0);
+    }
+  return main_loop_io_uring_type;
+}
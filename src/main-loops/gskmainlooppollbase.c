@@ -114,11 +114,20 @@ gsk_main_loop_handle_sigchld (int       sig_no,
   return TRUE;
 }
 
+/* one per pipe in 'signal_fds' */
+typedef struct _SignalPipe SignalPipe;
+struct _SignalPipe
+{
+  guint high_bits;
+  GskSource *source;
+};
+
 static gboolean
 handle_signal_pipe_input  (int                   fd,
 			   GIOCondition          condition,
 			   gpointer              user_data)
 {
+  SignalPipe *signal_pipe = user_data;
   guint high_bits;
   AtomicSignalType atomic_sigs[1024];
   int n_bytes_read;
@@ -128,10 +137,12 @@ handle_signal_pipe_input  (int                   fd,
     return TRUE;
 
   G_LOCK (signal_fds);
-  high_bits = GPOINTER_TO_UINT (user_data);
+  high_bits = signal_pipe->high_bits;
   n_bytes_read = read (fd, atomic_sigs, sizeof (atomic_sigs));
   if (n_bytes_read < 0)
     {
+      if (errno == EAGAIN)
+        gsk_source_io_would_block (signal_pipe->source, G_IO_IN);
       if (gsk_errno_is_ignorable (errno))
 	{
 	  G_UNLOCK (signal_fds);
@@ -147,6 +158,11 @@ handle_signal_pipe_input  (int                   fd,
       G_UNLOCK (signal_fds);
       return FALSE;
     }
+  if (n_bytes_read < (int) sizeof (atomic_sigs))
+    {
+      /* the short read emptied the pipe */
+      gsk_source_io_would_block (signal_pipe->source, G_IO_IN);
+    }
   if ((n_bytes_read % sizeof (AtomicSignalType)) != 0)
     {
       g_warning ("did not get an integer number of signal-ids from pipe");
@@ -172,12 +188,17 @@ handle_signal_pipe_input  (int                   fd,
 static gboolean
 handle_wakeup (int fd, GIOCondition condition, gpointer user_data)
 {
+  GskMainLoopPollBase *poll_base = user_data;
   char buf[4096];
+  int rv;
   g_return_val_if_fail (GSK_IS_MAIN_LOOP_POLL_BASE (user_data), FALSE);
   if ((condition & G_IO_IN) != G_IO_IN)
     return TRUE;
-  while (read (fd, buf, sizeof (buf)) == sizeof (buf))
+  while ((rv = read (fd, buf, sizeof (buf))) == sizeof (buf))
     ;
+  /* a short read, like EAGAIN, means the pipe is empty */
+  if (rv >= 0 || errno == EAGAIN)
+    gsk_source_io_would_block (poll_base->wakeup_read_pipe, G_IO_IN);
   return TRUE;
 }
 
@@ -244,7 +265,7 @@ gsk_main_loop_poll_base_change     (GskMainLoop           *main_loop,
 		 || g_array_index (signal_fds, int, signal_fd_index) == -1)
 		  {
 		    int pipe_fds[2];
-		    GskSource *signal_source;
+		    SignalPipe *signal_pipe;
 		    if (pipe (pipe_fds) < 0)
 		      {
 			g_warning ("error creating signal-pipe: %s", g_strerror (errno));
@@ -252,9 +273,11 @@ gsk_main_loop_poll_base_change     (GskMainLoop           *main_loop,
 		      }
 		    gsk_fd_set_nonblocking (pipe_fds[0]);
 		    gsk_fd_set_nonblocking (pipe_fds[1]);
-		    signal_source = gsk_main_loop_add_io (main_loop, pipe_fds[0], G_IO_IN,
-							  handle_signal_pipe_input, 
-							  GUINT_TO_POINTER (SIGNAL_FDS_INDEX_TO_HIGH_BITS (signal_fd_index)), NULL);
+		    signal_pipe = g_new (SignalPipe, 1);
+		    signal_pipe->high_bits = SIGNAL_FDS_INDEX_TO_HIGH_BITS (signal_fd_index);
+		    signal_pipe->source = gsk_main_loop_add_io (main_loop, pipe_fds[0], G_IO_IN,
+							        handle_signal_pipe_input,
+							        signal_pipe, g_free);
 		    if (signal_fds->len <= signal_fd_index)
 		      {
 			GArray *sfds = g_array_new (FALSE, FALSE, sizeof (int));
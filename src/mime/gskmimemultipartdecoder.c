@@ -215,7 +215,8 @@ feed_buffer_into_feed_stream (GskMimeMultipartDecoder *multipart_decoder)
 
   gboolean terminated = FALSE;
   gboolean at_line_start;
-  char *bdy_tmp;
+  char *bdy_scratch;
+  const guint8 *bdy_tmp = NULL;
   gsk_buffer_iterator_construct (&iterator, &multipart_decoder->buffer);
   if (multipart_decoder->state == STATE_CONTENT_MIDLINE)
     {
@@ -231,14 +232,17 @@ feed_buffer_into_feed_stream (GskMimeMultipartDecoder *multipart_decoder)
   else
     g_return_val_if_reached (FALSE);
   
-  bdy_tmp = g_alloca (multipart_decoder->boundary_str_len + 4 + 1);
+  /* only used if the boundary straddles buffer fragments */
+  bdy_scratch = g_alloca (multipart_decoder->boundary_str_len + 4);
   while (at_line_start)
     {
-      unsigned n_peeked = gsk_buffer_iterator_peek (&iterator, bdy_tmp, multipart_decoder->boundary_str_len + 4);
+      guint n_peeked;
       gboolean could_be_bdy = TRUE;
+      bdy_tmp = gsk_buffer_iterator_peek_contiguous (&iterator,
+                                                     multipart_decoder->boundary_str_len + 4,
+                                                     &n_peeked, bdy_scratch);
       if (n_peeked == 0)
 	break;
-      bdy_tmp[n_peeked] = 0;
       if (n_peeked > 0 && bdy_tmp[0] != '-')
 	could_be_bdy = FALSE;
       if (n_peeked > 1 && bdy_tmp[1] != '-')
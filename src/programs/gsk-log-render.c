@@ -0,0 +1,114 @@
+#include "../gsklogbinary.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_TIME_FORMAT     "%Y-%m-%d %H:%M:%S"
+
+static void
+usage ()
+{
+  g_printerr ("usage: gsk-log-render [OPTIONS] FILES...\n\n"
+              "Print the messages in binary logs written by gsk_log_binary().\n\n"
+              "OPTIONS:\n"
+              "  --gmtime           Print times in GMT rather than local time.\n"
+              "  --time-format=FMT  Print times as per strftime FMT.\n"
+              "  --domain=DOMAIN    Only print messages from DOMAIN.\n"
+             );
+  exit (1);
+}
+
+static const char *
+level_name (GLogLevelFlags level)
+{
+  if (level & G_LOG_LEVEL_ERROR)
+    return "Error";
+  if (level & G_LOG_LEVEL_CRITICAL)
+    return "Critical";
+  if (level & G_LOG_LEVEL_WARNING)
+    return "Warning";
+  if (level & G_LOG_LEVEL_MESSAGE)
+    return "Message";
+  if (level & G_LOG_LEVEL_INFO)
+    return "Info";
+  if (level & G_LOG_LEVEL_DEBUG)
+    return "Debug";
+  return "Unknown";
+}
+
+int main (int argc, char **argv)
+{
+  gboolean use_gmtime = FALSE;
+  const char *time_format = DEFAULT_TIME_FORMAT;
+  const char *domain = NULL;
+  gboolean had_error = FALSE;
+  guint n_files = 0;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    {
+      GskLogBinaryReader *reader;
+      GskLogBinaryMessage message;
+      GError *error = NULL;
+      if (strcmp (argv[i], "--help") == 0)
+        usage ();
+      else if (strcmp (argv[i], "--gmtime") == 0)
+        {
+          use_gmtime = TRUE;
+          continue;
+        }
+      else if (g_str_has_prefix (argv[i], "--time-format="))
+        {
+          time_format = strchr (argv[i], '=') + 1;
+          continue;
+        }
+      else if (g_str_has_prefix (argv[i], "--domain="))
+        {
+          domain = strchr (argv[i], '=') + 1;
+          continue;
+        }
+      else if (argv[i][0] == '-')
+        usage ();
+
+      n_files++;
+      reader = gsk_log_binary_reader_open (argv[i], &error);
+      if (reader == NULL)
+        {
+          g_printerr ("gsk-log-render: %s\n", error->message);
+          g_error_free (error);
+          had_error = TRUE;
+          continue;
+        }
+      while (gsk_log_binary_reader_next (reader, &message, &error))
+        {
+          char buf[256];
+          time_t t = message.time / 1000000;
+          struct tm tm;
+          if (domain != NULL
+           && (message.domain == NULL || strcmp (message.domain, domain) != 0))
+            continue;
+          if (use_gmtime)
+            gmtime_r (&t, &tm);
+          else
+            localtime_r (&t, &tm);
+          if (strftime (buf, sizeof (buf), time_format, &tm) == 0)
+            buf[0] = '\0';
+          printf ("%s.%06u %s: ", buf, (guint) (message.time % 1000000),
+                  level_name (message.level));
+          if (message.domain != NULL)
+            printf ("[%s]: ", message.domain);
+          printf ("%s\n", message.message);
+        }
+      if (error != NULL)
+        {
+          g_printerr ("gsk-log-render: %s\n", error->message);
+          g_error_free (error);
+          had_error = TRUE;
+        }
+      gsk_log_binary_reader_close (reader);
+    }
+  if (n_files == 0)
+    usage ();
+  return had_error ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+#include "../gsklogringbuffer.h"
+#include "../gskinit.h"
+#include <string.h>
+#include <stdio.h>
+
+#define N_THREADS	4
+#define N_EVENTS	1000
+#define RING_SIZE	64
+
+static volatile gint n_done = 0;
+
+static gpointer
+record_events (gpointer data)
+{
+  guint t = GPOINTER_TO_UINT (data);
+  guint i;
+  for (i = 0; i < N_EVENTS; i++)
+    gsk_flight_recorder_event ("test-event", t, i);
+
+  /* an exited thread's ring may be reused:  wait for the others */
+  g_atomic_int_inc (&n_done);
+  while (g_atomic_int_get (&n_done) < N_THREADS)
+    g_usleep (1000);
+  return NULL;
+}
+
+int main (int argc, char **argv)
+{
+  GThread *threads[N_THREADS];
+  guint n_lines = 0;
+  guint last_i[N_THREADS];
+  gboolean seen[N_THREADS];
+  gdouble last_ago = 1e9;
+  char *snapshot, *at;
+  guint i;
+
+  gsk_init (&argc, &argv, NULL);
+
+  /* nothing is recorded until the recorder is on */
+  gsk_flight_recorder_event ("ignored", 0, 0);
+  snapshot = gsk_flight_recorder_snapshot ();
+  g_assert (snapshot[0] == '\0');
+  g_free (snapshot);
+
+  gsk_flight_recorder_init (RING_SIZE);
+  for (i = 0; i < N_THREADS; i++)
+    threads[i] = g_thread_create (record_events, GUINT_TO_POINTER (i), TRUE, NULL);
+  for (i = 0; i < N_THREADS; i++)
+    g_thread_join (threads[i]);
+
+  /* only the latest events of each thread remain,
+     and they are merged oldest first */
+  memset (seen, 0, sizeof (seen));
+  snapshot = gsk_flight_recorder_snapshot ();
+  for (at = snapshot; *at != '\0'; at = strchr (at, '\n') + 1)
+    {
+      gdouble ago;
+      guint serial, t, ev;
+      g_assert (sscanf (at, "-%lf [thread %u] test-event %u %u",
+                        &ago, &serial, &t, &ev) == 4);
+      g_assert (ago <= last_ago);
+      last_ago = ago;
+      g_assert (t < N_THREADS);
+      g_assert (ev >= N_EVENTS - RING_SIZE);
+      if (seen[t])
+        g_assert (ev == last_i[t] + 1);
+      seen[t] = TRUE;
+      last_i[t] = ev;
+      n_lines++;
+    }
+  g_free (snapshot);
+  for (i = 0; i < N_THREADS; i++)
+    g_assert (seen[i] && last_i[i] == N_EVENTS - 1);
+  g_assert (n_lines <= N_THREADS * RING_SIZE);
+
+  return 0;
+}
@@ -21,9 +21,11 @@
 */
 
 #include "../gskbuffer.h"
+#include "../gskbufferscan.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 void random_slice(GskBuffer* buf)
 {
@@ -78,6 +80,94 @@ void decount(GskBuffer* buf, int start, int end)
     }
 }
 
+/* naive searches of flat memory, to check the buffer scanning against */
+static int
+flat_str_index_of (const char *data, guint len, const char *str)
+{
+  guint str_len = strlen (str);
+  guint i;
+  for (i = 0; i + str_len <= len; i++)
+    if (memcmp (data + i, str, str_len) == 0)
+      return i;
+  return -1;
+}
+
+static int
+flat_polystr_index_of (const char *data, guint len, char **strs)
+{
+  guint i;
+  for (i = 0; i < len; i++)
+    {
+      char **at;
+      for (at = strs; *at != NULL; at++)
+        if (i + strlen (*at) <= len && memcmp (data + i, *at, strlen (*at)) == 0)
+          return i;
+    }
+  return -1;
+}
+
+/* Search randomly generated, randomly fragmented buffers
+   with the current scanning implementation. */
+static void
+test_scanning (void)
+{
+  static char *needles[] = { "\r\n\r\n", "ab", "ba", "aab", "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbba", NULL };
+  static char *poly1[] = { "\r\n", "\n\n", NULL };
+  static char *poly2[] = { "abba", "bab", "q", "xyz", NULL };
+  guint iter;
+  for (iter = 0; iter < 300; iter++)
+    {
+      GskBuffer buffer = GSK_BUFFER_STATIC_INIT;
+      guint len = rand () % 300;
+      char *data = g_new (char, len + 1);
+      guint i, n;
+      GskBufferIterator iterator;
+
+      /* a small alphabet makes for lots of partial matches */
+      for (i = 0; i < len; i++)
+        data[i] = "ab\r\nq"[rand () % (iter % 2 ? 2 : 5)];
+      for (i = 0; i < len; i += n)
+        {
+          n = rand () % 70 + 1;
+          if (n > len - i)
+            n = len - i;
+          gsk_buffer_append_foreign (&buffer, data + i, n, NULL, NULL);
+        }
+      for (i = 0; needles[i] != NULL; i++)
+        g_assert (gsk_buffer_str_index_of (&buffer, needles[i])
+                  == flat_str_index_of (data, len, needles[i]));
+      g_assert (gsk_buffer_polystr_index_of (&buffer, poly1)
+                == flat_polystr_index_of (data, len, poly1));
+      g_assert (gsk_buffer_polystr_index_of (&buffer, poly2)
+                == flat_polystr_index_of (data, len, poly2));
+      g_assert (gsk_buffer_index_of (&buffer, 'q')
+                == flat_str_index_of (data, len, "q"));
+      gsk_buffer_iterator_construct (&iterator, &buffer);
+      if (gsk_buffer_iterator_find_char (&iterator, 'q'))
+        g_assert ((int) gsk_buffer_iterator_offset (&iterator)
+                  == flat_str_index_of (data, len, "q"));
+      else
+        g_assert (flat_str_index_of (data, len, "q") == -1);
+      gsk_buffer_destruct (&buffer);
+      g_free (data);
+    }
+}
+
+static void
+increment_uint (gpointer data)
+{
+  ++(*(guint *) data);
+}
+
+static void
+count_recycling_stats (const GskBufferRecyclingStats *stats,
+                       gpointer                       data)
+{
+  g_assert (stats->n_hits <= stats->n_allocs);
+  g_assert (stats->cached_bytes >= stats->n_cached);
+  ++*(guint*)data;
+}
+
 int main(int argc, char** argv)
 {
 
@@ -161,5 +251,180 @@ int main(int argc, char** argv)
     gsk_buffer_destruct (&buffer);
   }
 
+  /* Test scanning with each implementation the CPU supports */
+  {
+    GskBufferScanImpl impl, orig_impl = _gsk_buffer_scan_get_impl ();
+    for (impl = GSK_BUFFER_SCAN_SCALAR; impl <= GSK_BUFFER_SCAN_AVX2; impl++)
+      if (_gsk_buffer_scan_set_impl (impl))
+        test_scanning ();
+    _gsk_buffer_scan_set_impl (orig_impl);
+  }
+
+  /* Test gsk_buffer_read_in_fd */
+  {
+    GskBuffer buffer = GSK_BUFFER_STATIC_INIT;
+    int fds[2];
+    char *data = g_new (char, 50000);
+    char *got = g_new (char, 50000);
+    guint i;
+    for (i = 0; i < 50000; i++)
+      data[i] = 'a' + (i % 26);
+    if (pipe (fds) < 0)
+      g_error ("error creating pipe");
+
+    /* reads are appended to the partially filled last fragment */
+    gsk_buffer_append_string (&buffer, "head:");
+    g_assert (write (fds[1], data, 100) == 100);
+    g_assert (gsk_buffer_read_in_fd (&buffer, fds[0]) == 100);
+    g_assert (buffer.size == 105);
+    g_assert (buffer.first_frag == buffer.last_frag);
+    g_assert (gsk_buffer_read (&buffer, got, 5) == 5);
+    g_assert (memcmp (got, "head:", 5) == 0);
+
+    /* large reads span several fragments */
+    g_assert (write (fds[1], data + 100, 49900) == 49900);
+    while (buffer.size < 50000)
+      g_assert (gsk_buffer_read_in_fd (&buffer, fds[0]) > 0);
+    g_assert (buffer.size == 50000);
+    g_assert (gsk_buffer_read (&buffer, got, 50000) == 50000);
+    g_assert (memcmp (got, data, 50000) == 0);
+
+    /* end-of-file */
+    close (fds[1]);
+    g_assert (gsk_buffer_read_in_fd (&buffer, fds[0]) == 0);
+    g_assert (buffer.size == 0);
+    close (fds[0]);
+    gsk_buffer_destruct (&buffer);
+    g_free (data);
+    g_free (got);
+  }
+
+  /* Test contiguous peeking */
+  {
+    GskBuffer buffer = GSK_BUFFER_STATIC_INIT;
+    GskBufferIterator iterator;
+    char scratch[16];
+    const guint8 *at;
+    guint len;
+    gsk_buffer_append_foreign (&buffer, "hello ", 6, NULL, NULL);
+    gsk_buffer_append_foreign (&buffer, "world", 5, NULL, NULL);
+
+    /* within a fragment, no copy is made */
+    at = gsk_buffer_peek_contiguous (&buffer, 1, 4, scratch);
+    g_assert (at == (const guint8 *) buffer.first_frag->buf + 1);
+    at = gsk_buffer_peek_contiguous (&buffer, 6, 5, scratch);
+    g_assert (at == (const guint8 *) buffer.last_frag->buf);
+
+    /* straddling fragments uses the scratch space */
+    at = gsk_buffer_peek_contiguous (&buffer, 4, 4, scratch);
+    g_assert (at == (const guint8 *) scratch);
+    g_assert (memcmp (at, "o wo", 4) == 0);
+    g_assert (gsk_buffer_peek_contiguous (&buffer, 8, 4, scratch) == NULL);
+    g_assert (buffer.size == 11);
+
+    gsk_buffer_iterator_construct (&iterator, &buffer);
+    gsk_buffer_iterator_skip (&iterator, 2);
+    at = gsk_buffer_iterator_peek_contiguous (&iterator, 3, &len, scratch);
+    g_assert (len == 3 && at == (const guint8 *) buffer.first_frag->buf + 2);
+    at = gsk_buffer_iterator_peek_contiguous (&iterator, 16, &len, scratch);
+    g_assert (len == 9 && at == (const guint8 *) scratch);
+    g_assert (memcmp (at, "llo world", 9) == 0);
+    gsk_buffer_destruct (&buffer);
+  }
+
+  /* Test shared fragments */
+  {
+    GskBuffer buffers[3];
+    GskBuffer tmp = GSK_BUFFER_STATIC_INIT;
+    GskBufferShared *shared;
+    guint destroy_count = 0;
+    char got[64];
+    guint i;
+
+    shared = gsk_buffer_shared_new_foreign ("hello shared world", 18,
+                                            increment_uint, &destroy_count);
+    for (i = 0; i < 3; i++)
+      {
+        gsk_buffer_construct (&buffers[i]);
+        gsk_buffer_append_string (&buffers[i], "<");
+        gsk_buffer_append_shared (&buffers[i], shared, 6, 6);
+        gsk_buffer_append_string (&buffers[i], ">");
+      }
+    gsk_buffer_shared_unref (shared);
+    g_assert (destroy_count == 0);
+
+    /* appends must not write into the shared data */
+    g_assert (buffers[0].last_frag->buf_length == 1);
+    g_assert (gsk_buffer_read (&buffers[0], got, sizeof (got)) == 8);
+    g_assert (memcmp (got, "<shared>", 8) == 0);
+    g_assert (destroy_count == 0);
+
+    /* cloning and transferring slices keep referencing the data */
+    g_assert (gsk_buffer_clone_range (&tmp, &buffers[1], 3, 100) == 5);
+    gsk_buffer_destruct (&buffers[1]);
+    g_assert (gsk_buffer_discard (&buffers[2], 2) == 2);
+    g_assert (gsk_buffer_transfer (&tmp, &buffers[2], 2) == 2);
+    gsk_buffer_destruct (&buffers[2]);
+    g_assert (destroy_count == 0);
+    g_assert (tmp.size == 7);
+    g_assert (gsk_buffer_read (&tmp, got, sizeof (got)) == 7);
+    g_assert (memcmp (got, "ared>ha", 7) == 0);
+    g_assert (destroy_count == 1);
+
+    /* sharing a buffer's contents */
+    gsk_buffer_append_string (&tmp, "abc");
+    gsk_buffer_append_foreign (&tmp, "def", 3, NULL, NULL);
+    shared = gsk_buffer_shared_new_from_buffer (&tmp);
+    g_assert (tmp.size == 0);
+    g_assert (shared->length == 6);
+    g_assert (memcmp (shared->data, "abcdef", 6) == 0);
+    gsk_buffer_shared_unref (shared);
+  }
+
+  /* Test fragment recycling */
+  {
+    GskBuffer buffer = GSK_BUFFER_STATIC_INIT;
+    GskBufferRecyclingStats before, after;
+    guint n_threads = 0;
+    gsk_buffer_cleanup_recycling_bin ();
+    gsk_buffer_get_recycling_stats (&before);
+    g_assert (before.n_cached == 0);
+    g_assert (before.cached_bytes == 0);
+
+    /* enough fragments to overflow the thread's cache */
+    gsk_buffer_append_repeated_char (&buffer, 'x', 4*1024*1024);
+    gsk_buffer_destruct (&buffer);
+    gsk_buffer_get_recycling_stats (&after);
+    g_assert (after.n_cached > 0);
+    g_assert (after.cached_bytes > 0);
+    g_assert (after.n_spills > before.n_spills);
+
+    before = after;
+    gsk_buffer_append_repeated_char (&buffer, 'x', 4*1024*1024);
+    gsk_buffer_destruct (&buffer);
+    gsk_buffer_get_recycling_stats (&after);
+    g_assert (after.n_allocs > before.n_allocs);
+    g_assert (after.n_hits > before.n_hits);
+    g_assert (after.n_refills > before.n_refills);
+    g_assert (after.live_bytes == 0);
+    g_assert (GSK_BUFFER_RECYCLING_STATS_HIT_RATE (&after) > 0.0);
+
+    /* small buffers use small fragments */
+    gsk_buffer_append_string (&buffer, "GET / HTTP/1.1\r\n");
+    g_assert (gsk_buffer_get_wasted_bytes (&buffer)
+              == gsk_buffer_get_fragment_size (0) - buffer.size);
+    gsk_buffer_destruct (&buffer);
+
+    /* ... but buffers appended to piece by piece grow quickly */
+    count (&buffer, 1, 100000);
+    g_assert (gsk_buffer_get_wasted_bytes (&buffer) < buffer.size / 8);
+    decount (&buffer, 1, 100000);
+    gsk_buffer_destruct (&buffer);
+
+    gsk_buffer_recycling_stats_foreach (count_recycling_stats, &n_threads);
+    g_assert (n_threads == 1);
+    gsk_buffer_cleanup_recycling_bin ();
+  }
+
   return 0;
 }
@@ -87,19 +87,20 @@ compare_by_memcmp (guint         test_key_len,
                    const guint8 *test_key,
                    gpointer      compare_data)
 {
+  /* returns the query key <=> test_key */
   GByteArray *array = compare_data;
   if (test_key_len > array->len)
     {
-      int rv = memcmp (test_key, array->data, array->len);
-      return rv ? rv : 1;
+      int rv = memcmp (array->data, test_key, array->len);
+      return rv ? rv : -1;
     }
   else if (test_key_len < array->len)
     {
-      int rv = memcmp (test_key, array->data, test_key_len);
-      return rv ? rv : -1;
+      int rv = memcmp (array->data, test_key, test_key_len);
+      return rv ? rv : 1;
     }
   else
-    return memcmp (test_key, array->data, test_key_len);
+    return memcmp (array->data, test_key, test_key_len);
 }
 
 static void
@@ -128,6 +129,75 @@ query_entries (GskTableFile *file,
   gsk_table_file_query_clear (&query);
 }
 
+/* query every 'step'th entry, checking whether it was found */
+static void
+check_entries_found (GskTableFile *file,
+                     GenKeyValue   gen_kv,
+                     guint         start,
+                     guint         end,
+                     guint         step,
+                     gboolean      expect_found)
+{
+  GByteArray *key = g_byte_array_new ();
+  GByteArray *value = g_byte_array_new ();
+  guint i;
+  GskTableFileQuery query = GSK_TABLE_FILE_QUERY_INIT;
+  GError *error = NULL;
+  query.compare = compare_by_memcmp;
+  query.compare_data = key;
+  query.has_key_hash = TRUE;
+
+  for (i = start; i < end; i += step)
+    {
+      gen_kv (i, key, value);
+      query.key_hash = gsk_table_file_hash_key (key->len, key->data);
+      if (!gsk_table_file_query (file, &query, &error))
+        g_error ("gsk_table_file_query: %s", error->message);
+      g_assert (query.found == expect_found);
+      if (expect_found)
+        g_assert (query.value.len == value->len
+               && memcmp (query.value.data, value->data, value->len) == 0);
+    }
+  g_byte_array_free (key, TRUE);
+  g_byte_array_free (value, TRUE);
+  gsk_table_file_query_clear (&query);
+}
+
+/* query every 'step'th key in ascending order, letting the file
+   start each search where the last ended;  only keys before
+   'n_in_file' should be found */
+static void
+check_entries_ascending (GskTableFile *file,
+                         GenKeyValue   gen_kv,
+                         guint         end,
+                         guint         step,
+                         guint         n_in_file)
+{
+  GByteArray *key = g_byte_array_new ();
+  GByteArray *value = g_byte_array_new ();
+  guint i;
+  GskTableFileQuery query = GSK_TABLE_FILE_QUERY_INIT;
+  GError *error = NULL;
+  query.compare = compare_by_memcmp;
+  query.compare_data = key;
+  query.ascending = TRUE;
+  gsk_table_file_query_restart (&query);
+
+  for (i = 0; i < end; i += step)
+    {
+      gen_kv (i, key, value);
+      if (!gsk_table_file_query (file, &query, &error))
+        g_error ("gsk_table_file_query: %s", error->message);
+      g_assert (query.found == (i < n_in_file));
+      if (query.found)
+        g_assert (query.value.len == value->len
+               && memcmp (query.value.data, value->data, value->len) == 0);
+    }
+  g_byte_array_free (key, TRUE);
+  g_byte_array_free (value, TRUE);
+  gsk_table_file_query_clear (&query);
+}
+
 static void
 finish_file (GskTableFile *file)
 {
@@ -236,6 +306,108 @@ run_test_big (GskTableFileFactory *factory,
     g_error ("gsk_table_file_destroy: %s", error->message);
 }
 
+/* with a filter, every key is still found, and keys not in
+   the file are not (the filter may only give false positives) */
+static void
+run_test_filter (GskTableFileFactory *factory,
+                 const char          *dir,
+                 guint64              id)
+{
+  GskTableFile *file;
+  GskTableFileHints hints = GSK_TABLE_FILE_HINTS_DEFAULTS;
+  GError *error = NULL;
+  guint n = 100*1000;
+
+  hints.max_entries = n;
+  hints.filter_false_positive_rate = 0.01;
+  file = gsk_table_file_factory_create_file (factory, dir, id, &hints, &error);
+  if (file == NULL)
+    g_error ("gsk_table_file_factory_create_file: %s", error->message);
+  inject_entries (file, gen_kv_0, 0, n);
+  finish_file (file);
+  check_entries_found (file, gen_kv_0, 0, n, 7, TRUE);
+  check_entries_found (file, gen_kv_0, n, 2 * n, 7, FALSE);
+
+  if (!gsk_table_file_destroy (file, dir, FALSE, &error))
+    g_error ("gsk_table_file_destroy: %s", error->message);
+  file = gsk_table_file_factory_open_file (factory, dir, id, &error);
+  if (file == NULL)
+    g_error ("gsk_table_file_factory_open_file: %s", error->message);
+  check_entries_found (file, gen_kv_0, 0, n, 1, TRUE);
+  check_entries_found (file, gen_kv_0, n, 2 * n, 1, FALSE);
+
+  if (!gsk_table_file_destroy (file, dir, TRUE, &error))
+    g_error ("gsk_table_file_destroy: %s", error->message);
+}
+
+/* querying the same chunk twice decompresses it once,
+   unless the cache is disabled */
+static void
+run_test_cache (GskTableFileFactory *factory,
+                const char          *dir,
+                guint64              id)
+{
+  GskTableFile *file;
+  GskTableFileHints hints = GSK_TABLE_FILE_HINTS_DEFAULTS;
+  GskTableCacheStats stats, stats2;
+  GError *error = NULL;
+  guint n = 10*1000;
+
+  file = gsk_table_file_factory_create_file (factory, dir, id, &hints, &error);
+  if (file == NULL)
+    g_error ("gsk_table_file_factory_create_file: %s", error->message);
+  inject_entries (file, gen_kv_0, 0, n);
+  finish_file (file);
+
+  gsk_table_get_cache_stats (&stats);
+  check_entries_found (file, gen_kv_0, 5000, 5001, 1, TRUE);
+  check_entries_found (file, gen_kv_0, 5000, 5001, 1, TRUE);
+  gsk_table_get_cache_stats (&stats2);
+  g_assert (stats2.n_hits > stats.n_hits);
+  g_assert (stats2.n_bytes <= stats2.max_bytes);
+
+  /* a full scan stays within the bound */
+  gsk_table_set_cache_max_bytes (64*1024);
+  check_entries_found (file, gen_kv_0, 0, n, 1, TRUE);
+  gsk_table_get_cache_stats (&stats);
+  g_assert (stats.n_bytes <= 64*1024);
+
+  gsk_table_set_cache_max_bytes (0);
+  gsk_table_get_cache_stats (&stats);
+  g_assert (stats.n_chunks == 0 && stats.n_bytes == 0);
+  check_entries_found (file, gen_kv_0, 5000, 5001, 1, TRUE);
+  check_entries_found (file, gen_kv_0, 5000, 5001, 1, TRUE);
+  gsk_table_get_cache_stats (&stats2);
+  g_assert (stats2.n_hits == stats.n_hits);
+  g_assert (stats2.n_chunks == 0);
+
+  if (!gsk_table_file_destroy (file, dir, TRUE, &error))
+    g_error ("gsk_table_file_destroy: %s", error->message);
+}
+
+static void
+run_test_ascending (GskTableFileFactory *factory,
+                    const char          *dir,
+                    guint64              id)
+{
+  GskTableFile *file;
+  GskTableFileHints hints = GSK_TABLE_FILE_HINTS_DEFAULTS;
+  GError *error = NULL;
+  guint n = 100*1000;
+
+  file = gsk_table_file_factory_create_file (factory, dir, id, &hints, &error);
+  if (file == NULL)
+    g_error ("gsk_table_file_factory_create_file: %s", error->message);
+  inject_entries (file, gen_kv_0, 0, n);
+  finish_file (file);
+  check_entries_ascending (file, gen_kv_0, n + 100, 1, n);
+  check_entries_ascending (file, gen_kv_0, n + 100, 37, n);
+  check_entries_ascending (file, gen_kv_0, n + 5000, 1001, n);
+
+  if (!gsk_table_file_destroy (file, dir, TRUE, &error))
+    g_error ("gsk_table_file_destroy: %s", error->message);
+}
+
 int
 main(int    argc,
      char **argv)
@@ -256,6 +428,18 @@ main(int    argc,
   run_test_big (factory, dir, 1001);
   g_printerr ("done.\n");
 
+  g_printerr ("running filter test... ");
+  run_test_filter (factory, dir, 1002);
+  g_printerr ("done.\n");
+
+  g_printerr ("running cache test... ");
+  run_test_cache (factory, dir, 1003);
+  g_printerr ("done.\n");
+
+  g_printerr ("running ascending query test... ");
+  run_test_ascending (factory, dir, 1004);
+  g_printerr ("done.\n");
+
   if (rmdir (dir) < 0)
     g_error ("rmdir(%s) failed: %s", dir, g_strerror (errno));
   g_free (dir);
@@ -13,6 +13,9 @@ static const char *input = NULL;
 static gboolean create = FALSE;
 static gboolean existing = FALSE;
 static gboolean no_close = FALSE;
+static gboolean background_merging = FALSE;
+static gint batch_size = 0;
+static gint max_in_memory_entries = 0;
 
 static gboolean
 print_op_modes_handler (const gchar    *option_name,
@@ -22,7 +25,9 @@ print_op_modes_handler (const gchar    *option_name,
 {
   g_printerr ("operation modes:\n");
   g_printerr ("  replacement         Setting a key's value twice\n"
-              "                      overrides the old value.\n");
+              "                      overrides the old value.\n"
+              "  concatenation       Setting a key's value twice\n"
+              "                      appends the new value to the old.\n");
   exit (1);
 }
 static gboolean
@@ -60,6 +65,12 @@ static GOptionEntry op_entries[] =
     "open an existing table; abort if it does not exist", NULL },
   { "no-close", 0, 0, G_OPTION_ARG_NONE, &no_close,
     "do not cleanup when done", NULL },
+  { "background-merging", 0, 0, G_OPTION_ARG_NONE, &background_merging,
+    "merge files in a background thread", NULL },
+  { "batch-size", 0, 0, G_OPTION_ARG_INT, &batch_size,
+    "add entries in batches of N", "N" },
+  { "max-in-memory-entries", 0, 0, G_OPTION_ARG_INT, &max_in_memory_entries,
+    "flush the in-memory tree every N entries", "N" },
   { "help-op-modes", 0, G_OPTION_FLAG_NO_ARG,
     G_OPTION_ARG_CALLBACK, print_op_modes_handler,
     "print the operation modes and exit", NULL },
@@ -142,6 +153,36 @@ parse_hex (const char *line,
   return TRUE;
 }
 
+/* the order of a and b matters here, unlike for replacement */
+static GskTableMergeResult
+merge_concatenate (guint         key_len,
+                   const guint8 *key_data,
+                   guint         a_len,
+                   const guint8 *a_data,
+                   guint         b_len,
+                   const guint8 *b_data,
+                   GskTableBuffer *output,
+                   gpointer      user_data)
+{
+  guint8 *out = gsk_table_buffer_set_len (output, a_len + b_len);
+  memcpy (out, a_data, a_len);
+  memcpy (out + a_len, b_data, b_len);
+  return GSK_TABLE_MERGE_SUCCESS;
+}
+
+/* write out the adds queued up in the batch */
+static void
+flush_batch (GskTable           *table,
+             GskTableWriteBatch *batch)
+{
+  GError *error = NULL;
+  if (batch == NULL || gsk_table_write_batch_get_n_entries (batch) == 0)
+    return;
+  if (!gsk_table_write (table, batch, FALSE, &error))
+    g_error ("gsk_table_write failed: %s", error->message);
+  gsk_table_write_batch_clear (batch);
+}
+
 int main(int argc, char **argv)
 {
   GOptionContext *context;
@@ -149,9 +190,18 @@ int main(int argc, char **argv)
   GskTableNewFlags new_flags = GSK_TABLE_MAY_EXIST|GSK_TABLE_MAY_CREATE;
   GError *error = NULL;
   GskTable *table = NULL;
+  GskTableWriteBatch *batch = NULL;
   FILE *input_fp;
+  gint i;
 
-  gsk_init_without_threads (&argc,&argv);
+  /* only background merging needs threads */
+  for (i = 1; i < argc; i++)
+    if (strcmp (argv[i], "--background-merging") == 0)
+      break;
+  if (i < argc)
+    gsk_init (&argc, &argv, NULL);
+  else
+    gsk_init_without_threads (&argc, &argv);
 
   context = g_option_context_new ("test-gsktable-prog");
   g_option_context_add_main_entries (context, op_entries, NULL);
@@ -174,12 +224,23 @@ int main(int argc, char **argv)
       if (strcmp (io_mode, "default") == 0)
         io_mode = "cmd_prefixed_hex";
     }
+  else if (strcmp (op_mode, "concatenation") == 0)
+    {
+      options->merge = merge_concatenate;
+      if (strcmp (io_mode, "default") == 0)
+        io_mode = "cmd_prefixed_hex";
+    }
   else
     g_error ("unknown operations mode '%s'", op_mode);
+  options->background_merging = background_merging;
+  if (max_in_memory_entries > 0)
+    options->max_in_memory_entries = max_in_memory_entries;
 
   table = gsk_table_new (dir, options, new_flags, &error);
   if (table == NULL)
     g_error ("gsk_table_new() failed: %s", error->message);
+  if (batch_size > 0)
+    batch = gsk_table_write_batch_new ();
 
   if (input == NULL || strcmp (input, "-") == 0)
     input_fp = stdin;
@@ -210,6 +271,7 @@ int main(int argc, char **argv)
                 if (!parse_hex (line+1, 1, data, &error))
                   g_error ("error line %u parsing query binary data: %s",
                            lineno, error->message);
+                flush_batch (table, batch);
                 if (!gsk_table_query (table, data[0].len, data[0].data,
                                       &found, &value_len, &value_data,
                                       &error))
@@ -230,8 +292,15 @@ int main(int argc, char **argv)
               if (!parse_hex (line+1, 2, data, &error))
                 g_error ("error line %u parsing add binary data: %s",
                          lineno, error->message);
-              if (!gsk_table_add (table, data[0].len, data[0].data,
-                                  data[1].len, data[1].data, &error))
+              if (batch != NULL)
+                {
+                  gsk_table_write_batch_add (batch, data[0].len, data[0].data,
+                                             data[1].len, data[1].data);
+                  if (gsk_table_write_batch_get_n_entries (batch) == (guint) batch_size)
+                    flush_batch (table, batch);
+                }
+              else if (!gsk_table_add (table, data[0].len, data[0].data,
+                                       data[1].len, data[1].data, &error))
                 g_error ("gsk_table_add failed: %s", error->message);
               g_free (data[0].data);
               g_free (data[1].data);
@@ -251,6 +320,7 @@ int main(int argc, char **argv)
                 if (!parse_hex (line+2, should_exist ? 2 : 1, data, &error))
                   g_error ("error line %u parsing assert binary data: %s",
                            lineno, error->message);
+                flush_batch (table, batch);
                 if (!gsk_table_query (table, data[0].len, data[0].data,
                                       &found, &value_len, &value_data,
                                       &error))
@@ -287,6 +357,9 @@ int main(int argc, char **argv)
   else
     g_error ("unknown io_mode %s", io_mode);
 
+  flush_batch (table, batch);
+  if (batch != NULL)
+    gsk_table_write_batch_free (batch);
   if (!no_close)
     gsk_table_destroy (table);
 
@@ -0,0 +1,162 @@
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "../gsktable.h"
+#include "../gskutils.h"
+#include "../gskinit.h"
+
+/* gsk_table_query_many() must give what gsk_table_query() gives
+   for each key, in the order the keys were given.  Flush the tree
+   every few entries, so that the keys are spread over the tree,
+   several files and the merge tasks running between them;
+   the values hardly compress, so that the merges' outputs
+   are queryable before the merges finish. */
+#define N_ADDS                  20000
+#define N_KEYS                  5000
+#define N_QUERY_KEYS            200
+#define MAX_IN_MEMORY_ENTRIES   32
+
+/* the order of a and b matters here, unlike for replacement */
+static GskTableMergeResult
+merge_concatenate (guint         key_len,
+                   const guint8 *key_data,
+                   guint         a_len,
+                   const guint8 *a_data,
+                   guint         b_len,
+                   const guint8 *b_data,
+                   GskTableBuffer *output,
+                   gpointer      user_data)
+{
+  guint8 *out = gsk_table_buffer_set_len (output, a_len + b_len);
+  memcpy (out, a_data, a_len);
+  memcpy (out + a_len, b_data, b_len);
+  return GSK_TABLE_MERGE_SUCCESS;
+}
+
+/* keys are queried unsorted, some of them twice,
+   and some are not in the table at all */
+static guint
+pick_query_key (guint round, guint j)
+{
+  guint base = (round * 337) % N_KEYS;
+  switch (j % 4)
+    {
+    case 0: return base + j;                            /* clustered */
+    case 1: return (j * 2654435761u) % (N_KEYS + 100);  /* scattered */
+    case 2: return base;                                /* duplicated */
+    default: return N_KEYS + j;                         /* missing */
+    }
+}
+
+static void
+check_query_many (GskTable *table,
+                  guint     round)
+{
+  guint32 keys[N_QUERY_KEYS];
+  guint key_lens[N_QUERY_KEYS];
+  const guint8 *key_datas[N_QUERY_KEYS];
+  gboolean found[N_QUERY_KEYS];
+  guint value_lens[N_QUERY_KEYS];
+  guint8 *value_datas[N_QUERY_KEYS];
+  GError *error = NULL;
+  guint j;
+
+  for (j = 0; j < N_QUERY_KEYS; j++)
+    {
+      keys[j] = GUINT32_TO_BE (pick_query_key (round, j));
+      key_lens[j] = 4;
+      key_datas[j] = (const guint8 *) (keys + j);
+    }
+  if (!gsk_table_query_many (table, N_QUERY_KEYS, key_lens, key_datas,
+                             found, value_lens, value_datas, &error))
+    g_error ("gsk_table_query_many: %s", error->message);
+
+  for (j = 0; j < N_QUERY_KEYS; j++)
+    {
+      gboolean one_found;
+      guint one_value_len;
+      guint8 *one_value_data = NULL;
+      if (!gsk_table_query (table, 4, key_datas[j],
+                            &one_found, &one_value_len, &one_value_data,
+                            &error))
+        g_error ("gsk_table_query: %s", error->message);
+      if (found[j] != one_found)
+        g_error ("round %u, key %u: query_many found=%u, query found=%u",
+                 round, GUINT32_FROM_BE (keys[j]), found[j], one_found);
+      if (one_found)
+        {
+          g_assert (value_lens[j] == one_value_len);
+          g_assert (memcmp (value_datas[j], one_value_data, one_value_len) == 0);
+        }
+      else
+        g_assert (value_datas[j] == NULL);
+      g_free (one_value_data);
+      g_free (value_datas[j]);
+    }
+}
+
+static void
+run_test (gboolean concatenate,
+          gboolean background_merging)
+{
+  GskTableOptions *options;
+  GskTable *table;
+  GError *error = NULL;
+  char *dir;
+  guint i;
+
+  dir = g_strdup_printf ("test-gsktable-query-many-%u", (guint) getpid ());
+  options = gsk_table_options_new ();
+  if (concatenate)
+    options->merge = merge_concatenate;
+  else
+    gsk_table_options_set_replacement_semantics (options);
+  options->background_merging = background_merging;
+  options->max_in_memory_entries = MAX_IN_MEMORY_ENTRIES;
+
+  table = gsk_table_new (dir, options, GSK_TABLE_MAY_CREATE, &error);
+  if (table == NULL)
+    g_error ("gsk_table_new: %s", error->message);
+  for (i = 0; i < N_ADDS; i++)
+    {
+      guint32 key = GUINT32_TO_BE ((i * 7919) % N_KEYS);
+      guint32 value[2];
+      value[0] = i * 2654435761u;
+      value[1] = (i ^ 0x5bd1e995) * 0x9e3779b9u;
+      if (!gsk_table_add (table, 4, (const guint8 *) &key,
+                          sizeof (value), (const guint8 *) value, &error))
+        g_error ("gsk_table_add: %s", error->message);
+
+      /* query at odd points, so that the tree is seldom empty */
+      if (i % 97 == 0)
+        check_query_many (table, i);
+    }
+  check_query_many (table, N_ADDS);
+  gsk_table_destroy (table);
+
+  gsk_table_options_destroy (options);
+  if (!gsk_rm_rf (dir, &error))
+    g_error ("error deleting %s: %s", dir, error->message);
+  g_free (dir);
+}
+
+int main (int argc, char **argv)
+{
+  gsk_init (&argc, &argv, NULL);
+
+  g_printerr ("running replacement test... ");
+  run_test (FALSE, FALSE);
+  g_printerr ("done.\n");
+
+  g_printerr ("running concatenation test... ");
+  run_test (TRUE, FALSE);
+  g_printerr ("done.\n");
+
+  if (gsk_init_get_support_threads ())
+    {
+      g_printerr ("running background merging test... ");
+      run_test (TRUE, TRUE);
+      g_printerr ("done.\n");
+    }
+  return 0;
+}
@@ -0,0 +1,132 @@
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "../gsktable.h"
+#include "../gskutils.h"
+#include "../gskinit.h"
+
+/* several threads write batches at once, so that their writes
+   are committed in groups, with the tree flushed and the journal
+   reset in the middle of batches */
+#define N_WRITERS               4
+#define N_ENTRIES_PER_WRITER    3000
+#define BATCH_SIZE              16
+#define MAX_IN_MEMORY_ENTRIES   64
+
+static GskTable *table;
+
+static void
+make_key_value (guint    index,
+                guint32 *key_out,
+                char    *value_buf)
+{
+  *key_out = GUINT32_TO_BE (index);
+  g_snprintf (value_buf, 32, "value-%u", index);
+}
+
+static gpointer
+writer_thread (gpointer data)
+{
+  guint writer = GPOINTER_TO_UINT (data);
+  GskTableWriteBatch *batch = gsk_table_write_batch_new ();
+  GError *error = NULL;
+  guint i;
+  for (i = 0; i < N_ENTRIES_PER_WRITER; i++)
+    {
+      guint32 key;
+      char value[32];
+      make_key_value (i * N_WRITERS + writer, &key, value);
+      gsk_table_write_batch_add (batch, 4, (const guint8 *) &key,
+                                 strlen (value), (const guint8 *) value);
+      if (gsk_table_write_batch_get_n_entries (batch) == BATCH_SIZE
+       || i + 1 == N_ENTRIES_PER_WRITER)
+        {
+          /* some writers ask for their batches to be synced */
+          gboolean sync = (writer % 2 == 0);
+          if (!gsk_table_write (table, batch, sync, &error))
+            g_error ("gsk_table_write: %s", error->message);
+          gsk_table_write_batch_clear (batch);
+        }
+    }
+  gsk_table_write_batch_free (batch);
+  return NULL;
+}
+
+static void
+check_table (void)
+{
+  GError *error = NULL;
+  guint i;
+  for (i = 0; i < N_WRITERS * N_ENTRIES_PER_WRITER + 1; i++)
+    {
+      guint32 key;
+      char value[32];
+      gboolean found;
+      guint value_len;
+      guint8 *value_data;
+      make_key_value (i, &key, value);
+      if (!gsk_table_query (table, 4, (const guint8 *) &key,
+                            &found, &value_len, &value_data, &error))
+        g_error ("gsk_table_query: %s", error->message);
+      if (i == N_WRITERS * N_ENTRIES_PER_WRITER)
+        {
+          g_assert (!found);
+          continue;
+        }
+      if (!found)
+        g_error ("key %u not found", i);
+      g_assert (value_len == strlen (value));
+      g_assert (memcmp (value_data, value, value_len) == 0);
+      g_free (value_data);
+    }
+}
+
+int main (int argc, char **argv)
+{
+  GskTableOptions *options;
+  GThread *threads[N_WRITERS];
+  GError *error = NULL;
+  char *dir;
+  guint i;
+
+  gsk_init (&argc, &argv, NULL);
+  if (!gsk_init_get_support_threads ())
+    {
+      g_printerr ("test-gsktable-write: no thread support; skipping\n");
+      return 0;
+    }
+
+  dir = g_strdup_printf ("test-gsktable-write-%u", (guint) getpid ());
+  options = gsk_table_options_new ();
+  gsk_table_options_set_replacement_semantics (options);
+  options->background_merging = TRUE;
+  options->max_in_memory_entries = MAX_IN_MEMORY_ENTRIES;
+
+  table = gsk_table_new (dir, options, GSK_TABLE_MAY_CREATE, &error);
+  if (table == NULL)
+    g_error ("gsk_table_new: %s", error->message);
+  for (i = 0; i < N_WRITERS; i++)
+    {
+      threads[i] = g_thread_create (writer_thread, GUINT_TO_POINTER (i),
+                                    TRUE, &error);
+      if (threads[i] == NULL)
+        g_error ("g_thread_create: %s", error->message);
+    }
+  for (i = 0; i < N_WRITERS; i++)
+    g_thread_join (threads[i]);
+  check_table ();
+  gsk_table_destroy (table);
+
+  /* everything comes back from the files and the journal */
+  table = gsk_table_new (dir, options, GSK_TABLE_MAY_EXIST, &error);
+  if (table == NULL)
+    g_error ("reopening table: %s", error->message);
+  check_table ();
+  gsk_table_destroy (table);
+
+  gsk_table_options_destroy (options);
+  if (!gsk_rm_rf (dir, &error))
+    g_error ("error deleting %s: %s", dir, error->message);
+  g_free (dir);
+  return 0;
+}
@@ -0,0 +1,163 @@
+#include "../http/gskhttpserver.h"
+#include "../gskinit.h"
+#include <string.h>
+#include <stdlib.h>
+
+/* GskHttpServer parses each request into its response's memory pool:
+   header lines should cost next to no allocations of their own.
+   Requests with and without many header lines are parsed,
+   by the server and by gsk_http_header_from_buffer(),
+   counting the allocations made for the extra lines. */
+#define N_MISC_LINES    20
+
+static guint n_allocs = 0;
+
+static gpointer
+counting_malloc (gsize n_bytes)
+{
+  n_allocs++;
+  return malloc (n_bytes);
+}
+
+static gpointer
+counting_realloc (gpointer mem, gsize n_bytes)
+{
+  if (mem == NULL)
+    n_allocs++;
+  return realloc (mem, n_bytes);
+}
+
+static GMemVTable counting_vtable =
+{
+  counting_malloc,
+  counting_realloc,
+  free,
+  NULL,
+  NULL,
+  NULL
+};
+
+static char *
+make_request_text (gboolean many_lines)
+{
+  GString *str = g_string_new ("GET /some/path/to/a/page.html?q=1 HTTP/1.1\r\n"
+                               "Host: localhost\r\n");
+  guint i;
+  if (many_lines)
+    {
+      g_string_append (str, "Accept-Charset: iso-8859-5, unicode-1-1;q=0.8, utf-8\r\n"
+                            "Accept-Language: da, en-gb;q=0.8, en;q=0.7\r\n"
+                            "Accept: text/*;q=0.3, text/html;q=0.7, */*\r\n");
+      for (i = 0; i < N_MISC_LINES; i++)
+        g_string_append_printf (str, "X-Misc-%u: value number %u\r\n", i, i);
+    }
+  g_string_append (str, "\r\n");
+  return g_string_free (str, FALSE);
+}
+
+static void
+check_request (GskHttpRequest *request,
+               gboolean        many_lines)
+{
+  g_assert (strcmp (request->path, "/some/path/to/a/page.html?q=1") == 0);
+  if (many_lines)
+    {
+      g_assert (strcmp (request->accept_charsets->next->charset_name, "unicode-1-1") == 0);
+      g_assert (strcmp (request->accept_languages->next->language, "en-gb") == 0);
+      g_assert (strcmp (request->accept_media_types->next->subtype, "html") == 0);
+      g_assert (strcmp (gsk_http_header_lookup_misc (GSK_HTTP_HEADER (request), "x-misc-7"),
+                        "value number 7") == 0);
+    }
+}
+
+/* returns the number of allocations made while parsing */
+static guint
+parse_with_server (gboolean many_lines)
+{
+  GskHttpServer *server = gsk_http_server_new ();
+  GskHttpRequest *request;
+  GskHttpResponse *response;
+  GskStream *post_data;
+  GskBuffer output = GSK_BUFFER_STATIC_INIT;
+  GError *error = NULL;
+  char *text = make_request_text (many_lines);
+  guint len = strlen (text);
+  guint n_allocs_before;
+  guint rv;
+
+  n_allocs_before = n_allocs;
+  g_assert (gsk_stream_write (GSK_STREAM (server), text, len, &error) == len);
+  g_assert (error == NULL);
+  g_assert (gsk_http_server_get_request (server, &request, &post_data));
+  rv = n_allocs - n_allocs_before;
+  g_assert (post_data == NULL);
+  check_request (request, many_lines);
+
+  /* finish the response while the request is still referenced:
+     its fields must be copied out of the pool */
+  response = gsk_http_response_from_request (request, GSK_HTTP_STATUS_OK, 0);
+  gsk_http_server_respond (server, request, response, NULL);
+  g_object_unref (response);
+  while (gsk_stream_read_buffer (GSK_STREAM (server), &output, &error) > 0)
+    ;
+  g_assert (error == NULL);
+  g_assert (output.size > 0);
+  check_request (request, many_lines);
+
+  gsk_buffer_destruct (&output);
+  g_object_unref (request);
+  g_object_unref (server);
+  g_free (text);
+  return rv;
+}
+
+static guint
+parse_with_header_from_buffer (gboolean many_lines)
+{
+  GskBuffer input = GSK_BUFFER_STATIC_INIT;
+  GskHttpHeader *header;
+  GError *error = NULL;
+  char *text = make_request_text (many_lines);
+  guint n_allocs_before;
+  guint rv;
+
+  gsk_buffer_append_string (&input, text);
+  n_allocs_before = n_allocs;
+  header = gsk_http_header_from_buffer (&input, TRUE, 0, &error);
+  rv = n_allocs - n_allocs_before;
+  g_assert (header != NULL);
+  check_request (GSK_HTTP_REQUEST (header), many_lines);
+
+  g_object_unref (header);
+  gsk_buffer_destruct (&input);
+  g_free (text);
+  return rv;
+}
+
+int main (int argc, char **argv)
+{
+  gint server_cost, unpooled_cost;
+
+  g_mem_set_vtable (&counting_vtable);
+  gsk_init_without_threads (&argc, &argv);
+
+  /* warm up the type system and the allocators */
+  parse_with_server (TRUE);
+  parse_with_header_from_buffer (TRUE);
+
+  unpooled_cost = (gint) parse_with_header_from_buffer (TRUE)
+                - (gint) parse_with_header_from_buffer (FALSE);
+  server_cost = (gint) parse_with_server (TRUE)
+              - (gint) parse_with_server (FALSE);
+  g_printerr ("allocations for the extra header lines: "
+              "server %d, gsk_http_header_from_buffer %d\n",
+              server_cost, unpooled_cost);
+  if (unpooled_cost == 0)
+    {
+      g_message ("allocations cannot be counted: skipping test");
+      return 0;
+    }
+  g_assert (unpooled_cost >= 2 * N_MISC_LINES);
+  g_assert (server_cost * 10 <= unpooled_cost);
+  return 0;
+}
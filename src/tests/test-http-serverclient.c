@@ -18,6 +18,9 @@ static GskBuffer       client_content = GSK_BUFFER_STATIC_INIT;
 static gboolean        has_response_content;
 static gboolean        client_got_response = FALSE;
 
+/* longer than the stack buffers in gskhttpserver.c */
+#define LONG_LINE_LENGTH	6000
+
 #if 0
 #define DEBUG g_message
 #else
@@ -49,6 +52,7 @@ handle_server_trap (GskHttpServer *server,
   g_assert (!server_got_request);
   g_assert (server_request == NULL);
   g_assert (gsk_http_server_get_request (server, &server_request, &server_post_content));
+  g_assert (gsk_mem_pool_strdup (gsk_http_server_peek_request_pool (server, server_request), "/") != NULL);
   had_post_content = (server_post_content != NULL);
   gsk_buffer_destruct (&post_content_buffer);
 
@@ -278,6 +282,59 @@ int main(int argc, char **argv)
 	}
     }
 
+  /* Test a request line and header lines too long for the
+     server's stack buffer, which it copies into the request's pool */
+  {
+    char *long_path = g_malloc (LONG_LINE_LENGTH + 2);
+    char *long_agent = g_malloc (LONG_LINE_LENGTH + 1);
+    char *long_misc = g_malloc (2 * LONG_LINE_LENGTH + 1);
+    GskMemPool *pool;
+    char *copy;
+    new_client_server ();
+
+    g_printerr ("GET with long request and header lines... ");
+    long_path[0] = '/';
+    memset (long_path + 1, 'p', LONG_LINE_LENGTH);
+    long_path[LONG_LINE_LENGTH + 1] = '\0';
+    memset (long_agent, 'a', LONG_LINE_LENGTH);
+    long_agent[LONG_LINE_LENGTH] = '\0';
+    for (i = 0; i < 2 * LONG_LINE_LENGTH; i++)
+      long_misc[i] = 'A' + i % 26;
+    long_misc[2 * LONG_LINE_LENGTH] = '\0';
+
+    client_request = gsk_http_request_new (GSK_HTTP_VERB_GET, long_path);
+    gsk_http_request_set_user_agent (client_request, long_agent);
+    gsk_http_header_add_misc (GSK_HTTP_HEADER (client_request), "X-Long", long_misc);
+    gsk_http_client_request (client, client_request, NULL, client_handle_server_response, NULL, NULL);
+    g_object_unref (client_request);
+    while (!server_got_request)
+      gsk_main_loop_run (loop, -1, NULL);
+    g_assert (server_request->verb == GSK_HTTP_VERB_GET);
+    g_assert (strcmp (server_request->path, long_path) == 0);
+    g_assert (strcmp (gsk_http_request_peek_user_agent (server_request), long_agent) == 0);
+    g_assert (strcmp (gsk_http_header_lookup_misc (GSK_HTTP_HEADER (server_request), "x-long"), long_misc) == 0);
+
+    /* handlers may use the pool too */
+    pool = gsk_http_server_peek_request_pool (server, server_request);
+    copy = gsk_mem_pool_strdup (pool, long_misc);
+    g_assert (strcmp (copy, long_misc) == 0);
+
+    response = gsk_http_response_from_request (server_request, GSK_HTTP_STATUS_OK, 0);
+    gsk_http_server_respond (server, server_request, response, NULL);
+    g_object_unref (response);
+    response = NULL;
+    while (!client_got_response)
+      gsk_main_loop_run (loop, -1, NULL);
+    g_assert (client_response->status_code == GSK_HTTP_STATUS_OK);
+    g_assert (gsk_http_client_is_requestable (client));
+    reset_transaction ();
+    g_free (long_path);
+    g_free (long_agent);
+    g_free (long_misc);
+    g_printerr ("Ok.\n");
+    clear_client_server ();
+  }
+
   /* Test HEAD request */
   {
     static GskHttpStatus codes[2] = { 200, 404 };
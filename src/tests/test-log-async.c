@@ -0,0 +1,87 @@
+#include "../gsklog.h"
+#include "../gskinit.h"
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define N_THREADS	4
+#define N_MESSAGES	10000
+
+static gpointer
+log_messages (gpointer data)
+{
+  guint t = GPOINTER_TO_UINT (data);
+  guint i;
+  for (i = 0; i < N_MESSAGES; i++)
+    gsk_message ("test-log-async", "thread %u message %u", t, i);
+  return NULL;
+}
+
+static void
+log_from_threads (void)
+{
+  GThread *threads[N_THREADS];
+  guint i;
+  for (i = 0; i < N_THREADS; i++)
+    threads[i] = g_thread_create (log_messages, GUINT_TO_POINTER (i), TRUE, NULL);
+  for (i = 0; i < N_THREADS; i++)
+    g_thread_join (threads[i]);
+}
+
+int main (int argc, char **argv)
+{
+  char filename[] = "/tmp/test-log-async-XXXXXX";
+  guint next[N_THREADS];
+  char line[256];
+  guint n_lines = 0;
+  FILE *fp;
+  int fd;
+
+  gsk_init (&argc, &argv, NULL);
+
+  fd = mkstemp (filename);
+  g_assert (fd >= 0);
+  close (fd);
+  g_assert (gsk_log_trap_domain_to_file ("test-log-async", G_LOG_LEVEL_MESSAGE,
+                                         filename, "%{localtime} %{message}") != NULL);
+  gsk_message ("test-log-async", "before async mode");
+
+  /* a small ring, so that the loggers have to wait for the writer */
+  gsk_log_set_async (16, GSK_LOG_OVERFLOW_BLOCK);
+  log_from_threads ();
+  gsk_log_flush ();
+  g_assert (gsk_log_get_n_dropped () == 0);
+  gsk_log_set_async (0, GSK_LOG_OVERFLOW_BLOCK);
+
+  /* every message is there, in order for each thread */
+  memset (next, 0, sizeof (next));
+  fp = fopen (filename, "r");
+  g_assert (fp != NULL);
+  while (fgets (line, sizeof (line), fp) != NULL)
+    {
+      const char *msg = strstr (line, "thread ");
+      guint t, i;
+      n_lines++;
+      if (n_lines == 1)
+        {
+          g_assert (strstr (line, "before async mode") != NULL);
+          continue;
+        }
+      g_assert (msg != NULL);
+      g_assert (sscanf (msg, "thread %u message %u", &t, &i) == 2);
+      g_assert (t < N_THREADS);
+      g_assert (i == next[t]);
+      next[t]++;
+    }
+  fclose (fp);
+  g_assert (n_lines == N_THREADS * N_MESSAGES + 1);
+
+  /* a tiny ring:  messages may be dropped, but logging never waits */
+  gsk_log_set_async (1, GSK_LOG_OVERFLOW_COUNT);
+  log_from_threads ();
+  gsk_log_flush ();
+  gsk_log_set_async (0, GSK_LOG_OVERFLOW_BLOCK);
+
+  unlink (filename);
+  return 0;
+}
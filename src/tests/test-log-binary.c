@@ -0,0 +1,111 @@
+#include "../gsklogbinary.h"
+#include "../gskinit.h"
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define MAX_MESSAGES	16
+
+static char *expected[MAX_MESSAGES];
+static const char *expected_domains[MAX_MESSAGES];
+static guint n_expected = 0;
+
+/* log a message, and remember how it should be rendered */
+#define LOG_AND_EXPECT(domain, ...)                                     \
+  G_STMT_START{                                                         \
+    gsk_log_binary (domain, G_LOG_LEVEL_MESSAGE, __VA_ARGS__);          \
+    expected_domains[n_expected] = domain;                              \
+    expected[n_expected++] = g_strdup_printf (__VA_ARGS__);             \
+  }G_STMT_END
+
+static void
+log_messages (void)
+{
+  LOG_AND_EXPECT ("test-a", "hello %d %s %5.2f %%", 42, "world", 3.14159);
+  LOG_AND_EXPECT ("test-a", "%ld %lu %x %c [%*d] [%-*.*s] %hd",
+                  -5L, 1UL << 31, 255, 'q', 6, 12, 8, 3, "abcdef", 300);
+  LOG_AND_EXPECT (NULL, "no domain %s", (const char *) NULL);
+  LOG_AND_EXPECT ("test-b", "%e", 2.5e10);
+  LOG_AND_EXPECT ("test-a", "hello %d %s %5.2f %%", 43, "again", 2.0);
+  LOG_AND_EXPECT ("test-b", "%lu %lx %ld %zu %zd",
+                  G_MAXULONG, G_MAXULONG, G_MINLONG, (gsize) G_MAXSIZE, (gssize) -3);
+}
+
+/* a damaged log must give an error, not abort */
+static void
+check_damaged_log (const char *filename,
+                   guint32     bad_length)
+{
+  GskLogBinaryReader *reader;
+  GskLogBinaryMessage message;
+  GError *error = NULL;
+  FILE *fp;
+
+  unlink (filename);
+  g_assert (gsk_log_binary_open (filename, FALSE, 0, &error));
+  gsk_log_binary ("test-c", G_LOG_LEVEL_MESSAGE, "damaged %d", 1);
+  gsk_log_binary_close ();
+
+  /* the last message's argument-length precedes its one int */
+  fp = fopen (filename, "r+b");
+  g_assert (fp != NULL);
+  g_assert (fseek (fp, -8, SEEK_END) == 0);
+  g_assert (fwrite (&bad_length, 4, 1, fp) == 1);
+  fclose (fp);
+
+  reader = gsk_log_binary_reader_open (filename, &error);
+  g_assert (reader != NULL);
+  g_assert (!gsk_log_binary_reader_next (reader, &message, &error));
+  g_assert (error != NULL);
+  g_clear_error (&error);
+  gsk_log_binary_reader_close (reader);
+}
+
+int main (int argc, char **argv)
+{
+  char filename[] = "/tmp/test-log-binary-XXXXXX";
+  GskLogBinaryReader *reader;
+  GskLogBinaryMessage message;
+  GError *error = NULL;
+  guint i;
+  int fd;
+
+  gsk_init_without_threads (&argc, &argv);
+
+  fd = mkstemp (filename);
+  g_assert (fd >= 0);
+  close (fd);
+
+  g_assert (gsk_log_binary_open (filename, FALSE, 0, &error));
+  log_messages ();
+  gsk_log_binary_close ();
+
+  /* appending starts another header:  everything must be defined again */
+  g_assert (gsk_log_binary_open (filename, FALSE, 0, &error));
+  log_messages ();
+  gsk_log_binary_close ();
+
+  reader = gsk_log_binary_reader_open (filename, &error);
+  g_assert (reader != NULL);
+  for (i = 0; gsk_log_binary_reader_next (reader, &message, &error); i++)
+    {
+      g_assert (i < n_expected);
+      g_assert (strcmp (message.message, expected[i]) == 0);
+      if (expected_domains[i] == NULL)
+        g_assert (message.domain == NULL);
+      else
+        g_assert (strcmp (message.domain, expected_domains[i]) == 0);
+      g_assert (message.level == G_LOG_LEVEL_MESSAGE);
+    }
+  g_assert (error == NULL);
+  g_assert (i == n_expected);
+  gsk_log_binary_reader_close (reader);
+
+  check_damaged_log (filename, 0x7ffffff0);
+  check_damaged_log (filename, 5);	/* one byte past the end */
+
+  for (i = 0; i < n_expected; i++)
+    g_free (expected[i]);
+  unlink (filename);
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include "../gskmainloop.h"
+#include "../gskinit.h"
+#include "../gskghelpers.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+static GskSource *source;
+static guint n_handler_calls = 0;
+static guint n_bytes_read = 0;
+
+/* read until EAGAIN, and say so */
+static gboolean
+drain_input (int fd, GIOCondition condition, gpointer data)
+{
+  char buf[512];
+  n_handler_calls++;
+  for (;;)
+    {
+      int rv = read (fd, buf, sizeof (buf));
+      if (rv < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          g_assert (errno == EAGAIN);
+          gsk_source_io_would_block (source, G_IO_IN);
+          break;
+        }
+      g_assert (rv > 0);
+      n_bytes_read += rv;
+    }
+  return TRUE;
+}
+
+static void
+write_bytes (int fd, guint len)
+{
+  char buf[4096];
+  g_assert (len <= sizeof (buf));
+  memset (buf, 'x', len);
+  g_assert (write (fd, buf, len) == (int) len);
+}
+
+int main (int argc, char **argv)
+{
+  GskMainLoop *loop;
+  int fds[2];
+
+  gsk_init_without_threads (&argc, &argv);
+  g_setenv ("GSK_MAIN_LOOP_TYPE", "epoll-et", TRUE);
+  loop = gsk_main_loop_new (0);
+  if (strcmp (G_OBJECT_TYPE_NAME (loop), "GskMainLoopEpollEt") != 0)
+    {
+      g_message ("epoll-et not supported: skipping test");
+      return 0;
+    }
+
+  g_assert (pipe (fds) == 0);
+  gsk_fd_set_nonblocking (fds[0]);
+  source = gsk_main_loop_add_io (loop, fds[0], G_IO_IN, drain_input, NULL, NULL);
+
+  /* one edge, one call, everything read */
+  write_bytes (fds[1], 3000);
+  gsk_main_loop_run (loop, 1000, NULL);
+  g_assert (n_handler_calls == 1);
+  g_assert (n_bytes_read == 3000);
+
+  /* drained:  no more events until more data comes */
+  gsk_main_loop_run (loop, 0, NULL);
+  gsk_main_loop_run (loop, 50, NULL);
+  g_assert (n_handler_calls == 1);
+
+  write_bytes (fds[1], 100);
+  gsk_main_loop_run (loop, 1000, NULL);
+  g_assert (n_handler_calls == 2);
+  g_assert (n_bytes_read == 3100);
+
+  /* an edge seen while nobody wanted input is reported
+     when input is wanted again */
+  gsk_source_remove_io_events (source, G_IO_IN);
+  write_bytes (fds[1], 10);
+  gsk_main_loop_run (loop, 50, NULL);
+  g_assert (n_handler_calls == 2);
+  gsk_source_add_io_events (source, G_IO_IN);
+  gsk_main_loop_run (loop, 1000, NULL);
+  g_assert (n_handler_calls == 3);
+  g_assert (n_bytes_read == 3110);
+  gsk_main_loop_run (loop, 50, NULL);
+  g_assert (n_handler_calls == 3);
+
+  gsk_source_remove (source);
+  close (fds[0]);
+  close (fds[1]);
+  g_object_unref (loop);
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include "../gskmainloop.h"
+#include "../gskinit.h"
+#include "../gskghelpers.h"
+#include "../main-loops/gskmainloopiouring.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/* more than the backend's submission queue holds */
+#define N_PIPES		300
+
+static guint n_handler_calls = 0;
+
+/* reads only one byte, so level-triggering must report the rest */
+static gboolean
+read_one_byte (int fd, GIOCondition condition, gpointer data)
+{
+  char c;
+  n_handler_calls++;
+  g_assert (read (fd, &c, 1) == 1);
+  return TRUE;
+}
+
+int main (int argc, char **argv)
+{
+  GskMainLoop *loop;
+  GskSource *sources[N_PIPES];
+  int fds[N_PIPES][2];
+  guint i;
+
+  gsk_init_without_threads (&argc, &argv);
+  if (!gsk_main_loop_io_uring_probe ())
+    {
+      g_message ("io_uring not supported: skipping test");
+      return 0;
+    }
+
+  /* preferred to every other type by default */
+  g_unsetenv ("GSK_MAIN_LOOP_TYPE");
+  loop = gsk_main_loop_new (0);
+  g_assert (strcmp (G_OBJECT_TYPE_NAME (loop), "GskMainLoopIoUring") == 0);
+
+  /* arm more fds in one iteration than fit in the submission queue */
+  for (i = 0; i < N_PIPES; i++)
+    {
+      g_assert (pipe (fds[i]) == 0);
+      gsk_fd_set_nonblocking (fds[i][0]);
+      sources[i] = gsk_main_loop_add_io (loop, fds[i][0], G_IO_IN,
+                                         read_one_byte, NULL, NULL);
+    }
+  gsk_main_loop_run (loop, 0, NULL);
+  g_assert (n_handler_calls == 0);
+  for (i = 0; i < N_PIPES; i++)
+    g_assert (write (fds[i][1], "ab", 2) == 2);
+  while (n_handler_calls < 2 * N_PIPES)
+    gsk_main_loop_run (loop, 1000, NULL);
+  g_assert (n_handler_calls == 2 * N_PIPES);
+
+  /* drained:  no more calls */
+  gsk_main_loop_run (loop, 50, NULL);
+  g_assert (n_handler_calls == 2 * N_PIPES);
+
+  /* interest changes */
+  gsk_source_remove_io_events (sources[7], G_IO_IN);
+  g_assert (write (fds[7][1], "c", 1) == 1);
+  gsk_main_loop_run (loop, 50, NULL);
+  g_assert (n_handler_calls == 2 * N_PIPES);
+  gsk_source_add_io_events (sources[7], G_IO_IN);
+  gsk_main_loop_run (loop, 1000, NULL);
+  g_assert (n_handler_calls == 2 * N_PIPES + 1);
+
+  for (i = 0; i < N_PIPES; i++)
+    {
+      gsk_source_remove (sources[i]);
+      close (fds[i][0]);
+      close (fds[i][1]);
+    }
+  g_object_unref (loop);
+  return 0;
+}
@@ -0,0 +1,87 @@
+#include "../gskmainloop.h"
+#include "../gskinit.h"
+#include <string.h>
+
+static guint idle_count = 0;
+
+static gboolean
+handle_idle (gpointer data)
+{
+  return ++idle_count < 10;
+}
+
+static gboolean
+handle_timer (gpointer data)
+{
+  return FALSE;
+}
+
+typedef struct
+{
+  guint64 iteration_count;
+  guint64 idle_count;
+  guint64 timer_count;
+} Counts;
+
+static void
+get_counts (const char                 *name,
+            const GskMainLoopHistogram *histogram,
+            gpointer                    data)
+{
+  Counts *counts = data;
+  guint64 total = 0;
+  guint i;
+  for (i = 0; i < GSK_MAIN_LOOP_HISTOGRAM_N_BUCKETS; i++)
+    total += histogram->buckets[i];
+  g_assert (total == histogram->count);
+  if (strcmp (name, "iteration") == 0)
+    counts->iteration_count = histogram->count;
+  else if (strcmp (name, "my-idle") == 0)
+    counts->idle_count = histogram->count;
+  else if (strcmp (name, "my-timer") == 0)
+    counts->timer_count = histogram->count;
+}
+
+int main (int argc, char **argv)
+{
+  GskMainLoop *loop;
+  GskSource *source;
+  Counts counts;
+  char *str;
+
+  gsk_init_without_threads (&argc, &argv);
+  loop = gsk_main_loop_default ();
+
+  /* nothing is recorded until instrumentation is on */
+  source = gsk_main_loop_add_idle (loop, handle_idle, NULL, NULL);
+  gsk_main_loop_run (loop, 0, NULL);
+  g_assert (idle_count == 1);
+
+  gsk_main_loop_set_instrumented (loop, TRUE);
+  gsk_source_set_label (source, "my-idle");
+  source = gsk_main_loop_add_timer (loop, handle_timer, NULL, NULL, 5, -1);
+  gsk_source_set_label (source, "my-timer");
+  while (idle_count < 10)
+    gsk_main_loop_run (loop, 0, NULL);
+  gsk_main_loop_run (loop, 100, NULL);
+
+  memset (&counts, 0, sizeof (counts));
+  gsk_main_loop_foreach_stats (loop, get_counts, &counts);
+  g_assert (counts.idle_count == 9);
+  g_assert (counts.timer_count == 1);
+  g_assert (counts.iteration_count >= 10);
+
+  str = gsk_main_loop_stats_to_string (loop);
+  g_assert (strstr (str, "my-idle") != NULL);
+  g_free (str);
+
+  gsk_main_loop_reset_stats (loop);
+  gsk_main_loop_set_instrumented (loop, FALSE);
+  gsk_main_loop_run (loop, 0, NULL);
+  memset (&counts, 0, sizeof (counts));
+  gsk_main_loop_foreach_stats (loop, get_counts, &counts);
+  g_assert (counts.iteration_count == 0);
+  g_assert (counts.idle_count == 0);
+
+  return 0;
+}
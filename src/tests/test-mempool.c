@@ -53,9 +53,34 @@ record_allocation (GskTree *tree, AllocInfo *info)
   gsk_tree_node_unvisit (tree, node);
 }
 
+/* --- freeing type-pool objects in another thread --- */
+#define N_PASSED_ROUNDS         100
+#define N_PASSED_PER_ROUND      1000
+
+static GskTypePool passed_pool = GSK_TYPE_POOL_STATIC_INIT ("passed", 40);
+
+/* frees each batch of objects it is given, then acknowledges it */
+static gpointer
+free_passed_objects (gpointer data)
+{
+  GAsyncQueue **queues = data;
+  gpointer *batch;
+  while ((batch = g_async_queue_pop (queues[0])) != GINT_TO_POINTER (1))
+    {
+      guint j;
+      for (j = 0; j < N_PASSED_PER_ROUND; j++)
+        gsk_type_pool_free (&passed_pool, batch[j]);
+      g_async_queue_push (queues[1], batch);
+    }
+  return NULL;
+}
+
 int main (int argc, char **argv)
 {
   guint i;
+
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
   for (i = 0; i < 10; i++)
     {
       GskMemPool pool;
@@ -90,5 +115,127 @@ int main (int argc, char **argv)
       gsk_mem_pool_fixed_destruct (&pool);
       gsk_tree_unref (tree);
     }
+
+  /* trimming releases just the empty slabs */
+  {
+    GskMemPoolFixed pool;
+    GskMemPoolStats stats;
+    gpointer allocations[10000];
+    guint j;
+    gsk_mem_pool_fixed_construct (&pool, 24);
+    for (j = 0; j < 10000; j++)
+      allocations[j] = gsk_mem_pool_fixed_alloc (&pool);
+    for (j = 0; j < 10000; j++)
+      if (j % 1000 != 0)
+        gsk_mem_pool_fixed_free (&pool, allocations[j]);
+    gsk_mem_pool_fixed_get_stats (&pool, &stats);
+    g_assert (stats.n_empty_slabs > 0);
+    gsk_mem_pool_fixed_trim (&pool);
+    gsk_mem_pool_fixed_get_stats (&pool, &stats);
+    g_assert (stats.n_empty_slabs == 0);
+    g_assert (stats.n_slabs == 10);
+    for (j = 0; j < 10000; j += 1000)
+      gsk_mem_pool_fixed_free (&pool, allocations[j]);
+    gsk_mem_pool_fixed_trim (&pool);
+    gsk_mem_pool_fixed_get_stats (&pool, &stats);
+    g_assert (stats.n_slabs == 0);
+    g_assert (stats.bytes_retained == 0);
+    gsk_mem_pool_fixed_destruct (&pool);
+  }
+
+  /* size-classed pools */
+  {
+    GskMemPoolSized pool;
+    GskMemPoolStats stats;
+    GskTree *tree = gsk_tree_new_full (compare_by_pointer, NULL, g_free, NULL);
+    gpointer allocations[1000];
+    guint sizes[1000];
+    guint j;
+    gsk_mem_pool_sized_construct (&pool);
+    for (j = 0; j < 1000; j++)
+      {
+        AllocInfo *info = g_new (AllocInfo, 1);
+        info->size = sizes[j] = g_random_int_range (1, 2000);
+        info->allocation = allocations[j] = gsk_mem_pool_sized_alloc (&pool, info->size);
+        record_allocation (tree, info);
+      }
+    gsk_tree_unref (tree);
+    for (j = 0; j < 1000; j++)
+      gsk_mem_pool_sized_free (&pool, allocations[j], sizes[j]);
+    gsk_mem_pool_sized_get_stats (&pool, &stats);
+    g_assert (stats.n_slabs == stats.n_empty_slabs);
+    g_assert (stats.bytes_free <= stats.bytes_retained);
+    gsk_mem_pool_sized_trim (&pool);
+    gsk_mem_pool_sized_get_stats (&pool, &stats);
+    g_assert (stats.bytes_retained == 0);
+    gsk_mem_pool_sized_destruct (&pool);
+  }
+
+  /* type pools */
+  {
+    static GskTypePool type_pool = GSK_TYPE_POOL_STATIC_INIT ("test", 40);
+    GskTypePoolStats stats;
+    gsize retained;
+    gpointer allocations[1000];
+    GskTree *tree = gsk_tree_new_full (compare_by_pointer, NULL, g_free, NULL);
+    guint j;
+    for (j = 0; j < 1000; j++)
+      {
+        AllocInfo *info = g_new (AllocInfo, 1);
+        info->size = 40;
+        info->allocation = allocations[j] = gsk_type_pool_alloc (&type_pool);
+        record_allocation (tree, info);
+      }
+    gsk_tree_unref (tree);
+    for (j = 0; j < 1000; j++)
+      gsk_type_pool_free (&type_pool, allocations[j]);
+    gsk_type_pool_get_stats (&type_pool, &stats);
+    g_assert (stats.n_live == 0);
+    g_assert (stats.n_peak > 900 && stats.n_peak <= 1000); /* counted in batches */
+    g_assert (stats.n_allocs == 1000);
+    g_assert (stats.n_hits == 0);	/* carving a new slab is not a hit */
+    retained = stats.bytes_retained;
+
+    /* freed memory is reused */
+    for (j = 0; j < 1000; j++)
+      allocations[j] = gsk_type_pool_alloc (&type_pool);
+    gsk_type_pool_get_stats (&type_pool, &stats);
+    g_assert (stats.n_live == 1000);
+    g_assert (stats.n_hits > 900 && stats.n_hits <= 1000);
+    g_assert (stats.bytes_retained == retained);
+    for (j = 0; j < 1000; j++)
+      gsk_type_pool_free (&type_pool, allocations[j]);
+  }
+
+  /* objects freed by a consumer thread get back to the producer,
+     instead of piling up in the consumer's pool */
+  {
+    GAsyncQueue *queues[2];
+    gpointer batch[N_PASSED_PER_ROUND];
+    GThread *thread;
+    GskTypePoolStats stats;
+    guint round;
+    queues[0] = g_async_queue_new ();
+    queues[1] = g_async_queue_new ();
+    thread = g_thread_create (free_passed_objects, queues, TRUE, NULL);
+    for (round = 0; round < N_PASSED_ROUNDS; round++)
+      {
+        guint j;
+        for (j = 0; j < N_PASSED_PER_ROUND; j++)
+          batch[j] = gsk_type_pool_alloc (&passed_pool);
+        g_async_queue_push (queues[0], batch);
+        g_assert (g_async_queue_pop (queues[1]) == batch);
+      }
+    g_async_queue_push (queues[0], GINT_TO_POINTER (1));
+    g_thread_join (thread);
+    g_async_queue_unref (queues[0]);
+    g_async_queue_unref (queues[1]);
+
+    gsk_type_pool_get_stats (&passed_pool, &stats);
+    g_assert (stats.n_live == 0);
+    g_assert (stats.n_allocs == N_PASSED_ROUNDS * N_PASSED_PER_ROUND);
+    g_assert (stats.n_hits > stats.n_allocs / 2);
+    g_assert (stats.bytes_retained < N_PASSED_ROUNDS * N_PASSED_PER_ROUND * 40 / 10);
+  }
   return 0;
 }
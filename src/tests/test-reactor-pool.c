@@ -0,0 +1,91 @@
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "../gskreactorpool.h"
+#include "../gskerror.h"
+#include "../gskinit.h"
+
+#define N_REACTORS      3
+
+static char socket_path[256];
+static gint n_main_loops_finalized = 0;
+static gint n_listeners_finalized = 0;
+static gint failing_index = -1;
+
+static void
+inc_counter (gpointer data, GObject *where_the_object_was)
+{
+  g_atomic_int_inc ((gint *) data);
+}
+
+static gboolean
+setup_reactor (GskReactorPool *pool,
+               guint           index,
+               gpointer        data,
+               GError        **error)
+{
+  GskSocketAddress *address;
+  GskStreamListener *listener;
+
+  g_object_weak_ref (G_OBJECT (gsk_main_loop_default ()),
+                     inc_counter, &n_main_loops_finalized);
+  if ((gint) index == failing_index)
+    {
+      g_set_error (error, GSK_G_ERROR_DOMAIN, GSK_ERROR_UNKNOWN,
+                   "reactor %u failed on purpose", index);
+      return FALSE;
+    }
+
+  address = gsk_socket_address_local_new (socket_path);
+  listener = gsk_reactor_pool_listen (pool, address, error);
+  g_object_unref (address);
+  if (listener == NULL)
+    return FALSE;
+  g_object_weak_ref (G_OBJECT (listener), inc_counter, &n_listeners_finalized);
+  return TRUE;
+}
+
+int main (int argc, char **argv)
+{
+  GskReactorPool *pool;
+  GError *error = NULL;
+  guint pass;
+
+  gsk_init (&argc, &argv, NULL);
+  if (!gsk_init_get_support_threads ())
+    {
+      g_printerr ("test-reactor-pool: no thread support; skipping\n");
+      return 0;
+    }
+  g_snprintf (socket_path, sizeof (socket_path),
+              "/tmp/test-reactor-pool-%u", (guint) getpid ());
+  unlink (socket_path);
+
+  pool = gsk_reactor_pool_new (N_REACTORS);
+  g_assert (gsk_reactor_pool_get_n_reactors (pool) == N_REACTORS);
+
+  /* stopping destroys every reactor's listener and main-loop,
+     and the pool can be started again */
+  for (pass = 1; pass <= 2; pass++)
+    {
+      if (!gsk_reactor_pool_start (pool, setup_reactor, NULL, &error))
+        g_error ("starting reactor pool: %s", error->message);
+      gsk_reactor_pool_stop (pool);
+      g_assert (g_atomic_int_get (&n_main_loops_finalized) == (gint) (N_REACTORS * pass));
+      g_assert (g_atomic_int_get (&n_listeners_finalized) == (gint) (N_REACTORS * pass));
+    }
+
+  /* a failing setup function stops the pool and reports its error */
+  n_main_loops_finalized = n_listeners_finalized = 0;
+  failing_index = 1;
+  g_assert (!gsk_reactor_pool_start (pool, setup_reactor, NULL, &error));
+  g_assert (error != NULL);
+  g_assert (strstr (error->message, "on purpose") != NULL);
+  g_clear_error (&error);
+  g_assert (g_atomic_int_get (&n_main_loops_finalized) == N_REACTORS);
+  g_assert (g_atomic_int_get (&n_listeners_finalized) == N_REACTORS - 1);
+
+  gsk_reactor_pool_free (pool);
+  unlink (socket_path);
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include "../gskstreamfd.h"
+#include "../gskinit.h"
+#include <string.h>
+#include <unistd.h>
+
+/* GskStreamFds under the edge-triggered epoll main-loop,
+   with handlers that take only part of what is available:
+   the main-loop must keep invoking them until they hit EAGAIN. */
+#define CHUNK_SIZE      1000
+#define READ_TOTAL      40000   /* fits in the pipe */
+#define WRITE_TOTAL     500000  /* several pipes-full */
+
+static guint n_read = 0;
+static guint n_written = 0;
+static guint read_total;
+static gboolean timed_out = FALSE;
+
+static guint8
+data_at (guint offset)
+{
+  return (offset * 7) % 251;
+}
+
+static gboolean
+handle_readable (GskStream *stream, gpointer data)
+{
+  guint8 buf[CHUNK_SIZE];
+  GError *error = NULL;
+  gsize rv = gsk_stream_read (stream, buf, sizeof (buf), &error);
+  gsize i;
+  if (error != NULL)
+    g_error ("error reading: %s", error->message);
+  for (i = 0; i < rv; i++)
+    g_assert (buf[i] == data_at (n_read + i));
+  n_read += rv;
+  return TRUE;
+}
+
+static gboolean
+handle_writable (GskStream *stream, gpointer data)
+{
+  guint8 buf[CHUNK_SIZE];
+  GError *error = NULL;
+  guint i;
+  for (i = 0; i < sizeof (buf); i++)
+    buf[i] = data_at (n_written + i);
+  n_written += gsk_stream_write (stream, buf, sizeof (buf), &error);
+  if (error != NULL)
+    g_error ("error writing: %s", error->message);
+  return n_written < WRITE_TOTAL;
+}
+
+static gboolean
+handle_timeout (gpointer data)
+{
+  timed_out = TRUE;
+  return FALSE;
+}
+
+static void
+run_until_read (GskMainLoop *loop)
+{
+  GskSource *timer;
+  timed_out = FALSE;
+  timer = gsk_main_loop_add_timer (loop, handle_timeout, NULL, NULL, 5000, -1);
+  while (n_read < read_total && !timed_out)
+    gsk_main_loop_run (loop, -1, NULL);
+  if (timed_out)
+    g_error ("stalled after reading %u of %u bytes", n_read, read_total);
+  gsk_source_remove (timer);
+}
+
+int main (int argc, char **argv)
+{
+  GskMainLoop *loop;
+  GskStream *read_side, *write_side;
+  GError *error = NULL;
+  guint8 buf[READ_TOTAL];
+  guint i;
+
+  g_setenv ("GSK_MAIN_LOOP_TYPE", "epoll-et", TRUE);
+  gsk_init_without_threads (&argc, &argv);
+  loop = gsk_main_loop_default ();
+  if (strcmp (G_OBJECT_TYPE_NAME (loop), "GskMainLoopEpollEt") != 0)
+    {
+      g_message ("epoll-et not supported: skipping test");
+      return 0;
+    }
+
+  if (!gsk_stream_fd_pipe (&read_side, &write_side, &error))
+    g_error ("error creating pipe: %s", error->message);
+  gsk_stream_trap_readable (read_side, handle_readable, NULL, NULL, NULL);
+
+  /* one edge brings many reads' worth of input */
+  g_printerr ("Testing partial reads... ");
+  for (i = 0; i < READ_TOTAL; i++)
+    buf[i] = data_at (i);
+  g_assert (write (GSK_STREAM_FD_GET_FD (write_side), buf, READ_TOTAL) == READ_TOTAL);
+  read_total = READ_TOTAL;
+  run_until_read (loop);
+  g_assert (n_read == READ_TOTAL);
+  g_printerr ("done.\n");
+
+  /* writes stop at EAGAIN, and resume when the reader makes room */
+  g_printerr ("Testing partial writes... ");
+  n_written = READ_TOTAL;
+  read_total = WRITE_TOTAL;
+  gsk_stream_trap_writable (write_side, handle_writable, NULL, NULL, NULL);
+  run_until_read (loop);
+  g_assert (n_written == WRITE_TOTAL);
+  g_assert (n_read == WRITE_TOTAL);
+  g_printerr ("done.\n");
+
+  g_object_unref (read_side);
+  g_object_unref (write_side);
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include "../gskbufferstream.h"
+#include "../gskstreamfile.h"
+#include "../gskinit.h"
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define FILE_SIZE	(1000 * 1000 + 123)
+
+static void
+test_read_file (const char *filename,
+                guint       read_size,
+                guint       max_reads,
+                guint       read_ahead)
+{
+  GskMainLoop *loop = gsk_main_loop_default ();
+  GskStream *stream;
+  GskBufferStream *memory_output;
+  GskBuffer *output_buffer;
+  GskBuffer got = GSK_BUFFER_STATIC_INIT;
+  GError *error = NULL;
+  guint i;
+
+  stream = gsk_stream_file_new (filename, &error);
+  g_assert (stream != NULL);
+  g_assert (GSK_STREAM_FILE (stream)->file_size == FILE_SIZE);
+  if (read_size != 0)
+    gsk_stream_file_set_read_ahead (GSK_STREAM_FILE (stream),
+                                    read_size, max_reads, read_ahead);
+  memory_output = gsk_buffer_stream_new ();
+  gsk_stream_attach (stream, GSK_STREAM (memory_output), &error);
+  g_assert (error == NULL);
+  output_buffer = gsk_buffer_stream_peek_write_buffer (memory_output);
+
+  while (gsk_io_get_is_readable (stream))
+    {
+      gsk_main_loop_run (loop, -1, NULL);
+      gsk_buffer_drain (&got, output_buffer);
+      gsk_buffer_stream_write_buffer_changed (memory_output);
+    }
+  gsk_buffer_drain (&got, output_buffer);
+  g_assert (got.size == FILE_SIZE);
+  for (i = 0; i < FILE_SIZE; i++)
+    g_assert (gsk_buffer_read_char (&got) == (int) (i % 251));
+
+  g_object_unref (stream);
+  g_object_unref (memory_output);
+}
+
+int main (int argc, char **argv)
+{
+  char filename[] = "/tmp/test-stream-file-XXXXXX";
+  GskStream *stream;
+  FILE *fp;
+  int fd;
+  guint i;
+
+  gsk_init (&argc, &argv, NULL);
+
+  fd = mkstemp (filename);
+  g_assert (fd >= 0);
+  fp = fdopen (fd, "wb");
+  for (i = 0; i < FILE_SIZE; i++)
+    fputc (i % 251, fp);
+  fclose (fp);
+
+  test_read_file (filename, 0, 0, 0);
+  test_read_file (filename, 4096, 3, 16384);
+  test_read_file (filename, 1000, 1, 1000);
+
+  /* only regular files */
+  stream = gsk_stream_file_new ("/tmp", NULL);
+  g_assert (stream == NULL);
+
+  unlink (filename);
+  return 0;
+}
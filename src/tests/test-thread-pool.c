@@ -26,12 +26,117 @@ confirm_squared_input_and_inc_count (gpointer run_data, gpointer result_data)
   count++;
 }
 
+static GskThreadPool *nested_pool;
+
+/* split each task into two smaller ones */
+static gpointer square_input_and_split (gpointer run_data)
+{
+  guint i = GPOINTER_TO_UINT (run_data);
+  if (i >= 2)
+    {
+      gsk_thread_pool_push (nested_pool, square_input_and_split,
+                            confirm_squared_input_and_inc_count,
+                            GUINT_TO_POINTER (i / 2), NULL);
+      gsk_thread_pool_push (nested_pool, square_input_and_split,
+                            confirm_squared_input_and_inc_count,
+                            GUINT_TO_POINTER (i - i / 2), NULL);
+    }
+  return GUINT_TO_POINTER (i * i);
+}
+
+/* one task queues many slow ones for its own thread,
+   then keeps the thread busy:  the others must steal them. */
+#define N_IMBALANCED_TASKS	16
+static gpointer square_input_after_delay (gpointer run_data)
+{
+  guint i = GPOINTER_TO_UINT (run_data);
+  g_usleep (10 * 1000);
+  return GUINT_TO_POINTER (i * i);
+}
+static gpointer push_many_and_sleep (gpointer run_data)
+{
+  guint i;
+  for (i = 0; i < N_IMBALANCED_TASKS; i++)
+    gsk_thread_pool_push (nested_pool, square_input_after_delay,
+                          confirm_squared_input_and_inc_count,
+                          GUINT_TO_POINTER (i), NULL);
+  g_usleep (200 * 1000);
+  return square_input (run_data);
+}
+
+static guint n_destroyed = 0;
+static void
+inc_n_destroyed (gpointer run_data, gpointer result_data)
+{
+  n_destroyed++;
+}
+
+/* a thread's default pool must not keep its main-loop alive */
+static gboolean default_loop_finalized = FALSE;
+static void
+set_default_loop_finalized (gpointer data, GObject *where_the_object_was)
+{
+  default_loop_finalized = TRUE;
+}
+static gpointer
+use_default_pool_thread_func (gpointer data)
+{
+  GskMainLoop *main_loop = gsk_main_loop_default ();
+  guint n_done = count;
+  guint i;
+  g_object_weak_ref (G_OBJECT (main_loop), set_default_loop_finalized, NULL);
+  for (i = 0; i < 10; i++)
+    gsk_thread_pool_push (gsk_thread_pool_default (),
+                          square_input,
+                          confirm_squared_input_and_inc_count,
+                          GUINT_TO_POINTER (i), NULL);
+  while (count < n_done + 10)
+    gsk_main_loop_run (main_loop, -1, NULL);
+
+  /* these may not be run before the thread exits */
+  for (i = 0; i < 10; i++)
+    gsk_thread_pool_push (gsk_thread_pool_default (),
+                          square_input_and_sleep,
+                          confirm_squared_input_and_inc_count,
+                          GUINT_TO_POINTER (i), inc_n_destroyed);
+  return NULL;
+}
+
 static void
 set_count_to_user_data (gpointer user_data)
 {
   count = GPOINTER_TO_UINT (user_data);
 }
 
+#define N_INVOKING_THREADS	4
+#define N_INVOKES_PER_THREAD	1000
+static guint last_invoked[N_INVOKING_THREADS];
+static GskMainLoop *main_thread_loop;
+
+static void
+check_invoke_order (gpointer data)
+{
+  guint v = GPOINTER_TO_UINT (data);
+  guint thread_index = v / N_INVOKES_PER_THREAD;
+  guint seq = v % N_INVOKES_PER_THREAD + 1;
+  g_assert (last_invoked[thread_index] + 1 == seq);
+  last_invoked[thread_index] = seq;
+  count++;
+}
+
+static gpointer
+invoking_thread_func (gpointer data)
+{
+  guint thread_index = GPOINTER_TO_UINT (data);
+  guint i;
+  for (i = 0; i < N_INVOKES_PER_THREAD; i++)
+    gsk_main_loop_invoke (main_thread_loop,
+                          check_invoke_order,
+                          GUINT_TO_POINTER (thread_index * N_INVOKES_PER_THREAD + i),
+                          NULL);
+  return NULL;
+}
+
 int main (int argc, char **argv)
 {
   GskThreadPool *pool;
@@ -58,11 +163,114 @@ int main (int argc, char **argv)
   while (count < 100)
     gsk_main_loop_run (gsk_main_loop_default (), -1, NULL);
 
+  /* tasks pushed from tasks:  splitting 64 makes 127 tasks */
+  {
+    GskThreadPoolStats stats;
+    nested_pool = pool;
+    count = 0;
+    gsk_thread_pool_push (pool,
+                          square_input_and_split,
+                          confirm_squared_input_and_inc_count,
+                          GUINT_TO_POINTER (64), NULL);
+    while (count < 127)
+      gsk_main_loop_run (gsk_main_loop_default (), -1, NULL);
+    gsk_thread_pool_get_stats (pool, &stats);
+    g_assert (stats.n_tasks_run == 327);
+    g_assert (stats.n_steals <= 127);
+    g_assert (stats.queue_depth == 0);
+    g_assert (stats.n_threads <= 10);
+  }
+
   count = 0;
   gsk_thread_pool_destroy (pool, set_count_to_user_data,
 			   GUINT_TO_POINTER (31415));
   while (count != 31415)
     gsk_main_loop_run (gsk_main_loop_default (), -1, NULL);
 
+  /* tasks from the main-loop's thread are not steals */
+  {
+    GskThreadPoolStats stats;
+    pool = gsk_thread_pool_new (gsk_main_loop_default (), 4);
+    count = 0;
+    for (i = 0; i < 100; i++)
+      gsk_thread_pool_push (pool,
+                            square_input,
+                            confirm_squared_input_and_inc_count,
+                            GUINT_TO_POINTER (i), NULL);
+    while (count < 100)
+      gsk_main_loop_run (gsk_main_loop_default (), -1, NULL);
+    gsk_thread_pool_get_stats (pool, &stats);
+    g_assert (stats.n_tasks_run == 100);
+    g_assert (stats.n_steals == 0);
+    g_assert (stats.queue_depth == 0);
+    g_assert (stats.n_threads >= 1 && stats.n_threads <= 4);
+    g_assert (stats.max_wait_usecs * 100 >= stats.total_wait_usecs);
+
+    /* ...but ones queued by a busy worker are */
+    nested_pool = pool;
+    count = 0;
+    gsk_thread_pool_push (pool,
+                          push_many_and_sleep,
+                          confirm_squared_input_and_inc_count,
+                          GUINT_TO_POINTER (7), NULL);
+    while (count < N_IMBALANCED_TASKS + 1)
+      gsk_main_loop_run (gsk_main_loop_default (), -1, NULL);
+    gsk_thread_pool_get_stats (pool, &stats);
+    g_assert (stats.n_tasks_run == 100 + N_IMBALANCED_TASKS + 1);
+    g_assert (stats.n_steals > 0);
+    g_assert (stats.n_steals <= N_IMBALANCED_TASKS);
+    g_assert (stats.queue_depth == 0);
+
+    count = 0;
+    gsk_thread_pool_destroy (pool, set_count_to_user_data,
+                             GUINT_TO_POINTER (31415));
+    while (count != 31415)
+      gsk_main_loop_run (gsk_main_loop_default (), -1, NULL);
+  }
+
+  /* tasks still queued when the pool is destroyed are destroyed too */
+  pool = gsk_thread_pool_new (gsk_main_loop_default (), 1);
+  n_destroyed = 0;
+  for (i = 0; i < 10; i++)
+    gsk_thread_pool_push (pool,
+                          square_input_and_sleep,
+                          confirm_squared_input_and_inc_count,
+                          GUINT_TO_POINTER (i), inc_n_destroyed);
+  count = 0;
+  gsk_thread_pool_destroy (pool, set_count_to_user_data,
+			   GUINT_TO_POINTER (31415));
+  while (count != 31415)
+    gsk_main_loop_run (gsk_main_loop_default (), -1, NULL);
+  g_assert (n_destroyed == 10);
+
+  /* the default pool goes away with its thread's main-loop */
+  {
+    GThread *thread;
+    count = 0;
+    n_destroyed = 0;
+    thread = g_thread_create (use_default_pool_thread_func, NULL, TRUE, NULL);
+    g_thread_join (thread);
+    g_assert (default_loop_finalized);
+    g_assert (count == 10);
+    g_assert (n_destroyed == 10);
+  }
+
+  /* functions invoked from each thread run in order */
+  {
+    GThread *threads[N_INVOKING_THREADS];
+    main_thread_loop = gsk_main_loop_default ();
+    count = 0;
+    for (i = 0; i < N_INVOKING_THREADS; i++)
+      threads[i] = g_thread_create (invoking_thread_func, GUINT_TO_POINTER (i),
+                                    TRUE, NULL);
+    while (count < N_INVOKING_THREADS * N_INVOKES_PER_THREAD)
+      gsk_main_loop_run (main_thread_loop, -1, NULL);
+    for (i = 0; i < N_INVOKING_THREADS; i++)
+      {
+        g_thread_join (threads[i]);
+        g_assert (last_invoked[i] == N_INVOKES_PER_THREAD);
+      }
+  }
+
   return 0;
 }
@@ -130,11 +130,83 @@ static void test_2 (void)
     gsk_main_loop_run (gsk_main_loop_default (), -1, NULL);
 }
 
+/* coarse timers must never run early, and should run within their slack
+   (plus some allowance for the main-loop being slow to wake up) */
+#define N_COARSE_TIMERS		5000
+#define COARSE_LATE_ALLOWANCE	50
+typedef struct
+{
+  GTimeVal intended_runtime;
+  guint slack;
+  gboolean removed;
+} CoarseInfo;
+static guint n_coarse_pending = 0;
+
+static gboolean
+run_coarse_timer (gpointer data)
+{
+  CoarseInfo *info = data;
+  GTimeVal *ct = &gsk_main_loop_default ()->current_time;
+  gint64 late_ms = ((gint64) ct->tv_sec - info->intended_runtime.tv_sec) * 1000
+                 + ((gint64) ct->tv_usec - info->intended_runtime.tv_usec) / 1000;
+  g_assert (!info->removed);
+  if (is_greater_than (&info->intended_runtime, ct))
+    g_error ("coarse timer ran early");
+  if (late_ms > (gint64) info->slack + COARSE_LATE_ALLOWANCE)
+    g_error ("coarse timer ran %d ms late (slack=%u)", (int) late_ms, info->slack);
+  n_coarse_pending--;
+  return FALSE;
+}
+
+static void
+test_coarse (void)
+{
+  CoarseInfo *infos = g_new0 (CoarseInfo, N_COARSE_TIMERS);
+  GskSource **sources = g_new (GskSource *, N_COARSE_TIMERS);
+  GskMainLoop *loop = gsk_main_loop_default ();
+  guint i;
+  for (i = 0; i < N_COARSE_TIMERS; i++)
+    {
+      guint ms = rand () % 2000;
+      infos[i].slack = (i % 3 == 0) ? 0 : rand () % 300;
+      sources[i] = gsk_main_loop_add_timer_coarse (loop, run_coarse_timer, &infos[i], NULL,
+                                                   ms, -1, infos[i].slack);
+      infos[i].intended_runtime = loop->current_time;
+      add_ms (&infos[i].intended_runtime, ms);
+    }
+  n_coarse_pending = N_COARSE_TIMERS;
+
+  /* adjust or remove most of them, like idle-timeouts would be */
+  for (i = 0; i < N_COARSE_TIMERS; i++)
+    switch (rand () % 3)
+      {
+      case 0:
+        gsk_source_remove (sources[i]);
+        infos[i].removed = TRUE;
+        n_coarse_pending--;
+        break;
+      case 1:
+        {
+          guint ms = rand () % 1000;
+          gsk_source_adjust_timer (sources[i], ms, -1);
+          infos[i].intended_runtime = loop->current_time;
+          add_ms (&infos[i].intended_runtime, ms);
+        }
+        break;
+      }
+
+  while (n_coarse_pending > 0)
+    gsk_main_loop_run (loop, -1, NULL);
+  g_free (infos);
+  g_free (sources);
+}
+
 int main (int argc, char **argv)
 {
   guint i;
   gsk_init_without_threads (&argc, &argv);
   test_2 ();
+  test_coarse ();
   last_runtime = gsk_main_loop_default ()->current_time;
   init_second = last_runtime.tv_sec;
   for (i = 0; i < NUM_INITIAL_SOURCES; i++)
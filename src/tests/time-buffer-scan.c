@@ -0,0 +1,63 @@
+#include <string.h>
+#include <stdlib.h>
+#include "../gskbuffer.h"
+#include "../gskbufferscan.h"
+#include "../cycle.h"
+
+#define DATA_SIZE	(1024*1024)
+#define N_ITERATIONS	64
+
+static char *crlf_polystr[] = { "\r\n\r\n", "\n\n", NULL };
+
+/* Print bytes-per-tick for each kind of search
+ * with a particular scanning implementation.
+ * The data never matches, so every byte gets scanned. */
+static void
+time_impl (GskBuffer *buffer, GskBufferScanImpl impl)
+{
+  ticks start;
+  double char_ticks, str_ticks, polystr_ticks;
+  guint i;
+
+  start = getticks ();
+  for (i = 0; i < N_ITERATIONS; i++)
+    g_assert (gsk_buffer_index_of (buffer, '\t') == -1);
+  char_ticks = elapsed (getticks (), start);
+
+  start = getticks ();
+  for (i = 0; i < N_ITERATIONS; i++)
+    g_assert (gsk_buffer_str_index_of (buffer, "\r\n\r\n") == -1);
+  str_ticks = elapsed (getticks (), start);
+
+  start = getticks ();
+  for (i = 0; i < N_ITERATIONS; i++)
+    g_assert (gsk_buffer_polystr_index_of (buffer, crlf_polystr) == -1);
+  polystr_ticks = elapsed (getticks (), start);
+
+  g_print ("%-8s  index_of: %6.3f  str_index_of: %6.3f  polystr_index_of: %6.3f bytes/tick\n",
+           _gsk_buffer_scan_impl_name (impl),
+           (double) DATA_SIZE * N_ITERATIONS / char_ticks,
+           (double) DATA_SIZE * N_ITERATIONS / str_ticks,
+           (double) DATA_SIZE * N_ITERATIONS / polystr_ticks);
+}
+
+int main(int argc, char **argv)
+{
+  GskBuffer buffer = GSK_BUFFER_STATIC_INIT;
+  char *data = g_malloc (DATA_SIZE);
+  GskBufferScanImpl impl;
+  guint i;
+
+  /* text which looks like http headers, with no blank line */
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = "Content-Type: text/html; charset=utf-8\r\n"[i % 40];
+  gsk_buffer_append (&buffer, data, DATA_SIZE);
+  g_free (data);
+
+  for (impl = GSK_BUFFER_SCAN_SCALAR; impl <= GSK_BUFFER_SCAN_AVX2; impl++)
+    if (_gsk_buffer_scan_set_impl (impl))
+      time_impl (&buffer, impl);
+
+  gsk_buffer_destruct (&buffer);
+  return 0;
+}